@@ -0,0 +1,2709 @@
+// Ahead of Windows.h, which would bring in the old winsock.h
+#if defined(_WIN32)
+#include <WinSock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <iostream>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "pilotsimulator.h"
+
+#include <Psapi.h>
+
+using namespace pilotsimulator;
+
+constexpr int MOCK_TRACKER_TIME_IN_MS = 25;
+constexpr int MOCK_ANALYSIS_TIME_IN_MS = 8;
+constexpr int MOCK_PRESENT_TIME_IN_MS = 5;
+constexpr uint64_t BENCHMARK_FRAMES = 150;
+constexpr uint64_t GENERATOR_FRAMES = 3000;
+constexpr size_t COM_SKELETONS = 4096;
+constexpr int COM_REPEATS = 50;
+constexpr size_t PROJECTION_SKELETONS = 1024;
+constexpr int PROJECTION_REPEATS = 20;
+constexpr uint64_t BODY_MAP_OPERATIONS = 200000;
+constexpr uint32_t BODY_MAP_IDS = 48;
+constexpr size_t BODY_COM_FRAMES = 256;
+constexpr int BODY_COM_REPEATS = 40;
+constexpr int OVERLAY_REPEATS = 20;
+constexpr uint64_t IMAGE_POOL_FRAMES = 10000;
+constexpr uint64_t IMAGE_POOL_WARMUP_FRAMES = 100;
+constexpr uint64_t REPROJECTION_FRAMES = 30;
+constexpr uint64_t COM_LOG_FRAMES = 100000;
+constexpr uint64_t COM_LOG_RECORDS_PER_BENCHMARK_FILE = 65536;
+constexpr uint64_t ASYNC_WRITER_LINES = 20000;
+constexpr uint64_t ASYNC_WRITER_LINES_PER_IMAGE = 1000;
+constexpr size_t ASYNC_WRITER_BENCHMARK_CAPACITY = 64;
+constexpr uint64_t LATENCY_SAMPLES = 1000000;
+constexpr uint64_t TRACE_FRAMES = 150;
+constexpr uint64_t K4A_ALLOCATOR_FRAMES = 1000;
+constexpr size_t K4A_ALLOCATOR_FRAMES_IN_FLIGHT = 12;
+constexpr uint64_t ALLOCATION_WARMUP_FRAMES = 30;
+constexpr uint64_t ALLOCATION_FRAMES = 300;
+constexpr uint64_t PERF_COUNTER_FRAMES = 200;
+constexpr uint64_t METRICS_FRAMES = 300;
+constexpr int METRICS_BENCHMARK_PORT = 19464;
+constexpr uint64_t HEADLESS_FRAMES = 90;
+constexpr int DISPLAY_WAIT_KEY_IN_MS = 30;
+constexpr uint64_t PREVIEW_FRAMES = 150;
+constexpr uint64_t LATEST_SLOT_VALUES = 1000000;
+constexpr uint64_t COM_CHANNEL_SAMPLES = 100000;
+constexpr int COM_CHANNEL_PUBLISH_INTERVAL_USEC = 20;
+constexpr int COM_CHANNEL_READER_TIMEOUT_SECONDS = 30;
+constexpr uint64_t COM_CHANNEL_READS = 1000000;
+constexpr char COM_CHANNEL_BENCHMARK_NAME[] = "pilotsimulator_com_benchmark";
+constexpr char COM_CHANNEL_READER_ARGUMENT[] = "--com-channel-reader";
+constexpr uint64_t UDP_OUTPUT_FRAMES = 20000;
+constexpr int UDP_OUTPUT_PUBLISH_INTERVAL_USEC = 100;
+constexpr int UDP_OUTPUT_BENCHMARK_PORT = 19465;
+constexpr uint32_t UDP_OUTPUT_BODIES = 2;
+constexpr uint64_t FRAME_BUS_FRAMES = 60;
+constexpr uint64_t FRAME_BUS_PROCESS_FRAMES = 300;
+constexpr int FRAME_BUS_PUBLISH_INTERVAL_MS = 5;
+constexpr int FRAME_BUS_BENCHMARK_LEASE_TIMEOUT_MS = 200;
+constexpr int FRAME_BUS_READER_HOLD_MS = 2;
+constexpr char FRAME_BUS_BENCHMARK_NAME[] = "pilotsimulator_frames_benchmark";
+constexpr char FRAME_BUS_READER_ARGUMENT[] = "--frame-bus-reader";
+constexpr uint64_t LATEST_FRAME_FRAMES = 90;
+constexpr int LATEST_FRAME_ANALYSIS_TIME_IN_MS = 50;	// slower than the sensor, so a blocking pipeline falls behind
+constexpr int SOAK_SECONDS = 30;					// Benchmark --soak 3600 for the hour long run
+constexpr int SOAK_FPS = 30;						// of the synthetic source
+constexpr int SOAK_WARMUP_SECONDS = 10;
+constexpr int SOAK_SAMPLE_INTERVAL_MS = 250;
+constexpr double SOAK_MAX_GROWTH_MB = 16;				// two colour frames, a leak of one a frame passes it in a second
+constexpr size_t SOAK_MAX_POOLED_IMAGES = 64;
+constexpr char SOAK_ARGUMENT[] = "--soak";
+
+// Hands out empty captures on a 30 fps clock, dropping ticks the consumer was too slow for
+class MockSensor {
+public:
+	MockSensor() : next_tick(std::chrono::steady_clock::now()) {}
+
+	int get_capture(k4a_capture_t& capture)
+	{
+		const auto FRAME_PERIOD = std::chrono::microseconds(33333);
+
+		auto now = std::chrono::steady_clock::now();
+		while (next_tick + FRAME_PERIOD < now) { next_tick += FRAME_PERIOD; }
+
+		std::this_thread::sleep_until(next_tick);
+		next_tick += FRAME_PERIOD;
+
+		capture = NULL;
+		return SUCCESS;
+	}
+
+private:
+	std::chrono::steady_clock::time_point next_tick;
+};
+
+static void mock_analysis(BodyFrame&)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(MOCK_ANALYSIS_TIME_IN_MS));
+}
+
+static bool mock_present(BodyFrame&)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(MOCK_PRESENT_TIME_IN_MS));
+	return true;
+}
+
+// The capture -> enqueue -> pop -> analysis -> present loop the programs used before the pipeline
+static void benchmark_serial_loop()
+{
+	MockSensor sensor;
+	MockBodyTracker tracker(MOCK_TRACKER_TIME_IN_MS);
+
+	std::cout << "Serial loop:" << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint64_t i = 0; i < BENCHMARK_FRAMES; i++)
+	{
+		k4a_capture_t capture = NULL;
+		sensor.get_capture(capture);
+		tracker.enqueue_capture(capture, K4A_WAIT_INFINITE);
+
+		BodyFrame frame;
+		tracker.pop_result(frame, K4A_WAIT_INFINITE);
+		mock_analysis(frame);
+		mock_present(frame);
+		release_body_frame(frame);
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "  " << BENCHMARK_FRAMES << " frames, " << BENCHMARK_FRAMES / seconds << " fps" << std::endl;
+}
+
+static void benchmark_pipeline(size_t tracker_queue_depth)
+{
+	MockSensor sensor;
+	MockBodyTracker tracker(MOCK_TRACKER_TIME_IN_MS);
+
+	PipelineConfig config;
+	config.tracker_queue_depth = tracker_queue_depth;
+	config.max_frames = BENCHMARK_FRAMES;
+
+	std::cout << std::endl << "Pipeline, tracker queue depth " << tracker_queue_depth << ":";
+
+	Pipeline pipeline(
+		[&sensor](k4a_capture_t& capture) { return sensor.get_capture(capture); },
+		tracker,
+		mock_analysis,
+		mock_present,
+		config
+	);
+
+	reset_latency();
+
+	pipeline.run();
+	pipeline.print_stats();
+
+	LATENCY_REPORT();
+}
+
+// Single core rate of the synthetic pilots, skeletons alone and with the depth and body index images
+static void benchmark_synthetic_bodies(uint32_t num_bodies)
+{
+	k4a_calibration_t calibration = {};
+	get_synthetic_calibration(calibration);
+
+	SyntheticBodyConfig body_config;
+	body_config.num_bodies = num_bodies;
+	SyntheticBodyGenerator generator(calibration, body_config);
+
+	std::vector<uint16_t> depth_image((size_t)generator.get_width() * generator.get_height());
+	std::vector<uint8_t> body_index_map(depth_image.size());
+	k4abt_body_t bodies[MAX_BODIES];
+	uint64_t checksum = 0;
+
+	std::cout << std::endl << "Synthetic bodies, " << num_bodies << " bodies:" << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < GENERATOR_FRAMES; i++)
+	{
+		uint32_t count = generator.get_bodies(i * 33333, bodies, MAX_BODIES);
+		checksum += (uint64_t)bodies[count - 1].skeleton.joints[HEAD].position.xyz.y;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "  skeletons: " << GENERATOR_FRAMES / seconds << " fps" << std::endl;
+
+	start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < GENERATOR_FRAMES; i++)
+	{
+		generator.render(i * 33333, depth_image.data(), body_index_map.data());
+		checksum += depth_image[depth_image.size() / 2];
+	}
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "  depth and body index: " << GENERATOR_FRAMES / seconds << " fps (checksum " << checksum << ")" << std::endl;
+}
+
+// The std::map based COM of StreamCOM before compute_com_batch, kept as the reference
+enum MapSegments {
+	MAP_FOOT_RIGHT, MAP_SHANK_RIGHT, MAP_THIGH_RIGHT, MAP_TRUNK_RIGHT, MAP_UPPERARM_RIGHT, MAP_FOREARM_RIGHT, MAP_HAND_RIGHT,
+	MAP_FOOT_LEFT, MAP_SHANK_LEFT, MAP_THIGH_LEFT, MAP_TRUNK_LEFT, MAP_UPPERARM_LEFT, MAP_FOREARM_LEFT, MAP_HAND_LEFT, MAP_HEAD,
+	MAP_SEGMENT_NUM
+};
+
+static std::map<int, std::array<int, 2>> MapJointsForBodySegments{
+	{ MAP_FOOT_RIGHT, {TOE_RIGHT, ANKLE_RIGHT} }, { MAP_SHANK_RIGHT, {ANKLE_RIGHT, KNEE_RIGHT} }, { MAP_THIGH_RIGHT, {KNEE_RIGHT, HIP_RIGHT} },
+	{ MAP_TRUNK_RIGHT, {HIP_RIGHT, SHOULDER_RIGHT} }, { MAP_UPPERARM_RIGHT, {ELBOW_RIGHT, SHOULDER_RIGHT} },
+	{ MAP_FOREARM_RIGHT, {WRIST_RIGHT, ELBOW_RIGHT} }, { MAP_HAND_RIGHT, {HANDTIP_RIGHT, WRIST_RIGHT} },
+	{ MAP_FOOT_LEFT, {TOE_LEFT, ANKLE_LEFT} }, { MAP_SHANK_LEFT, {ANKLE_LEFT, KNEE_LEFT} }, { MAP_THIGH_LEFT, {KNEE_LEFT, HIP_LEFT} },
+	{ MAP_TRUNK_LEFT, {HIP_LEFT, SHOULDER_LEFT} }, { MAP_UPPERARM_LEFT, {ELBOW_LEFT, SHOULDER_LEFT} },
+	{ MAP_FOREARM_LEFT, {WRIST_LEFT, ELBOW_LEFT} }, { MAP_HAND_LEFT, {HANDTIP_LEFT, WRIST_LEFT} },
+	{ MAP_HEAD, {NOSE} }
+};
+
+static std::map<int, std::array<float, 2>> MapBodySegmentsData{
+	{ MAP_FOOT_RIGHT, {0.5f, 0.0133f} }, { MAP_SHANK_RIGHT, {0.419f, 0.0535f} }, { MAP_THIGH_RIGHT, {0.428f, 0.1175f} },
+	{ MAP_TRUNK_RIGHT, {0.5f, 0.225f} }, { MAP_UPPERARM_RIGHT, {0.458f, 0.029f} }, { MAP_FOREARM_RIGHT, {0.434f, 0.0157f} },
+	{ MAP_HAND_RIGHT, {0.468f, 0.005f} },
+	{ MAP_FOOT_LEFT, {0.5f, 0.0133f} }, { MAP_SHANK_LEFT, {0.419f, 0.0535f} }, { MAP_THIGH_LEFT, {0.428f, 0.1175f} },
+	{ MAP_TRUNK_LEFT, {0.5f, 0.225f} }, { MAP_UPPERARM_LEFT, {0.458f, 0.029f} }, { MAP_FOREARM_LEFT, {0.434f, 0.0157f} },
+	{ MAP_HAND_LEFT, {0.468f, 0.005f} },
+	{ MAP_HEAD, {0, 0.082f} }
+};
+
+static void get_map_com(k4a_float3_t& center_of_mass, k4a_float3_t body_segment_com[], const k4abt_joint_t joints[])
+{
+	center_of_mass.xyz = { 0, 0, 0 };
+
+	for (int segment_id = 0; segment_id < MAP_SEGMENT_NUM; segment_id++)
+	{
+		if (segment_id == MAP_HEAD)
+		{
+			body_segment_com[segment_id].xyz = joints[NOSE].position.xyz;
+		}
+		else
+		{
+			float length = MapBodySegmentsData[segment_id][0];
+			k4a_float3_t proximal = joints[MapJointsForBodySegments[segment_id][1]].position;
+			k4a_float3_t distal = joints[MapJointsForBodySegments[segment_id][0]].position;
+
+			body_segment_com[segment_id].xyz.x = proximal.xyz.x + length * (distal.xyz.x - proximal.xyz.x);
+			body_segment_com[segment_id].xyz.y = proximal.xyz.y + length * (distal.xyz.y - proximal.xyz.y);
+			body_segment_com[segment_id].xyz.z = proximal.xyz.z + length * (distal.xyz.z - proximal.xyz.z);
+		}
+
+		float weight = MapBodySegmentsData[segment_id][1];
+		center_of_mass.xyz.x += body_segment_com[segment_id].xyz.x * weight;
+		center_of_mass.xyz.y += body_segment_com[segment_id].xyz.y * weight;
+		center_of_mass.xyz.z += body_segment_com[segment_id].xyz.z * weight;
+	}
+}
+
+// compute_com_batch<FullBodyModel> against the map based COM on the same skeletons, results must agree
+static int benchmark_com()
+{
+	k4a_calibration_t calibration = {};
+	get_synthetic_calibration(calibration);
+
+	SyntheticBodyConfig body_config;
+	body_config.num_bodies = 4;
+	SyntheticBodyGenerator generator(calibration, body_config);
+
+	std::vector<k4abt_body_t> bodies(COM_SKELETONS);
+	for (size_t i = 0; i < COM_SKELETONS; i += body_config.num_bodies)
+	{
+		generator.get_bodies(i * 33333, &bodies[i], body_config.num_bodies);
+	}
+
+	std::vector<k4abt_skeleton_t> skeletons(COM_SKELETONS);
+	for (size_t i = 0; i < COM_SKELETONS; i++) { skeletons[i] = bodies[i].skeleton; }
+
+	std::vector<k4a_float3_t> map_com(COM_SKELETONS);
+	std::vector<k4a_float3_t> map_segment_com(COM_SKELETONS * MAP_SEGMENT_NUM);
+	std::vector<k4a_float3_t> batch_com(COM_SKELETONS);
+	std::vector<k4a_float3_t> batch_segment_com(COM_SKELETONS * MAX_BODY_SEGMENTS);
+
+	std::cout << std::endl << "COM of " << COM_SKELETONS << " skeletons:" << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < COM_REPEATS; repeat++)
+	{
+		for (size_t i = 0; i < COM_SKELETONS; i++)
+		{
+			get_map_com(map_com[i], &map_segment_com[i * MAP_SEGMENT_NUM], skeletons[i].joints);
+		}
+	}
+	double map_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < COM_REPEATS; repeat++)
+	{
+		compute_com_batch<FullBodyModel>(skeletons.data(), COM_SKELETONS, batch_com.data(), batch_segment_com.data());
+	}
+	double batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	float max_difference = 0;
+	for (size_t i = 0; i < COM_SKELETONS; i++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			max_difference = (std::max)(max_difference, std::fabs(map_com[i].v[axis] - batch_com[i].v[axis]));
+			for (int segment_id = 0; segment_id < MAP_SEGMENT_NUM; segment_id++)
+			{
+				float difference = map_segment_com[i * MAP_SEGMENT_NUM + segment_id].v[axis] - batch_segment_com[i * MAX_BODY_SEGMENTS + segment_id].v[axis];
+				max_difference = (std::max)(max_difference, std::fabs(difference));
+			}
+		}
+	}
+
+	double skeleton_count = (double)COM_SKELETONS * COM_REPEATS;
+	std::cout << "  std::map:          " << map_seconds * 1e9 / skeleton_count << " ns per skeleton" << std::endl;
+	std::cout << "  compute_com_batch: " << batch_seconds * 1e9 / skeleton_count << " ns per skeleton, "
+		<< map_seconds / batch_seconds << "x faster" << std::endl;
+	std::cout << "  max difference: " << max_difference << " mm" << std::endl;
+
+	if (max_difference > 0.01f)
+	{
+		std::cout << "COM Results Differ!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Joints of synthetic pilots through the SDK calibration functions and the Projector, depth to colour camera
+static int benchmark_projection()
+{
+	k4a_calibration_t calibration = {};
+	get_synthetic_calibration(calibration);
+
+	SyntheticBodyConfig body_config;
+	body_config.num_bodies = 4;
+	SyntheticBodyGenerator generator(calibration, body_config);
+
+	std::vector<k4abt_body_t> bodies(PROJECTION_SKELETONS);
+	for (size_t i = 0; i < PROJECTION_SKELETONS; i += body_config.num_bodies)
+	{
+		generator.get_bodies(i * 33333, &bodies[i], body_config.num_bodies);
+	}
+
+	size_t point_count = PROJECTION_SKELETONS * K4ABT_JOINT_COUNT;
+	std::vector<k4a_float3_t> points(point_count);
+	for (size_t i = 0; i < point_count; i++) { points[i] = bodies[i / K4ABT_JOINT_COUNT].skeleton.joints[i % K4ABT_JOINT_COUNT].position; }
+
+	// Where the joints fall in the depth image, to unproject them again
+	std::vector<k4a_float2_t> depth_pixels(point_count);
+	std::vector<float> depths(point_count);
+	for (size_t i = 0; i < point_count; i++)
+	{
+		int valid = 0;
+		k4a_calibration_3d_to_2d(&calibration, &points[i], K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_DEPTH, &depth_pixels[i], &valid);
+		depths[i] = valid ? points[i].xyz.z : 0.0f;
+	}
+
+	std::vector<k4a_float2_t> sdk_pixels(point_count), pixels(point_count);
+	std::vector<k4a_float3_t> sdk_points(point_count), unprojected(point_count);
+	std::vector<int> sdk_pixel_valid(point_count), pixel_valid(point_count);
+	std::vector<int> sdk_point_valid(point_count), point_valid(point_count);
+
+	std::cout << std::endl << "Projection of " << point_count << " joints, depth to colour camera:" << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < PROJECTION_REPEATS; repeat++)
+	{
+		for (size_t i = 0; i < point_count; i++)
+		{
+			k4a_calibration_3d_to_2d(&calibration, &points[i], K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_COLOR, &sdk_pixels[i], &sdk_pixel_valid[i]);
+		}
+	}
+	double sdk_project_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < PROJECTION_REPEATS; repeat++)
+	{
+		for (size_t i = 0; i < point_count; i++)
+		{
+			k4a_calibration_2d_to_3d(&calibration, &depth_pixels[i], depths[i], K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_COLOR, &sdk_points[i], &sdk_point_valid[i]);
+		}
+	}
+	double sdk_unproject_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Built per run, it is part of what a frame would pay
+	start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < PROJECTION_REPEATS; repeat++)
+	{
+		Projector projector(calibration);
+		projector.project(points.data(), point_count, pixels.data(), pixel_valid.data());
+	}
+	double project_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < PROJECTION_REPEATS; repeat++)
+	{
+		Projector projector(calibration);
+		projector.unproject(depth_pixels.data(), depths.data(), point_count, unprojected.data(), point_valid.data());
+	}
+	double unproject_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	float max_pixel_difference = 0;
+	float max_point_difference = 0;
+	size_t valid_differences = 0;
+	size_t valid_count = 0;
+	for (size_t i = 0; i < point_count; i++)
+	{
+		if (pixel_valid[i] != sdk_pixel_valid[i] || point_valid[i] != sdk_point_valid[i]) { valid_differences++; }
+		if (pixel_valid[i] && sdk_pixel_valid[i])
+		{
+			valid_count++;
+			for (int axis = 0; axis < 2; axis++)
+			{
+				max_pixel_difference = (std::max)(max_pixel_difference, std::fabs(pixels[i].v[axis] - sdk_pixels[i].v[axis]));
+			}
+		}
+		if (point_valid[i] && sdk_point_valid[i])
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				max_point_difference = (std::max)(max_point_difference, std::fabs(unprojected[i].v[axis] - sdk_points[i].v[axis]));
+			}
+		}
+	}
+
+	double points_projected = (double)point_count * PROJECTION_REPEATS;
+	std::cout << "  k4a_calibration_3d_to_2d: " << points_projected / sdk_project_seconds / 1e6 << " M points/s" << std::endl;
+	std::cout << "  Projector::project:       " << points_projected / project_seconds / 1e6 << " M points/s, "
+		<< sdk_project_seconds / project_seconds << "x faster" << std::endl;
+	std::cout << "  k4a_calibration_2d_to_3d: " << points_projected / sdk_unproject_seconds / 1e6 << " M points/s" << std::endl;
+	std::cout << "  Projector::unproject:     " << points_projected / unproject_seconds / 1e6 << " M points/s, "
+		<< sdk_unproject_seconds / unproject_seconds << "x faster" << std::endl;
+	std::cout << "  max difference: " << max_pixel_difference << " pixels, " << max_point_difference << " mm, "
+		<< valid_differences << " of " << point_count << " differ in validity" << std::endl;
+
+	// Float against whatever precision the SDK works in, and the odd point right on the lens radius
+	if (valid_count == 0 || max_pixel_difference > 0.05f || max_point_difference > 0.5f || valid_differences > point_count / 1000)
+	{
+		std::cout << "Projection Results Differ!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// BodyMap against std::map over random inserts, finds and erases of a few ids
+static int benchmark_body_map()
+{
+	BodyMap<uint64_t, BODY_COM_MAP_CAPACITY> map;
+	std::map<uint32_t, uint64_t> reference;
+	uint32_t random = 12345;
+
+	for (uint64_t operation = 0; operation < BODY_MAP_OPERATIONS; operation++)
+	{
+		random = random * 1664525u + 1013904223u;
+		uint32_t id = (random >> 8) % BODY_MAP_IDS + 1;
+		int action = (random >> 24) % 3;
+
+		if (action == 0 && (!map.full() || reference.count(id) > 0))
+		{
+			uint64_t* value = map.insert(id);
+			if (value == NULL) { break; }
+			*value = operation;
+			reference[id] = operation;
+		}
+		else if (action == 1)
+		{
+			if (map.erase(id) != (reference.erase(id) > 0)) { break; }
+		}
+
+		const uint64_t* value = map.find(id);
+		auto expected = reference.find(id);
+		if ((value == NULL) != (expected == reference.end()) || (value != NULL && *value != expected->second) || map.size() != reference.size())
+		{
+			std::cout << "Body Map Differs After " << operation << " Operations!" << std::endl;
+			return FAILURE;
+		}
+	}
+
+	size_t visited = 0;
+	map.for_each([&](uint32_t id, uint64_t& value) { if (reference.count(id) > 0 && reference[id] == value) { visited++; } });
+	if (visited != reference.size())
+	{
+		std::cout << "Body Map Differs!" << std::endl;
+		return FAILURE;
+	}
+
+	std::cout << "  BodyMap matches std::map over " << BODY_MAP_OPERATIONS << " operations" << std::endl;
+
+	return SUCCESS;
+}
+
+// COM of 1 to MAX_BODIES synthetic bodies per frame with their per id state
+static int benchmark_body_com()
+{
+	k4a_calibration_t calibration = {};
+	get_synthetic_calibration(calibration);
+
+	std::cout << std::endl << "Multi-body COM, " << BODY_COM_FRAMES << " frames:" << std::endl;
+
+	if (benchmark_body_map() == FAILURE) { return FAILURE; }
+
+	std::vector<BodyFrame> frames(BODY_COM_FRAMES);
+	double single_body_ns = 0;
+	double many_body_ns = 0;
+
+	for (uint32_t num_bodies = 1; num_bodies <= MAX_BODIES; num_bodies *= 2)
+	{
+		SyntheticBodyConfig body_config;
+		body_config.num_bodies = num_bodies;
+		SyntheticBodyGenerator generator(calibration, body_config);
+
+		for (size_t i = 0; i < BODY_COM_FRAMES; i++)
+		{
+			frames[i].num_bodies = generator.get_bodies(i * 33333, frames[i].bodies, MAX_BODIES);
+		}
+
+		BodyComTracker tracker;
+		BodyCom coms[MAX_BODIES];
+
+		auto start = std::chrono::steady_clock::now();
+		for (int repeat = 0; repeat < BODY_COM_REPEATS; repeat++)
+		{
+			for (size_t i = 0; i < BODY_COM_FRAMES; i++)
+			{
+				compute_com_batch<FullBodyModel>(&frames[i], 1);
+				tracker.update(frames[i], coms);
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Each body against its own reference: set on one frame, carried by the next
+		tracker.set_reference();
+		BodyFrame& last = frames[BODY_COM_FRAMES - 1];
+		uint32_t count = tracker.update(frames[0], coms);
+		bool matches = count == num_bodies && tracker.size() == num_bodies;
+		for (uint32_t i = 0; i < count && matches; i++)
+		{
+			matches = coms[i].id == frames[0].bodies[i].id && coms[i].has_reference &&
+				std::memcmp(&coms[i].reference, &last.center_of_mass[i], sizeof(k4a_float3_t)) == 0 &&
+				std::memcmp(&coms[i].center_of_mass, &frames[0].center_of_mass[i], sizeof(k4a_float3_t)) == 0;
+		}
+
+		// Bodies that leave are dropped after BODY_COM_LOST_FRAMES
+		frames[0].num_bodies = 1;
+		for (uint64_t i = 0; i < BODY_COM_LOST_FRAMES; i++) { tracker.update(frames[0], coms); }
+		matches = matches && tracker.size() == 1;
+		frames[0].num_bodies = num_bodies;
+
+		if (!matches)
+		{
+			std::cout << "Body COM State Differs With " << num_bodies << " Bodies!" << std::endl;
+			return FAILURE;
+		}
+
+		double body_count = (double)BODY_COM_FRAMES * BODY_COM_REPEATS * num_bodies;
+		double ns_per_body = seconds * 1e9 / body_count;
+		std::cout << "  " << num_bodies << " bodies: " << seconds * 1e9 / ((double)BODY_COM_FRAMES * BODY_COM_REPEATS) << " ns per frame, "
+			<< ns_per_body << " ns per body, " << body_count / seconds / 1e6 << " M bodies/s" << std::endl;
+
+		if (num_bodies == 1) { single_body_ns = ns_per_body; }
+		many_body_ns = ns_per_body;
+	}
+
+	// Bodies of a frame share the COM kernel's lanes, more of them cost less each
+	if (many_body_ns >= single_body_ns)
+	{
+		std::cout << "Body COM Does Not Scale!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// The per pixel loop of get_body_color_overlay_image before overlay_body_index
+static void legacy_overlay(uint8_t* bgra, const uint8_t* body_index, int width, int height)
+{
+	for (int row = 0; row < height; ++row)
+	{
+		const uint8_t* currentPixel = body_index + (size_t)row * width;
+		for (int col = 0; col < width; ++col)
+		{
+			if ((int)*currentPixel++ == 255) continue; // ignore background
+
+			bgra[((size_t)row * width + col) * 4] = 255;
+		}
+	}
+}
+
+// Body index map of upscaled synthetic pilots, as the depth to colour transformation produces
+static void get_overlay_body_index(std::vector<uint8_t>& body_index, int width, int height)
+{
+	k4a_calibration_t calibration = {};
+	get_synthetic_calibration(calibration);
+
+	SyntheticBodyConfig body_config;
+	body_config.num_bodies = 3;
+	SyntheticBodyGenerator generator(calibration, body_config);
+
+	std::vector<uint16_t> depth_image((size_t)generator.get_width() * generator.get_height());
+	std::vector<uint8_t> depth_body_index(depth_image.size());
+	generator.render(0, depth_image.data(), depth_body_index.data());
+
+	body_index.resize((size_t)width * height);
+	for (int row = 0; row < height; row++)
+	{
+		int depth_row = row * generator.get_height() / height;
+		for (int col = 0; col < width; col++)
+		{
+			body_index[(size_t)row * width + col] = depth_body_index[(size_t)depth_row * generator.get_width() + col * generator.get_width() / width];
+		}
+	}
+}
+
+// overlay_body_index against the original loop and the scalar kernel, results must match the scalar kernel
+static int benchmark_overlay(int width, int height)
+{
+	std::vector<uint8_t> body_index;
+	get_overlay_body_index(body_index, width, height);
+
+	std::vector<uint8_t> color_image((size_t)width * height * 4);
+	for (size_t i = 0; i < color_image.size(); i++) { color_image[i] = (uint8_t)(i * 7 + (i >> 12)); }
+
+	std::vector<uint8_t> legacy_image, scalar_image, kernel_image;
+	const OverlayLut& lut = get_body_overlay_lut();
+
+	std::cout << std::endl << "Overlay " << width << "x" << height << ":" << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < OVERLAY_REPEATS; repeat++)
+	{
+		legacy_image = color_image;
+		legacy_overlay(legacy_image.data(), body_index.data(), width, height);
+	}
+	double legacy_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// One pixel at a time through the same blend, the reference for the SSE2 runs
+	start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < OVERLAY_REPEATS; repeat++)
+	{
+		scalar_image = color_image;
+		for (int row = 0; row < height; row++)
+		{
+			for (int col = 0; col < width; col++)
+			{
+				overlay_body_index_rows(&scalar_image[((size_t)row * width + col) * 4], 0, &body_index[(size_t)row * width + col], 0, 1, 0, 1, lut);
+			}
+		}
+	}
+	double scalar_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int repeat = 0; repeat < OVERLAY_REPEATS; repeat++)
+	{
+		kernel_image = color_image;
+		overlay_body_index(kernel_image.data(), width * 4, body_index.data(), width, width, height, lut);
+	}
+	double kernel_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "  original loop:      " << legacy_seconds * 1e3 / OVERLAY_REPEATS << " ms" << std::endl;
+	std::cout << "  scalar blend:       " << scalar_seconds * 1e3 / OVERLAY_REPEATS << " ms" << std::endl;
+	std::cout << "  overlay_body_index: " << kernel_seconds * 1e3 / OVERLAY_REPEATS << " ms, "
+		<< legacy_seconds / kernel_seconds << "x the original loop" << std::endl;
+
+	if (kernel_image != scalar_image)
+	{
+		std::cout << "Overlay Results Differ!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+static size_t get_working_set_bytes()
+{
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.WorkingSetSize;
+}
+
+// Writes one byte per page so the buffer counts towards the working set
+static void touch_image(k4a_image_t image)
+{
+	uint8_t* buffer = k4a_image_get_buffer(image);
+	size_t size = k4a_image_get_size(image);
+	for (size_t i = 0; i < size; i += 4096) { buffer[i] = (uint8_t)i; }
+}
+
+// The per frame images of a synthetic stream_images session, from the pool: after warm up no buffer
+// may be allocated and the working set must stay flat
+static int benchmark_image_pool()
+{
+	ImagePool pool;
+
+	std::cout << std::endl << "Image pool, " << IMAGE_POOL_FRAMES << " frames:" << std::endl;
+
+	size_t warm_working_set = 0;
+	uint64_t warm_buffer_allocations = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < IMAGE_POOL_WARMUP_FRAMES + IMAGE_POOL_FRAMES; i++)
+	{
+		if (i == IMAGE_POOL_WARMUP_FRAMES)
+		{
+			warm_working_set = get_working_set_bytes();
+			warm_buffer_allocations = pool.get_stats().buffer_allocations;
+			start = std::chrono::steady_clock::now();
+		}
+
+		// Capture, tracker body index map, then the transformed images of compose_body_color_overlay
+		k4a_image_t images[5] = {};
+		pool.create_image(K4A_IMAGE_FORMAT_COLOR_BGRA32, SYNTHETIC_COLOR_WIDTH, SYNTHETIC_COLOR_HEIGHT, SYNTHETIC_COLOR_WIDTH * 4, images[0]);
+		pool.create_image(K4A_IMAGE_FORMAT_DEPTH16, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, SYNTHETIC_DEPTH_WIDTH * 2, images[1]);
+		pool.create_image(K4A_IMAGE_FORMAT_CUSTOM8, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, SYNTHETIC_DEPTH_WIDTH, images[2]);
+		pool.create_image(K4A_IMAGE_FORMAT_DEPTH16, SYNTHETIC_COLOR_WIDTH, SYNTHETIC_COLOR_HEIGHT, SYNTHETIC_COLOR_WIDTH * 2, images[3]);
+		pool.create_image(K4A_IMAGE_FORMAT_CUSTOM8, SYNTHETIC_COLOR_WIDTH, SYNTHETIC_COLOR_HEIGHT, SYNTHETIC_COLOR_WIDTH, images[4]);
+
+		for (k4a_image_t image : images)
+		{
+			if (image == NULL) { return FAILURE; }
+			touch_image(image);
+			k4a_image_release(image);
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	ImagePoolStats stats = pool.get_stats();
+	double working_set_growth_mb = ((double)get_working_set_bytes() - (double)warm_working_set) / (1024 * 1024);
+
+	std::cout << "  " << seconds * 1e6 / IMAGE_POOL_FRAMES << " us per frame of 5 images" << std::endl;
+	std::cout << "  buffers allocated: " << stats.buffer_allocations << " (" << stats.bytes_allocated / (1024 * 1024) << " MB), "
+		<< stats.buffer_allocations - warm_buffer_allocations << " after warm up" << std::endl;
+	std::cout << "  working set growth: " << working_set_growth_mb << " MB" << std::endl;
+
+	if (stats.buffer_allocations != warm_buffer_allocations || stats.buffers_in_use != 0 || working_set_growth_mb > 1)
+	{
+		std::cout << "Image Pool Is Not Flat!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+struct ReprojectionAgreement {
+	uint64_t compared = 0;
+	uint64_t agreed = 0;
+	double get_ratio() const { return compared == 0 ? 1.0 : (double)agreed / compared; }
+};
+
+// Pixels the SDK fills that we fill within 1% of its depth
+static void compare_depth(ReprojectionAgreement& agreement, const k4a_image_t sdk_image, const k4a_image_t image)
+{
+	const uint16_t* sdk_depth = (const uint16_t*)(const void*)k4a_image_get_buffer(sdk_image);
+	const uint16_t* depth = (const uint16_t*)(const void*)k4a_image_get_buffer(image);
+	size_t count = k4a_image_get_size(image) / sizeof(uint16_t);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (sdk_depth[i] == 0) { continue; }
+		agreement.compared++;
+		if (depth[i] != 0 && std::abs((int)depth[i] - (int)sdk_depth[i]) * 100 <= sdk_depth[i]) { agreement.agreed++; }
+	}
+}
+
+// Pixels the SDK colours that we colour within 8 levels per channel, the SDK samples between colour pixels
+static void compare_color(ReprojectionAgreement& agreement, const k4a_image_t sdk_image, const k4a_image_t image)
+{
+	const uint8_t* sdk_color = k4a_image_get_buffer(sdk_image);
+	const uint8_t* color = k4a_image_get_buffer(image);
+	size_t count = k4a_image_get_size(image) / 4;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint8_t* sdk_pixel = sdk_color + i * 4;
+		if (sdk_pixel[0] == 0 && sdk_pixel[1] == 0 && sdk_pixel[2] == 0) { continue; }
+		agreement.compared++;
+
+		bool agreed = true;
+		for (int channel = 0; channel < 3; channel++)
+		{
+			if (std::abs((int)color[i * 4 + channel] - (int)sdk_pixel[channel]) > 8) { agreed = false; }
+		}
+		if (agreed) { agreement.agreed++; }
+	}
+}
+
+// Reprojector against k4a_transformation on the source's captures, synthetic unless a recording is given.
+// Timed per frame, and the SDK's depth in colour and colour in depth images must be matched on 95% of their pixels.
+static int benchmark_reprojection(FrameSource& source)
+{
+	k4a_calibration_t calibration = {};
+	if (source.get_calibration(calibration) == FAILURE) { return FAILURE; }
+
+	Reprojector reprojector(calibration);
+	TransformationHandle transformation(k4a_transformation_create(&calibration));
+
+	// Real captures have to be checked against the SDK, synthetic ones only when the SDK is there to do it
+	if (!transformation && !source.is_synthetic())
+	{
+		std::cout << "No SDK Transformation To Validate The Reprojection Against!" << std::endl;
+		return FAILURE;
+	}
+
+	int color_width = reprojector.get_color_width();
+	int color_height = reprojector.get_color_height();
+	int depth_width = reprojector.get_depth_width();
+	int depth_height = reprojector.get_depth_height();
+
+	k4a_image_t images[4] = {};
+	get_image_pool().create_image(K4A_IMAGE_FORMAT_DEPTH16, color_width, color_height, color_width * 2, images[0]);
+	get_image_pool().create_image(K4A_IMAGE_FORMAT_DEPTH16, color_width, color_height, color_width * 2, images[1]);
+	get_image_pool().create_image(K4A_IMAGE_FORMAT_COLOR_BGRA32, depth_width, depth_height, depth_width * 4, images[2]);
+	get_image_pool().create_image(K4A_IMAGE_FORMAT_COLOR_BGRA32, depth_width, depth_height, depth_width * 4, images[3]);
+	k4a_image_t sdk_depth_in_color = images[0], depth_in_color = images[1], sdk_color_in_depth = images[2], color_in_depth = images[3];
+
+	std::cout << std::endl << "Reprojection " << depth_width << "x" << depth_height << " <-> " << color_width << "x" << color_height << ":" << std::endl;
+
+	double sdk_depth_seconds = 0, depth_seconds = 0, sdk_color_seconds = 0, color_seconds = 0;
+	ReprojectionAgreement depth_agreement, color_agreement;
+	uint64_t frames = 0;
+
+	for (; frames < REPROJECTION_FRAMES; frames++)
+	{
+		k4a_capture_t capture = NULL;
+		if (source.get_capture(capture) == FAILURE) { break; }
+
+		// RecordingFrameSource converts colour to BGRA, a device has to be started in BGRA
+		k4a_image_t color_image = k4a_capture_get_color_image(capture);
+		k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+		if (color_image == NULL || depth_image == NULL || k4a_image_get_format(color_image) != K4A_IMAGE_FORMAT_COLOR_BGRA32)
+		{
+			std::cout << "  needs BGRA colour and depth in every capture" << std::endl;
+			if (color_image != NULL) { k4a_image_release(color_image); }
+			if (depth_image != NULL) { k4a_image_release(depth_image); }
+			k4a_capture_release(capture);
+			break;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		reprojector.depth_to_color(depth_image, NULL, depth_in_color, NULL, K4A_TRANSFORMATION_INTERPOLATION_TYPE_NEAREST, 0);
+		depth_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		reprojector.color_to_depth(depth_image, color_image, color_in_depth);
+		color_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (transformation)
+		{
+			start = std::chrono::steady_clock::now();
+			k4a_transformation_depth_image_to_color_camera(transformation.get(), depth_image, sdk_depth_in_color);
+			sdk_depth_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			k4a_transformation_color_image_to_depth_camera(transformation.get(), depth_image, color_image, sdk_color_in_depth);
+			sdk_color_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			compare_depth(depth_agreement, sdk_depth_in_color, depth_in_color);
+			compare_color(color_agreement, sdk_color_in_depth, color_in_depth);
+		}
+
+		k4a_image_release(color_image);
+		k4a_image_release(depth_image);
+		k4a_capture_release(capture);
+	}
+
+	for (k4a_image_t image : images) { k4a_image_release(image); }
+
+	if (frames == 0) { return FAILURE; }
+
+	std::cout << "  Reprojector depth to color: " << depth_seconds * 1e3 / frames << " ms, color to depth: " << color_seconds * 1e3 / frames << " ms" << std::endl;
+
+	if (!transformation)
+	{
+		std::cout << "  NOT VALIDATED: no SDK transformation for the synthetic captures, Benchmark --recording <file.mkv> compares with the SDK" << std::endl;
+		return SUCCESS;
+	}
+
+	std::cout << "  SDK         depth to color: " << sdk_depth_seconds * 1e3 / frames << " ms, color to depth: " << sdk_color_seconds * 1e3 / frames << " ms" << std::endl;
+	std::cout << "  agreement with the SDK: depth " << depth_agreement.get_ratio() * 100 << "%, color " << color_agreement.get_ratio() * 100 << "%" << std::endl;
+
+	// No pixel the SDK filled is no agreement either
+	if (depth_agreement.compared == 0 || color_agreement.compared == 0 ||
+		depth_agreement.get_ratio() < 0.95 || color_agreement.get_ratio() < 0.95)
+	{
+		std::cout << "Reprojection Differs From The SDK!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// ComLog appends from the present stage, rotating files on the way, then reads every record back
+static int benchmark_com_log()
+{
+	k4a_calibration_t calibration = {};
+	get_synthetic_calibration(calibration);
+
+	SyntheticBodyConfig body_config;
+	body_config.num_bodies = 2;
+	SyntheticBodyGenerator generator(calibration, body_config);
+
+	std::vector<BodyFrame> frames(64);
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		frames[i].device_timestamp_usec = i * 33333;
+		frames[i].num_bodies = generator.get_bodies(frames[i].device_timestamp_usec, frames[i].bodies, MAX_BODIES);
+		compute_com_batch<SeatedBodyModel>(&frames[i], 1);
+	}
+
+	std::cout << std::endl << "COM log, " << COM_LOG_FRAMES << " frames of " << body_config.num_bodies << " bodies:" << std::endl;
+
+	ComLog com_log;
+	if (com_log.open("benchmark_com_log", COM_LOG_RECORDS_PER_BENCHMARK_FILE) == FAILURE) { return FAILURE; }
+
+	double slowest_seconds = 0;
+	double append_seconds = 0;
+	for (uint64_t i = 0; i < COM_LOG_FRAMES; i++)
+	{
+		// Far faster than any tracker, so give the preparer the time 30 fps would, outside the timed append
+		while (!com_log.is_next_prepared()) { std::this_thread::yield(); }
+
+		auto append_start = std::chrono::steady_clock::now();
+		com_log.append_frame<SeatedBodyModel>(frames[i % frames.size()], i == 0 ? COM_LOG_REFERENCE : 0);
+		double frame_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - append_start).count();
+		slowest_seconds = (std::max)(slowest_seconds, frame_seconds);
+		append_seconds += frame_seconds;
+	}
+
+	uint64_t record_count = com_log.get_record_count();
+	uint64_t dropped_count = com_log.get_dropped_count();
+	com_log.close();
+
+	uint64_t read_count = 0;
+	bool matches = true;
+	for (uint32_t file_index = 0; read_count < record_count; file_index++)
+	{
+		std::string path = get_com_log_path("benchmark_com_log", file_index);
+
+		ComLogHeader header;
+		std::vector<ComLogRecord> records;
+		if (read_com_log(path, header, records) == FAILURE || records.empty()) { break; }
+
+		for (const ComLogRecord& record : records)
+		{
+			const BodyFrame& frame = frames[(read_count / body_config.num_bodies) % frames.size()];
+			uint32_t body = read_count % body_config.num_bodies;
+			if (record.device_timestamp_usec != frame.device_timestamp_usec ||
+				std::memcmp(&record.center_of_mass, &frame.center_of_mass[body], sizeof(k4a_float3_t)) != 0)
+			{
+				matches = false;
+			}
+			read_count++;
+		}
+
+		std::remove(path.c_str());
+	}
+
+	std::cout << "  " << append_seconds * 1e9 / record_count << " ns per record, slowest frame " << slowest_seconds * 1e6 << " us" << std::endl;
+	std::cout << "  " << read_count << " of " << record_count << " records read back, " << dropped_count << " dropped" << std::endl;
+
+	if (read_count != record_count || dropped_count != 0 || !matches)
+	{
+		std::cout << "COM Log Differs!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Lines and the odd 720p JPEG from a loop that never waits on the disk unless the policy says so
+static int benchmark_async_writer(OverflowPolicy policy)
+{
+	const char* POLICY_NAMES[] = { "block", "drop oldest", "drop newest" };
+	const std::string TEXT_PATH = "benchmark_async_writer.txt";
+	const std::string IMAGE_PATH = "benchmark_async_writer.jpg";
+
+	std::cout << std::endl << "Async writer, " << POLICY_NAMES[policy] << ", capacity " << ASYNC_WRITER_BENCHMARK_CAPACITY << ":" << std::endl;
+
+	std::remove(TEXT_PATH.c_str());
+
+	cv::Mat image(720, 1280, CV_8UC4);
+	cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+
+	AsyncWriterStats stats;
+	double seconds = 0;
+	double slowest_seconds = 0;
+	{
+		AsyncWriter writer(ASYNC_WRITER_BENCHMARK_CAPACITY, policy);
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < ASYNC_WRITER_LINES; i++)
+		{
+			auto submit_start = std::chrono::steady_clock::now();
+			if (i % ASYNC_WRITER_LINES_PER_IMAGE == 0) { writer.write_image(IMAGE_PATH, image); }
+			writer.append_text(TEXT_PATH, std::to_string(i) + "\n");
+			slowest_seconds = (std::max)(slowest_seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - submit_start).count());
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		writer.flush();
+		stats = writer.get_stats();
+	}
+
+	// Whatever survived must be whole and in submission order
+	uint64_t line_count = 0;
+	bool in_order = true;
+	{
+		std::ifstream file(TEXT_PATH);
+		int64_t previous = -1;
+		int64_t value;
+		while (file >> value)
+		{
+			if (value <= previous) { in_order = false; }
+			previous = value;
+			line_count++;
+		}
+	}
+	std::remove(TEXT_PATH.c_str());
+	std::remove(IMAGE_PATH.c_str());
+
+	uint64_t job_count = ASYNC_WRITER_LINES + ASYNC_WRITER_LINES / ASYNC_WRITER_LINES_PER_IMAGE;
+
+	std::cout << "  " << seconds * 1e9 / job_count << " ns per job submitted, slowest " << slowest_seconds * 1e6 << " us" << std::endl;
+	std::cout << "  " << stats.written << " written, " << stats.dropped << " dropped, " << stats.failed << " failed, "
+		<< line_count << " lines read back, high water mark " << stats.high_water_mark << " of " << stats.capacity << std::endl;
+
+	if (stats.submitted != job_count ||
+		stats.written + stats.dropped + stats.failed != stats.submitted ||
+		stats.failed != 0 || !in_order ||
+		stats.high_water_mark > stats.capacity ||
+		(policy == OVERFLOW_BLOCK && (stats.dropped != 0 || line_count != ASYNC_WRITER_LINES)))
+	{
+		std::cout << "Async Writer Lost Or Reordered Jobs!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Histogram percentiles against the exact ones, and what a scoped timer costs the stage it measures
+static int benchmark_latency()
+{
+	std::cout << std::endl << "Latency histogram, " << LATENCY_SAMPLES << " samples:" << std::endl;
+
+	// Log-uniform from 100 ns to 100 ms, like stage times that span a few orders of magnitude
+	std::vector<uint64_t> samples(LATENCY_SAMPLES);
+	cv::RNG rng(7);
+	for (uint64_t& sample : samples) { sample = (uint64_t)std::exp(rng.uniform(std::log(1e2), std::log(1e8))); }
+
+	std::unique_ptr<LatencyHistogram> histogram(new LatencyHistogram());
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t sample : samples) { histogram->record(sample); }
+	double record_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < LATENCY_SAMPLES; i++)
+	{
+		ScopedLatencyTimer timer(LATENCY_LOG_WRITE);
+	}
+	double timer_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<uint64_t> sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+
+	double worst_error = 0;
+	const double FRACTIONS[] = { 0.5, 0.9, 0.99, 0.999 };
+	for (double fraction : FRACTIONS)
+	{
+		uint64_t exact = sorted[(size_t)std::ceil(fraction * sorted.size()) - 1];
+		uint64_t reported = histogram->get_percentile(fraction);
+		double error = std::abs((double)reported - (double)exact) / exact;
+		worst_error = (std::max)(worst_error, error);
+
+		std::cout << "  p" << fraction * 100 << ": " << reported / 1e3 << " us, exact " << exact / 1e3 << " us" << std::endl;
+	}
+
+	std::cout << "  record: " << record_seconds * 1e9 / LATENCY_SAMPLES << " ns, scoped timer: " << timer_seconds * 1e9 / LATENCY_SAMPLES << " ns" << std::endl;
+	std::cout << "  worst percentile error: " << worst_error * 100 << "%" << std::endl;
+
+	// A bucket spans 1/32 of its power of two
+	if (worst_error > 1.0 / 32 || histogram->get_max() != sorted.back() || histogram->get_count() != LATENCY_SAMPLES)
+	{
+		std::cout << "Latency Histogram Is Off!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Traces a pipeline run and checks every frame has its five stages, ending in order on the timeline
+static int benchmark_trace()
+{
+	const std::string TRACE_PATH = "benchmark_trace.json";
+
+	std::cout << std::endl << "Trace of the pipeline, " << TRACE_FRAMES << " frames:" << std::endl;
+
+#if PILOTSIMULATOR_LATENCY
+	MockSensor sensor;
+	MockBodyTracker tracker(MOCK_TRACKER_TIME_IN_MS);
+
+	PipelineConfig config;
+	config.tracker_queue_depth = 3;
+	config.max_frames = TRACE_FRAMES;
+
+	Pipeline pipeline(
+		[&sensor](k4a_capture_t& capture) { return sensor.get_capture(capture); },
+		tracker,
+		mock_analysis,
+		mock_present,
+		config
+	);
+
+	if (start_trace(TRACE_PATH) == FAILURE) { return FAILURE; }
+	pipeline.run();
+	uint64_t event_count = get_trace_event_count();
+	if (stop_trace() == FAILURE) { return FAILURE; }
+
+	// End of each pipeline stage of each frame, from the spans. A pop starts waiting before its frame is enqueued.
+	const char* STAGES[] = { "capture", "enqueue", "pop", "analysis", "present" };
+	const int STAGE_COUNT = sizeof(STAGES) / sizeof(STAGES[0]);
+	std::vector<std::array<double, STAGE_COUNT>> stage_ends(TRACE_FRAMES);
+	for (auto& ends : stage_ends) { ends.fill(-1); }
+
+	std::ifstream file(TRACE_PATH);
+	std::string line;
+	std::getline(file, line);
+	bool well_formed = line.find("\"traceEvents\":[") != std::string::npos;
+	std::string last_line;
+
+	while (std::getline(file, line))
+	{
+		last_line = line;
+
+		char name[32];
+		double ts, duration;
+		unsigned tid;
+		unsigned long long frame;
+		if (std::sscanf(line.c_str(), "{\"name\":\"%31[^\"]\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%lf,\"dur\":%lf,\"pid\":1,\"tid\":%u,\"args\":{\"frame\":%llu}}",
+			name, &ts, &duration, &tid, &frame) != 5)
+		{
+			continue;
+		}
+
+		for (int stage = 0; stage < STAGE_COUNT; stage++)
+		{
+			if (std::strcmp(name, STAGES[stage]) == 0 && frame < TRACE_FRAMES) { stage_ends[frame][stage] = ts + duration; }
+		}
+	}
+	well_formed = well_formed && last_line == "]}";
+	std::remove(TRACE_PATH.c_str());
+
+	uint64_t complete_frames = 0;
+	for (const auto& ends : stage_ends)
+	{
+		bool complete = true;
+		for (int stage = 0; stage < STAGE_COUNT; stage++)
+		{
+			if (ends[stage] < 0 || (stage > 0 && ends[stage] < ends[stage - 1])) { complete = false; }
+		}
+		if (complete) { complete_frames++; }
+	}
+
+	std::cout << "  " << event_count << " events, " << complete_frames << " of " << TRACE_FRAMES << " frames with every stage, in order" << std::endl;
+
+	if (!well_formed || complete_frames != TRACE_FRAMES)
+	{
+		std::cout << "Trace Is Incomplete!" << std::endl;
+		return FAILURE;
+	}
+#else
+	std::cout << "  compiled out, PILOTSIMULATOR_LATENCY is 0" << std::endl;
+#endif
+
+	return SUCCESS;
+}
+
+// Writes one byte per page, as filling the buffer would, so fresh memory pays its page faults
+static void touch_pages(uint8_t* buffer, size_t size)
+{
+	for (size_t offset = 0; offset < size; offset += 4096) { buffer[offset] = (uint8_t)offset; }
+}
+
+// What the SDK asks for per capture, 1080p BGRA, depth and IR, with a pipeline's worth of captures alive
+static double run_k4a_buffers(bool pooled)
+{
+	const int SIZES[] = { 1920 * 1080 * 4, 640 * 576 * 2, 640 * 576 * 2 };
+	const int SIZE_COUNT = sizeof(SIZES) / sizeof(SIZES[0]);
+
+	struct Allocation { uint8_t* buffer; void* context; };
+	std::vector<Allocation> in_flight(K4A_ALLOCATOR_FRAMES_IN_FLIGHT * SIZE_COUNT);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t frame = 0; frame < K4A_ALLOCATOR_FRAMES + K4A_ALLOCATOR_FRAMES_IN_FLIGHT; frame++)
+	{
+		for (int i = 0; i < SIZE_COUNT; i++)
+		{
+			Allocation& allocation = in_flight[(frame % K4A_ALLOCATOR_FRAMES_IN_FLIGHT) * SIZE_COUNT + i];
+
+			// The capture from K4A_ALLOCATOR_FRAMES_IN_FLIGHT frames ago is released
+			if (frame >= K4A_ALLOCATOR_FRAMES_IN_FLIGHT)
+			{
+				if (pooled) { k4a_allocator_free(allocation.buffer, allocation.context); }
+				else { _aligned_free(allocation.buffer); }
+			}
+			if (frame >= K4A_ALLOCATOR_FRAMES) { continue; }
+
+			if (pooled) { allocation.buffer = k4a_allocator_allocate(SIZES[i], &allocation.context); }
+			else { allocation.buffer = (uint8_t*)_aligned_malloc(SIZES[i], IMAGE_POOL_ALIGNMENT); }
+			touch_pages(allocation.buffer, SIZES[i]);
+		}
+	}
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Size classes cover every size tightly, and a capture stream settles on the buffers of the first few frames
+static int benchmark_k4a_allocator()
+{
+	std::cout << std::endl << "K4A allocator, " << K4A_ALLOCATOR_FRAMES << " captures, " << K4A_ALLOCATOR_FRAMES_IN_FLIGHT << " alive:" << std::endl;
+
+	bool classes_fit = true;
+	for (size_t size = 1; size < ((size_t)1 << 30); size += size / 7 + 1)
+	{
+		int size_class = get_k4a_allocator_class(size);
+		size_t class_size = get_k4a_allocator_class_size(size_class);
+		size_t smaller_class_size = size_class > 0 ? get_k4a_allocator_class_size(size_class - 1) : 0;
+		if (size_class >= K4A_ALLOCATOR_CLASS_COUNT || class_size < size || smaller_class_size >= size ||
+			(size > 4096 && class_size > size + size / 4))
+		{
+			classes_fit = false;
+		}
+	}
+
+	double system_seconds = run_k4a_buffers(false);
+	K4aAllocatorStats before = get_k4a_allocator_stats();
+	double pooled_seconds = run_k4a_buffers(true);
+	K4aAllocatorStats after = get_k4a_allocator_stats();
+	trim_k4a_allocator();
+
+	uint64_t allocations = after.allocations - before.allocations;
+	uint64_t system_allocations = after.system_allocations - before.system_allocations;
+	uint64_t buffers_alive = K4A_ALLOCATOR_FRAMES_IN_FLIGHT * 3;
+
+	std::cout << "  system allocator " << system_seconds * 1e6 / K4A_ALLOCATOR_FRAMES << " us per capture, pooled "
+		<< pooled_seconds * 1e6 / K4A_ALLOCATOR_FRAMES << " us per capture" << std::endl;
+	std::cout << "  " << allocations << " allocations, " << system_allocations << " from the system, peak "
+		<< after.peak_live_bytes / (1024.0 * 1024.0) << " MB live" << std::endl;
+
+	if (!classes_fit || system_allocations > buffers_alive || after.live_bytes != before.live_bytes)
+	{
+		std::cout << "K4A Allocator Does Not Recycle!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// The whole loop on synthetic captures: pooled images, tracker, COM, binary log and per-frame text.
+// Once warmed up no frame may allocate, a regression fails here with the stage it came from.
+static int benchmark_allocations()
+{
+	const std::string TEXT_PATH = "alloc_text.txt";	// short enough to be copied into a job without allocating
+	const std::string COM_LOG_PATH = "benchmark_allocations";
+
+	std::cout << std::endl << "Allocations, " << ALLOCATION_FRAMES << " frames after " << ALLOCATION_WARMUP_FRAMES << " to warm up:" << std::endl;
+
+#if PILOTSIMULATOR_ALLOC_AUDIT
+	SyntheticFrameSource source(ALLOCATION_WARMUP_FRAMES + ALLOCATION_FRAMES);
+	if (source.open() == FAILURE) { return FAILURE; }
+	source.set_clock_mode(FAST_CLOCK);
+
+	k4a_calibration_t calibration = {};
+	source.get_calibration(calibration);
+	MockBodyTracker tracker(0, 3, source.get_body_config(), &calibration);
+
+	ComLog com_log;
+	if (com_log.open(COM_LOG_PATH, COM_LOG_RECORDS_PER_BENCHMARK_FILE) == FAILURE) { return FAILURE; }
+
+	AsyncWriter writer;
+	uint64_t presented = 0;
+
+	PipelineConfig config;
+	config.max_frames = ALLOCATION_WARMUP_FRAMES + ALLOCATION_FRAMES;
+
+	Pipeline pipeline(
+		[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+		tracker,
+		[](BodyFrame& frame) { compute_com_batch<SeatedBodyModel>(&frame, 1); },
+		[&](BodyFrame& frame) {
+			if (presented++ == ALLOCATION_WARMUP_FRAMES) { reset_allocation_audit(); }
+
+			com_log.append_frame<SeatedBodyModel>(frame);
+
+			AsyncText frame_text(writer, &TEXT_PATH);
+			frame_text.print("%llu: %u bodies, COM %g %g %g\n", (unsigned long long)frame.frame_id, frame.num_bodies,
+				frame.center_of_mass[0].xyz.x, frame.center_of_mass[0].xyz.y, frame.center_of_mass[0].xyz.z);
+			return true;
+		},
+		config
+	);
+
+	// The pool would otherwise still grow the first time the queues all fill up
+	size_t frames_in_flight = pipeline.get_max_frames_in_flight();
+	ImagePool& pool = get_image_pool();
+	if (pool.reserve(K4A_IMAGE_FORMAT_COLOR_BGRA32, SYNTHETIC_COLOR_WIDTH, SYNTHETIC_COLOR_HEIGHT, SYNTHETIC_COLOR_WIDTH * 4, frames_in_flight) == FAILURE ||
+		pool.reserve(K4A_IMAGE_FORMAT_DEPTH16, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, SYNTHETIC_DEPTH_WIDTH * (int)sizeof(uint16_t), frames_in_flight) == FAILURE ||
+		pool.reserve(K4A_IMAGE_FORMAT_CUSTOM8, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, SYNTHETIC_DEPTH_WIDTH, frames_in_flight) == FAILURE)
+	{
+		return FAILURE;
+	}
+
+	pipeline.run();
+
+	AllocationFrameStats stats = get_allocation_frame_stats();
+	print_allocation_report();
+
+	writer.flush();
+	com_log.close();
+	std::remove(TEXT_PATH.c_str());
+	std::remove(get_com_log_path(COM_LOG_PATH, 0).c_str());
+
+	if (stats.frames != ALLOCATION_FRAMES || stats.frames_with_allocations != 0)
+	{
+		std::cout << "Steady State Frames Allocate!" << std::endl;
+		return FAILURE;
+	}
+#else
+	std::cout << "  compiled out, PILOTSIMULATOR_ALLOC_AUDIT is 0" << std::endl;
+#endif
+
+	return SUCCESS;
+}
+
+// Hardware counters of the pipeline stages on synthetic captures, every frame must reach the CSV.
+// Machines that do not let us count, virtual ones or a strict perf_event_paranoid, only report so.
+static int benchmark_perf_counters()
+{
+	const std::string CSV_PATH = "benchmark_perf.csv";
+
+	std::cout << std::endl << "Hardware counters, " << PERF_COUNTER_FRAMES << " frames:" << std::endl;
+
+#if PILOTSIMULATOR_LATENCY
+	if (start_perf_counters(CSV_PATH) == FAILURE)
+	{
+		std::cout << "  unavailable" << std::endl;
+		return SUCCESS;
+	}
+
+	SyntheticFrameSource source(PERF_COUNTER_FRAMES);
+	if (source.open() == FAILURE) { return FAILURE; }
+	source.set_clock_mode(FAST_CLOCK);
+
+	k4a_calibration_t calibration = {};
+	source.get_calibration(calibration);
+	MockBodyTracker tracker(0, 3, source.get_body_config(), &calibration);
+
+	PipelineConfig config;
+	config.max_frames = PERF_COUNTER_FRAMES;
+
+	Pipeline pipeline(
+		[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+		tracker,
+		[](BodyFrame& frame) { compute_com_batch<SeatedBodyModel>(&frame, 1); },
+		[](BodyFrame&) { return true; },
+		config
+	);
+
+	pipeline.run();
+	stop_perf_counters();
+	get_async_writer().flush();
+
+	PerfCounts analysis;
+	get_perf_counts(LATENCY_ANALYSIS, analysis);
+	uint64_t frames = get_perf_frame_count();
+	print_perf_report();
+
+	std::ifstream file(CSV_PATH);
+	std::string line;
+	uint64_t analysis_lines = 0;
+	while (std::getline(file, line))
+	{
+		if (line.find(",analysis,") != std::string::npos) { analysis_lines++; }
+	}
+	file.close();
+	std::remove(CSV_PATH.c_str());
+
+	bool counted = analysis.spans == PERF_COUNTER_FRAMES && analysis.values[PERF_CYCLES] > 0 &&
+		(!is_perf_counter_available(PERF_INSTRUCTIONS) || analysis.values[PERF_INSTRUCTIONS] > 0);
+
+	if (frames != PERF_COUNTER_FRAMES || !counted || analysis_lines != PERF_COUNTER_FRAMES)
+	{
+		std::cout << "Hardware Counters Missed Frames!" << std::endl;
+		return FAILURE;
+	}
+#else
+	std::cout << "  compiled out, PILOTSIMULATOR_LATENCY is 0" << std::endl;
+#endif
+
+	return SUCCESS;
+}
+
+// Whole response of GET /metrics on the local port
+static int scrape_metrics(int port, std::string& response)
+{
+#if defined(_WIN32)
+	using Socket = SOCKET;
+	auto close_socket = [](Socket socket) { closesocket(socket); };
+#else
+	using Socket = int;
+	auto close_socket = [](Socket socket) { close(socket); };
+#endif
+
+	Socket client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if ((intptr_t)client == -1) { return FAILURE; }
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons((uint16_t)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	const char REQUEST[] = "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	if (connect(client, (const sockaddr*)&address, sizeof(address)) != 0 ||
+		send(client, REQUEST, (int)sizeof(REQUEST) - 1, 0) != (int)sizeof(REQUEST) - 1)
+	{
+		close_socket(client);
+		return FAILURE;
+	}
+
+	char received[4096];
+	int length;
+	response.clear();
+	while ((length = (int)recv(client, received, sizeof(received), 0)) > 0) { response.append(received, length); }
+	close_socket(client);
+
+	return response.compare(0, 15, "HTTP/1.1 200 OK") == 0 ? SUCCESS : FAILURE;
+}
+
+// Value of an unlabelled sample in Prometheus text, -1 when missing
+static double get_prometheus_value(const std::string& text, const std::string& name)
+{
+	size_t position = text.find("\n" + name + " ");
+	return position == std::string::npos ? -1 : std::atof(text.c_str() + position + name.size() + 2);
+}
+
+// The pipeline's metrics through the HTTP endpoint and the shared memory snapshot, both must agree
+// with what the pipeline did. Also what a scrape and a publish cost the process.
+static int benchmark_metrics()
+{
+	std::cout << std::endl << "Metrics, " << METRICS_FRAMES << " frames:" << std::endl;
+
+	MetricsServer server;
+	if (server.start(METRICS_BENCHMARK_PORT) == FAILURE) { return FAILURE; }
+
+	SharedMemory snapshot_memory;
+	if (snapshot_memory.open(get_metrics_snapshot_name(METRICS_BENCHMARK_PORT), sizeof(MetricsSnapshot)) == FAILURE)
+	{
+		std::cout << "Metrics Snapshot Not Found!" << std::endl;
+		return FAILURE;
+	}
+
+	// Counters are process wide, earlier benchmarks added to them already
+	PipelineMetrics& metrics = get_pipeline_metrics();
+	uint64_t captures_before = metrics.captures.get();
+	uint64_t pops_before = metrics.pop_latency.get_count();
+
+	SyntheticFrameSource source(METRICS_FRAMES);
+	if (source.open() == FAILURE) { return FAILURE; }
+	source.set_clock_mode(FAST_CLOCK);
+
+	k4a_calibration_t calibration = {};
+	source.get_calibration(calibration);
+	MockBodyTracker tracker(0, 3, source.get_body_config(), &calibration);
+
+	PipelineConfig config;
+	config.max_frames = METRICS_FRAMES;
+
+	Pipeline pipeline(
+		[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+		tracker,
+		[](BodyFrame& frame) { compute_com_batch<SeatedBodyModel>(&frame, 1); },
+		[](BodyFrame&) { get_pipeline_metrics().com_published.add(); return true; },
+		config
+	);
+	pipeline.run();
+
+	uint64_t captures = metrics.captures.get() - captures_before;
+	uint64_t pops = metrics.pop_latency.get_count() - pops_before;
+
+	std::string response;
+	auto scrape_start = std::chrono::steady_clock::now();
+	if (scrape_metrics(METRICS_BENCHMARK_PORT, response) == FAILURE)
+	{
+		std::cout << "Failed To Scrape The Metrics!" << std::endl;
+		return FAILURE;
+	}
+	double scrape_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - scrape_start).count();
+
+	bool scraped = get_prometheus_value(response, "pilotsimulator_captures_total") == (double)metrics.captures.get() &&
+		get_prometheus_value(response, "pilotsimulator_tracker_pop_seconds_count") == (double)metrics.pop_latency.get_count() &&
+		get_prometheus_value(response, "pilotsimulator_bodies") == (double)source.get_body_config().num_bodies &&
+		response.find("# TYPE pilotsimulator_tracker_pop_seconds histogram") != std::string::npos;
+
+	// After the next publish the snapshot holds the final counts
+	std::this_thread::sleep_for(std::chrono::milliseconds(2 * METRICS_PUBLISH_INTERVAL_MS));
+	std::unique_ptr<MetricsSnapshot> snapshot(new MetricsSnapshot());
+	bool published = read_metrics_snapshot(snapshot_memory, *snapshot) == SUCCESS;
+	bool snapshot_captures = false;
+	for (uint32_t i = 0; published && i < snapshot->entry_count; i++)
+	{
+		if (std::strcmp(snapshot->entries[i].name, "pilotsimulator_captures_total") == 0)
+		{
+			snapshot_captures = snapshot->entries[i].count == metrics.captures.get();
+		}
+	}
+
+	auto publish_start = std::chrono::steady_clock::now();
+	const int PUBLISHES = 1000;
+	for (int i = 0; i < PUBLISHES; i++) { get_metrics().write_snapshot(*snapshot); }
+	double publish_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - publish_start).count();
+
+	std::cout << "  " << captures << " captures, " << pops << " pops, scrape of " << response.size() << " bytes in "
+		<< scrape_seconds * 1e3 << " ms, snapshot in " << publish_seconds * 1e6 / PUBLISHES << " us" << std::endl;
+
+	snapshot_memory.close();
+	server.stop();
+
+	if (captures != METRICS_FRAMES || pops != METRICS_FRAMES || !scraped || !published || !snapshot_captures)
+	{
+		std::cout << "Metrics Do Not Match The Pipeline!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// StreamCOM's present with a display and headless, at the sensor's 30 fps behind a tracker of MOCK_TRACKER_TIME_IN_MS.
+// No window opens here, cv::waitKey(30) is stood in for by the 30 ms it waits when no key is pressed.
+static int benchmark_headless()
+{
+	const std::string TEXT_PATH = "headless.txt";
+	double fps[2] = {};
+	double present_ms[2] = {};
+
+	std::cout << std::endl << "Display against headless, " << HEADLESS_FRAMES << " frames at 30 fps:" << std::endl;
+
+	for (int headless = 0; headless < 2; headless++)
+	{
+		SyntheticFrameSource source(HEADLESS_FRAMES);
+		source.set_color_enabled(!headless);
+		if (source.open() == FAILURE) { return FAILURE; }
+
+		k4a_calibration_t calibration = {};
+		source.get_calibration(calibration);
+		MockBodyTracker tracker(MOCK_TRACKER_TIME_IN_MS, 3, source.get_body_config(), &calibration);
+		AsyncWriter writer;
+		std::chrono::steady_clock::duration present_time(0);
+
+		auto present_display = [&](BodyFrame& frame) {
+			auto start = std::chrono::steady_clock::now();
+
+			k4a_image_t color_image = k4a_capture_get_color_image(frame.capture);
+			if (color_image == NULL) { return false; }
+
+			cv::Mat color_image_mat(
+				k4a_image_get_height_pixels(color_image), k4a_image_get_width_pixels(color_image), CV_8UC4,
+				(void*)k4a_image_get_buffer(color_image),
+				cv::Mat::AUTO_STEP
+			);
+
+			AsyncText frame_text(writer, &TEXT_PATH);
+			int valid = 0;
+			for (int segment_id = 0; segment_id < FullBodyModel::SEGMENT_COUNT; segment_id++)
+			{
+				k4a_float2_t segment_com_2d = {};
+				k4a_calibration_3d_to_2d(&calibration, &frame.body_segment_com[0][segment_id],
+					K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_COLOR, &segment_com_2d, &valid);
+				cv::circle(color_image_mat, cv::Point((int)segment_com_2d.xy.x, (int)segment_com_2d.xy.y), 20, cv::Scalar(0, 255, 0), cv::FILLED);
+			}
+
+			k4a_float2_t com_2d = {};
+			k4a_calibration_3d_to_2d(&calibration, &frame.center_of_mass[0], K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_COLOR, &com_2d, &valid);
+			cv::circle(color_image_mat, cv::Point((int)com_2d.xy.x, (int)com_2d.xy.y), 20, cv::Scalar(0, 0, 255), cv::FILLED);
+
+			char text[32];
+			snprintf(text, sizeof(text), "Z: %.2f mm", frame.center_of_mass[0].xyz.z);
+			cv::putText(color_image_mat, text, cv::Point((int)com_2d.xy.x + 30, (int)com_2d.xy.y + 30), cv::FONT_HERSHEY_DUPLEX, 1.0, cv::Scalar(0, 0, 255), 2);
+			frame_text.print("%s\n", text);
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(DISPLAY_WAIT_KEY_IN_MS));
+			k4a_image_release(color_image);
+			present_time += std::chrono::steady_clock::now() - start;
+			return true;
+		};
+
+		auto present_headless = [&](BodyFrame& frame) {
+			auto start = std::chrono::steady_clock::now();
+			{
+				AsyncText frame_text(writer, &TEXT_PATH);
+				frame_text.print("COM: %.2f %.2f %.2f mm\n", frame.center_of_mass[0].xyz.x, frame.center_of_mass[0].xyz.y, frame.center_of_mass[0].xyz.z);
+			}
+			present_time += std::chrono::steady_clock::now() - start;
+			return true;
+		};
+
+		PipelineConfig config;
+		config.max_frames = HEADLESS_FRAMES;
+
+		Pipeline pipeline(
+			[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+			tracker,
+			[](BodyFrame& frame) { compute_com_batch<FullBodyModel>(&frame, 1); },
+			headless ? Pipeline::PresentFunction(present_headless) : Pipeline::PresentFunction(present_display),
+			config
+		);
+
+		pipeline.run();
+		writer.flush();
+
+		fps[headless] = pipeline.get_throughput(PRESENT_STAGE);
+		present_ms[headless] = std::chrono::duration<double, std::milli>(present_time).count() / HEADLESS_FRAMES;
+		if (pipeline.get_frame_count(PRESENT_STAGE) != HEADLESS_FRAMES)
+		{
+			std::cout << "Headless Run Lost Frames!" << std::endl;
+			return FAILURE;
+		}
+	}
+
+	std::remove(TEXT_PATH.c_str());
+
+	// Both may keep up with the sensor, what the display costs shows in the present stage's share of the frame
+	std::cout << "  display " << fps[0] << " fps, " << present_ms[0] << " ms present per frame" << std::endl;
+	std::cout << "  headless " << fps[1] << " fps, " << present_ms[1] << " ms present per frame" << std::endl;
+
+	if (fps[1] < fps[0] * 0.98 || present_ms[1] >= present_ms[0])
+	{
+		std::cout << "Headless Is Not Faster!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+static int benchmark_latest_slot()
+{
+	LatestSlot<uint64_t> slot;
+	std::atomic<bool> done{ false };
+	uint64_t replaced = 0;
+
+	std::thread producer([&] {
+		for (uint64_t value = 1; value <= LATEST_SLOT_VALUES; value++)
+		{
+			slot.back() = value;
+			if (slot.publish()) { replaced++; }
+		}
+		done = true;
+	});
+
+	// Values only ever grow and the last one is always taken, whatever was replaced on the way
+	uint64_t last = 0;
+	uint64_t taken = 0;
+	bool in_order = true;
+	while (!done || last != LATEST_SLOT_VALUES)
+	{
+		if (!slot.take()) { continue; }
+
+		if (slot.front() <= last) { in_order = false; }
+		last = slot.front();
+		taken++;
+	}
+	producer.join();
+
+	std::cout << "  latest slot " << taken << " taken, " << replaced << " replaced of " << LATEST_SLOT_VALUES << std::endl;
+
+	if (!in_order || taken + replaced != LATEST_SLOT_VALUES)
+	{
+		std::cout << "Latest Slot Lost Order!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+static int benchmark_preview()
+{
+	double fps[2] = {};
+	PreviewStats stats;
+
+	std::cout << std::endl << "Display on the processing thread against the preview thread, " << PREVIEW_FRAMES << " frames:" << std::endl;
+
+	if (benchmark_latest_slot() == FAILURE) { return FAILURE; }
+
+	for (int decoupled = 0; decoupled < 2; decoupled++)
+	{
+		SyntheticFrameSource source(PREVIEW_FRAMES);
+		source.set_clock_mode(FAST_CLOCK);
+		if (source.open() == FAILURE) { return FAILURE; }
+
+		k4a_calibration_t calibration = {};
+		source.get_calibration(calibration);
+		MockBodyTracker tracker(0, 3, source.get_body_config(), &calibration);
+
+		Preview preview;
+		int window = preview.add_window("preview");
+
+		auto present = [&](BodyFrame& frame) {
+			k4a_image_t color_image = k4a_capture_get_color_image(frame.capture);
+			if (color_image == NULL) { return false; }
+
+			if (decoupled)
+			{
+				preview.show(window, color_image, CV_8UC4);
+			}
+			else
+			{
+				cv::Mat color_image_mat(
+					k4a_image_get_height_pixels(color_image), k4a_image_get_width_pixels(color_image), CV_8UC4,
+					(void*)k4a_image_get_buffer(color_image),
+					cv::Mat::AUTO_STEP
+				);
+				cv::imshow("preview", color_image_mat);
+				cv::waitKey(DISPLAY_WAIT_KEY_IN_MS);
+			}
+
+			k4a_image_release(color_image);
+			return true;
+		};
+
+		PipelineConfig config;
+		config.max_frames = PREVIEW_FRAMES;
+
+		Pipeline pipeline(
+			[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+			tracker,
+			[](BodyFrame& frame) { compute_com_batch<FullBodyModel>(&frame, 1); },
+			present,
+			config
+		);
+
+		if (decoupled) { preview.start(); }
+		pipeline.run();
+		preview.stop();
+		if (!decoupled) { cv::destroyWindow("preview"); }
+
+		fps[decoupled] = pipeline.get_throughput(PRESENT_STAGE);
+		if (decoupled) { stats = preview.get_stats(window); }
+	}
+
+	std::cout << "  inline waitKey(" << DISPLAY_WAIT_KEY_IN_MS << ") " << fps[0] << " fps" << std::endl;
+	std::cout << "  preview " << fps[1] << " fps, " << stats.shown << " shown, " << stats.replaced
+		<< " replaced of " << stats.published << " at " << get_display_refresh_rate() << " Hz" << std::endl;
+
+	if (fps[1] < fps[0] * 2 || stats.shown == 0 || stats.published != PREVIEW_FRAMES)
+	{
+		std::cout << "Preview Does Not Decouple The Display!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+#if defined(_WIN32)
+using ProcessHandle = HANDLE;
+#else
+using ProcessHandle = pid_t;
+#endif
+
+// This program again with one argument, as a second process
+static int start_benchmark_process(const char* program, const char* argument, ProcessHandle& process)
+{
+#if defined(_WIN32)
+	char path[MAX_PATH];
+	if (GetModuleFileNameA(NULL, path, MAX_PATH) == 0) { return FAILURE; }
+
+	std::string command_line = std::string("\"") + path + "\" " + argument;
+	STARTUPINFOA startup_info = {};
+	startup_info.cb = sizeof(startup_info);
+	PROCESS_INFORMATION process_info = {};
+	if (!CreateProcessA(path, &command_line[0], NULL, NULL, FALSE, 0, NULL, NULL, &startup_info, &process_info)) { return FAILURE; }
+
+	CloseHandle(process_info.hThread);
+	process = process_info.hProcess;
+#else
+	process = fork();
+	if (process < 0) { return FAILURE; }
+	if (process == 0)
+	{
+		execl(program, program, argument, (char*)NULL);
+		_exit(127);
+	}
+#endif
+
+	return SUCCESS;
+}
+
+// Exit code of the process, -1 when it could not be waited for
+static int wait_benchmark_process(ProcessHandle process)
+{
+#if defined(_WIN32)
+	DWORD exit_code = (DWORD)-1;
+	if (WaitForSingleObject(process, INFINITE) != WAIT_OBJECT_0 || !GetExitCodeProcess(process, &exit_code)) { exit_code = (DWORD)-1; }
+	CloseHandle(process);
+	return (int)exit_code;
+#else
+	int status = 0;
+	if (waitpid(process, &status, 0) != process || !WIFEXITED(status)) { return -1; }
+	return WEXITSTATUS(status);
+#endif
+}
+
+static uint64_t get_steady_nsec()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sample i of the channel benchmark: every value the reader checks follows from i, so a torn copy shows
+static void fill_com_channel_frame(BodyFrame& frame, uint64_t i)
+{
+	frame.frame_id = i;
+	frame.device_timestamp_usec = i * 33333;
+	frame.num_bodies = 1 + (uint32_t)(i % 3);
+
+	for (uint32_t body = 0; body < frame.num_bodies; body++)
+	{
+		frame.bodies[body].id = (uint32_t)i + body;
+		frame.center_of_mass[body] = { { (float)i, (float)body, -(float)i } };
+		frame.body_segment_com[body][FullBodyModel::SEGMENT_COUNT - 1] = { { (float)i, 0, 0 } };
+		frame.bodies[body].skeleton.joints[K4ABT_JOINT_COUNT - 1].position = { { (float)i, 0, 0 } };
+	}
+}
+
+static bool is_com_channel_sample_whole(const ComChannelSample& sample)
+{
+	uint64_t i = sample.frame_id;
+	if (sample.index != i || sample.device_timestamp_usec != i * 33333 || sample.num_bodies != 1 + i % 3 ||
+		sample.segment_count != FullBodyModel::SEGMENT_COUNT)
+	{
+		return false;
+	}
+
+	for (uint32_t body = 0; body < sample.num_bodies; body++)
+	{
+		const ComChannelBody& channel_body = sample.bodies[body];
+		if (channel_body.id != (uint32_t)i + body || channel_body.center_of_mass[0] != (float)i ||
+			channel_body.center_of_mass[1] != (float)body || channel_body.center_of_mass[2] != -(float)i ||
+			channel_body.body_segment_com[FullBodyModel::SEGMENT_COUNT - 1][0] != (float)i ||
+			channel_body.joints[COM_CHANNEL_JOINTS - 1].position[0] != (float)i)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// The reader process of benchmark_com_channel: follows every sample, checks it and prints the latency from publish to read
+static int run_com_channel_reader()
+{
+	static ComChannelSample sample;
+	ComSubscriber subscriber;
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(COM_CHANNEL_READER_TIMEOUT_SECONDS);
+	while (subscriber.open(COM_CHANNEL_BENCHMARK_NAME) == FAILURE)
+	{
+		if (std::chrono::steady_clock::now() > deadline) { return FAILURE; }
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	std::vector<uint64_t> latencies;
+	latencies.reserve(COM_CHANNEL_SAMPLES);
+	uint64_t torn = 0;
+
+	while (latencies.size() + subscriber.get_lost() < COM_CHANNEL_SAMPLES && std::chrono::steady_clock::now() < deadline)
+	{
+		// Yielding keeps a machine with one core fair, it returns at once when a core is free
+		if (subscriber.read_next(sample) == FAILURE)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		latencies.push_back(get_steady_nsec() - sample.publish_steady_nsec);
+		if (!is_com_channel_sample_whole(sample)) { torn++; }
+	}
+
+	if (latencies.empty())
+	{
+		std::cout << "COM Channel Reader Got Nothing!" << std::endl;
+		return FAILURE;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&](double p) { return latencies[(size_t)(p * (latencies.size() - 1))]; };
+
+	std::cout << "  reader process " << latencies.size() << " read, " << subscriber.get_lost() << " lost, " << torn << " torn" << std::endl;
+	std::cout << "  publish to read p50 " << percentile(0.5) << " ns, p99 " << percentile(0.99) << " ns, p99.9 "
+		<< percentile(0.999) << " ns, max " << latencies.back() << " ns" << std::endl;
+
+	if (torn > 0)
+	{
+		std::cout << "COM Channel Reader Saw A Torn Sample!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Publishes to a reader in a second process at a steady interval, the reader reports the latency.
+// Then what reading the newest sample costs a reader in this process.
+static int benchmark_com_channel(const char* program)
+{
+	std::cout << std::endl << "COM channel between two processes, " << COM_CHANNEL_SAMPLES << " samples every "
+		<< COM_CHANNEL_PUBLISH_INTERVAL_USEC << " us:" << std::endl;
+
+	ComPublisher publisher;
+	if (publisher.open(COM_CHANNEL_BENCHMARK_NAME) == FAILURE)
+	{
+		std::cout << "COM Channel Open Failed!" << std::endl;
+		return FAILURE;
+	}
+
+	ProcessHandle reader;
+	if (start_benchmark_process(program, COM_CHANNEL_READER_ARGUMENT, reader) == FAILURE)
+	{
+		std::cout << "COM Channel Reader Did Not Start!" << std::endl;
+		return FAILURE;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(COM_CHANNEL_READER_TIMEOUT_SECONDS);
+	while (publisher.get_reader_count() == 0 && std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	static BodyFrame frame;
+	double publish_seconds = 0;
+	uint64_t next_publish = get_steady_nsec();
+	for (uint64_t i = 0; i < COM_CHANNEL_SAMPLES; i++)
+	{
+		while (get_steady_nsec() < next_publish) { std::this_thread::yield(); }
+		next_publish += COM_CHANNEL_PUBLISH_INTERVAL_USEC * 1000;
+
+		fill_com_channel_frame(frame, i);
+		auto publish_start = std::chrono::steady_clock::now();
+		publisher.publish(frame, FullBodyModel::SEGMENT_COUNT);
+		publish_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - publish_start).count();
+	}
+
+	if (wait_benchmark_process(reader) != SUCCESS)
+	{
+		std::cout << "COM Channel Reader Failed!" << std::endl;
+		return FAILURE;
+	}
+
+	static ComChannelSample sample;
+	ComSubscriber subscriber;
+	if (subscriber.open(COM_CHANNEL_BENCHMARK_NAME) == FAILURE) { return FAILURE; }
+
+	uint64_t whole = 0;
+	auto read_start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < COM_CHANNEL_READS; i++)
+	{
+		if (subscriber.read_latest(sample) == SUCCESS && sample.frame_id == COM_CHANNEL_SAMPLES - 1) { whole++; }
+	}
+	double read_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - read_start).count();
+
+	std::cout << "  publish " << publish_seconds * 1e9 / COM_CHANNEL_SAMPLES << " ns, read_latest "
+		<< read_seconds * 1e9 / COM_CHANNEL_READS << " ns" << std::endl;
+
+	if (whole != COM_CHANNEL_READS || !is_com_channel_sample_whole(sample))
+	{
+		std::cout << "COM Channel Lost The Latest Sample!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Little endian field of a binary datagram at offset
+template <typename T>
+static T get_udp_field(const uint8_t* data, size_t offset)
+{
+	T value;
+	std::memcpy(&value, data + offset, sizeof(value));
+	return value;
+}
+
+// What each format makes of one frame, checked field by field
+static int check_udp_encoders()
+{
+	static BodyFrame frame;
+	fill_com_channel_frame(frame, 1234);
+	frame.num_bodies = UDP_OUTPUT_BODIES;
+	for (uint32_t body = 0; body < UDP_OUTPUT_BODIES; body++)
+	{
+		frame.bodies[body].id = 1234 + body;
+		frame.center_of_mass[body] = { { 1234.0f, (float)body, -1234.0f } };
+	}
+
+	std::vector<UdpDatagram> datagrams(UDP_ENCODE_CAPACITY);
+	bool whole = true;
+
+	BinaryUdpEncoder binary;
+	size_t count = binary.encode(frame, FullBodyModel::SEGMENT_COUNT, datagrams.data(), datagrams.size());
+	whole = whole && count == 1 + UDP_OUTPUT_BODIES;
+	for (size_t i = 0; i < count && whole; i++)
+	{
+		const uint8_t* data = datagrams[i].data;
+		whole = get_udp_field<uint32_t>(data, 0) == UDP_BINARY_MAGIC && get_udp_field<uint16_t>(data, 4) == UDP_BINARY_VERSION &&
+			data[6] == (i == 0 ? UDP_BINARY_COM : UDP_BINARY_SKELETON) && get_udp_field<uint32_t>(data, 8) == i &&
+			get_udp_field<uint16_t>(data, 12) == i && get_udp_field<uint16_t>(data, 14) == count &&
+			get_udp_field<uint64_t>(data, 16) == 1234;
+	}
+	whole = whole && datagrams[0].data[7] == UDP_OUTPUT_BODIES &&
+		datagrams[0].length == UDP_BINARY_HEADER_SIZE + UDP_OUTPUT_BODIES * (8 + 12 * (1 + FullBodyModel::SEGMENT_COUNT)) &&
+		get_udp_field<uint32_t>(datagrams[0].data, UDP_BINARY_HEADER_SIZE) == 1234 &&
+		get_udp_field<float>(datagrams[0].data, UDP_BINARY_HEADER_SIZE + 8) == 1234.0f &&
+		get_udp_field<float>(datagrams[2].data, UDP_BINARY_HEADER_SIZE + 4 + (K4ABT_JOINT_COUNT - 1) * sizeof(k4abt_joint_t)) == 1234.0f;
+
+	XPlaneUdpEncoder xplane;
+	count = xplane.encode(frame, FullBodyModel::SEGMENT_COUNT, datagrams.data(), datagrams.size());
+	whole = whole && count == 1 && datagrams[0].length == 5 + 36 * UDP_OUTPUT_BODIES &&
+		std::memcmp(datagrams[0].data, "DATA", 5) == 0 &&
+		get_udp_field<int32_t>(datagrams[0].data, 5 + 36) == UDP_XPLANE_DATA_INDEX + 1 &&
+		get_udp_field<float>(datagrams[0].data, 5 + 4) == 1.234f &&
+		get_udp_field<float>(datagrams[0].data, 5 + 36 + 8) == 1.0f / 1000.0f &&
+		get_udp_field<float>(datagrams[0].data, 5 + 4 + 3 * 4) == 1234.0f &&
+		get_udp_field<float>(datagrams[0].data, 5 + 4 + 4 * 4) == UDP_XPLANE_NO_VALUE;
+
+	FlightGearUdpEncoder flightgear;
+	count = flightgear.encode(frame, FullBodyModel::SEGMENT_COUNT, datagrams.data(), datagrams.size());
+	std::string line((const char*)datagrams[1].data, datagrams[1].length);
+	whole = whole && count == UDP_OUTPUT_BODIES && line == "1,1234,41132922,1235,1.2340,0.0010,-1.2340\n";
+
+	if (!whole)
+	{
+		std::cout << "UDP Encoders Wrote Something Else!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Binary datagrams through UdpOutput to a receiver on the loopback: what publish costs the tracking thread,
+// the loss from the sequence numbers and the one-way latency from the publish timestamps
+static int benchmark_udp_output()
+{
+	std::cout << std::endl << "UDP output over the loopback, " << UDP_OUTPUT_FRAMES << " frames of " << UDP_OUTPUT_BODIES
+		<< " bodies every " << UDP_OUTPUT_PUBLISH_INTERVAL_USEC << " us:" << std::endl;
+
+	if (check_udp_encoders() == FAILURE) { return FAILURE; }
+
+#if defined(_WIN32)
+	using Socket = SOCKET;
+	auto close_socket = [](Socket socket) { closesocket(socket); };
+#else
+	using Socket = int;
+	auto close_socket = [](Socket socket) { close(socket); };
+#endif
+
+	// Started first, it sets up Winsock for the receiver too
+	UdpOutput output;
+	if (output.start("127.0.0.1:" + std::to_string(UDP_OUTPUT_BENCHMARK_PORT), get_udp_encoder(UDP_FORMAT_BINARY)) == FAILURE) { return FAILURE; }
+
+	Socket receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if ((intptr_t)receiver == -1) { return FAILURE; }
+
+	int receive_buffer = 4 * 1024 * 1024;
+	setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, (const char*)&receive_buffer, sizeof(receive_buffer));
+#if defined(_WIN32)
+	DWORD receive_timeout = 100;
+#else
+	timeval receive_timeout = { 0, 100000 };
+#endif
+	setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, (const char*)&receive_timeout, sizeof(receive_timeout));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons((uint16_t)UDP_OUTPUT_BENCHMARK_PORT);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(receiver, (const sockaddr*)&address, sizeof(address)) != 0)
+	{
+		std::cout << "Failed To Bind UDP Port " << UDP_OUTPUT_BENCHMARK_PORT << "!" << std::endl;
+		close_socket(receiver);
+		return FAILURE;
+	}
+
+	std::atomic<bool> publishing{ true };
+	std::vector<uint64_t> latencies;
+	latencies.reserve(UDP_OUTPUT_FRAMES * (1 + UDP_OUTPUT_BODIES));
+	uint64_t received = 0;
+	uint64_t malformed = 0;
+	uint64_t out_of_order = 0;
+	int64_t last_sequence = -1;
+
+	std::thread receiving([&] {
+		uint8_t data[UDP_DATAGRAM_SIZE];
+		for (;;)
+		{
+			int length = (int)recv(receiver, (char*)data, sizeof(data), 0);
+			if (length <= 0)
+			{
+				if (!publishing) { break; }
+				continue;
+			}
+
+			uint64_t now_usec = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+
+			if (length < (int)UDP_BINARY_HEADER_SIZE || get_udp_field<uint32_t>(data, 0) != UDP_BINARY_MAGIC)
+			{
+				malformed++;
+				continue;
+			}
+
+			int64_t sequence = get_udp_field<uint32_t>(data, 8);
+			if (sequence <= last_sequence) { out_of_order++; }
+			last_sequence = sequence;
+
+			// The COM of the first body is the frame id, as fill_com_channel_frame wrote it
+			uint64_t frame_id = get_udp_field<uint64_t>(data, 16);
+			if (data[6] == UDP_BINARY_COM && get_udp_field<float>(data, UDP_BINARY_HEADER_SIZE + 8) != (float)frame_id) { malformed++; }
+
+			latencies.push_back(now_usec - get_udp_field<uint64_t>(data, 32));
+			received++;
+		}
+	});
+
+	static BodyFrame frame;
+	std::vector<uint64_t> publish_nsec;
+	publish_nsec.reserve(UDP_OUTPUT_FRAMES);
+	uint64_t next_publish = get_steady_nsec();
+
+	for (uint64_t i = 0; i < UDP_OUTPUT_FRAMES; i++)
+	{
+		while (get_steady_nsec() < next_publish) { std::this_thread::yield(); }
+		next_publish += UDP_OUTPUT_PUBLISH_INTERVAL_USEC * 1000;
+
+		fill_com_channel_frame(frame, i);
+		frame.num_bodies = UDP_OUTPUT_BODIES;
+
+		uint64_t start = get_steady_nsec();
+		output.publish(frame, FullBodyModel::SEGMENT_COUNT);
+		publish_nsec.push_back(get_steady_nsec() - start);
+	}
+
+	output.flush();
+	UdpOutputStats stats = output.get_stats();
+	output.stop();
+
+	publishing = false;
+	receiving.join();
+	close_socket(receiver);
+
+	uint64_t expected = UDP_OUTPUT_FRAMES * (1 + UDP_OUTPUT_BODIES);
+	std::sort(publish_nsec.begin(), publish_nsec.end());
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [](const std::vector<uint64_t>& values, double p) {
+		return values.empty() ? 0 : values[(size_t)(p * (values.size() - 1))];
+	};
+
+	std::cout << "  publish on the tracking thread p50 " << percentile(publish_nsec, 0.5) << " ns, p99 "
+		<< percentile(publish_nsec, 0.99) << " ns, max " << publish_nsec.back() << " ns" << std::endl;
+	std::cout << "  " << stats.sent << " sent in " << stats.batches << " batches, " << stats.dropped << " dropped, "
+		<< stats.failed << " failed, queue high water mark " << stats.high_water_mark << " of " << stats.capacity << std::endl;
+	std::cout << "  " << received << " of " << expected << " received, loss " << 100.0 * (expected - received) / expected
+		<< "%, one-way p50 " << percentile(latencies, 0.5) << " us, p99 " << percentile(latencies, 0.99) << " us" << std::endl;
+
+	if (stats.queued != expected || received == 0 || malformed > 0 || out_of_order > 0 ||
+		stats.sent + stats.dropped + stats.failed != expected)
+	{
+		std::cout << "UDP Output Lost Track Of Its Datagrams!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Every byte of frame index's images is the low byte of index, the readers check a few
+static void fill_frame_bus_frame(FrameBusWriter& writer, uint64_t index)
+{
+	for (int kind = 0; kind < FRAME_BUS_IMAGE_COUNT; kind++)
+	{
+		uint8_t* data = writer.get_image_data((FrameBusImageKind)kind);
+		const FrameBusImageFormat& format = writer.get_image_format((FrameBusImageKind)kind);
+		if (data != NULL) { std::memset(data, (int)(index & 0xFF), (size_t)format.stride_bytes * format.height); }
+	}
+}
+
+static bool is_frame_bus_frame_whole(const FrameLease& lease)
+{
+	uint8_t value = (uint8_t)(lease.get_index() & 0xFF);
+
+	for (int kind = 0; kind < FRAME_BUS_IMAGE_COUNT; kind++)
+	{
+		const uint8_t* data = lease.get_image_data((FrameBusImageKind)kind);
+		const FrameBusImageFormat& format = lease.get_image_format((FrameBusImageKind)kind);
+		if (format.width == 0) { continue; }
+
+		size_t size = (size_t)format.stride_bytes * format.height;
+		if (data == NULL || data[0] != value || data[size / 2] != value || data[size - 1] != value) { return false; }
+	}
+
+	return true;
+}
+
+// The reader process of benchmark_frame_bus: leases the newest frame, looks at it for a while like a
+// visualizer drawing it, and checks it stayed whole
+static int run_frame_bus_reader()
+{
+	FrameBusReader reader;
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(COM_CHANNEL_READER_TIMEOUT_SECONDS);
+	while (reader.open(FRAME_BUS_BENCHMARK_NAME) == FAILURE)
+	{
+		if (std::chrono::steady_clock::now() > deadline) { return FAILURE; }
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	FrameLease lease;
+	std::vector<uint64_t> latencies;
+	uint64_t last_index = (uint64_t)-1;
+	uint64_t torn = 0;
+
+	while (last_index != FRAME_BUS_PROCESS_FRAMES - 1 && std::chrono::steady_clock::now() < deadline)
+	{
+		if (reader.acquire_latest(lease) == FAILURE || lease.get_index() == last_index)
+		{
+			lease.release();
+			std::this_thread::yield();
+			continue;
+		}
+
+		latencies.push_back(get_steady_nsec() - lease.get_slot().publish_steady_nsec);
+		last_index = lease.get_index();
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_BUS_READER_HOLD_MS));
+		if (!is_frame_bus_frame_whole(lease) || !lease.is_valid()) { torn++; }
+		lease.release();
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	size_t median = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+
+	std::cout << "  reader process " << latencies.size() << " frames seen of " << FRAME_BUS_PROCESS_FRAMES << ", "
+		<< torn << " torn, publish to lease p50 " << median << " ns" << std::endl;
+
+	if (torn > 0 || last_index != FRAME_BUS_PROCESS_FRAMES - 1)
+	{
+		std::cout << "Frame Bus Reader Lost Frames!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Frames of the pipeline through the bus compared with their captures, a reader holding a lease against
+// the writer, then a visualizer in a second process
+static int benchmark_frame_bus(const char* program)
+{
+	std::cout << std::endl << "Frame bus, " << FRAME_BUS_FRAMES << " pipeline frames and " << FRAME_BUS_PROCESS_FRAMES
+		<< " to a second process every " << FRAME_BUS_PUBLISH_INTERVAL_MS << " ms:" << std::endl;
+
+	SyntheticFrameSource source(FRAME_BUS_FRAMES);
+	if (source.open() == FAILURE) { return FAILURE; }
+	source.set_clock_mode(FAST_CLOCK);
+
+	k4a_calibration_t calibration = {};
+	source.get_calibration(calibration);
+	MockBodyTracker tracker(0, 3, source.get_body_config(), &calibration);
+
+	FrameBusWriter writer;
+	if (writer.open(FRAME_BUS_BENCHMARK_NAME, get_frame_bus_format(calibration, true), FRAME_BUS_BENCHMARK_LEASE_TIMEOUT_MS) == FAILURE)
+	{
+		std::cout << "Frame Bus Open Failed!" << std::endl;
+		return FAILURE;
+	}
+
+	FrameBusReader reader;
+	if (reader.open(FRAME_BUS_BENCHMARK_NAME) == FAILURE) { return FAILURE; }
+
+	// What the reader maps has to be what the capture held, byte for byte
+	uint64_t differing = 0;
+	double publish_seconds = 0;
+	auto present = [&](BodyFrame& frame) {
+		auto publish_start = std::chrono::steady_clock::now();
+		if (writer.publish(frame) == FAILURE) { differing++; }
+		publish_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - publish_start).count();
+
+		FrameLease lease;
+		k4a_image_t images[FRAME_BUS_IMAGE_COUNT] = {
+			k4a_capture_get_color_image(frame.capture), k4a_capture_get_depth_image(frame.capture), frame.body_index_map
+		};
+		if (reader.acquire_latest(lease) == FAILURE || lease.get_slot().frame_id != frame.frame_id) { differing++; }
+
+		for (int kind = 0; kind < FRAME_BUS_IMAGE_COUNT && lease.is_held(); kind++)
+		{
+			const uint8_t* data = lease.get_image_data((FrameBusImageKind)kind);
+			if (images[kind] == NULL || data == NULL ||
+				std::memcmp(data, k4a_image_get_buffer(images[kind]), k4a_image_get_size(images[kind])) != 0)
+			{
+				differing++;
+			}
+		}
+
+		k4a_image_release(images[FRAME_BUS_COLOR]);
+		k4a_image_release(images[FRAME_BUS_DEPTH]);
+		return true;
+	};
+
+	PipelineConfig config;
+	config.max_frames = FRAME_BUS_FRAMES;
+
+	Pipeline pipeline(
+		[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+		tracker,
+		[](BodyFrame&) {},
+		present,
+		config
+	);
+	pipeline.run();
+
+	const FrameBusFormat& format = reader.get_format();
+	double frame_mb = 0;
+	for (const FrameBusImageFormat& image : format.images) { frame_mb += (double)image.stride_bytes * image.height / (1024 * 1024); }
+
+	std::cout << "  " << writer.get_stats().published << " published of " << frame_mb << " MB, publish "
+		<< publish_seconds * 1000 / FRAME_BUS_FRAMES << " ms, " << differing << " differing" << std::endl;
+
+	// A reader holding the newest frame: the writer goes around it and only takes it back after the timeout
+	FrameLease held;
+	if (reader.acquire_latest(held) == FAILURE) { return FAILURE; }
+	uint64_t held_index = held.get_index();
+	uint8_t held_byte = held.get_image_data(FRAME_BUS_DEPTH)[0];
+
+	FrameBusStats before = writer.get_stats();
+	for (uint32_t i = 0; i < 2 * FRAME_BUS_SLOTS; i++)
+	{
+		if (writer.begin_frame() != NULL) { writer.end_frame(); }
+	}
+	FrameBusStats around = writer.get_stats();
+	bool kept = held.is_valid() && held.get_index() == held_index && held.get_image_data(FRAME_BUS_DEPTH)[0] == held_byte;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_BUS_BENCHMARK_LEASE_TIMEOUT_MS + 50));
+	for (uint32_t i = 0; i < FRAME_BUS_SLOTS; i++)
+	{
+		if (writer.begin_frame() != NULL) { writer.end_frame(); }
+	}
+	FrameBusStats after = writer.get_stats();
+	bool reclaimed = !held.is_valid() && after.reclaimed == before.reclaimed + 1;
+
+	// The reclaimed reader letting go late leaves the lease of the next reader of its slot alone
+	FrameLease next_held;
+	for (uint32_t i = 0; i < FRAME_BUS_SLOTS && (!next_held.is_held() || &next_held.get_slot() != &held.get_slot()); i++)
+	{
+		if (writer.begin_frame() != NULL) { writer.end_frame(); }
+		if (reader.acquire_latest(next_held) == FAILURE) { return FAILURE; }
+	}
+	held.release();
+	const FrameBusSlot& held_slot = next_held.get_slot();
+	bool next_kept = next_held.is_valid() && (uint32_t)held_slot.leases.load() == 1;
+	next_held.release();
+	bool released = (uint32_t)held_slot.leases.load() == 0;
+
+	std::cout << "  held lease " << (kept ? "kept" : "lost") << " while " << around.skipped - before.skipped
+		<< " slots were skipped, " << (reclaimed ? "reclaimed" : "not reclaimed") << " after "
+		<< FRAME_BUS_BENCHMARK_LEASE_TIMEOUT_MS << " ms" << std::endl;
+
+	if (differing > 0 || !kept || around.skipped == before.skipped || around.dropped != before.dropped || !reclaimed ||
+		!next_kept || !released)
+	{
+		std::cout << "Frame Bus Did Not Keep Its Leases!" << std::endl;
+		return FAILURE;
+	}
+
+	// Frame indexes from 0 again for the second process
+	FrameBusFormat process_format = format;
+	reader.close();
+	writer.close();
+	if (writer.open(FRAME_BUS_BENCHMARK_NAME, process_format, FRAME_BUS_BENCHMARK_LEASE_TIMEOUT_MS) == FAILURE) { return FAILURE; }
+
+	// It looks at each frame for FRAME_BUS_READER_HOLD_MS, the writer never waits for it
+	ProcessHandle reader_process;
+	if (start_benchmark_process(program, FRAME_BUS_READER_ARGUMENT, reader_process) == FAILURE)
+	{
+		std::cout << "Frame Bus Reader Did Not Start!" << std::endl;
+		return FAILURE;
+	}
+
+	uint64_t slowest_publish = 0;
+	for (uint64_t i = 0; i < FRAME_BUS_PROCESS_FRAMES; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_BUS_PUBLISH_INTERVAL_MS));
+
+		uint64_t start = get_steady_nsec();
+		if (writer.begin_frame() == NULL) { continue; }
+		fill_frame_bus_frame(writer, i);
+		writer.end_frame();
+		slowest_publish = (std::max)(slowest_publish, get_steady_nsec() - start);
+	}
+
+	if (wait_benchmark_process(reader_process) != SUCCESS)
+	{
+		std::cout << "Frame Bus Reader Failed!" << std::endl;
+		return FAILURE;
+	}
+
+	FrameBusStats stats = writer.get_stats();
+	std::cout << "  writer " << stats.published << " published, " << stats.dropped << " dropped, " << stats.skipped
+		<< " leased slots skipped, slowest publish " << slowest_publish / 1000 << " us" << std::endl;
+
+	if (stats.published != FRAME_BUS_PROCESS_FRAMES)
+	{
+		std::cout << "Frame Bus Writer Waited On The Reader!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Takes what stream_images prints every frame, so the soak's output is its own
+class NullBuffer : public std::streambuf {
+protected:
+	int overflow(int c) override { return c; }
+};
+
+// The hand-off policies of BoundedQueue: what stays queued and what comes back to the caller
+static int benchmark_queue_policies()
+{
+	BoundedQueue<int> drop_oldest(2);
+	BoundedQueue<int> drop_newest(2);
+	int item = 0;
+	int results[4] = {};
+
+	for (int value = 1; value <= 3; value++)
+	{
+		item = value;
+		results[value - 1] = drop_oldest.push(item, OVERFLOW_DROP_OLDEST);
+	}
+	int replaced = item;
+
+	for (int value = 1; value <= 3; value++)
+	{
+		item = value;
+		results[3] = drop_newest.push(item, OVERFLOW_DROP_NEWEST);
+	}
+
+	int oldest[2] = {};
+	int newest[2] = {};
+	drop_oldest.close();
+	drop_newest.close();
+	for (int i = 0; i < 2; i++)
+	{
+		drop_oldest.pop(oldest[i]);
+		drop_newest.pop(newest[i]);
+	}
+
+	item = 4;
+	if (results[0] != PUSH_QUEUED || results[1] != PUSH_QUEUED || results[2] != PUSH_REPLACED || replaced != 1 ||
+		oldest[0] != 2 || oldest[1] != 3 || results[3] != PUSH_DROPPED || newest[0] != 1 || newest[1] != 2 ||
+		drop_oldest.push(item, OVERFLOW_DROP_OLDEST) != PUSH_CLOSED)
+	{
+		std::cout << "Queue Policies Do Not Hold!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// Age of the frames presented with an analysis slower than the sensor: the blocking pipeline works through
+// every capture ever further behind, --latest skips to the newest at every stage and counts what it skips
+static int benchmark_latest_frame()
+{
+	const char* NAMES[2] = { "blocking", "latest only" };
+	double mean_age_ms[2] = {};
+	double max_age_ms[2] = {};
+
+	// A reader that stalls three frame periods finds the source two frames on
+	{
+		SyntheticFrameSource source(LATEST_FRAME_FRAMES);
+		source.set_color_enabled(false);
+		source.set_latest_only(true);
+		if (source.open() == FAILURE) { return FAILURE; }
+
+		k4a_capture_t capture = NULL;
+		uint64_t timestamps_usec[2] = {};
+		for (int i = 0; i < 2; i++)
+		{
+			if (i > 0) { std::this_thread::sleep_for(std::chrono::microseconds(3 * SYNTHETIC_FRAME_PERIOD_USEC)); }
+			if (source.get_capture(capture) == FAILURE) { return FAILURE; }
+
+			k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+			timestamps_usec[i] = k4a_image_get_device_timestamp_usec(depth_image);
+			k4a_image_release(depth_image);
+			k4a_capture_release(capture);
+		}
+
+		if (source.get_discarded_captures() < 2 || timestamps_usec[1] - timestamps_usec[0] != (source.get_discarded_captures() + 1) * SYNTHETIC_FRAME_PERIOD_USEC)
+		{
+			std::cout << "Latest Only Source Did Not Skip!" << std::endl;
+			return FAILURE;
+		}
+	}
+
+	std::cout << std::endl << "Latest frame against blocking, " << LATEST_FRAME_FRAMES << " captures at 30 fps, "
+		<< LATEST_FRAME_ANALYSIS_TIME_IN_MS << " ms analysis:" << std::endl;
+
+	for (int latest = 0; latest < 2; latest++)
+	{
+		SyntheticFrameSource source(LATEST_FRAME_FRAMES);
+		source.set_color_enabled(false);
+		source.set_latest_only(latest != 0);
+		if (source.open() == FAILURE) { return FAILURE; }
+
+		k4a_calibration_t calibration = {};
+		source.get_calibration(calibration);
+		MockBodyTracker tracker(MOCK_TRACKER_TIME_IN_MS, 3, source.get_body_config(), &calibration);
+
+		std::chrono::steady_clock::time_point start;
+		bool started = false;
+		double total_age_ms = 0;
+		uint64_t presented = 0;
+
+		Pipeline pipeline(
+			[&](k4a_capture_t& capture) {
+				int result = source.get_capture(capture);
+				// Synthetic timestamps count from the first capture
+				if (!started) { start = std::chrono::steady_clock::now(); started = true; }
+				return result;
+			},
+			tracker,
+			[](BodyFrame&) { std::this_thread::sleep_for(std::chrono::milliseconds(LATEST_FRAME_ANALYSIS_TIME_IN_MS)); },
+			[&](BodyFrame& frame) {
+				double age_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() -
+					frame.device_timestamp_usec / 1000.0;
+				total_age_ms += age_ms;
+				max_age_ms[latest] = (std::max)(max_age_ms[latest], age_ms);
+				presented++;
+				return true;
+			},
+			latest ? get_low_latency_pipeline_config() : PipelineConfig()
+		);
+
+		pipeline.run();
+
+		uint64_t captured = pipeline.get_frame_count(CAPTURE_STAGE);
+		uint64_t discarded = pipeline.get_discarded_count(ENQUEUE_STAGE) + pipeline.get_discarded_count(ANALYSIS_STAGE) +
+			pipeline.get_discarded_count(PRESENT_STAGE);
+		mean_age_ms[latest] = presented > 0 ? total_age_ms / presented : 0;
+
+		std::cout << "  " << NAMES[latest] << ": " << presented << " presented, age " << mean_age_ms[latest] << " ms mean, "
+			<< max_age_ms[latest] << " ms max, discarded " << source.get_discarded_captures() << " by the source, "
+			<< pipeline.get_discarded_count(ENQUEUE_STAGE) << " tracker, " << pipeline.get_discarded_count(ANALYSIS_STAGE)
+			<< " analysis, " << pipeline.get_discarded_count(PRESENT_STAGE) << " present" << std::endl;
+
+		// Every capture made is either presented or counted where it was discarded
+		if (source.get_discarded_captures() + captured != LATEST_FRAME_FRAMES || discarded + presented != captured ||
+			(!latest && discarded + source.get_discarded_captures() != 0))
+		{
+			std::cout << "Discarded Frames Do Not Add Up!" << std::endl;
+			return FAILURE;
+		}
+	}
+
+	if (mean_age_ms[1] >= mean_age_ms[0] || max_age_ms[1] >= max_age_ms[0])
+	{
+		std::cout << "Latest Frame Is Not Fresher!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+// One stream_images with its windows on synthetic captures at 30 fps for the given time, sampled every
+// SOAK_SAMPLE_INTERVAL_MS. Once SOAK_WARMUP_SECONDS have passed, the working set outside the image pool may not
+// grow past SOAK_MAX_GROWTH_MB however long it runs, and the pooled images in use not pass
+// SOAK_MAX_POOLED_IMAGES. The pool's own size is left out: a busy moment holding more frames than before may
+// still make it take a buffer.
+static int benchmark_soak(int seconds)
+{
+	const double MB = 1024 * 1024;
+	uint64_t frames = (uint64_t)seconds * SOAK_FPS;
+
+	std::cout << std::endl << "stream_images soak, " << seconds << " s, " << frames << " captures:" << std::endl;
+
+	std::atomic<bool> streaming{ true };
+	bool warm = false;
+	double warm_working_set_mb = 0;
+	double peak_working_set_mb = 0;
+	double pool_mb = 0;
+	size_t peak_pooled_images = 0;
+	std::thread watcher([&] {
+		auto start = std::chrono::steady_clock::now();
+		while (streaming)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(SOAK_SAMPLE_INTERVAL_MS));
+			if (std::chrono::steady_clock::now() - start < std::chrono::seconds(SOAK_WARMUP_SECONDS)) { continue; }
+
+			ImagePoolStats pool_stats = get_image_pool().get_stats();
+			pool_mb = pool_stats.bytes_allocated / MB;
+			peak_pooled_images = (std::max)(peak_pooled_images, pool_stats.buffers_in_use);
+			double working_set_mb = get_working_set_bytes() / MB - pool_mb;
+			if (!warm) { warm_working_set_mb = working_set_mb; warm = true; }
+			peak_working_set_mb = (std::max)(peak_working_set_mb, working_set_mb);
+		}
+	});
+
+	NullBuffer null_buffer;
+	std::streambuf* console = std::cout.rdbuf(&null_buffer);
+	{
+		SyntheticFrameSource source(frames);
+		source.open();
+
+		k4a_calibration_t calibration = {};
+		source.get_calibration(calibration);
+		MockBodyTracker tracker(MOCK_TRACKER_TIME_IN_MS, 3, source.get_body_config(), &calibration);
+
+		stream_images(source, calibration, tracker);
+	}
+	std::cout.rdbuf(console);
+
+	streaming = false;
+	watcher.join();
+
+	ImagePoolStats pool_stats = get_image_pool().get_stats();
+	double growth_mb = peak_working_set_mb - warm_working_set_mb;
+
+	std::cout << "  working set outside the pool after warm up " << warm_working_set_mb << " MB, peak growth "
+		<< growth_mb << " MB, pool " << pool_mb << " MB" << std::endl;
+	std::cout << "  pooled images in use: at most " << peak_pooled_images << ", " << pool_stats.buffers_in_use
+		<< " after the stream" << std::endl;
+
+	if (!warm || growth_mb > SOAK_MAX_GROWTH_MB || peak_pooled_images > SOAK_MAX_POOLED_IMAGES || pool_stats.buffers_in_use != 0)
+	{
+		std::cout << "Stream Images Memory Is Not Bounded!" << std::endl;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	// Benchmark --com-channel-reader and --frame-bus-reader are the second processes of benchmark_com_channel
+	// and benchmark_frame_bus
+	if (argc > 1 && std::string(argv[1]) == COM_CHANNEL_READER_ARGUMENT) { return run_com_channel_reader(); }
+	if (argc > 1 && std::string(argv[1]) == FRAME_BUS_READER_ARGUMENT) { return run_frame_bus_reader(); }
+
+	// Benchmark --soak <seconds> runs nothing but the soak, that long
+	if (argc > 2 && std::string(argv[1]) == SOAK_ARGUMENT) { return benchmark_soak(std::atoi(argv[2])); }
+
+	std::cout << "Running: Benchmark.cpp" << std::endl << std::endl;
+
+	benchmark_serial_loop();
+	benchmark_pipeline(1);
+	benchmark_pipeline(3);
+	benchmark_synthetic_bodies(1);
+	benchmark_synthetic_bodies(4);
+
+	if (benchmark_latency() == FAILURE) { return FAILURE; }
+	if (benchmark_trace() == FAILURE) { return FAILURE; }
+	if (benchmark_allocations() == FAILURE) { return FAILURE; }
+	if (benchmark_perf_counters() == FAILURE) { return FAILURE; }
+	if (benchmark_metrics() == FAILURE) { return FAILURE; }
+	if (benchmark_headless() == FAILURE) { return FAILURE; }
+	if (benchmark_queue_policies() == FAILURE) { return FAILURE; }
+	if (benchmark_latest_frame() == FAILURE) { return FAILURE; }
+	if (benchmark_preview() == FAILURE) { return FAILURE; }
+	if (benchmark_com() == FAILURE) { return FAILURE; }
+	if (benchmark_projection() == FAILURE) { return FAILURE; }
+	if (benchmark_body_com() == FAILURE) { return FAILURE; }
+	if (benchmark_com_channel(argv[0]) == FAILURE) { return FAILURE; }
+	if (benchmark_udp_output() == FAILURE) { return FAILURE; }
+	if (benchmark_frame_bus(argv[0]) == FAILURE) { return FAILURE; }
+	if (benchmark_soak(SOAK_SECONDS) == FAILURE) { return FAILURE; }
+	if (benchmark_overlay(1280, 720) == FAILURE) { return FAILURE; }
+	if (benchmark_overlay(1920, 1080) == FAILURE) { return FAILURE; }
+	if (benchmark_overlay(3840, 2160) == FAILURE) { return FAILURE; }
+	if (benchmark_image_pool() == FAILURE) { return FAILURE; }
+	if (benchmark_k4a_allocator() == FAILURE) { return FAILURE; }
+	if (benchmark_com_log() == FAILURE) { return FAILURE; }
+	if (benchmark_async_writer(OVERFLOW_BLOCK) == FAILURE) { return FAILURE; }
+	if (benchmark_async_writer(OVERFLOW_DROP_OLDEST) == FAILURE) { return FAILURE; }
+	if (benchmark_async_writer(OVERFLOW_DROP_NEWEST) == FAILURE) { return FAILURE; }
+
+	// Benchmark [--recording <file.mkv>] validates the reprojection on recorded data, failing without the SDK
+	std::unique_ptr<FrameSource> source(new SyntheticFrameSource(REPROJECTION_FRAMES));
+	if (argc > 1 ? get_frame_source(source, argc, argv) == FAILURE : source->open() == FAILURE) { return FAILURE; }
+	source->set_clock_mode(FAST_CLOCK);
+	if (benchmark_reprojection(*source) == FAILURE) { return FAILURE; }
+
+	return 0;
+}
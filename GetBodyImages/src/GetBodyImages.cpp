@@ -12,36 +12,33 @@ using namespace pilotsimulator;
 		goto Exit;			\
 	}
 
-int main(void)
+int main(int argc, char* argv[])
 {
 	std::cout << "Running GetImages.cpp\n\n";
 
-	k4a_device_t device = NULL;
-	k4a_device_configuration_t device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
-	k4a_capture_t capture = NULL;
+	// Given back in reverse: the images, then the transformation and tracker, before the source closes
+	std::unique_ptr<FrameSource> source;
+	CaptureHandle capture;
 	k4a_calibration_t calibration = {};
-	k4abt_tracker_t tracker = NULL;
-	k4a_transformation_t transformation = NULL;
-	k4a_image_t images[pilotsimulator::TOTAL_IMAGE_NUMBER] = {};
+	TrackerHandle tracker;
+	TransformationHandle transformation;
+	ImageHandle images[pilotsimulator::TOTAL_IMAGE_NUMBER];
 
-	VERIFY(get_device(device));
-	VERIFY(start_camera(device, device_config));
-	VERIFY(get_capture(device, capture));
-	VERIFY(get_calibration(device, device_config, calibration));
-	VERIFY(get_tracker(tracker, calibration));
-	VERIFY(get_transformation(transformation, calibration));
+	VERIFY(get_frame_source(source, argc, argv));
+	VERIFY(source->get_capture(capture.out()));
+	VERIFY(source->get_calibration(calibration));
+	VERIFY(get_tracker(tracker.out(), calibration));
+	VERIFY(get_transformation(transformation.out(), calibration));
 
-	get_body_tracking_image(BODY, images, capture, tracker);
-	get_body_tracking_image(BODY_IN_COLOR_SPACE, images, capture, tracker, &transformation);
+	get_body_tracking_image(BODY, images, capture.get(), tracker.get());
+	get_body_tracking_image(BODY_IN_COLOR_SPACE, images, capture.get(), tracker.get(), transformation.get());
 
 	save_image(BODY, images, "body.jpg");
 	save_image(BODY_IN_COLOR_SPACE, images, "body_in_color_space.jpg");
 
-	get_body_tracking_image(BODY_COLOR_OVERLAY, images, capture, tracker, &transformation);
-	get_body_tracking_image(SKELETON_IN_COLOR_SPACE, images, capture, tracker, NULL, &calibration);
+	get_body_tracking_image(BODY_COLOR_OVERLAY, images, capture.get(), tracker.get(), transformation.get());
+	get_body_tracking_image(SKELETON_IN_COLOR_SPACE, images, capture.get(), tracker.get(), NULL, &calibration);
 
 Exit:
-	clear_memory(&device, &capture, images);
-
 	return 0;
 }
\ No newline at end of file
@@ -12,33 +12,35 @@ using namespace pilotsimulator;
 		goto Exit;			\
 	}
 
-int main(void)
+int main(int argc, char* argv[])
 {
 	std::cout << "Running GetImages.cpp\n\n";
 
-	k4a_device_t device = NULL;
-	k4a_device_configuration_t device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
-	k4a_capture_t capture = NULL;
+	std::unique_ptr<FrameSource> source;
+	CaptureHandle capture;
 	k4a_calibration_t calibration = {};
-	k4a_transformation_t transformation = NULL;
-	k4a_image_t images[pilotsimulator::TOTAL_IMAGE_NUMBER] = {};
+	TransformationHandle transformation;
+	ImageHandle images[pilotsimulator::TOTAL_IMAGE_NUMBER];
 
-	VERIFY(get_device(device));
-	VERIFY(start_camera(device, device_config));
-	VERIFY(get_capture(device, capture));
-	VERIFY(get_calibration(device, device_config, calibration));
-	VERIFY(get_transformation(transformation, calibration));
+	VERIFY(get_frame_source(source, argc, argv));
+	VERIFY(source->get_capture(capture.out()));
+	VERIFY(source->get_calibration(calibration));
+	VERIFY(get_transformation(transformation.out(), calibration));
 
-	get_image(COLOR, images, capture);
-	get_image(DEPTH, images, capture);
-	get_image(COLOR_IN_DEPTH_SPACE, images, capture, &transformation);
+	{
+		Reprojector reprojector(calibration);
+
+		get_image(COLOR, images, capture.get());
+		get_image(DEPTH, images, capture.get());
+		get_image(COLOR_IN_DEPTH_SPACE, images, capture.get(), transformation.get());
+		get_image(DEPTH_IN_COLOR_SPACE, images, capture.get(), NULL, &reprojector);
+	}
 
 	save_image(COLOR, images, "color.jpg");
 	save_image(DEPTH, images, "depth.jpg");
 	save_image(COLOR_IN_DEPTH_SPACE, images, "color_in_depth_space.jpg");
+	save_image(DEPTH_IN_COLOR_SPACE, images, "depth_in_color_space.jpg");
 
 Exit:
-	clear_memory(&device, &capture, images);
-
 	return 0;
 }
\ No newline at end of file
@@ -1,19 +1,34 @@
 ﻿#include <iostream>
-#include <array>
-#include <map>
 #include <string>  
 #include <sstream>  
 #include <iomanip>
 #include <cmath>
-#include <fstream>
 
-#include <Windows.h>
-
-#include <k4a/k4a.h>
-#include <k4abt.h>
-
-constexpr int SUCCESS = 0;
-constexpr int FAILURE = 1;
+#include "pilotsimulator.h"
+
+using pilotsimulator::SUCCESS;
+using pilotsimulator::FAILURE;
+using pilotsimulator::FrameSource;
+using pilotsimulator::get_frame_source;
+using pilotsimulator::get_body_tracker;
+using pilotsimulator::BodyFrame;
+using pilotsimulator::BodyTracker;
+using pilotsimulator::TrackerHandle;
+using pilotsimulator::Pipeline;
+using pilotsimulator::get_pipeline_config;
+using pilotsimulator::compute_com_batch;
+using pilotsimulator::ComLog;
+using pilotsimulator::ComPublisher;
+using pilotsimulator::UdpOutput;
+using pilotsimulator::get_udp_output;
+using pilotsimulator::COM_LOG_REFERENCE;
+using pilotsimulator::get_async_writer;
+using pilotsimulator::AsyncText;
+using pilotsimulator::print_k4a_allocator_stats;
+using pilotsimulator::get_pipeline_metrics;
+using pilotsimulator::BodyCom;
+using pilotsimulator::BodyComTracker;
+using pilotsimulator::MAX_BODIES;
 
 #define VERIFY(result)		\
 	if (result == FAILURE)	\
@@ -21,348 +36,128 @@ constexpr int FAILURE = 1;
 		goto Exit;			\
 	}
 
-int get_device(k4a_device_t& device)
-{
-	// Get devices count
-	uint32_t count = k4a_device_get_installed_count();
-	if (count == 0)
-	{
-		std::cout << "No Device Found!" << std::endl;
-		return FAILURE;
-	}
-	else {
-		std::cout << count << " Device(s) Found!" << std::endl;
-	}
-
-	// Open the first plugged in Kinect device
-	if (K4A_FAILED(k4a_device_open(K4A_DEVICE_DEFAULT, &device)))
-	{
-		std::cout << "Failed To Open Device!\n";
-		return FAILURE;
-	}
-
-	// Get the size of the serial number
-	size_t serial_size = 0;
-	k4a_device_get_serialnum(device, NULL, &serial_size);
-
-	// Allocate memory for the serial, then acquire it
-	char* serial = (char*)(malloc(serial_size));
-	k4a_device_get_serialnum(device, serial, &serial_size);
-	std::cout << "Opened Device: " << serial << std::endl << std::endl;
-	free(serial);
-
-	return SUCCESS;
-}
-
-int start_camera(const k4a_device_t& device, k4a_device_configuration_t& device_config)
-{
-	device_config.camera_fps = K4A_FRAMES_PER_SECOND_30;
-	device_config.color_format = K4A_IMAGE_FORMAT_COLOR_BGRA32;
-	device_config.color_resolution = K4A_COLOR_RESOLUTION_1080P;
-	device_config.depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
-	device_config.synchronized_images_only = true;
-
-	if (K4A_RESULT_SUCCEEDED != k4a_device_start_cameras(device, &device_config))
-	{
-		std::cout << "Failed To Start Device!" << std::endl;
-		return FAILURE;
-	}
-
-	return SUCCESS;
-}
-
-int get_calibration(
-	const k4a_device_t& device,
-	const k4a_device_configuration_t& device_config,
-	k4a_calibration_t& calibration
-)
-{
-	int result = k4a_device_get_calibration(device, device_config.depth_mode, device_config.color_resolution, &calibration);
-
-	if (result != K4A_RESULT_SUCCEEDED)
-	{
-		std::cout << "Failed to get calibration" << std::endl;
-		return FAILURE;
-	}
-
-	return SUCCESS;
-}
+using ComModel = pilotsimulator::SeatedBodyModel;
 
-int get_tracker(k4abt_tracker_t& tracker, const k4a_calibration_t& calibration)
+void start_com_tracking(FrameSource& source, BodyTracker& body_tracker)
 {
-	k4abt_tracker_configuration_t tracker_config = K4ABT_TRACKER_CONFIG_DEFAULT;
+	// Reference point and recent COMs of every body by id, the pilot and an instructor each against their own
+	BodyComTracker body_coms;
+	BodyCom coms[MAX_BODIES];
+#if PILOTSIMULATOR_LATENCY
+	bool latency_key_was_down = false;
+#endif
 
-	std::cout << "Creating Tracker..." << std::endl;
+	std::cout << "COM Tracking Start!" << std::endl;
 
-	int result = k4abt_tracker_create(&calibration, tracker_config, &tracker);
+	// Every frame with its timestamps, PipeCOM/src/com_log_to_csv.py turns it into com_data.csv
+	ComLog com_log;
+	if (com_log.open("com_data") == FAILURE) { return; }
 
-	if (result == K4A_RESULT_FAILED)
+	// Latest COMs and skeletons for the flight simulator, which reads them with ComSubscriber
+	ComPublisher com_channel;
+	if (com_channel.open() == FAILURE)
 	{
-		std::cout << "Failed to create tracker." << std::endl;
-		return FAILURE;
+		std::cout << "COM Channel Open Failed, Tracking Without It!" << std::endl;
 	}
 
-	std::cout << "Created Tracker!" << std::endl << std::endl;
-
-	return SUCCESS;
-}
-
-int get_capture(const k4a_device_t& device, k4a_capture_t& capture)
-{
-	const int32_t TIMEOUT_IN_MS = 1000;
-	switch (k4a_device_get_capture(device, &capture, TIMEOUT_IN_MS))
-	{
-	case K4A_WAIT_RESULT_SUCCEEDED:
-	{
-		std::cout << "Succesfully Read A Capture!\n" << std::endl;
-		return SUCCESS;
-	}
-	break;
-	case K4A_WAIT_RESULT_TIMEOUT:
-	{
-		std::cout << "Timed Out Waiting For A Capture!" << std::endl;
-		return FAILURE;
-	}
-	break;
-	case K4A_WAIT_RESULT_FAILED:
-	{
-		std::cout << "Failed To Read A Capture!" << std::endl;
-		return FAILURE;
-	}
-	break;
-	default:
-	{
-		return FAILURE;
-	}
-	break;
-	}
-
-	return FAILURE;
-}
-
-enum Joints {
-	PELVIS, SPINE_NAVAL, SPINE_CHEST, NECK, CLAVICLE_LEFT, SHOULDER_LEFT,
-	ELBOW_LEFT, WRIST_LEFT, HAND_LEFT, HANDTIP_LEFT, THUMB_LEFT, CLAVICLE_RIGHT,
-	SHOULDER_RIGHT, ELBOW_RIGHT, WRIST_RIGHT, HAND_RIGHT, HANDTIP_RIGHT, THUMB_RIGHT,
-	HIP_LEFT, KNEE_LEFT, ANKLE_LEFT, TOE_LEFT, HIP_RIGHT, KNEE_RIGHT, ANKLE_RIGHT,
-	TOE_RIGHT, HEAD, NOSE, EYE_LEFT, EAR_LEFT, EYE_RIGHT, EAR_RIGHT
-};
-
-enum BodySegments {
-	FOOT_RIGHT, SHANK_RIGHT, THIGH_RIGHT, TRUNK_RIGHT,
-	FOOT_LEFT, SHANK_LEFT, THIGH_LEFT, TRUNK_LEFT, HEAD_SEGMENT,
-	BODY_SEGMENT_NUM
-};
+	// Simulators on other hosts, when started with --udp
+	UdpOutput* udp_output = get_udp_output();
 
-std::map<int, std::array<int, 2>> JointsToBodySegments{
-	{ TOE_RIGHT, {FOOT_RIGHT} }, { ANKLE_RIGHT, {FOOT_RIGHT, SHANK_RIGHT} }, { KNEE_RIGHT, {SHANK_RIGHT, THIGH_RIGHT} },
-	{ HIP_RIGHT, {THIGH_RIGHT, TRUNK_RIGHT} }, { SHOULDER_RIGHT, {TRUNK_RIGHT} },
-	{ TOE_LEFT, {FOOT_LEFT} }, { ANKLE_LEFT, {FOOT_LEFT, SHANK_LEFT} }, { KNEE_LEFT, {SHANK_LEFT, THIGH_LEFT} },
-	{ HIP_LEFT, {THIGH_LEFT, TRUNK_LEFT} }, { SHOULDER_LEFT, {TRUNK_LEFT} },
-	{ NOSE, {HEAD_SEGMENT} }
-};
+	// Runs on the analysis worker while the next captures are already in the tracker
+	auto analyze = [](BodyFrame& frame) {
+		compute_com_batch<ComModel>(&frame, 1);
+	};
 
-std::map<int, std::array<int, 2>> JointsForBodySegments{
-	{ FOOT_RIGHT, {TOE_RIGHT, ANKLE_RIGHT} }, { SHANK_RIGHT, {ANKLE_RIGHT, KNEE_RIGHT} }, { THIGH_RIGHT, {KNEE_RIGHT, HIP_RIGHT} },
-	{ TRUNK_RIGHT, {HIP_RIGHT, SHOULDER_RIGHT} }, { FOOT_LEFT, {TOE_LEFT, ANKLE_LEFT} }, { SHANK_LEFT, {ANKLE_LEFT, KNEE_LEFT} }, 
-	{ THIGH_LEFT, {KNEE_LEFT, HIP_LEFT} }, { TRUNK_LEFT, {HIP_LEFT, SHOULDER_LEFT} }, { HEAD_SEGMENT, {HEAD} }
-};
+	auto present = [&](BodyFrame& frame) {
+		uint32_t com_count = body_coms.update(frame, coms);
 
-enum BodySegmentsDataName {
-	LENGTH, WEIGHT
-};
-
-std::map<int, std::array<float, 2>> BodySegmentsData{
-	{ FOOT_RIGHT, {0.5, 0.0133} }, { SHANK_RIGHT, {0.419, 0.0535} }, 
-	{ THIGH_RIGHT, {0.428, 0.1175} }, { TRUNK_RIGHT, {0.5, 0.225} },
-	{ FOOT_LEFT, {0.5, 0.0133} }, { SHANK_LEFT, {0.419, 0.0535} }, 
-	{ THIGH_LEFT, {0.428, 0.1175} }, { TRUNK_LEFT, {0.5, 0.225} },
-	{ HEAD_SEGMENT, {0, 0.1814} }
-};
-
-void get_body_segment_com(k4a_float3_t body_segment_com[], bool body_segment_exist[], k4abt_joint_t joints[])
-{
-	k4a_float3_t proximal = {}, distal = {};
-	float length = NULL;
-
-	for (int segment_id = 0; segment_id < BODY_SEGMENT_NUM; segment_id++) {
-		if (body_segment_exist[segment_id]) 
+		if (GetKeyState(VK_ESCAPE) & 0x8000) // 'esc' held down ends the tracking, polled once a frame
 		{
-			if (segment_id == HEAD_SEGMENT) 
-			{
-				body_segment_com[HEAD_SEGMENT].xyz = joints[NOSE].position.xyz;
-			}
-			else
-			{
-				length = BodySegmentsData[segment_id][LENGTH];
-				
-				proximal.xyz = joints[JointsForBodySegments[segment_id][1]].position.xyz;
-				distal.xyz = joints[JointsForBodySegments[segment_id][0]].position.xyz;
-
-				body_segment_com[segment_id].xyz.x = proximal.xyz.x + length * (distal.xyz.x - proximal.xyz.x);
-				body_segment_com[segment_id].xyz.y = proximal.xyz.y + length * (distal.xyz.y - proximal.xyz.y);
-				body_segment_com[segment_id].xyz.z = proximal.xyz.z + length * (distal.xyz.z - proximal.xyz.z);
-			}	
+			return false;
 		}
-	}
-}
 
-void get_com(k4a_float3_t& center_of_mass, bool body_segment_exist[], k4a_float3_t body_segment_com[], k4abt_joint_t joints[])
-{
-	float weight = 0;
-
-	get_body_segment_com(body_segment_com, body_segment_exist, joints);
-
-	center_of_mass.xyz = { 0, 0, 0 };
-
-	for (int segment_id = 0; segment_id < BODY_SEGMENT_NUM; segment_id++) {
-		if (body_segment_exist[segment_id])
-		{
-			weight = BodySegmentsData[segment_id][WEIGHT];
-			center_of_mass.xyz.x += body_segment_com[segment_id].xyz.x * weight;
-			center_of_mass.xyz.y += body_segment_com[segment_id].xyz.y * weight;
-			center_of_mass.xyz.z += body_segment_com[segment_id].xyz.z * weight;
+#if PILOTSIMULATOR_LATENCY
+		// 'L' prints the latency and allocations so far, once per press
+		bool latency_key_down = (GetKeyState('L') & 0x8000) != 0;
+		if (latency_key_down && !latency_key_was_down) { LATENCY_REPORT(); ALLOCATION_REPORT(); }
+		latency_key_was_down = latency_key_down;
+#endif
+
+		uint32_t log_flags = 0;
+		if (GetKeyState(VK_SPACE) & 0x8000) { // Set reference point of every body
+			body_coms.set_reference();
+			log_flags |= COM_LOG_REFERENCE;
 		}
-	}
 
-	//std::cout << "X: " << center_of_mass.xyz.x << std::endl;
-	//std::cout << "Y: " << center_of_mass.xyz.y << std::endl;
-	//std::cout << "Z: " << center_of_mass.xyz.z << std::endl;
+		if (com_channel.is_open()) { com_channel.publish(frame, ComModel::SEGMENT_COUNT); }
+		if (udp_output != NULL) { udp_output->publish(frame, ComModel::SEGMENT_COUNT); }
 
-}
-
-void start_com_tracking(k4a_device_t& device, k4a_calibration_t& device_calibration, k4abt_tracker_t& tracker, k4a_capture_t& capture)
-{
-	k4a_wait_result_t queue_capture_result = K4A_WAIT_RESULT_FAILED;
-	k4abt_frame_t body_frame = NULL;
-	k4a_wait_result_t pop_frame_result = K4A_WAIT_RESULT_FAILED;
-	bool segment_exists[BODY_SEGMENT_NUM] = {};
-	k4a_float3_t old_center_of_mass_3d = {0, 0, 0};
-	k4a_float3_t center_of_mass_3d = {};
-	k4a_float3_t com_difference = {};
-	k4a_image_t color_image = NULL;
-	uint8_t* color_image_buffer = NULL;
-	k4abt_skeleton_t skeleton = {};
-	k4a_float3_t body_segment_com[BODY_SEGMENT_NUM] = {};
-	boolean reference_point_set = false;
-
-	std::cout << "COM Tracking Start!" << std::endl;
-
-	for (int i = 0; i < BODY_SEGMENT_NUM; i++) {
-		segment_exists[i] = true;
-	}
-
-	std::fstream fs;
-	fs.open("com_data.csv", std::ios::out, std::ios::trunc);
-
-BodyTracking:
-
-	if (get_capture(device, capture) == FAILURE) { return; };
-	
-	queue_capture_result = k4abt_tracker_enqueue_capture(tracker, capture, K4A_WAIT_INFINITE);
-	if (queue_capture_result == K4A_WAIT_RESULT_FAILED)
-	{
-		std::cout << "Failed to add capture to tracker process queue." << std::endl;
-		return;
-	}
-
-	pop_frame_result = k4abt_tracker_pop_result(tracker, &body_frame, K4A_WAIT_INFINITE);
-	if (pop_frame_result == K4A_WAIT_RESULT_SUCCEEDED)
-	{
-
-		color_image = k4a_capture_get_color_image(capture);
-
-		int image_width = k4a_image_get_width_pixels(color_image);
-		int image_height = k4a_image_get_height_pixels(color_image);
-
-		color_image_buffer = k4a_image_get_buffer(color_image);
-
-		k4abt_frame_get_body_skeleton(body_frame, 0, &skeleton);
-
-		get_com(center_of_mass_3d, segment_exists, body_segment_com, skeleton.joints);
-
-		com_difference.xyz.x = -(old_center_of_mass_3d.xyz.x - center_of_mass_3d.xyz.x);
-		com_difference.xyz.y = -(old_center_of_mass_3d.xyz.y - center_of_mass_3d.xyz.y);
-		com_difference.xyz.z = old_center_of_mass_3d.xyz.z - center_of_mass_3d.xyz.z;
-
-		k4abt_frame_release(body_frame);
-		k4a_capture_release(capture);
-
-		if (GetKeyState(VK_ESCAPE) & 0x8000) //wait for 'esc' key press for 30ms. If 'esc' key is pressed, break loop
 		{
-			fs.close();
-			return;
-		}
-
-		if (GetKeyState(VK_SPACE) & 0x8000) { // Set reference point
-			old_center_of_mass_3d.xyz = center_of_mass_3d.xyz;
-			reference_point_set = true;
+			LATENCY_SCOPE(pilotsimulator::LATENCY_LOG_WRITE);
+			com_log.append_frame<ComModel>(frame, log_flags);
 		}
+		get_pipeline_metrics().com_published.add();
 
-		std::cout << std::endl;
-		std::cout << "X: " << com_difference.xyz.x << std::endl;
-		std::cout << "Y: " << com_difference.xyz.y << std::endl;
-		std::cout << "Z: " << com_difference.xyz.z << std::endl;
-
-		if (reference_point_set) {
-			fs << com_difference.xyz.x << "," << com_difference.xyz.y << ","
-				<< com_difference.xyz.z << "," << std::endl;
+		// Against the reference before this frame's space press, one block per body
+		AsyncText difference_text(get_async_writer());
+		for (uint32_t i = 0; i < com_count; i++)
+		{
+			const BodyCom& com = coms[i];
+			difference_text.print("\nBody: %u\nX: %g\nY: %g\nZ: %g\n", com.id,
+				com.center_of_mass.xyz.x - com.reference.xyz.x,
+				com.center_of_mass.xyz.y - com.reference.xyz.y,
+				com.reference.xyz.z - com.center_of_mass.xyz.z);
 		}
 
-	}
-	else {
-		std::cout << "Failed to pop capture from tracker process queue." << std::endl;
-		return;
-	}
-
-	goto BodyTracking;
-}
+		return true;
+	};
 
-void clear_memory(
-	k4a_device_t* device,
-	k4a_capture_t* capture,
-	k4abt_tracker_t* tracker
-)
-{
+	Pipeline pipeline(
+		[&source](k4a_capture_t& next_capture) { return source.get_capture(next_capture); },
+		body_tracker,
+		analyze,
+		present,
+		get_pipeline_config()
+	);
 
-	if (*tracker != NULL)
+	pipeline.run();
+	pipeline.print_stats();
+	if (source.is_latest_only())
 	{
-		k4abt_tracker_shutdown(*tracker);
-		k4abt_tracker_destroy(*tracker);
+		std::cout << "Captures Discarded For Newer Ones: " << source.get_discarded_captures() << std::endl;
 	}
 
-	if (*capture != NULL)
-	{
-		k4a_capture_release(*capture);
-	}
+	get_async_writer().flush();
+	get_async_writer().print_stats();
+	if (udp_output != NULL) { udp_output->print_stats(); }
+	print_k4a_allocator_stats();
+
+	LATENCY_REPORT();
+	ALLOCATION_REPORT();
 
-	if (*device != NULL)
+	if (com_log.get_dropped_count() != 0)
 	{
-		k4a_device_stop_cameras(*device);
-		k4a_device_close(*device);
+		std::cout << "COM Log Records Dropped Waiting For The Next File: " << com_log.get_dropped_count() << std::endl;
 	}
-
+	com_log.close();
 }
 
-int main (void)
+int main (int argc, char* argv[])
 {
-	k4a_device_t device = NULL;
-	k4a_device_configuration_t device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+	std::unique_ptr<FrameSource> source;
 	k4a_calibration_t calibration = {};
-	k4a_transformation_t transformation = NULL;
-	k4abt_tracker_t tracker = NULL;
-	k4a_capture_t capture = NULL;
+	TrackerHandle tracker;
+	std::unique_ptr<BodyTracker> body_tracker;
 
-	VERIFY(get_device(device)); 
-	VERIFY(start_camera(device, device_config));
-	VERIFY(get_capture(device, capture));
-	VERIFY(get_calibration(device, device_config, calibration));
-	VERIFY(get_tracker(tracker, calibration));
+	VERIFY(get_frame_source(source, argc, argv));
+	VERIFY(source->get_calibration(calibration));
+	VERIFY(get_body_tracker(body_tracker, tracker.out(), *source, calibration));
 
-	start_com_tracking(device, calibration, tracker, capture);
+	start_com_tracking(*source, *body_tracker);
 	
 Exit:
-	clear_memory(&device, &capture, &tracker);
+	body_tracker.reset();
+	tracker.reset();
 	std::cout << "Exiting..." << std::endl;
 
 	return SUCCESS;
@@ -0,0 +1,93 @@
+"""Converts the binary COM log of PipeCOM into the com_data.csv read by PlotDifference.ipynb.
+
+    python com_log_to_csv.py com_data_0000.pscom [com_data_0001.pscom ...] [-o com_data.csv]
+
+Rows start at the first reference point (space in PipeCOM). dx, dy, dz are the COM difference
+from the body's last reference, signed as PipeCOM printed them; the timestamps, absolute COM and
+validity mask follow. The layout mirrors pilotsimulator/src/com_log.h.
+"""
+
+import argparse
+import csv
+import struct
+
+MAGIC = b"PSCOMLOG"
+VERSION = 1
+HEADER = struct.Struct("<8s6I3Q")
+RECORD = struct.Struct("<3Q4I3f48f12x")
+CHECKSUM_WORD = 9  # checksum is the 10th 32 bit word of a record
+REFERENCE = 1 << 0
+
+
+def fnv1a(value, word):
+    return ((value ^ word) * 16777619) & 0xFFFFFFFF
+
+
+def checksum(data):
+    """get_com_log_checksum: FNV-1a over four interleaved lanes of 32 bit words, then over the lanes."""
+    words = list(struct.unpack("<64I", data))
+    words[CHECKSUM_WORD] = 0
+    lanes = [2166136261] * 4
+    for i, word in enumerate(words):
+        lanes[i % 4] = fnv1a(lanes[i % 4], word)
+    value = 2166136261
+    for lane in lanes:
+        value = fnv1a(value, lane)
+    return value
+
+
+def read_records(path):
+    """Records of one file up to the first unwritten or torn one, as ComLog leaves them after a crash."""
+    with open(path, "rb") as file:
+        data = file.read()
+
+    magic, version, header_size, record_size, _, _, closed, _, record_count, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        raise ValueError(f"{path} is not a COM log")
+
+    records = []
+    for offset in range(header_size, len(data) - record_size + 1, record_size):
+        if closed and len(records) == record_count:
+            break
+        chunk = data[offset:offset + record_size]
+        fields = RECORD.unpack(chunk)
+        if fields[0] != len(records) + 1 or fields[6] != checksum(chunk):
+            break
+        records.append(fields)
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("logs", nargs="+")
+    parser.add_argument("-o", "--output", default="com_data.csv")
+    args = parser.parse_args()
+
+    references = {}
+    rows = 0
+    with open(args.output, "w", newline="") as csv_file:
+        writer = csv.writer(csv_file)
+        writer.writerow(["dx", "dy", "dz", "device_timestamp_usec", "system_timestamp_usec", "body_id", "x", "y", "z", "valid_mask"])
+
+        for path in args.logs:
+            for record in read_records(path):
+                device_usec, system_usec, body_id, flags, valid_mask = record[1], record[2], record[3], record[4], record[5]
+                com = record[7:10]
+
+                if flags & REFERENCE:
+                    references[body_id] = com
+                if body_id not in references:
+                    continue
+
+                reference = references[body_id]
+                writer.writerow([
+                    com[0] - reference[0], com[1] - reference[1], reference[2] - com[2],
+                    device_usec, system_usec, body_id, com[0], com[1], com[2], f"0x{valid_mask:08x}",
+                ])
+                rows += 1
+
+    print(f"{rows} rows written to {args.output}")
+
+
+if __name__ == "__main__":
+    main()
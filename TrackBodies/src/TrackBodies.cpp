@@ -12,25 +12,24 @@ using namespace pilotsimulator;
 		goto Exit;			\
 	}
 
-int main(void)
+int main(int argc, char* argv[])
 {
 	std::cout << "Running TrackBodies.cpp\n\n";
 
-	k4a_device_t device = NULL;
-	k4a_device_configuration_t device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
-	k4a_capture_t capture = NULL;
+	std::unique_ptr<FrameSource> source;
 	k4a_calibration_t calibration = {};
-	k4abt_tracker_t tracker = NULL;
+	TrackerHandle tracker;
+	std::unique_ptr<BodyTracker> body_tracker;
 
-	VERIFY(get_device(device));
-	VERIFY(start_camera(device, device_config));
-	VERIFY(get_calibration(device, device_config, calibration));
-	VERIFY(create_tracker(tracker, calibration));
+	VERIFY(get_frame_source(source, argc, argv));
+	VERIFY(source->get_calibration(calibration));
+	VERIFY(get_body_tracker(body_tracker, tracker.out(), *source, calibration));
 
-	start_body_tracking(device, capture, tracker);
+	start_body_tracking(*source, *body_tracker);
 
 Exit:
-	clear_memory(&device, &capture, NULL, NULL, &tracker);
+	body_tracker.reset();
+	tracker.reset();
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "pilotsimulator.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+
+namespace pilotsimulator {
+
+	constexpr int ALLOCATION_STAGE_SLOTS = ALLOCATION_NO_STAGE + 1;
+
+	// Plain statics with constant initialisation, operator new runs before any dynamic initialiser
+	static std::atomic<uint64_t> stage_allocations[ALLOCATION_STAGE_SLOTS];
+	static std::atomic<uint64_t> stage_bytes[ALLOCATION_STAGE_SLOTS];
+	static thread_local int allocation_stage = ALLOCATION_NO_STAGE;
+
+	static std::mutex frame_mutex;
+	static AllocationFrameStats frame_stats;
+	static uint64_t frame_start_allocations = 0;
+
+	void count_allocation(size_t bytes)
+	{
+		stage_allocations[allocation_stage].fetch_add(1, std::memory_order_relaxed);
+		stage_bytes[allocation_stage].fetch_add(bytes, std::memory_order_relaxed);
+	}
+
+	int set_allocation_stage(int stage)
+	{
+		int previous_stage = allocation_stage;
+		allocation_stage = stage >= 0 && stage < ALLOCATION_NO_STAGE ? stage : ALLOCATION_NO_STAGE;
+		return previous_stage;
+	}
+
+	AllocationCounts get_allocation_counts()
+	{
+		AllocationCounts counts;
+		for (int stage = 0; stage < ALLOCATION_STAGE_SLOTS; stage++)
+		{
+			counts.allocations += stage_allocations[stage].load(std::memory_order_relaxed);
+			counts.bytes += stage_bytes[stage].load(std::memory_order_relaxed);
+		}
+
+		return counts;
+	}
+
+	AllocationCounts get_stage_allocation_counts(int stage)
+	{
+		AllocationCounts counts;
+		if (stage < 0 || stage >= ALLOCATION_STAGE_SLOTS) { return counts; }
+
+		counts.allocations = stage_allocations[stage].load(std::memory_order_relaxed);
+		counts.bytes = stage_bytes[stage].load(std::memory_order_relaxed);
+
+		return counts;
+	}
+
+	void record_allocation_frame()
+	{
+		uint64_t allocations = get_allocation_counts().allocations;
+
+		std::lock_guard<std::mutex> lock(frame_mutex);
+		uint64_t frame_allocations = allocations - frame_start_allocations;
+		frame_start_allocations = allocations;
+
+		frame_stats.frames++;
+		frame_stats.allocations += frame_allocations;
+		if (frame_allocations > 0) { frame_stats.frames_with_allocations++; }
+		if (frame_allocations > frame_stats.max_allocations_per_frame) { frame_stats.max_allocations_per_frame = frame_allocations; }
+	}
+
+	AllocationFrameStats get_allocation_frame_stats()
+	{
+		std::lock_guard<std::mutex> lock(frame_mutex);
+		return frame_stats;
+	}
+
+	void print_allocation_report()
+	{
+		// Read before the report allocates anything of its own
+		AllocationCounts counts[ALLOCATION_STAGE_SLOTS];
+		for (int stage = 0; stage < ALLOCATION_STAGE_SLOTS; stage++) { counts[stage] = get_stage_allocation_counts(stage); }
+		AllocationFrameStats stats = get_allocation_frame_stats();
+
+		std::cout << std::endl << "Allocation Report:" << std::endl;
+		std::cout << std::setw(10) << "stage" << std::setw(12) << "allocations" << std::setw(14) << "bytes" << std::endl;
+
+		for (int stage = 0; stage < ALLOCATION_STAGE_SLOTS; stage++)
+		{
+			if (counts[stage].allocations == 0) { continue; }
+
+			std::cout << std::setw(10) << (stage == ALLOCATION_NO_STAGE ? "other" : get_latency_stage_name((LatencyStage)stage))
+				<< std::setw(12) << counts[stage].allocations
+				<< std::setw(14) << counts[stage].bytes << std::endl;
+		}
+
+		std::cout << stats.frames << " frames, " << stats.frames_with_allocations << " allocated, "
+			<< stats.max_allocations_per_frame << " allocations in the worst" << std::endl;
+	}
+
+	void reset_allocation_audit()
+	{
+		for (int stage = 0; stage < ALLOCATION_STAGE_SLOTS; stage++)
+		{
+			stage_allocations[stage].store(0, std::memory_order_relaxed);
+			stage_bytes[stage].store(0, std::memory_order_relaxed);
+		}
+
+		std::lock_guard<std::mutex> lock(frame_mutex);
+		frame_stats = AllocationFrameStats();
+		frame_start_allocations = 0;
+	}
+}
+
+#if PILOTSIMULATOR_ALLOC_AUDIT
+// Counting replacements of the global allocation functions, on top of malloc like the CRT's own
+
+void* operator new(size_t size)
+{
+	pilotsimulator::count_allocation(size);
+
+	for (;;)
+	{
+		void* memory = std::malloc(size > 0 ? size : 1);
+		if (memory != NULL) { return memory; }
+
+		std::new_handler handler = std::get_new_handler();
+		if (handler == NULL) { throw std::bad_alloc(); }
+		handler();
+	}
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try {
+		return operator new(size);
+	}
+	catch (const std::bad_alloc&) {
+		return NULL;
+	}
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+#endif
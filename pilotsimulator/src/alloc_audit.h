@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "latency.h"
+
+// Allocation auditing replaces the global operator new, so like the latency instrumentation it is compiled out
+// of release builds. Define PILOTSIMULATOR_ALLOC_AUDIT=1 to keep it there, or 0 to drop it from a debug build.
+#if !defined(PILOTSIMULATOR_ALLOC_AUDIT)
+#if defined(NDEBUG)
+#define PILOTSIMULATOR_ALLOC_AUDIT 0
+#else
+#define PILOTSIMULATOR_ALLOC_AUDIT 1
+#endif
+#endif
+
+namespace pilotsimulator {
+
+	// Stage of allocations made outside every LATENCY_SCOPE and ALLOCATION_STAGE
+	constexpr int ALLOCATION_NO_STAGE = LATENCY_STAGE_COUNT;
+
+	struct AllocationCounts {
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+	};
+
+	struct AllocationFrameStats {
+		uint64_t frames = 0;
+		uint64_t frames_with_allocations = 0;
+		uint64_t max_allocations_per_frame = 0;
+		uint64_t allocations = 0;		// within those frames
+	};
+
+	// Counts every operator new of the process and the system allocations of the k4a allocator, charged
+	// to the stage the allocating thread is in. The steady state of the frame loops is meant to allocate nothing,
+	// ALLOCATION_FRAME after each presented frame keeps score of how close it gets.
+	void count_allocation(size_t bytes);
+
+	// Stage the calling thread's allocations are charged to from now on, returns the previous one
+	int set_allocation_stage(int stage);
+
+	// Since the last reset, all stages or one of them
+	AllocationCounts get_allocation_counts();
+	AllocationCounts get_stage_allocation_counts(int stage);
+
+	// Closes a frame, the allocations of every thread since the last call count towards it
+	void record_allocation_frame();
+	AllocationFrameStats get_allocation_frame_stats();
+
+	// Allocations per stage, then how many frames allocated and the most any frame did
+	void print_allocation_report();
+	void reset_allocation_audit();
+
+	// Charges the thread's allocations to stage for the lifetime of the scope
+	class ScopedAllocationStage {
+	public:
+		explicit ScopedAllocationStage(int stage) : previous_stage(set_allocation_stage(stage)) {}
+		~ScopedAllocationStage() { set_allocation_stage(previous_stage); }
+
+		ScopedAllocationStage(const ScopedAllocationStage&) = delete;
+		ScopedAllocationStage& operator=(const ScopedAllocationStage&) = delete;
+
+	private:
+		int previous_stage;
+	};
+}
+
+// The audit points, empty statements when compiled out. Every LATENCY_SCOPE is an ALLOCATION_STAGE as well.
+#if PILOTSIMULATOR_ALLOC_AUDIT
+#define ALLOCATION_STAGE(stage) ::pilotsimulator::ScopedAllocationStage LATENCY_CONCAT(allocation_stage_, __LINE__)(stage)
+#define ALLOCATION_FRAME() ::pilotsimulator::record_allocation_frame()
+#define ALLOCATION_REPORT() ::pilotsimulator::print_allocation_report()
+#else
+#define ALLOCATION_STAGE(stage) ((void)0)
+#define ALLOCATION_FRAME() ((void)0)
+#define ALLOCATION_REPORT() ((void)0)
+#endif
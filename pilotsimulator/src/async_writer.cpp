@@ -0,0 +1,280 @@
+#include "pilotsimulator.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace pilotsimulator {
+
+	// Wakes the writer when no producer managed to, and bounds how long flush waits between checks
+	static const std::chrono::milliseconds WRITER_POLL_INTERVAL(10);
+
+	AsyncWriter::AsyncWriter(size_t capacity, OverflowPolicy policy)
+		: jobs(capacity), policy(policy),
+		submitted(0), written(0), dropped(0), failed(0), high_water_mark(0),
+		writer_waiting(false), stopping(false)
+	{
+		jobs.allocate();
+		writer = std::thread(&AsyncWriter::run, this);
+	}
+
+	AsyncWriter::~AsyncWriter()
+	{
+		stopping = true;
+		wake_writer();
+		writer.join();
+	}
+
+	bool AsyncWriter::write_image(const std::string& path, const cv::Mat& image)
+	{
+		Job job;
+		job.kind = IMAGE_JOB;
+		job.path = path;
+		job.image = image.clone();
+
+		return submit(job);
+	}
+
+	bool AsyncWriter::append_text(const std::string& path, const std::string& text)
+	{
+		return submit_text(APPEND_TEXT_JOB, &path, text.data(), text.size(), false);
+	}
+
+	bool AsyncWriter::append_text(const std::string& path, const char* text, size_t length)
+	{
+		return submit_text(APPEND_TEXT_JOB, &path, text, length, false);
+	}
+
+	bool AsyncWriter::print(const std::string& line)
+	{
+		return submit_text(PRINT_JOB, NULL, line.data(), line.size(), true);
+	}
+
+	bool AsyncWriter::print(const char* line)
+	{
+		return submit_text(PRINT_JOB, NULL, line, std::strlen(line), true);
+	}
+
+	bool AsyncWriter::print_text(const char* text, size_t length)
+	{
+		return submit_text(PRINT_JOB, NULL, text, length, false);
+	}
+
+	// One job per ASYNC_WRITER_TEXT_SIZE bytes, the line end goes with the last piece when it fits
+	bool AsyncWriter::submit_text(JobKind kind, const std::string* path, const char* text, size_t length, bool end_line)
+	{
+		bool submitted_all = true;
+		size_t offset = 0;
+
+		do
+		{
+			Job job;
+			job.kind = kind;
+			if (path != NULL) { job.path = *path; }
+
+			size_t piece = (std::min)(length - offset, ASYNC_WRITER_TEXT_SIZE);
+			std::memcpy(job.text, text + offset, piece);
+			offset += piece;
+
+			if (end_line && offset == length && piece < ASYNC_WRITER_TEXT_SIZE)
+			{
+				job.text[piece++] = '\n';
+				end_line = false;
+			}
+			job.text_length = piece;
+
+			if (!submit(job)) { submitted_all = false; }
+		} while (offset < length || end_line);
+
+		return submitted_all;
+	}
+
+	bool AsyncWriter::submit(Job& job)
+	{
+		submitted.fetch_add(1, std::memory_order_relaxed);
+
+		while (!jobs.try_push([&job](Job& cell) { cell = std::move(job); }))
+		{
+			if (policy == OVERFLOW_DROP_NEWEST)
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			if (policy == OVERFLOW_DROP_OLDEST)
+			{
+				Job oldest;
+				if (try_pop(oldest)) { dropped.fetch_add(1, std::memory_order_relaxed); }
+				continue;
+			}
+
+			wake_writer();
+			std::this_thread::yield();
+		}
+
+		size_t depth = jobs.size();
+		size_t mark = high_water_mark.load(std::memory_order_relaxed);
+		while (depth > mark && depth <= jobs.get_capacity() && !high_water_mark.compare_exchange_weak(mark, depth)) {}
+
+		if (writer_waiting.load()) { wake_writer(); }
+
+		return true;
+	}
+
+	bool AsyncWriter::try_pop(Job& job)
+	{
+		// Emptied so the ring holds no image or path of a written job
+		return jobs.try_pop([&job](Job& cell) { job = std::move(cell); cell = Job(); });
+	}
+
+	void AsyncWriter::wake_writer()
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		wake.notify_one();
+	}
+
+	void AsyncWriter::run()
+	{
+		Job job;
+
+		for (;;)
+		{
+			while (try_pop(job))
+			{
+				write(job);
+				job = Job();
+			}
+
+			// Queue drained: the text files and the console go to the OS and flush can return
+			for (auto& file : text_files) { file.second->flush(); }
+			std::cout.flush();
+			done.notify_all();
+
+			if (stopping) { break; }
+
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			writer_waiting = true;
+			if (jobs.is_empty() && !stopping)
+			{
+				wake.wait_for(lock, WRITER_POLL_INTERVAL);
+			}
+			writer_waiting = false;
+		}
+
+		// Jobs submitted while stopping
+		while (try_pop(job)) { write(job); }
+		text_files.clear();
+		std::cout.flush();
+		done.notify_all();
+	}
+
+	void AsyncWriter::write(Job& job)
+	{
+		bool succeeded = true;
+
+		switch (job.kind)
+		{
+		case IMAGE_JOB:
+			try {
+				succeeded = cv::imwrite(job.path, job.image);
+			}
+			catch (const cv::Exception&) {
+				succeeded = false;
+			}
+			if (!succeeded) { std::cout << "Failed To Write Image " << job.path << "!" << std::endl; }
+			break;
+
+		case APPEND_TEXT_JOB: {
+			std::unique_ptr<std::ofstream>& file = text_files[job.path];
+			if (!file) { file.reset(new std::ofstream(job.path, std::ios::app)); }
+
+			file->write(job.text, job.text_length);
+			succeeded = file->good();
+			if (!succeeded) { std::cout << "Failed To Write " << job.path << "!" << std::endl; }
+			break;
+		}
+
+		case PRINT_JOB:
+			std::cout.write(job.text, job.text_length);
+			break;
+		}
+
+		if (succeeded) { written.fetch_add(1, std::memory_order_release); }
+		else { failed.fetch_add(1, std::memory_order_release); }
+	}
+
+	void AsyncWriter::flush()
+	{
+		uint64_t target = submitted.load();
+
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		while (written.load() + failed.load() + dropped.load() < target)
+		{
+			wake.notify_one();
+			done.wait_for(lock, WRITER_POLL_INTERVAL);
+		}
+	}
+
+	AsyncWriterStats AsyncWriter::get_stats() const
+	{
+		AsyncWriterStats stats;
+		stats.submitted = submitted.load();
+		stats.written = written.load();
+		stats.dropped = dropped.load();
+		stats.failed = failed.load();
+		stats.high_water_mark = high_water_mark.load();
+		stats.capacity = jobs.get_capacity();
+
+		return stats;
+	}
+
+	void AsyncWriter::print_stats() const
+	{
+		AsyncWriterStats stats = get_stats();
+
+		std::cout << std::endl << "Async Writer Stats:" << std::endl;
+		std::cout << "  " << stats.submitted << " jobs, " << stats.written << " written, "
+			<< stats.dropped << " dropped, " << stats.failed << " failed" << std::endl;
+		std::cout << "  Queue high water mark: " << stats.high_water_mark << " of " << stats.capacity << std::endl;
+	}
+
+	AsyncWriter& get_async_writer()
+	{
+		// Destroyed at exit, after draining what main left queued
+		static AsyncWriter writer;
+		return writer;
+	}
+
+	void AsyncText::print(const char* format, ...)
+	{
+		va_list arguments;
+		va_start(arguments, format);
+
+		va_list retry_arguments;
+		va_copy(retry_arguments, arguments);
+
+		int written = std::vsnprintf(buffer + length, ASYNC_WRITER_TEXT_SIZE - length, format, arguments);
+
+		// Did not fit behind what is there, send that and start over at the front
+		if (written >= 0 && length + (size_t)written >= ASYNC_WRITER_TEXT_SIZE && length > 0)
+		{
+			flush();
+			written = std::vsnprintf(buffer, ASYNC_WRITER_TEXT_SIZE, format, retry_arguments);
+		}
+
+		va_end(retry_arguments);
+		va_end(arguments);
+
+		if (written > 0) { length = (std::min)(length + (size_t)written, ASYNC_WRITER_TEXT_SIZE - 1); }
+	}
+
+	void AsyncText::flush()
+	{
+		if (length == 0) { return; }
+
+		if (path != NULL) { writer.append_text(*path, buffer, length); }
+		else { writer.print_text(buffer, length); }
+
+		length = 0;
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "mpmc_ring.h"
+
+namespace pilotsimulator {
+
+	constexpr size_t ASYNC_WRITER_CAPACITY = 256;	// jobs, rounded up to a power of two
+	constexpr size_t ASYNC_WRITER_TEXT_SIZE = 512;	// text carried inline by a job, longer text takes several
+
+	// What a full queue does to the next job
+	enum OverflowPolicy {
+		OVERFLOW_BLOCK,			// wait for the writer, nothing is lost
+		OVERFLOW_DROP_OLDEST,	// discard the oldest queued job to make room
+		OVERFLOW_DROP_NEWEST	// discard the job being submitted
+	};
+
+	struct AsyncWriterStats {
+		uint64_t submitted = 0;
+		uint64_t written = 0;
+		uint64_t dropped = 0;
+		uint64_t failed = 0;
+		size_t high_water_mark = 0;		// most jobs queued at once
+		size_t capacity = 0;
+	};
+
+	// Hands images, text files and console lines to one writer thread through a bounded lock-free ring,
+	// so frame loops never wait on the disk or the console. Jobs from one thread are written in order.
+	// Text travels inside the preallocated jobs: text and console output allocate nothing on the way,
+	// unless an append_text path is too long for the short string buffer.
+	class AsyncWriter {
+	public:
+		explicit AsyncWriter(size_t capacity = ASYNC_WRITER_CAPACITY, OverflowPolicy policy = OVERFLOW_BLOCK);
+		~AsyncWriter();
+
+		AsyncWriter(const AsyncWriter&) = delete;
+		AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+		void set_overflow_policy(OverflowPolicy policy) { this->policy = policy; }
+		OverflowPolicy get_overflow_policy() const { return policy; }
+
+		// The image is copied, the caller may reuse or release its buffer straight away.
+		// False when the job was dropped.
+		bool write_image(const std::string& path, const cv::Mat& image);
+
+		// Appended to path, the file is opened on first use and kept open
+		bool append_text(const std::string& path, const std::string& text);
+		bool append_text(const std::string& path, const char* text, size_t length);
+
+		// One line on std::cout
+		bool print(const std::string& line);
+		bool print(const char* line);
+
+		// Text on std::cout as it is, without a line end
+		bool print_text(const char* text, size_t length);
+
+		// Waits until every job submitted before the call is written or dropped
+		void flush();
+
+		AsyncWriterStats get_stats() const;
+		void print_stats() const;
+
+	private:
+		enum JobKind { IMAGE_JOB, APPEND_TEXT_JOB, PRINT_JOB };
+
+		struct Job {
+			JobKind kind = PRINT_JOB;
+			std::string path;
+			cv::Mat image;
+			size_t text_length = 0;
+			char text[ASYNC_WRITER_TEXT_SIZE];
+		};
+
+		bool submit(Job& job);
+		bool submit_text(JobKind kind, const std::string* path, const char* text, size_t length, bool end_line);
+		bool try_pop(Job& job);
+		void run();
+		void write(Job& job);
+		void wake_writer();
+
+		MpmcRing<Job> jobs;
+		OverflowPolicy policy;
+
+		alignas(64) std::atomic<uint64_t> submitted;
+		std::atomic<uint64_t> written;
+		std::atomic<uint64_t> dropped;
+		std::atomic<uint64_t> failed;
+		std::atomic<size_t> high_water_mark;
+
+		std::atomic<bool> writer_waiting;
+		std::atomic<bool> stopping;
+		std::mutex wake_mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+
+		std::map<std::string, std::unique_ptr<std::ofstream>> text_files;	// writer thread only
+		std::thread writer;
+	};
+
+	// Writer shared by the library and the applications, drained when the process exits
+	AsyncWriter& get_async_writer();
+
+	// printf into a fixed buffer that goes to the writer whenever it fills up and when the AsyncText goes out
+	// of scope, for per-frame console output or a text file that costs no allocation to build
+	class AsyncText {
+	public:
+		explicit AsyncText(AsyncWriter& writer, const std::string* path = NULL) : writer(writer), path(path) {}
+		~AsyncText() { flush(); }
+
+		AsyncText(const AsyncText&) = delete;
+		AsyncText& operator=(const AsyncText&) = delete;
+
+		// A single piece longer than the buffer is cut short
+		void print(const char* format, ...);
+		void flush();
+
+	private:
+		AsyncWriter& writer;
+		const std::string* path;	// console when NULL
+		size_t length = 0;
+		char buffer[ASYNC_WRITER_TEXT_SIZE];
+	};
+}
@@ -0,0 +1,99 @@
+#include "pilotsimulator.h"
+
+namespace pilotsimulator {
+
+	uint32_t BodyComTracker::update(const BodyFrame& frame, BodyCom coms[MAX_BODIES])
+	{
+		update_count++;
+
+		uint32_t count = 0;
+		for (uint32_t body = 0; body < frame.num_bodies && body < MAX_BODIES; body++)
+		{
+			uint32_t id = frame.bodies[body].id;
+			if (id == K4ABT_INVALID_BODY_ID) { continue; }
+
+			BodyComState* state = states.find(id);
+			if (state == NULL)
+			{
+				// Bodies only linger for BODY_COM_LOST_FRAMES, make room when that is not enough
+				if (states.full()) { drop_lost_bodies(); }
+				state = states.insert(id);
+				if (state == NULL) { continue; }
+			}
+
+			state->last_update = update_count;
+			state->center_of_mass = frame.center_of_mass[body];
+			state->history[state->history_next] = state->center_of_mass;
+			state->history_next = (state->history_next + 1) % BODY_COM_HISTORY;
+			if (state->history_count < BODY_COM_HISTORY) { state->history_count++; }
+
+			BodyCom& com = coms[count++];
+			com.id = id;
+			com.body = body;
+			com.has_reference = state->has_reference;
+			com.center_of_mass = state->center_of_mass;
+			com.reference = state->reference;
+		}
+
+		drop_lost_bodies();
+
+		return count;
+	}
+
+	void BodyComTracker::drop_lost_bodies()
+	{
+		// Collected first, erasing moves entries the walk has not reached yet
+		uint32_t lost[BODY_COM_MAP_CAPACITY];
+		size_t lost_count = 0;
+		uint64_t oldest_update = update_count;
+		uint32_t oldest = K4ABT_INVALID_BODY_ID;
+
+		states.for_each([&](uint32_t id, BodyComState& state) {
+			if (update_count - state.last_update >= BODY_COM_LOST_FRAMES) { lost[lost_count++] = id; }
+			if (state.last_update < oldest_update)
+			{
+				oldest_update = state.last_update;
+				oldest = id;
+			}
+		});
+
+		for (size_t i = 0; i < lost_count; i++) { states.erase(lost[i]); }
+
+		// Still full of bodies seen lately, the one seen longest ago goes
+		if (states.full() && oldest != K4ABT_INVALID_BODY_ID) { states.erase(oldest); }
+	}
+
+	void BodyComTracker::set_reference()
+	{
+		states.for_each([](uint32_t, BodyComState& state) {
+			state.reference = state.center_of_mass;
+			state.has_reference = true;
+		});
+	}
+
+	bool BodyComTracker::set_reference(uint32_t id)
+	{
+		BodyComState* state = states.find(id);
+		if (state == NULL) { return false; }
+
+		state->reference = state->center_of_mass;
+		state->has_reference = true;
+
+		return true;
+	}
+
+	size_t BodyComTracker::get_history(uint32_t id, k4a_float3_t history[], size_t capacity) const
+	{
+		const BodyComState* state = states.find(id);
+		if (state == NULL) { return 0; }
+
+		size_t count = (std::min)(capacity, state->history_count);
+		size_t first = (state->history_next + BODY_COM_HISTORY - count) % BODY_COM_HISTORY;
+		for (size_t i = 0; i < count; i++)
+		{
+			history[i] = state->history[(first + i) % BODY_COM_HISTORY];
+		}
+
+		return count;
+	}
+}
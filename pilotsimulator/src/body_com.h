@@ -0,0 +1,159 @@
+#pragma once
+
+#include <k4a/k4a.h>
+#include <k4abt.h>
+
+#include "pipeline.h"
+
+namespace pilotsimulator {
+
+	constexpr size_t BODY_COM_HISTORY = 32;			// COMs kept per body, about a second at 30 fps
+	constexpr uint64_t BODY_COM_LOST_FRAMES = 30;	// state of a body missing from this many frames is dropped
+	constexpr size_t BODY_COM_MAP_CAPACITY = 4 * MAX_BODIES;
+
+	// Open addressing map from k4abt body id to T: linear probing over a power of two table allocated with the map,
+	// filled at most half so probes stay short. Deleting shifts the rest of the probe run back, no tombstones.
+	template <typename T, size_t Capacity>
+	class BodyMap {
+	public:
+		static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "BodyMap capacity is a power of two");
+
+		BodyMap() { clear(); }
+
+		void clear()
+		{
+			for (size_t i = 0; i < Capacity; i++)
+			{
+				ids[i] = K4ABT_INVALID_BODY_ID;
+				values[i] = T();
+			}
+			count = 0;
+		}
+
+		T* find(uint32_t id)
+		{
+			for (size_t i = get_home(id); ; i = (i + 1) & MASK)
+			{
+				if (ids[i] == id) { return &values[i]; }
+				if (ids[i] == K4ABT_INVALID_BODY_ID) { return NULL; }
+			}
+		}
+
+		const T* find(uint32_t id) const { return const_cast<BodyMap*>(this)->find(id); }
+
+		// The value of id, a default one when it was not there. NULL when the map is full.
+		T* insert(uint32_t id)
+		{
+			size_t i = get_home(id);
+			for (; ids[i] != K4ABT_INVALID_BODY_ID; i = (i + 1) & MASK)
+			{
+				if (ids[i] == id) { return &values[i]; }
+			}
+
+			if (full()) { return NULL; }
+
+			ids[i] = id;
+			values[i] = T();
+			count++;
+
+			return &values[i];
+		}
+
+		bool erase(uint32_t id)
+		{
+			size_t hole = get_home(id);
+			for (; ids[hole] != id; hole = (hole + 1) & MASK)
+			{
+				if (ids[hole] == K4ABT_INVALID_BODY_ID) { return false; }
+			}
+
+			// Entries further along the run move into the hole unless their home lies between the hole and them
+			for (size_t i = (hole + 1) & MASK; ids[i] != K4ABT_INVALID_BODY_ID; i = (i + 1) & MASK)
+			{
+				size_t home = get_home(ids[i]);
+				if (((i - home) & MASK) < ((i - hole) & MASK)) { continue; }
+
+				ids[hole] = ids[i];
+				values[hole] = std::move(values[i]);
+				hole = i;
+			}
+
+			ids[hole] = K4ABT_INVALID_BODY_ID;
+			values[hole] = T();
+			count--;
+
+			return true;
+		}
+
+		// function(id, value) for every entry, in table order
+		template <typename Function>
+		void for_each(Function function)
+		{
+			for (size_t i = 0; i < Capacity; i++)
+			{
+				if (ids[i] != K4ABT_INVALID_BODY_ID) { function(ids[i], values[i]); }
+			}
+		}
+
+		size_t size() const { return count; }
+		bool full() const { return count >= Capacity / 2; }
+
+	private:
+		enum : size_t { MASK = Capacity - 1 };
+
+		static size_t get_home(uint32_t id)
+		{
+			uint32_t hash = id * 2654435769u;
+			return (size_t)(hash ^ (hash >> 16)) & MASK;
+		}
+
+		uint32_t ids[Capacity];
+		T values[Capacity];
+		size_t count = 0;
+	};
+
+	// What BodyComTracker keeps of one body
+	struct BodyComState {
+		uint64_t last_update = 0;
+		bool has_reference = false;
+		k4a_float3_t center_of_mass = {};
+		k4a_float3_t reference = {};		// zero until set_reference
+		k4a_float3_t history[BODY_COM_HISTORY] = {};
+		size_t history_count = 0;
+		size_t history_next = 0;
+	};
+
+	// One body of one frame as the tracker sees it
+	struct BodyCom {
+		uint32_t id;
+		uint32_t body;					// index into the frame's bodies
+		bool has_reference;
+		k4a_float3_t center_of_mass;
+		k4a_float3_t reference;
+	};
+
+	// COM state of every body by k4abt body id: reference point and recent COMs, so each pilot and the
+	// instructor are measured against their own reference. Fed analysed frames in order, from one thread.
+	class BodyComTracker {
+	public:
+		// Bodies of frame after compute_com_batch, one BodyCom per body in the frame's order. Returns their count.
+		uint32_t update(const BodyFrame& frame, BodyCom coms[MAX_BODIES]);
+
+		// Every tracked body's latest COM becomes its reference
+		void set_reference();
+		bool set_reference(uint32_t id);
+
+		const BodyComState* find(uint32_t id) const { return states.find(id); }
+
+		// COMs of a body oldest first, at most capacity of them. Returns their count.
+		size_t get_history(uint32_t id, k4a_float3_t history[], size_t capacity) const;
+
+		size_t size() const { return states.size(); }
+
+	private:
+		void drop_lost_bodies();
+
+		BodyMap<BodyComState, BODY_COM_MAP_CAPACITY> states;
+		uint64_t update_count = 0;
+	};
+}
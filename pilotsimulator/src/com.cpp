@@ -0,0 +1,9 @@
+#include "pilotsimulator.h"
+
+namespace pilotsimulator {
+
+	// Definitions of the constexpr model tables, needed before C++17 made them inline
+	constexpr SegmentDefinition LegsAndTrunkModel::segments[];
+	constexpr SegmentDefinition FullBodyModel::segments[];
+	constexpr SegmentDefinition SeatedBodyModel::segments[];
+}
\ No newline at end of file
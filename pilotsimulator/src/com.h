@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+
+#include <k4a/k4a.h>
+#include <k4abt.h>
+
+#include "pipeline.h"
+
+namespace pilotsimulator {
+
+	// Skeletons processed side by side by the COM kernel, one float lane each
+	constexpr size_t COM_BATCH_LANES = 8;
+
+	// Segment COM = proximal + length_ratio * (distal - proximal), a segment with no length sits on its joint
+	struct SegmentDefinition {
+		int proximal_joint;
+		int distal_joint;
+		float length_ratio;
+		float mass_fraction;
+	};
+
+	// Segment models: a Segment enum ending in SEGMENT_COUNT and a constexpr table in that order.
+	// Body COM is the mass weighted mean of the segment COMs.
+
+	// Legs and trunk only, drawn by the stream_images overlay
+	struct LegsAndTrunkModel {
+		enum Segment {
+			FOOT_RIGHT, SHANK_RIGHT, THIGH_RIGHT, TRUNK_RIGHT, FOOT_LEFT, SHANK_LEFT, THIGH_LEFT, TRUNK_LEFT,
+			SEGMENT_COUNT
+		};
+		static constexpr SegmentDefinition segments[SEGMENT_COUNT] = {
+			{ K4ABT_JOINT_ANKLE_RIGHT, K4ABT_JOINT_FOOT_RIGHT, 0.5f, 0.0133f },
+			{ K4ABT_JOINT_KNEE_RIGHT, K4ABT_JOINT_ANKLE_RIGHT, 0.419f, 0.0535f },
+			{ K4ABT_JOINT_KNEE_RIGHT, K4ABT_JOINT_HIP_RIGHT, 0.428f, 0.1175f },
+			{ K4ABT_JOINT_HIP_RIGHT, K4ABT_JOINT_SHOULDER_RIGHT, 0.5f, 0.225f },
+			{ K4ABT_JOINT_ANKLE_LEFT, K4ABT_JOINT_FOOT_LEFT, 0.5f, 0.0133f },
+			{ K4ABT_JOINT_KNEE_LEFT, K4ABT_JOINT_ANKLE_LEFT, 0.419f, 0.0535f },
+			{ K4ABT_JOINT_KNEE_LEFT, K4ABT_JOINT_HIP_LEFT, 0.428f, 0.1175f },
+			{ K4ABT_JOINT_HIP_LEFT, K4ABT_JOINT_SHOULDER_LEFT, 0.5f, 0.225f }
+		};
+	};
+
+	// Arms and hands included, used by StreamCOM
+	struct FullBodyModel {
+		enum Segment {
+			FOOT_RIGHT, SHANK_RIGHT, THIGH_RIGHT, TRUNK_RIGHT, UPPERARM_RIGHT, FOREARM_RIGHT, HAND_SEGMENT_RIGHT,
+			FOOT_LEFT, SHANK_LEFT, THIGH_LEFT, TRUNK_LEFT, UPPERARM_LEFT, FOREARM_LEFT, HAND_SEGMENT_LEFT, HEAD_SEGMENT,
+			SEGMENT_COUNT
+		};
+		static constexpr SegmentDefinition segments[SEGMENT_COUNT] = {
+			{ K4ABT_JOINT_ANKLE_RIGHT, K4ABT_JOINT_FOOT_RIGHT, 0.5f, 0.0133f },
+			{ K4ABT_JOINT_KNEE_RIGHT, K4ABT_JOINT_ANKLE_RIGHT, 0.419f, 0.0535f },
+			{ K4ABT_JOINT_HIP_RIGHT, K4ABT_JOINT_KNEE_RIGHT, 0.428f, 0.1175f },
+			{ K4ABT_JOINT_SHOULDER_RIGHT, K4ABT_JOINT_HIP_RIGHT, 0.5f, 0.225f },
+			{ K4ABT_JOINT_SHOULDER_RIGHT, K4ABT_JOINT_ELBOW_RIGHT, 0.458f, 0.029f },
+			{ K4ABT_JOINT_ELBOW_RIGHT, K4ABT_JOINT_WRIST_RIGHT, 0.434f, 0.0157f },
+			{ K4ABT_JOINT_WRIST_RIGHT, K4ABT_JOINT_HANDTIP_RIGHT, 0.468f, 0.005f },
+			{ K4ABT_JOINT_ANKLE_LEFT, K4ABT_JOINT_FOOT_LEFT, 0.5f, 0.0133f },
+			{ K4ABT_JOINT_KNEE_LEFT, K4ABT_JOINT_ANKLE_LEFT, 0.419f, 0.0535f },
+			{ K4ABT_JOINT_HIP_LEFT, K4ABT_JOINT_KNEE_LEFT, 0.428f, 0.1175f },
+			{ K4ABT_JOINT_SHOULDER_LEFT, K4ABT_JOINT_HIP_LEFT, 0.5f, 0.225f },
+			{ K4ABT_JOINT_SHOULDER_LEFT, K4ABT_JOINT_ELBOW_LEFT, 0.458f, 0.029f },
+			{ K4ABT_JOINT_ELBOW_LEFT, K4ABT_JOINT_WRIST_LEFT, 0.434f, 0.0157f },
+			{ K4ABT_JOINT_WRIST_LEFT, K4ABT_JOINT_HANDTIP_LEFT, 0.468f, 0.005f },
+			{ K4ABT_JOINT_NOSE, K4ABT_JOINT_NOSE, 0, 0.082f }
+		};
+	};
+
+	// Pilot with the hands on the controls, the arm mass is carried by the head. Used by PipeCOM.
+	struct SeatedBodyModel {
+		enum Segment {
+			FOOT_RIGHT, SHANK_RIGHT, THIGH_RIGHT, TRUNK_RIGHT,
+			FOOT_LEFT, SHANK_LEFT, THIGH_LEFT, TRUNK_LEFT, HEAD_SEGMENT,
+			SEGMENT_COUNT
+		};
+		static constexpr SegmentDefinition segments[SEGMENT_COUNT] = {
+			{ K4ABT_JOINT_ANKLE_RIGHT, K4ABT_JOINT_FOOT_RIGHT, 0.5f, 0.0133f },
+			{ K4ABT_JOINT_KNEE_RIGHT, K4ABT_JOINT_ANKLE_RIGHT, 0.419f, 0.0535f },
+			{ K4ABT_JOINT_HIP_RIGHT, K4ABT_JOINT_KNEE_RIGHT, 0.428f, 0.1175f },
+			{ K4ABT_JOINT_SHOULDER_RIGHT, K4ABT_JOINT_HIP_RIGHT, 0.5f, 0.225f },
+			{ K4ABT_JOINT_ANKLE_LEFT, K4ABT_JOINT_FOOT_LEFT, 0.5f, 0.0133f },
+			{ K4ABT_JOINT_KNEE_LEFT, K4ABT_JOINT_ANKLE_LEFT, 0.419f, 0.0535f },
+			{ K4ABT_JOINT_HIP_LEFT, K4ABT_JOINT_KNEE_LEFT, 0.428f, 0.1175f },
+			{ K4ABT_JOINT_SHOULDER_LEFT, K4ABT_JOINT_HIP_LEFT, 0.5f, 0.225f },
+			{ K4ABT_JOINT_NOSE, K4ABT_JOINT_NOSE, 0, 0.1814f }
+		};
+	};
+
+	template <typename Model>
+	constexpr float get_total_mass_fraction()
+	{
+		float total = 0;
+		for (int segment_id = 0; segment_id < Model::SEGMENT_COUNT; segment_id++)
+		{
+			total += Model::segments[segment_id].mass_fraction;
+		}
+		return total;
+	}
+
+	// Up to COM_BATCH_LANES skeletons and where their results go
+	struct ComBlock {
+		size_t count = 0;
+		const k4abt_skeleton_t* skeleton[COM_BATCH_LANES] = {};
+		k4a_float3_t* center_of_mass[COM_BATCH_LANES] = {};
+		k4a_float3_t* body_segment_com[COM_BATCH_LANES] = {};
+	};
+
+	struct ComLanes {
+		alignas(32) float x[COM_BATCH_LANES];
+		alignas(32) float y[COM_BATCH_LANES];
+		alignas(32) float z[COM_BATCH_LANES];
+	};
+
+	// One segment of Model for all lanes, then the next: the recursion unrolls the model at compile time
+	// with the joints, ratio and weight as constants. Unused lanes compute on zeros and are never stored.
+	template <typename Model, int Segment = 0, bool Done = (Segment == Model::SEGMENT_COUNT)>
+	struct ComSegmentKernel {
+		static void run(const ComBlock& block, ComLanes& com)
+		{
+			constexpr int proximal = Model::segments[Segment].proximal_joint;
+			constexpr int distal = Model::segments[Segment].distal_joint;
+			constexpr float length = Model::segments[Segment].length_ratio;
+			constexpr float weight = Model::segments[Segment].mass_fraction / get_total_mass_fraction<Model>();
+
+			ComLanes proximal_lanes = {};
+			ComLanes distal_lanes = {};
+			ComLanes segment;
+
+			for (size_t lane = 0; lane < block.count; lane++)
+			{
+				const k4abt_joint_t* joints = block.skeleton[lane]->joints;
+				proximal_lanes.x[lane] = joints[proximal].position.xyz.x;
+				proximal_lanes.y[lane] = joints[proximal].position.xyz.y;
+				proximal_lanes.z[lane] = joints[proximal].position.xyz.z;
+				distal_lanes.x[lane] = joints[distal].position.xyz.x;
+				distal_lanes.y[lane] = joints[distal].position.xyz.y;
+				distal_lanes.z[lane] = joints[distal].position.xyz.z;
+			}
+
+			for (size_t lane = 0; lane < COM_BATCH_LANES; lane++)
+			{
+				segment.x[lane] = proximal_lanes.x[lane] + length * (distal_lanes.x[lane] - proximal_lanes.x[lane]);
+				segment.y[lane] = proximal_lanes.y[lane] + length * (distal_lanes.y[lane] - proximal_lanes.y[lane]);
+				segment.z[lane] = proximal_lanes.z[lane] + length * (distal_lanes.z[lane] - proximal_lanes.z[lane]);
+
+				com.x[lane] += weight * segment.x[lane];
+				com.y[lane] += weight * segment.y[lane];
+				com.z[lane] += weight * segment.z[lane];
+			}
+
+			for (size_t lane = 0; lane < block.count; lane++)
+			{
+				if (block.body_segment_com[lane] == NULL) { continue; }
+
+				block.body_segment_com[lane][Segment].xyz = { segment.x[lane], segment.y[lane], segment.z[lane] };
+			}
+
+			ComSegmentKernel<Model, Segment + 1>::run(block, com);
+		}
+	};
+
+	template <typename Model, int Segment>
+	struct ComSegmentKernel<Model, Segment, true> {
+		static void run(const ComBlock&, ComLanes&) {}
+	};
+
+	template <typename Model>
+	void compute_com_block(const ComBlock& block)
+	{
+		static_assert(Model::SEGMENT_COUNT <= MAX_BODY_SEGMENTS, "BodyFrame holds at most MAX_BODY_SEGMENTS segments");
+
+		ComLanes com = {};
+		ComSegmentKernel<Model>::run(block, com);
+
+		for (size_t lane = 0; lane < block.count; lane++)
+		{
+			block.center_of_mass[lane]->xyz = { com.x[lane], com.y[lane], com.z[lane] };
+		}
+	}
+
+	// COM of count skeletons. body_segment_com, if not NULL, takes MAX_BODY_SEGMENTS entries per skeleton.
+	template <typename Model>
+	void compute_com_batch(
+		const k4abt_skeleton_t skeletons[],
+		size_t count,
+		k4a_float3_t center_of_mass[],
+		k4a_float3_t body_segment_com[] = NULL
+	)
+	{
+		ComBlock block;
+
+		for (size_t start = 0; start < count; start += COM_BATCH_LANES)
+		{
+			block.count = (std::min)(COM_BATCH_LANES, count - start);
+
+			for (size_t lane = 0; lane < block.count; lane++)
+			{
+				block.skeleton[lane] = &skeletons[start + lane];
+				block.center_of_mass[lane] = &center_of_mass[start + lane];
+				block.body_segment_com[lane] = body_segment_com != NULL ? &body_segment_com[(start + lane) * MAX_BODY_SEGMENTS] : NULL;
+			}
+
+			compute_com_block<Model>(block);
+		}
+	}
+
+	// Fills center_of_mass and body_segment_com of every body of frame_count frames.
+	// Bodies of consecutive frames share blocks, so one body per frame still fills the lanes.
+	template <typename Model>
+	void compute_com_batch(BodyFrame frames[], size_t frame_count)
+	{
+		ComBlock block;
+
+		for (size_t frame_id = 0; frame_id < frame_count; frame_id++)
+		{
+			BodyFrame& frame = frames[frame_id];
+
+			for (uint32_t body = 0; body < frame.num_bodies; body++)
+			{
+				block.skeleton[block.count] = &frame.bodies[body].skeleton;
+				block.center_of_mass[block.count] = &frame.center_of_mass[body];
+				block.body_segment_com[block.count] = frame.body_segment_com[body];
+				block.count++;
+
+				if (block.count == COM_BATCH_LANES)
+				{
+					compute_com_block<Model>(block);
+					block.count = 0;
+				}
+			}
+		}
+
+		if (block.count > 0)
+		{
+			compute_com_block<Model>(block);
+		}
+	}
+}
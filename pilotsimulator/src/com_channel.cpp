@@ -0,0 +1,206 @@
+#include "pilotsimulator.h"
+
+#include <cstring>
+
+namespace pilotsimulator {
+
+	static_assert(COM_CHANNEL_MAX_BODIES >= MAX_BODIES, "A channel sample holds every body of a frame");
+	static_assert(COM_CHANNEL_MAX_SEGMENTS >= MAX_BODY_SEGMENTS, "A channel sample holds every segment of a body");
+	static_assert(COM_CHANNEL_JOINTS == K4ABT_JOINT_COUNT, "A channel body holds the whole skeleton");
+	static_assert(sizeof(ComChannelJoint) == sizeof(k4abt_joint_t), "ComChannelJoint mirrors k4abt_joint_t");
+	static_assert((COM_CHANNEL_SLOTS & (COM_CHANNEL_SLOTS - 1)) == 0, "COM_CHANNEL_SLOTS is a power of two");
+
+	// Attempts at a slot the publisher keeps overwriting, it only laps a reader that lost the processor
+	constexpr int COM_CHANNEL_READ_ATTEMPTS = 100;
+
+	static uint64_t get_steady_nsec()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	int ComPublisher::open(const std::string& name)
+	{
+		close();
+
+		if (memory.create(name, sizeof(ComChannel)) == FAILURE) { return FAILURE; }
+		channel = (ComChannel*)memory.get_data();
+
+		// A mapping left by a publisher that crashed starts over, its readers see the count go back
+		ComChannelHeader& header = channel->header;
+		header.magic = 0;
+		header.published.store(0, std::memory_order_relaxed);
+		for (ComChannelSample& sample : channel->samples) { sample.sequence.store(0, std::memory_order_relaxed); }
+
+		header.version = COM_CHANNEL_VERSION;
+		header.slot_count = COM_CHANNEL_SLOTS;
+		header.sample_size = sizeof(ComChannelSample);
+		std::atomic_thread_fence(std::memory_order_release);
+		header.magic = COM_CHANNEL_MAGIC;
+
+		return SUCCESS;
+	}
+
+	void ComPublisher::close()
+	{
+		channel = NULL;
+		writing = NULL;
+		memory.close();
+	}
+
+	ComChannelSample& ComPublisher::begin_sample()
+	{
+		uint64_t index = channel->header.published.load(std::memory_order_relaxed);
+		writing = &channel->samples[index & (COM_CHANNEL_SLOTS - 1)];
+
+		writing->sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		writing->index = index;
+
+		return *writing;
+	}
+
+	void ComPublisher::end_sample()
+	{
+		uint64_t index = writing->index;
+		writing->publish_steady_nsec = get_steady_nsec();
+
+		writing->sequence.store(2 * (index + 1), std::memory_order_release);
+		channel->header.published.store(index + 1, std::memory_order_release);
+		writing = NULL;
+	}
+
+	void ComPublisher::publish(const BodyFrame& frame, uint32_t segment_count)
+	{
+		ComChannelSample& sample = begin_sample();
+
+		sample.frame_id = frame.frame_id;
+		sample.device_timestamp_usec = frame.device_timestamp_usec;
+		sample.system_timestamp_usec = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		sample.num_bodies = (std::min)(frame.num_bodies, COM_CHANNEL_MAX_BODIES);
+		sample.segment_count = (std::min)(segment_count, COM_CHANNEL_MAX_SEGMENTS);
+
+		for (uint32_t i = 0; i < sample.num_bodies; i++)
+		{
+			ComChannelBody& body = sample.bodies[i];
+			body.id = frame.bodies[i].id;
+			std::memcpy(body.center_of_mass, frame.center_of_mass[i].v, sizeof(body.center_of_mass));
+			std::memcpy(body.body_segment_com, frame.body_segment_com[i], sample.segment_count * sizeof(k4a_float3_t));
+			std::memcpy(body.joints, frame.bodies[i].skeleton.joints, sizeof(body.joints));
+		}
+
+		end_sample();
+	}
+
+	uint64_t ComPublisher::get_published() const
+	{
+		return channel != NULL ? channel->header.published.load(std::memory_order_relaxed) : 0;
+	}
+
+	uint32_t ComPublisher::get_reader_count() const
+	{
+		return channel != NULL ? channel->header.reader_count.load(std::memory_order_relaxed) : 0;
+	}
+
+	int ComSubscriber::open(const std::string& name)
+	{
+		close();
+
+		if (memory.open(name, sizeof(ComChannel)) == FAILURE) { return FAILURE; }
+
+		ComChannel* shared = (ComChannel*)memory.get_data();
+		const ComChannelHeader& header = shared->header;
+		if (header.magic != COM_CHANNEL_MAGIC || header.version != COM_CHANNEL_VERSION ||
+			header.slot_count != COM_CHANNEL_SLOTS || header.sample_size != sizeof(ComChannelSample))
+		{
+			memory.close();
+			return FAILURE;
+		}
+
+		shared->header.reader_count.fetch_add(1, std::memory_order_relaxed);
+		channel = shared;
+		next_index = header.published.load(std::memory_order_acquire);
+		lost = 0;
+
+		return SUCCESS;
+	}
+
+	void ComSubscriber::close()
+	{
+		if (channel != NULL)
+		{
+			((ComChannel*)memory.get_data())->header.reader_count.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		channel = NULL;
+		memory.close();
+	}
+
+	int ComSubscriber::read_slot(uint64_t index, ComChannelSample& sample) const
+	{
+		const ComChannelSample& shared = channel->samples[index & (COM_CHANNEL_SLOTS - 1)];
+		uint64_t sequence = 2 * (index + 1);
+
+		if (shared.sequence.load(std::memory_order_acquire) != sequence) { return FAILURE; }
+
+		sample.index = shared.index;
+		sample.frame_id = shared.frame_id;
+		sample.device_timestamp_usec = shared.device_timestamp_usec;
+		sample.system_timestamp_usec = shared.system_timestamp_usec;
+		sample.publish_steady_nsec = shared.publish_steady_nsec;
+		sample.num_bodies = (std::min)(shared.num_bodies, COM_CHANNEL_MAX_BODIES);
+		sample.segment_count = shared.segment_count;
+		std::memcpy(sample.bodies, shared.bodies, sample.num_bodies * sizeof(ComChannelBody));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (shared.sequence.load(std::memory_order_relaxed) != sequence) { return FAILURE; }
+
+		sample.sequence.store(sequence, std::memory_order_relaxed);
+
+		return SUCCESS;
+	}
+
+	int ComSubscriber::read_latest(ComChannelSample& sample)
+	{
+		for (int attempt = 0; attempt < COM_CHANNEL_READ_ATTEMPTS; attempt++)
+		{
+			uint64_t published = channel->header.published.load(std::memory_order_acquire);
+			if (published == 0) { return FAILURE; }
+
+			if (read_slot(published - 1, sample) == SUCCESS)
+			{
+				next_index = published;
+				return SUCCESS;
+			}
+		}
+
+		return FAILURE;
+	}
+
+	int ComSubscriber::read_next(ComChannelSample& sample)
+	{
+		for (int attempt = 0; attempt < COM_CHANNEL_READ_ATTEMPTS; attempt++)
+		{
+			uint64_t published = channel->header.published.load(std::memory_order_acquire);
+			if (published < next_index) { next_index = published; }		// the publisher started over
+			if (next_index == published) { return FAILURE; }
+
+			// The slot after the newest may be written already, everything older than the ring holds is gone
+			uint64_t oldest = published > COM_CHANNEL_SLOTS - 1 ? published - (COM_CHANNEL_SLOTS - 1) : 0;
+			if (next_index < oldest)
+			{
+				lost += oldest - next_index;
+				next_index = oldest;
+			}
+
+			if (read_slot(next_index, sample) == SUCCESS)
+			{
+				next_index++;
+				return SUCCESS;
+			}
+		}
+
+		return FAILURE;
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "shared_memory.h"
+
+// Layout and reader of the COM channel, free of the Azure Kinect headers so the simulator can include it as it is
+// and link only pilotsimulator.lib.
+
+namespace pilotsimulator {
+
+	struct BodyFrame;
+
+	constexpr uint32_t COM_CHANNEL_MAGIC = 0x43435350;		// "PSCC"
+	constexpr uint32_t COM_CHANNEL_VERSION = 1;
+	constexpr uint32_t COM_CHANNEL_SLOTS = 16;				// power of two
+	constexpr uint32_t COM_CHANNEL_MAX_BODIES = 16;
+	constexpr uint32_t COM_CHANNEL_MAX_SEGMENTS = 16;
+	constexpr uint32_t COM_CHANNEL_JOINTS = 32;				// K4ABT_JOINT_COUNT
+	constexpr size_t COM_CHANNEL_CACHE_LINE = 64;
+	constexpr char COM_CHANNEL_DEFAULT_NAME[] = "pilotsimulator_com";
+
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The channel's sequences are shared between processes, they have to be lock free");
+
+	// As k4abt_joint_t: position in mm, orientation w, x, y, z, k4abt_joint_confidence_level_t
+	struct ComChannelJoint {
+		float position[3];
+		float orientation[4];
+		uint32_t confidence_level;
+	};
+
+	struct ComChannelBody {
+		uint32_t id;
+		uint32_t reserved;
+		float center_of_mass[3];
+		float body_segment_com[COM_CHANNEL_MAX_SEGMENTS][3];
+		ComChannelJoint joints[COM_CHANNEL_JOINTS];
+	};
+
+	// One analysed frame. sequence is odd while the publisher writes the slot and 2 * (index + 1) once sample
+	// index is complete, a reader copies the slot and keeps the copy when sequence held that value around it.
+	struct alignas(COM_CHANNEL_CACHE_LINE) ComChannelSample {
+		std::atomic<uint64_t> sequence;
+		uint64_t index;
+		uint64_t frame_id;
+		uint64_t device_timestamp_usec;
+		uint64_t system_timestamp_usec;		// system clock since the epoch, to line up with the simulator
+		uint64_t publish_steady_nsec;		// steady clock of the machine when published, for the latency
+		uint32_t num_bodies;
+		uint32_t segment_count;
+		ComChannelBody bodies[COM_CHANNEL_MAX_BODIES];
+	};
+
+	// Each counter on a cache line of its own, readers polling published do not share a line with the slots
+	struct ComChannelHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slot_count;
+		uint32_t sample_size;
+		alignas(COM_CHANNEL_CACHE_LINE) std::atomic<uint64_t> published;		// samples published so far
+		alignas(COM_CHANNEL_CACHE_LINE) std::atomic<uint32_t> reader_count;	// readers open, a crashed one stays counted
+	};
+
+	// The shared memory: a ring of the latest COM_CHANNEL_SLOTS samples, one writer, any number of readers
+	struct ComChannel {
+		ComChannelHeader header;
+		ComChannelSample samples[COM_CHANNEL_SLOTS];
+	};
+
+	// Writer side, in PipeCOM
+	class ComPublisher {
+	public:
+		ComPublisher() = default;
+		~ComPublisher() { close(); }
+
+		ComPublisher(const ComPublisher&) = delete;
+		ComPublisher& operator=(const ComPublisher&) = delete;
+
+		int open(const std::string& name = COM_CHANNEL_DEFAULT_NAME);
+		void close();
+		bool is_open() const { return channel != NULL; }
+
+		// The next slot, odd until end_sample. Fill what the sample carries, index and sequence are set.
+		ComChannelSample& begin_sample();
+		void end_sample();
+
+		// Bodies of an analysed frame with segment_count segment COMs each
+		void publish(const BodyFrame& frame, uint32_t segment_count);
+
+		uint64_t get_published() const;
+		uint32_t get_reader_count() const;
+
+	private:
+		SharedMemory memory;
+		ComChannel* channel = NULL;
+		ComChannelSample* writing = NULL;
+	};
+
+	// Reader side, for the simulator and tools: polls the shared memory, no system calls after open
+	class ComSubscriber {
+	public:
+		ComSubscriber() = default;
+		~ComSubscriber() { close(); }
+
+		ComSubscriber(const ComSubscriber&) = delete;
+		ComSubscriber& operator=(const ComSubscriber&) = delete;
+
+		// FAILURE while no publisher has the channel open or its layout differs
+		int open(const std::string& name = COM_CHANNEL_DEFAULT_NAME);
+		void close();
+		bool is_open() const { return channel != NULL; }
+
+		// Newest sample, FAILURE when there is none yet or the publisher kept overwriting it
+		int read_latest(ComChannelSample& sample);
+
+		// The sample after the last one read, FAILURE when there is no newer one.
+		// Samples overwritten before they were read are skipped and counted by get_lost.
+		int read_next(ComChannelSample& sample);
+
+		uint64_t get_lost() const { return lost; }
+
+	private:
+		int read_slot(uint64_t index, ComChannelSample& sample) const;
+
+		SharedMemory memory;
+		const ComChannel* channel = NULL;
+		uint64_t next_index = 0;
+		uint64_t lost = 0;
+	};
+}
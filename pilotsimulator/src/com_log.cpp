@@ -0,0 +1,306 @@
+#include "pilotsimulator.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace pilotsimulator {
+
+	static const char COM_LOG_MAGIC[8] = { 'P', 'S', 'C', 'O', 'M', 'L', 'O', 'G' };
+
+	// How often the preparer looks for the writer's request. The writer only stores an atomic, not even a wake
+	// up, and a file lasts minutes to hours.
+	constexpr int COM_LOG_PREPARER_POLL_MS = 10;
+
+	uint32_t get_com_log_checksum(const ComLogRecord& record)
+	{
+		uint32_t words[sizeof(ComLogRecord) / sizeof(uint32_t)];
+		std::memcpy(words, &record, sizeof(ComLogRecord));
+		words[offsetof(ComLogRecord, checksum) / sizeof(uint32_t)] = 0;
+
+		// Four interleaved lanes keep the multiplies independent, then the lanes are hashed together
+		uint32_t lanes[4] = { 2166136261u, 2166136261u, 2166136261u, 2166136261u };
+		for (size_t i = 0; i < sizeof(words) / sizeof(uint32_t); i += 4)
+		{
+			for (int lane = 0; lane < 4; lane++) { lanes[lane] = (lanes[lane] ^ words[i + lane]) * 16777619u; }
+		}
+
+		uint32_t hash = 2166136261u;
+		for (uint32_t lane : lanes) { hash = (hash ^ lane) * 16777619u; }
+
+		return hash;
+	}
+
+	std::string get_com_log_path(const std::string& base_path, uint32_t file_index)
+	{
+		char suffix[32];
+		std::snprintf(suffix, sizeof(suffix), "_%04u.pscom", file_index);
+		return base_path + suffix;
+	}
+
+	ComLog::~ComLog()
+	{
+		close();
+	}
+
+	int ComLog::open(const std::string& base_path, uint64_t records_per_file)
+	{
+		close();
+
+		this->base_path = base_path;
+		this->records_per_file = records_per_file;
+		total_record_count = 0;
+		dropped_count = 0;
+
+		if (create_segment(current, 0) == FAILURE) { return FAILURE; }
+
+		// The next file is made while the first one fills
+		next_file_index = 1;
+		next_state = NEXT_EMPTY;
+		stopping = false;
+		preparer = std::thread(&ComLog::prepare_loop, this);
+
+		return SUCCESS;
+	}
+
+	void ComLog::close()
+	{
+		if (preparer.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(prepare_mutex);
+				stopping = true;
+			}
+			prepare_wake.notify_all();
+			preparer.join();
+		}
+
+		// Stopped before it got to them
+		close_segment(retired);
+
+		// The prepared file never got a record
+		if (next_state == NEXT_READY)
+		{
+			std::string path = get_com_log_path(base_path, next.file_index);
+			close_segment(next);
+			DeleteFileA(path.c_str());
+		}
+		next_state = NEXT_EMPTY;
+
+		close_segment(current);
+	}
+
+	int ComLog::append(ComLogRecord& record)
+	{
+		if (current.view == NULL) { return FAILURE; }
+
+		if (current.record_count == records_per_file)
+		{
+			int state = next_state.load(std::memory_order_acquire);
+			if (state != NEXT_READY)
+			{
+				// The preparer said why, the writer only asks again
+				if (state == NEXT_FAILED) { request_next(); }
+				dropped_count++;
+				return FAILURE;
+			}
+
+			retired = current;
+			current = next;
+			next = Segment();
+			next_file_index = current.file_index + 1;
+			request_next();
+		}
+
+		record.sequence = current.record_count + 1;
+		record.checksum = 0;
+		record.checksum = get_com_log_checksum(record);
+
+		std::memcpy(current.view + COM_LOG_HEADER_SIZE + current.record_count * sizeof(ComLogRecord), &record, sizeof(ComLogRecord));
+		current.record_count++;
+		total_record_count++;
+
+		return SUCCESS;
+	}
+
+	template<typename Model>
+	int ComLog::append_frame(const BodyFrame& frame, uint32_t flags)
+	{
+		uint64_t system_timestamp_usec = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+
+		for (uint32_t i = 0; i < frame.num_bodies; i++)
+		{
+			const k4abt_joint_t* joints = frame.bodies[i].skeleton.joints;
+
+			ComLogRecord record = {};
+			record.device_timestamp_usec = frame.device_timestamp_usec;
+			record.system_timestamp_usec = system_timestamp_usec;
+			record.body_id = frame.bodies[i].id;
+			record.flags = flags;
+			record.center_of_mass = frame.center_of_mass[i];
+
+			uint32_t valid_mask = COM_LOG_COM_VALID;
+			for (int segment = 0; segment < Model::SEGMENT_COUNT; segment++)
+			{
+				const SegmentDefinition& definition = Model::segments[segment];
+				record.body_segment_com[segment] = frame.body_segment_com[i][segment];
+
+				if (joints[definition.proximal_joint].confidence_level > K4ABT_JOINT_CONFIDENCE_NONE &&
+					joints[definition.distal_joint].confidence_level > K4ABT_JOINT_CONFIDENCE_NONE)
+				{
+					valid_mask |= 1u << segment;
+				}
+				else
+				{
+					valid_mask &= ~COM_LOG_COM_VALID;
+				}
+			}
+			record.valid_mask = valid_mask;
+
+			if (append(record) == FAILURE) { return FAILURE; }
+		}
+
+		return SUCCESS;
+	}
+
+	template int ComLog::append_frame<LegsAndTrunkModel>(const BodyFrame& frame, uint32_t flags);
+	template int ComLog::append_frame<FullBodyModel>(const BodyFrame& frame, uint32_t flags);
+	template int ComLog::append_frame<SeatedBodyModel>(const BodyFrame& frame, uint32_t flags);
+
+	int ComLog::create_segment(Segment& segment, uint32_t file_index)
+	{
+		std::string path = get_com_log_path(base_path, file_index);
+		LARGE_INTEGER size;
+		size.QuadPart = (LONGLONG)(COM_LOG_HEADER_SIZE + records_per_file * sizeof(ComLogRecord));
+
+		segment = Segment();
+		segment.file_index = file_index;
+		segment.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+		if (segment.file == INVALID_HANDLE_VALUE ||
+			!SetFilePointerEx(segment.file, size, NULL, FILE_BEGIN) ||
+			!SetEndOfFile(segment.file) ||
+			(segment.mapping = CreateFileMappingA(segment.file, NULL, PAGE_READWRITE, 0, 0, NULL)) == NULL ||
+			(segment.view = (uint8_t*)MapViewOfFile(segment.mapping, FILE_MAP_WRITE, 0, 0, 0)) == NULL)
+		{
+			std::cout << "Failed To Create COM Log " << path << "!" << std::endl;
+			close_segment(segment);
+			return FAILURE;
+		}
+
+		ComLogHeader header = {};
+		std::memcpy(header.magic, COM_LOG_MAGIC, sizeof(header.magic));
+		header.version = COM_LOG_VERSION;
+		header.header_size = (uint32_t)COM_LOG_HEADER_SIZE;
+		header.record_size = (uint32_t)sizeof(ComLogRecord);
+		header.segment_count = MAX_BODY_SEGMENTS;
+		header.file_index = file_index;
+		header.capacity = records_per_file;
+		header.created_system_usec = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+
+		// On disk before any record, so a crashed log can always be read back
+		std::memcpy(segment.view, &header, sizeof(header));
+		FlushViewOfFile(segment.view, COM_LOG_HEADER_SIZE);
+
+		// Fault every page in here rather than on the writer's append
+		const size_t PAGE_SIZE = 4096;
+		volatile uint8_t* page = segment.view + COM_LOG_HEADER_SIZE;
+		volatile uint8_t* end = segment.view + (size_t)size.QuadPart;
+		for (; page < end; page += PAGE_SIZE) { *page = 0; }
+
+		return SUCCESS;
+	}
+
+	void ComLog::close_segment(Segment& segment)
+	{
+		if (segment.view != NULL)
+		{
+			ComLogHeader* header = (ComLogHeader*)(void*)segment.view;
+			header->record_count = segment.record_count;
+			header->closed = 1;
+
+			FlushViewOfFile(segment.view, 0);
+			UnmapViewOfFile(segment.view);
+		}
+
+		if (segment.mapping != NULL) { CloseHandle(segment.mapping); }
+
+		if (segment.file != INVALID_HANDLE_VALUE)
+		{
+			// Drop the preallocated tail
+			if (segment.view != NULL)
+			{
+				LARGE_INTEGER size;
+				size.QuadPart = (LONGLONG)(COM_LOG_HEADER_SIZE + segment.record_count * sizeof(ComLogRecord));
+				SetFilePointerEx(segment.file, size, NULL, FILE_BEGIN);
+				SetEndOfFile(segment.file);
+			}
+
+			CloseHandle(segment.file);
+		}
+
+		segment = Segment();
+	}
+
+	// Hands next and retired to the preparer
+	void ComLog::request_next()
+	{
+		next_state.store(NEXT_EMPTY, std::memory_order_release);
+	}
+
+	void ComLog::prepare_loop()
+	{
+		std::unique_lock<std::mutex> lock(prepare_mutex);
+		while (!stopping)
+		{
+			if (next_state.load(std::memory_order_acquire) != NEXT_EMPTY)
+			{
+				prepare_wake.wait_for(lock, std::chrono::milliseconds(COM_LOG_PREPARER_POLL_MS));
+				continue;
+			}
+
+			lock.unlock();
+			close_segment(retired);
+			int state = create_segment(next, next_file_index) == SUCCESS ? NEXT_READY : NEXT_FAILED;
+			next_state.store(state, std::memory_order_release);
+			lock.lock();
+
+			// The writer asks again on its next record, a failing disk is tried once a second
+			if (state == NEXT_FAILED)
+			{
+				prepare_wake.wait_for(lock, std::chrono::seconds(1), [this] { return stopping.load(); });
+			}
+		}
+	}
+
+	int read_com_log(const std::string& path, ComLogHeader& header, std::vector<ComLogRecord>& records)
+	{
+		records.clear();
+
+		std::ifstream file(path, std::ios::binary);
+		if (!file.read((char*)&header, sizeof(header)) ||
+			std::memcmp(header.magic, COM_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != COM_LOG_VERSION ||
+			header.record_size != sizeof(ComLogRecord))
+		{
+			std::cout << "Not A COM Log: " << path << std::endl;
+			return FAILURE;
+		}
+
+		file.seekg(header.header_size);
+
+		ComLogRecord record;
+		while (file.read((char*)&record, sizeof(record)))
+		{
+			if (header.closed && records.size() == header.record_count) { break; }
+			if (record.sequence != records.size() + 1 || record.checksum != get_com_log_checksum(record)) { break; }
+
+			records.push_back(record);
+		}
+
+		return SUCCESS;
+	}
+}
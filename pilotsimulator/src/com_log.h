@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include <k4a/k4a.h>
+#include <k4abt.h>
+
+#include "com.h"
+
+namespace pilotsimulator {
+
+	constexpr uint32_t COM_LOG_VERSION = 1;
+	constexpr size_t COM_LOG_HEADER_SIZE = 4096;			// records start on a page
+	constexpr uint64_t COM_LOG_RECORDS_PER_FILE = 1 << 18;	// 64 MB, about 2.4 hours of one pilot at 30 fps
+
+	// ComLogRecord::flags
+	constexpr uint32_t COM_LOG_REFERENCE = 1 << 0;		// reference point set on this frame
+
+	// ComLogRecord::valid_mask: bit n for segment n of the model, COM_LOG_COM_VALID when all of them were
+	constexpr uint32_t COM_LOG_COM_VALID = 1u << 31;
+
+	// Written once when the file is created, record_count and closed only on a clean close
+	struct ComLogHeader {
+		char magic[8];					// "PSCOMLOG"
+		uint32_t version;
+		uint32_t header_size;
+		uint32_t record_size;
+		uint32_t segment_count;
+		uint32_t file_index;
+		uint32_t closed;
+		uint64_t capacity;
+		uint64_t record_count;
+		uint64_t created_system_usec;
+	};
+
+	// One body of one frame. Unwritten records are zero; sequence and checksum find the end after a crash.
+	struct ComLogRecord {
+		uint64_t sequence;				// 1 based within its file
+		uint64_t device_timestamp_usec;
+		uint64_t system_timestamp_usec;	// system_clock since the epoch, to line up with the simulator
+		uint32_t body_id;
+		uint32_t flags;
+		uint32_t valid_mask;
+		uint32_t checksum;				// get_com_log_checksum of the record with checksum 0
+		k4a_float3_t center_of_mass;
+		k4a_float3_t body_segment_com[MAX_BODY_SEGMENTS];
+		uint8_t reserved[12];
+	};
+	static_assert(sizeof(ComLogRecord) == 256, "ComLogRecord is a fixed 256 byte record");
+
+	// FNV-1a over four interleaved lanes of the record's 32 bit words, checksum taken as 0
+	uint32_t get_com_log_checksum(const ComLogRecord& record);
+
+	// Path of file file_index of a log, <base_path>_0000.pscom and on
+	std::string get_com_log_path(const std::string& base_path, uint32_t file_index);
+
+	// Append-only binary COM log. Each file is preallocated and mapped, so append is a copy into memory the OS
+	// writes back on its own, and survives the process crashing. A preparer thread living as long as the log
+	// creates the next file as soon as the current one opens, so rotation costs the writer only a pointer swap.
+	// append never waits on it: records that fill a file before the next one is ready are dropped and counted.
+	class ComLog {
+	public:
+		ComLog() {}
+		~ComLog();
+
+		ComLog(const ComLog&) = delete;
+		ComLog& operator=(const ComLog&) = delete;
+
+		int open(const std::string& base_path, uint64_t records_per_file = COM_LOG_RECORDS_PER_FILE);
+		void close();
+
+		// Fills sequence and checksum. FAILURE when the record was dropped.
+		int append(ComLogRecord& record);
+
+		// One record per body of an analysed frame, validity from the joint confidence of the model's segments.
+		// Instantiated for the models in com.h.
+		template<typename Model>
+		int append_frame(const BodyFrame& frame, uint32_t flags = 0);
+
+		uint64_t get_record_count() const { return total_record_count; }
+		uint64_t get_dropped_count() const { return dropped_count; }
+
+		// Whether the file after the current one is ready to take over
+		bool is_next_prepared() const { return next_state.load(std::memory_order_acquire) == NEXT_READY; }
+
+	private:
+		// Who owns next and retired: the preparer while NEXT_EMPTY, the writer otherwise
+		enum NextState {
+			NEXT_EMPTY,		// the preparer closes retired and creates next
+			NEXT_READY,
+			NEXT_FAILED		// the writer asks for another try
+		};
+
+		struct Segment {
+			HANDLE file = INVALID_HANDLE_VALUE;
+			HANDLE mapping = NULL;
+			uint8_t* view = NULL;
+			uint32_t file_index = 0;
+			uint64_t record_count = 0;
+		};
+
+		int create_segment(Segment& segment, uint32_t file_index);
+		void close_segment(Segment& segment);
+		void prepare_loop();
+		void request_next();
+
+		std::string base_path;
+		uint64_t records_per_file = 0;
+		uint64_t total_record_count = 0;
+		uint64_t dropped_count = 0;
+
+		Segment current;
+		Segment next;
+		Segment retired;
+		uint32_t next_file_index = 0;
+		std::atomic<int> next_state{ NEXT_EMPTY };
+		std::atomic<bool> stopping{ false };
+		std::mutex prepare_mutex;
+		std::condition_variable prepare_wake;
+		std::thread preparer;
+	};
+
+	// Records of one file up to the first unwritten or torn one
+	int read_com_log(const std::string& path, ComLogHeader& header, std::vector<ComLogRecord>& records);
+}
@@ -0,0 +1,359 @@
+#include "pilotsimulator.h"
+
+#include <cstring>
+
+namespace pilotsimulator {
+
+	static_assert(FRAME_BUS_MAX_BODIES >= MAX_BODIES, "A frame bus slot holds every body id of a frame");
+	static_assert(FRAME_BUS_SLOTS <= 0xFF, "The slot of the newest frame takes a byte of latest");
+
+	// Attempts at the newest frame while the writer keeps replacing it
+	constexpr int FRAME_BUS_ACQUIRE_ATTEMPTS = 100;
+
+	static uint64_t get_steady_nsec()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static size_t align_up(size_t size, size_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	static uint32_t get_lease_count(uint64_t leases)
+	{
+		return (uint32_t)leases;
+	}
+
+	static uint32_t get_reclaim_epoch(uint64_t leases)
+	{
+		return (uint32_t)(leases >> 32);
+	}
+
+	// Only a lease of the slot's current epoch is given back: one the writer took back is not given back twice,
+	// nor off the leases of the readers after it
+	static void drop_lease(FrameBusSlot& slot, uint32_t epoch)
+	{
+		uint64_t leases = slot.leases.load(std::memory_order_relaxed);
+		while (get_reclaim_epoch(leases) == epoch && get_lease_count(leases) > 0 &&
+			!slot.leases.compare_exchange_weak(leases, leases - 1, std::memory_order_release)) {}
+	}
+
+	FrameBusFormat get_frame_bus_format(const k4a_calibration_t& calibration, bool color)
+	{
+		FrameBusFormat format = {};
+		const k4a_calibration_camera_t& color_camera = calibration.color_camera_calibration;
+		const k4a_calibration_camera_t& depth_camera = calibration.depth_camera_calibration;
+
+		if (color && calibration.color_resolution != K4A_COLOR_RESOLUTION_OFF)
+		{
+			format.images[FRAME_BUS_COLOR] = { (uint32_t)color_camera.resolution_width, (uint32_t)color_camera.resolution_height,
+				(uint32_t)color_camera.resolution_width * 4, (uint32_t)K4A_IMAGE_FORMAT_COLOR_BGRA32 };
+		}
+
+		format.images[FRAME_BUS_DEPTH] = { (uint32_t)depth_camera.resolution_width, (uint32_t)depth_camera.resolution_height,
+			(uint32_t)depth_camera.resolution_width * (uint32_t)sizeof(uint16_t), (uint32_t)K4A_IMAGE_FORMAT_DEPTH16 };
+		format.images[FRAME_BUS_BODY_INDEX] = { (uint32_t)depth_camera.resolution_width, (uint32_t)depth_camera.resolution_height,
+			(uint32_t)depth_camera.resolution_width, (uint32_t)K4A_IMAGE_FORMAT_CUSTOM8 };
+
+		return format;
+	}
+
+	int FrameBusWriter::open(const std::string& name, const FrameBusFormat& format, int lease_timeout_ms)
+	{
+		close();
+
+		// Each slot's images one after another, the slots one page apart
+		FrameBusImage images[FRAME_BUS_IMAGE_COUNT] = {};
+		size_t slot_data_size = 0;
+		for (int kind = 0; kind < FRAME_BUS_IMAGE_COUNT; kind++)
+		{
+			const FrameBusImageFormat& image_format = format.images[kind];
+			images[kind].format = image_format;
+			images[kind].offset = slot_data_size;
+			slot_data_size += align_up((size_t)image_format.stride_bytes * image_format.height, FRAME_BUS_IMAGE_ALIGNMENT);
+		}
+		slot_data_size = align_up(slot_data_size, FRAME_BUS_PAGE);
+
+		size_t data_offset = align_up(sizeof(FrameBusHeader), FRAME_BUS_PAGE);
+		size_t size = data_offset + FRAME_BUS_SLOTS * slot_data_size;
+
+		if (memory.create(name, size) == FAILURE) { return FAILURE; }
+		header = (FrameBusHeader*)memory.get_data();
+
+		// A mapping left by a writer that crashed starts over
+		header->magic = 0;
+		header->latest.store(0, std::memory_order_relaxed);
+		for (uint32_t i = 0; i < FRAME_BUS_SLOTS; i++)
+		{
+			FrameBusSlot& slot = header->slots[i];
+			slot.generation.store(0, std::memory_order_relaxed);
+			slot.leases.store(0, std::memory_order_relaxed);
+			for (int kind = 0; kind < FRAME_BUS_IMAGE_COUNT; kind++)
+			{
+				slot.images[kind] = images[kind];
+				slot.images[kind].offset += data_offset + i * slot_data_size;
+			}
+		}
+
+		header->version = FRAME_BUS_VERSION;
+		header->slot_count = FRAME_BUS_SLOTS;
+		header->size = size;
+		header->data_offset = data_offset;
+		header->slot_data_size = slot_data_size;
+		header->format = format;
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = FRAME_BUS_MAGIC;
+
+		this->lease_timeout_ms = lease_timeout_ms;
+		next_slot = 0;
+		next_index = 0;
+		stats = FrameBusStats();
+		for (uint64_t& since : leased_since_nsec) { since = 0; }
+
+		return SUCCESS;
+	}
+
+	void FrameBusWriter::close()
+	{
+		header = NULL;
+		writing = NULL;
+		memory.close();
+	}
+
+	FrameBusSlot* FrameBusWriter::begin_frame()
+	{
+		uint64_t now = get_steady_nsec();
+
+		for (uint32_t attempt = 0; attempt < FRAME_BUS_SLOTS; attempt++)
+		{
+			uint32_t slot_number = (next_slot + attempt) % FRAME_BUS_SLOTS;
+			FrameBusSlot& slot = header->slots[slot_number];
+			uint64_t& since = leased_since_nsec[slot_number];
+
+			// A leased slot is passed over without touching its generation
+			uint64_t leases = slot.leases.load(std::memory_order_seq_cst);
+			if (get_lease_count(leases) != 0)
+			{
+				if (since == 0) { since = now; }
+
+				// Held past the timeout by a reader too slow or gone. The next epoch tells it the lease is gone,
+				// a lease taken or given back meanwhile leaves the slot to the next frame.
+				if (now - since < (uint64_t)lease_timeout_ms * 1000000 ||
+					!slot.leases.compare_exchange_strong(leases, (uint64_t)(get_reclaim_epoch(leases) + 1) << 32, std::memory_order_seq_cst))
+				{
+					stats.skipped++;
+					continue;
+				}
+				stats.reclaimed++;
+			}
+
+			// Odd first, then the leases again: a reader leasing at the same time either sees the odd generation
+			// and backs out, or its lease is seen here and the slot is left alone. Its lease stays valid either way.
+			uint64_t generation = slot.generation.load(std::memory_order_relaxed);
+			slot.generation.store(generation + 1, std::memory_order_seq_cst);
+			if (get_lease_count(slot.leases.load(std::memory_order_seq_cst)) != 0)
+			{
+				slot.generation.store(generation, std::memory_order_seq_cst);
+				if (since == 0) { since = now; }
+				stats.skipped++;
+				continue;
+			}
+
+			leased_since_nsec[slot_number] = 0;
+			std::atomic_thread_fence(std::memory_order_release);
+
+			next_slot = (slot_number + 1) % FRAME_BUS_SLOTS;
+			writing = &slot;
+			writing->index = next_index;
+			writing->num_bodies = 0;
+			for (FrameBusImage& image : writing->images) { image.size = (uint64_t)image.format.stride_bytes * image.format.height; }
+
+			return writing;
+		}
+
+		stats.dropped++;
+		return NULL;
+	}
+
+	uint8_t* FrameBusWriter::get_image_data(FrameBusImageKind kind)
+	{
+		const FrameBusImage& image = writing->images[kind];
+		return image.format.width > 0 ? (uint8_t*)memory.get_data() + image.offset : NULL;
+	}
+
+	void FrameBusWriter::set_image_size(FrameBusImageKind kind, uint64_t size)
+	{
+		FrameBusImage& image = writing->images[kind];
+		image.size = (std::min)(size, (uint64_t)image.format.stride_bytes * image.format.height);
+	}
+
+	void FrameBusWriter::end_frame()
+	{
+		uint64_t index = writing->index;
+		uint32_t slot_number = (uint32_t)(writing - header->slots);
+		writing->publish_steady_nsec = get_steady_nsec();
+
+		writing->generation.store(2 * (index + 1), std::memory_order_release);
+		header->latest.store((index + 1) << 8 | slot_number, std::memory_order_release);
+
+		next_index++;
+		stats.published++;
+		writing = NULL;
+	}
+
+	int FrameBusWriter::publish(const BodyFrame& frame)
+	{
+		if (begin_frame() == NULL) { return FAILURE; }
+
+		writing->frame_id = frame.frame_id;
+		writing->device_timestamp_usec = frame.device_timestamp_usec;
+		writing->num_bodies = (std::min)(frame.num_bodies, FRAME_BUS_MAX_BODIES);
+		for (uint32_t i = 0; i < writing->num_bodies; i++) { writing->body_ids[i] = frame.bodies[i].id; }
+
+		k4a_image_t images[FRAME_BUS_IMAGE_COUNT] = {};
+		if (frame.capture != NULL)
+		{
+			images[FRAME_BUS_COLOR] = k4a_capture_get_color_image(frame.capture);
+			images[FRAME_BUS_DEPTH] = k4a_capture_get_depth_image(frame.capture);
+		}
+		if (frame.body_index_map != NULL)
+		{
+			k4a_image_reference(frame.body_index_map);
+			images[FRAME_BUS_BODY_INDEX] = frame.body_index_map;
+		}
+
+		// Row by row, the SDK's stride may differ from the bus's
+		for (int kind = 0; kind < FRAME_BUS_IMAGE_COUNT; kind++)
+		{
+			const FrameBusImageFormat& format = writing->images[kind].format;
+			k4a_image_t image = images[kind];
+			uint8_t* data = get_image_data((FrameBusImageKind)kind);
+
+			if (image == NULL || data == NULL ||
+				k4a_image_get_width_pixels(image) != (int)format.width || k4a_image_get_height_pixels(image) != (int)format.height ||
+				k4a_image_get_format(image) != (k4a_image_format_t)format.format)
+			{
+				set_image_size((FrameBusImageKind)kind, 0);
+			}
+			else
+			{
+				const uint8_t* source = k4a_image_get_buffer(image);
+				size_t source_stride = (size_t)k4a_image_get_stride_bytes(image);
+				size_t row_size = (std::min)(source_stride, (size_t)format.stride_bytes);
+
+				if (source_stride == format.stride_bytes)
+				{
+					std::memcpy(data, source, (size_t)format.stride_bytes * format.height);
+				}
+				else
+				{
+					for (uint32_t row = 0; row < format.height; row++)
+					{
+						std::memcpy(data + row * format.stride_bytes, source + row * source_stride, row_size);
+					}
+				}
+			}
+
+			if (image != NULL) { k4a_image_release(image); }
+		}
+
+		end_frame();
+
+		return SUCCESS;
+	}
+
+	FrameLease& FrameLease::operator=(FrameLease&& other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			base = other.base;
+			slot = other.slot;
+			epoch = other.epoch;
+			other.slot = NULL;
+		}
+
+		return *this;
+	}
+
+	bool FrameLease::is_valid() const
+	{
+		if (slot == NULL) { return false; }
+
+		// After the reads of the frame, so a reclaim while they ran shows
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return get_reclaim_epoch(slot->leases.load(std::memory_order_relaxed)) == epoch;
+	}
+
+	void FrameLease::release()
+	{
+		if (slot == NULL) { return; }
+
+		drop_lease(*slot, epoch);
+		slot = NULL;
+	}
+
+	const uint8_t* FrameLease::get_image_data(FrameBusImageKind kind) const
+	{
+		const FrameBusImage& image = slot->images[kind];
+		return image.size > 0 ? base + image.offset : NULL;
+	}
+
+	int FrameBusReader::open(const std::string& name)
+	{
+		close();
+
+		// The header says how large the whole mapping is
+		SharedMemory header_memory;
+		if (header_memory.open(name, sizeof(FrameBusHeader)) == FAILURE) { return FAILURE; }
+
+		const FrameBusHeader& shared = *(const FrameBusHeader*)header_memory.get_data();
+		if (shared.magic != FRAME_BUS_MAGIC || shared.version != FRAME_BUS_VERSION || shared.slot_count != FRAME_BUS_SLOTS)
+		{
+			return FAILURE;
+		}
+		size_t size = (size_t)shared.size;
+		header_memory.close();
+
+		if (memory.open(name, size) == FAILURE) { return FAILURE; }
+		header = (FrameBusHeader*)memory.get_data();
+
+		return SUCCESS;
+	}
+
+	void FrameBusReader::close()
+	{
+		header = NULL;
+		memory.close();
+	}
+
+	int FrameBusReader::acquire_latest(FrameLease& lease)
+	{
+		lease.release();
+
+		for (int attempt = 0; attempt < FRAME_BUS_ACQUIRE_ATTEMPTS; attempt++)
+		{
+			uint64_t latest = header->latest.load(std::memory_order_acquire);
+			if (latest == 0) { return FAILURE; }
+
+			FrameBusSlot& slot = header->slots[(latest & 0xFF) % FRAME_BUS_SLOTS];
+			uint64_t generation = 2 * (latest >> 8);
+
+			// Lease first, then the generation, the other way round from the writer
+			uint32_t epoch = get_reclaim_epoch(slot.leases.fetch_add(1, std::memory_order_seq_cst));
+			if (slot.generation.load(std::memory_order_seq_cst) == generation)
+			{
+				lease.base = (const uint8_t*)memory.get_data();
+				lease.slot = &slot;
+				lease.epoch = epoch;
+				return SUCCESS;
+			}
+
+			drop_lease(slot, epoch);
+		}
+
+		return FAILURE;
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "shared_memory.h"
+
+// Layout and reader of the frame bus, free of the Azure Kinect and OpenCV headers like com_channel.h so a
+// visualizer can include it as it is.
+
+namespace pilotsimulator {
+
+	struct BodyFrame;
+
+	constexpr uint32_t FRAME_BUS_MAGIC = 0x42465350;		// "PSFB"
+	constexpr uint32_t FRAME_BUS_VERSION = 2;
+	constexpr uint32_t FRAME_BUS_SLOTS = 6;
+	constexpr uint32_t FRAME_BUS_MAX_BODIES = 16;
+	constexpr size_t FRAME_BUS_PAGE = 4096;				// every slot's images start on a page
+	constexpr size_t FRAME_BUS_IMAGE_ALIGNMENT = 64;
+	constexpr int FRAME_BUS_LEASE_TIMEOUT_MS = 1000;
+	constexpr char FRAME_BUS_DEFAULT_NAME[] = "pilotsimulator_frames";
+
+	enum FrameBusImageKind {
+		FRAME_BUS_COLOR,		// BGRA32
+		FRAME_BUS_DEPTH,		// DEPTH16
+		FRAME_BUS_BODY_INDEX,	// CUSTOM8, K4ABT_BODY_INDEX_MAP_BACKGROUND where there is no body
+		FRAME_BUS_IMAGE_COUNT
+	};
+
+	// What a slot holds room for, a width of 0 for an image the bus does not carry
+	struct FrameBusImageFormat {
+		uint32_t width;
+		uint32_t height;
+		uint32_t stride_bytes;
+		uint32_t format;		// k4a_image_format_t
+	};
+
+	struct FrameBusFormat {
+		FrameBusImageFormat images[FRAME_BUS_IMAGE_COUNT];
+	};
+
+	// One image of a slot, size 0 when the frame came without it
+	struct FrameBusImage {
+		FrameBusImageFormat format;
+		uint64_t offset;		// from the start of the mapping
+		uint64_t size;
+	};
+
+	// A frame. generation is odd while the writer fills the slot and 2 * (index + 1) once frame index is in it.
+	// leases is the reclaim epoch << 32 | the readers mapping the slot. The writer passes over a slot with leases
+	// and moves the epoch on when it takes back leases held past the timeout, which is what tells their readers.
+	struct alignas(64) FrameBusSlot {
+		std::atomic<uint64_t> generation;
+		std::atomic<uint64_t> leases;
+		uint32_t num_bodies;
+		uint64_t index;
+		uint64_t frame_id;
+		uint64_t device_timestamp_usec;
+		uint64_t publish_steady_nsec;		// steady clock of the machine when published
+		uint32_t body_ids[FRAME_BUS_MAX_BODIES];
+		FrameBusImage images[FRAME_BUS_IMAGE_COUNT];
+	};
+
+	// Start of the shared memory, the slots' images follow from data_offset on
+	struct FrameBusHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slot_count;
+		uint32_t reserved;
+		uint64_t size;				// of the whole mapping
+		uint64_t data_offset;
+		uint64_t slot_data_size;
+		FrameBusFormat format;
+		alignas(64) std::atomic<uint64_t> latest;		// (index + 1) << 8 | slot of the newest frame, 0 before the first
+		FrameBusSlot slots[FRAME_BUS_SLOTS];
+	};
+
+	struct FrameBusStats {
+		uint64_t published = 0;
+		uint64_t dropped = 0;		// every slot was leased
+		uint64_t skipped = 0;		// leased slots passed over
+		uint64_t reclaimed = 0;		// leases held past the timeout and taken back
+	};
+
+	// Producer side: copies each frame once into a free slot, or lets the caller fill one in place
+	class FrameBusWriter {
+	public:
+		FrameBusWriter() = default;
+		~FrameBusWriter() { close(); }
+
+		FrameBusWriter(const FrameBusWriter&) = delete;
+		FrameBusWriter& operator=(const FrameBusWriter&) = delete;
+
+		// A lease held longer than lease_timeout_ms is taken back, the reader finds it no longer valid
+		int open(const std::string& name, const FrameBusFormat& format, int lease_timeout_ms = FRAME_BUS_LEASE_TIMEOUT_MS);
+		void close();
+		bool is_open() const { return header != NULL; }
+
+		// A free slot to fill, NULL when readers hold every one. Fill the images through get_image_data and
+		// the metadata, then end_frame. Sizes default to the full image, 0 for images set_image_size says are missing.
+		FrameBusSlot* begin_frame();
+		uint8_t* get_image_data(FrameBusImageKind kind);
+		const FrameBusImageFormat& get_image_format(FrameBusImageKind kind) const { return header->format.images[kind]; }
+		void set_image_size(FrameBusImageKind kind, uint64_t size);
+		void end_frame();
+
+		// The frame's colour and depth images and its body index map, each copied when it has the bus's format.
+		// FAILURE when the frame was dropped.
+		int publish(const BodyFrame& frame);
+
+		FrameBusStats get_stats() const { return stats; }
+
+	private:
+		SharedMemory memory;
+		FrameBusHeader* header = NULL;
+		FrameBusSlot* writing = NULL;
+		uint32_t next_slot = 0;
+		uint64_t next_index = 0;
+		int lease_timeout_ms = FRAME_BUS_LEASE_TIMEOUT_MS;
+		uint64_t leased_since_nsec[FRAME_BUS_SLOTS] = {};	// when a slot was first found leased, 0 when free
+		FrameBusStats stats;
+	};
+
+	// A reader's hold on one frame: its images stay in place until release, or until the writer takes the
+	// slot back from a lease held past its timeout, which is_valid tells after the fact
+	class FrameLease {
+	public:
+		FrameLease() = default;
+		~FrameLease() { release(); }
+
+		FrameLease(const FrameLease&) = delete;
+		FrameLease& operator=(const FrameLease&) = delete;
+		FrameLease(FrameLease&& other) noexcept { *this = std::move(other); }
+		FrameLease& operator=(FrameLease&& other) noexcept;
+
+		bool is_held() const { return slot != NULL; }
+		bool is_valid() const;
+		void release();
+
+		const FrameBusSlot& get_slot() const { return *slot; }
+		uint64_t get_index() const { return slot->index; }
+
+		// NULL when the frame came without the image
+		const uint8_t* get_image_data(FrameBusImageKind kind) const;
+		const FrameBusImageFormat& get_image_format(FrameBusImageKind kind) const { return slot->images[kind].format; }
+
+	private:
+		friend class FrameBusReader;
+
+		const uint8_t* base = NULL;
+		FrameBusSlot* slot = NULL;
+		uint32_t epoch = 0;		// of the slot's leases when this one was taken
+	};
+
+	// Visualizer side: maps the bus and leases frames, no copy and no system call after open
+	class FrameBusReader {
+	public:
+		FrameBusReader() = default;
+		~FrameBusReader() { close(); }
+
+		FrameBusReader(const FrameBusReader&) = delete;
+		FrameBusReader& operator=(const FrameBusReader&) = delete;
+
+		// FAILURE while no writer has the bus open or its layout differs
+		int open(const std::string& name = FRAME_BUS_DEFAULT_NAME);
+		void close();
+		bool is_open() const { return header != NULL; }
+
+		const FrameBusFormat& get_format() const { return header->format; }
+
+		// Lease of the newest frame, FAILURE when there is none yet or the writer kept replacing it.
+		// Leases have to be released before the reader closes.
+		int acquire_latest(FrameLease& lease);
+
+	private:
+		SharedMemory memory;
+		FrameBusHeader* header = NULL;
+	};
+}
@@ -0,0 +1,492 @@
+#include "pilotsimulator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace pilotsimulator {
+
+	void FrameSource::pace(uint64_t timestamp_usec)
+	{
+		if (clock_mode == FAST_CLOCK) { return; }
+
+		if (!clock_started)
+		{
+			clock_started = true;
+			first_timestamp_usec = timestamp_usec;
+			clock_start = std::chrono::steady_clock::now();
+			return;
+		}
+
+		if (timestamp_usec < first_timestamp_usec) { return; }
+
+		std::this_thread::sleep_until(clock_start + std::chrono::microseconds(timestamp_usec - first_timestamp_usec));
+	}
+
+	uint64_t FrameSource::get_clock_usec() const
+	{
+		if (clock_mode == FAST_CLOCK || !clock_started) { return 0; }
+
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - clock_start);
+		return first_timestamp_usec + (uint64_t)elapsed.count();
+	}
+
+	void FrameSource::discard_captures(uint64_t count)
+	{
+		if (count == 0) { return; }
+
+		discarded_captures += count;
+		get_pipeline_metrics().captures_discarded.add(count);
+	}
+
+	DeviceFrameSource::~DeviceFrameSource()
+	{
+		if (device != NULL)
+		{
+			k4a_device_stop_cameras(device);
+			k4a_device_close(device);
+		}
+	}
+
+	int DeviceFrameSource::open()
+	{
+		if (get_device(device) == FAILURE) { return FAILURE; }
+
+		return start_camera(device, device_config, color_enabled);
+	}
+
+	int DeviceFrameSource::get_capture(k4a_capture_t& capture)
+	{
+		if (!latest_only) { return pilotsimulator::get_capture(device, capture); }
+
+		uint64_t discarded = 0;
+		int result = get_latest_capture(device, capture, discarded);
+		discard_captures(discarded);
+
+		return result;
+	}
+
+	int DeviceFrameSource::get_calibration(k4a_calibration_t& calibration)
+	{
+		return pilotsimulator::get_calibration(device, device_config, calibration);
+	}
+
+	RecordingFrameSource::~RecordingFrameSource()
+	{
+		if (playback != NULL)
+		{
+			k4a_playback_close(playback);
+		}
+	}
+
+	// Step of the device timestamps at each camera rate
+	static uint64_t get_frame_period_usec(k4a_fps_t fps)
+	{
+		switch (fps)
+		{
+		case K4A_FRAMES_PER_SECOND_5:
+			return 200000;
+		case K4A_FRAMES_PER_SECOND_15:
+			return 66667;
+		default:
+			return 33333;
+		}
+	}
+
+	int RecordingFrameSource::open()
+	{
+		if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+		{
+			std::cout << "Failed To Open Recording " << path << "!" << std::endl;
+			return FAILURE;
+		}
+
+		// The rest of the code works on BGRA32 whatever the recording was made with. Without colour the
+		// images stay as recorded, nothing looks at them and MJPEG is not decoded.
+		if (color_enabled && K4A_FAILED(k4a_playback_set_color_conversion(playback, K4A_IMAGE_FORMAT_COLOR_BGRA32)))
+		{
+			std::cout << "Failed To Set Color Conversion!" << std::endl;
+			return FAILURE;
+		}
+
+		k4a_record_configuration_t record_config;
+		if (K4A_FAILED(k4a_playback_get_record_configuration(playback, &record_config)))
+		{
+			std::cout << "Failed To Read The Recording Configuration!" << std::endl;
+			return FAILURE;
+		}
+		frame_period_usec = get_frame_period_usec(record_config.camera_fps);
+
+		std::cout << "Opened Recording: " << path << std::endl << std::endl;
+
+		return SUCCESS;
+	}
+
+	int RecordingFrameSource::get_capture(k4a_capture_t& capture)
+	{
+		if (read_capture(capture) == FAILURE) { return FAILURE; }
+
+		// A capture more than a frame behind the clock already has a newer one after it. At the end of the
+		// recording the last one read goes out, the next read reports the end.
+		while (latest_only && last_timestamp_usec + frame_period_usec < get_clock_usec())
+		{
+			k4a_capture_t newer = NULL;
+			if (read_capture(newer) == FAILURE) { break; }
+
+			k4a_capture_release(capture);
+			capture = newer;
+			discard_captures(1);
+		}
+
+		pace(last_timestamp_usec);
+
+		return SUCCESS;
+	}
+
+	int RecordingFrameSource::read_capture(k4a_capture_t& capture)
+	{
+		switch (k4a_playback_get_next_capture(playback, &capture))
+		{
+		case K4A_STREAM_RESULT_SUCCEEDED:
+			break;
+		case K4A_STREAM_RESULT_EOF:
+			if (!loop)
+			{
+				std::cout << "End Of Recording!" << std::endl;
+				return FAILURE;
+			}
+
+			// Keep the clock running across the restart
+			loop_offset_usec = last_timestamp_usec + frame_period_usec;
+			k4a_playback_seek_timestamp(playback, 0, K4A_PLAYBACK_SEEK_BEGIN);
+			if (k4a_playback_get_next_capture(playback, &capture) != K4A_STREAM_RESULT_SUCCEEDED)
+			{
+				std::cout << "Failed To Read A Capture!" << std::endl;
+				return FAILURE;
+			}
+			break;
+		default:
+			std::cout << "Failed To Read A Capture!" << std::endl;
+			return FAILURE;
+		}
+
+		k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+		if (depth_image != NULL)
+		{
+			last_timestamp_usec = loop_offset_usec + k4a_image_get_device_timestamp_usec(depth_image);
+			k4a_image_release(depth_image);
+		}
+
+		return SUCCESS;
+	}
+
+	int RecordingFrameSource::get_calibration(k4a_calibration_t& calibration)
+	{
+		if (K4A_FAILED(k4a_playback_get_calibration(playback, &calibration)))
+		{
+			std::cout << "Failed to get calibration" << std::endl;
+			return FAILURE;
+		}
+
+		return SUCCESS;
+	}
+
+	int SyntheticFrameSource::open()
+	{
+		get_synthetic_calibration(calibration);
+		generator.reset(new SyntheticBodyGenerator(calibration, body_config));
+		body_index_map.resize((size_t)SYNTHETIC_DEPTH_WIDTH * SYNTHETIC_DEPTH_HEIGHT);
+
+		std::cout << "Opened Synthetic Source" << std::endl << std::endl;
+
+		return SUCCESS;
+	}
+
+	int SyntheticFrameSource::get_capture(k4a_capture_t& capture)
+	{
+		if (frame_count != 0 && frame_id >= frame_count)
+		{
+			return FAILURE;
+		}
+
+		// Frames the clock has passed are never made, the newest one due is. The last frame always goes out.
+		if (latest_only)
+		{
+			uint64_t due_id = get_clock_usec() / SYNTHETIC_FRAME_PERIOD_USEC;
+			if (frame_count != 0) { due_id = (std::min)(due_id, frame_count - 1); }
+			if (due_id > frame_id)
+			{
+				discard_captures(due_id - frame_id);
+				frame_id = due_id;
+			}
+		}
+
+		uint64_t timestamp_usec = frame_id * SYNTHETIC_FRAME_PERIOD_USEC;
+		k4a_image_t color_image = NULL;
+		k4a_image_t depth_image = NULL;
+
+		if (K4A_FAILED(k4a_capture_create(&capture)) ||
+			(color_enabled && get_image_pool().create_image(
+				K4A_IMAGE_FORMAT_COLOR_BGRA32,
+				SYNTHETIC_COLOR_WIDTH,
+				SYNTHETIC_COLOR_HEIGHT,
+				SYNTHETIC_COLOR_WIDTH * 4 * (int)sizeof(uint8_t),
+				color_image) == FAILURE) ||
+			get_image_pool().create_image(
+				K4A_IMAGE_FORMAT_DEPTH16,
+				SYNTHETIC_DEPTH_WIDTH,
+				SYNTHETIC_DEPTH_HEIGHT,
+				SYNTHETIC_DEPTH_WIDTH * (int)sizeof(uint16_t),
+				depth_image) == FAILURE)
+		{
+			std::cout << "Failed To Create A Synthetic Capture!" << std::endl;
+			if (color_image != NULL) { k4a_image_release(color_image); }
+			if (capture != NULL) { k4a_capture_release(capture); capture = NULL; }
+			return FAILURE;
+		}
+
+		// Horizontal bands that scroll one row per frame, so consecutive frames differ
+		if (color_image != NULL)
+		{
+			uint8_t* color_image_buffer = k4a_image_get_buffer(color_image);
+			for (int row = 0; row < SYNTHETIC_COLOR_HEIGHT; row++)
+			{
+				uint8_t shade = (uint8_t)((row + frame_id) & 0xFF);
+				std::memset(color_image_buffer + (size_t)row * SYNTHETIC_COLOR_WIDTH * 4, shade, (size_t)SYNTHETIC_COLOR_WIDTH * 4);
+			}
+			k4a_image_set_device_timestamp_usec(color_image, timestamp_usec);
+			k4a_capture_set_color_image(capture, color_image);
+			k4a_image_release(color_image);
+		}
+
+		// The body index map is thrown away, MockBodyTracker renders its own from the same timestamp
+		uint16_t* depth_image_buffer = (uint16_t*)(void*)k4a_image_get_buffer(depth_image);
+		generator->render(timestamp_usec, depth_image_buffer, body_index_map.data());
+
+		k4a_image_set_device_timestamp_usec(depth_image, timestamp_usec);
+
+		// The capture takes its own references
+		k4a_capture_set_depth_image(capture, depth_image);
+		k4a_image_release(depth_image);
+
+		frame_id++;
+		pace(timestamp_usec);
+
+		return SUCCESS;
+	}
+
+	int SyntheticFrameSource::get_calibration(k4a_calibration_t& calibration)
+	{
+		calibration = this->calibration;
+
+		return SUCCESS;
+	}
+
+	// Of the last get_frame_source, read by the is_ functions
+	static ProgramOptions program_options;
+
+	bool is_headless()
+	{
+		return program_options.headless;
+	}
+
+	bool is_latest_only()
+	{
+		return program_options.latest;
+	}
+
+	PipelineConfig get_pipeline_config()
+	{
+		return program_options.latest ? get_low_latency_pipeline_config() : PipelineConfig();
+	}
+
+	bool is_frame_bus_enabled()
+	{
+		return program_options.frame_bus;
+	}
+
+	static void print_usage(const char* program)
+	{
+		std::cout << "Usage: " << program << " [--recording <file.mkv> [--loop] | --synthetic [frames] [--bodies <n>]] [--fast] [--trace <file.json>] [--perf-counters [file.csv]] [--metrics [port]] [--huge-pages] [--headless] [--udp <host:port> [--udp-format binary|xplane|flightgear]] [--frame-bus] [--latest]" << std::endl;
+	}
+
+	// Whole decimal number from minimum to maximum, anything else is a bad argument rather than an exception
+	static int get_number(const char* text, uint64_t minimum, uint64_t maximum, uint64_t& number)
+	{
+		if (!isdigit((unsigned char)text[0])) { return FAILURE; }
+
+		char* end = NULL;
+		errno = 0;
+		unsigned long long parsed = strtoull(text, &end, 10);
+		if (errno == ERANGE || *end != '\0' || parsed < minimum || parsed > maximum) { return FAILURE; }
+
+		number = parsed;
+
+		return SUCCESS;
+	}
+
+	// Number following argv[i] when there is one, i moved past it. FAILURE only for a value that is not a number in range.
+	static int get_optional_number(int argc, char* argv[], int& i, uint64_t minimum, uint64_t maximum, uint64_t& number)
+	{
+		if (i + 1 >= argc || argv[i + 1][0] == '-') { return SUCCESS; }
+
+		return get_number(argv[++i], minimum, maximum, number);
+	}
+
+	int parse_program_options(int argc, char* argv[], ProgramOptions& options)
+	{
+		options = ProgramOptions();
+		uint64_t number = 0;
+
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			bool valid = true;
+
+			if (arg == "--recording" && i + 1 < argc)
+			{
+				options.recording_path = argv[++i];
+			}
+			else if (arg == "--synthetic")
+			{
+				options.synthetic = true;
+				valid = get_optional_number(argc, argv, i, 0, UINT64_MAX, options.synthetic_frames) == SUCCESS;
+			}
+			else if (arg == "--bodies" && i + 1 < argc && get_number(argv[i + 1], 0, UINT64_MAX, number) == SUCCESS)
+			{
+				options.body_config.num_bodies = (uint32_t)(std::min)(number, (uint64_t)MAX_BODIES);
+				i++;
+			}
+			else if (arg == "--loop")
+			{
+				options.loop = true;
+			}
+			else if (arg == "--fast")
+			{
+				options.fast = true;
+			}
+			else if (arg == "--trace" && i + 1 < argc)
+			{
+				options.trace_path = argv[++i];
+			}
+			else if (arg == "--metrics")
+			{
+				number = METRICS_DEFAULT_PORT;
+				valid = get_optional_number(argc, argv, i, 1, 65535, number) == SUCCESS;
+				options.metrics_port = (int)number;
+			}
+			else if (arg == "--perf-counters")
+			{
+				options.perf_counters = true;
+				if (i + 1 < argc && argv[i + 1][0] != '-')
+				{
+					options.perf_counters_path = argv[++i];
+				}
+			}
+			else if (arg == "--huge-pages")
+			{
+				options.allocator_config.huge_pages = true;
+			}
+			else if (arg == "--headless")
+			{
+				options.headless = true;
+			}
+			else if (arg == "--udp" && i + 1 < argc)
+			{
+				options.udp_destination = argv[++i];
+			}
+			else if (arg == "--udp-format" && i + 1 < argc && get_udp_format(argv[i + 1], options.udp_format) == SUCCESS)
+			{
+				i++;
+			}
+			else if (arg == "--frame-bus")
+			{
+				options.frame_bus = true;
+			}
+			else if (arg == "--latest")
+			{
+				options.latest = true;
+			}
+			else
+			{
+				valid = false;
+			}
+
+			if (!valid)
+			{
+				print_usage(argv[0]);
+				return FAILURE;
+			}
+		}
+
+		return SUCCESS;
+	}
+
+	int start_services(const ProgramOptions& options)
+	{
+		// Written when the process exits
+		if (!options.trace_path.empty() && start_trace(options.trace_path) == FAILURE) { return FAILURE; }
+
+		if (options.metrics_port != 0 && start_metrics_server(options.metrics_port) == FAILURE) { return FAILURE; }
+
+		if (!options.udp_destination.empty() && start_udp_output(options.udp_destination, options.udp_format) == FAILURE) { return FAILURE; }
+
+		// Runs on without them when the machine does not allow counting
+		if (options.perf_counters) { start_perf_counters(options.perf_counters_path); }
+
+		// Before the device or recording makes its first capture
+		return install_k4a_allocator(options.allocator_config);
+	}
+
+	int get_frame_source(std::unique_ptr<FrameSource>& source, int argc, char* argv[])
+	{
+		if (parse_program_options(argc, argv, program_options) == FAILURE) { return FAILURE; }
+
+		if (program_options.synthetic)
+		{
+			source.reset(new SyntheticFrameSource(program_options.synthetic_frames, program_options.body_config));
+		}
+		else if (!program_options.recording_path.empty())
+		{
+			source.reset(new RecordingFrameSource(program_options.recording_path, program_options.loop));
+		}
+		else
+		{
+			source.reset(new DeviceFrameSource());
+		}
+
+		source->set_clock_mode(program_options.fast ? FAST_CLOCK : REAL_TIME_CLOCK);
+		source->set_color_enabled(!program_options.headless);
+		source->set_latest_only(program_options.latest);
+
+		if (start_services(program_options) == FAILURE) { return FAILURE; }
+
+		return source->open();
+	}
+
+	int get_body_tracker(
+		std::unique_ptr<BodyTracker>& body_tracker,
+		k4abt_tracker_t& tracker,
+		const FrameSource& source,
+		const k4a_calibration_t& calibration
+	)
+	{
+		if (source.is_synthetic())
+		{
+			// No GPU in the loop when running flat out
+			int processing_time_in_ms = source.get_clock_mode() == FAST_CLOCK ? 0 : 25;
+			const SyntheticBodyConfig& body_config = static_cast<const SyntheticFrameSource&>(source).get_body_config();
+			body_tracker.reset(new MockBodyTracker(processing_time_in_ms, 3, body_config, &calibration));
+			return SUCCESS;
+		}
+
+		if (get_tracker(tracker, calibration) == FAILURE) { return FAILURE; }
+
+		body_tracker.reset(new K4abtBodyTracker(tracker));
+
+		return SUCCESS;
+	}
+}
\ No newline at end of file
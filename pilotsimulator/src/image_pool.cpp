@@ -0,0 +1,239 @@
+#include "pilotsimulator.h"
+
+#include <malloc.h>
+
+namespace pilotsimulator {
+
+	ImagePool::ImagePool(size_t max_free_buffers_per_key) : max_free_buffers_per_key(max_free_buffers_per_key) {}
+
+	ImagePool::~ImagePool()
+	{
+		if (stats.buffers_in_use != 0)
+		{
+			std::cout << "Image Pool Destroyed With " << stats.buffers_in_use << " Images Still In Use!" << std::endl;
+		}
+
+		clear();
+	}
+
+	// Caller holds the mutex
+	size_t ImagePool::get_key_index(k4a_image_format_t format, int width_pixels, int height_pixels, int stride_bytes)
+	{
+		size_t key_index = 0;
+		while (key_index < keys.size())
+		{
+			const Key& key = keys[key_index];
+			if (key.format == format && key.width_pixels == width_pixels && key.height_pixels == height_pixels && key.stride_bytes == stride_bytes) { break; }
+			key_index++;
+		}
+
+		if (key_index == keys.size())
+		{
+			Key key;
+			key.format = format;
+			key.width_pixels = width_pixels;
+			key.height_pixels = height_pixels;
+			key.stride_bytes = stride_bytes;
+			key.size = (size_t)stride_bytes * height_pixels;
+			key.free_buffers.reserve(max_free_buffers_per_key);
+			keys.push_back(std::move(key));
+		}
+
+		return key_index;
+	}
+
+	// Caller holds the mutex
+	ImagePool::Buffer* ImagePool::allocate_buffer(size_t key_index)
+	{
+		size_t size = keys[key_index].size;
+
+		uint8_t* data = (uint8_t*)_aligned_malloc(size, IMAGE_POOL_ALIGNMENT);
+		if (data == NULL)
+		{
+			std::cout << "Failed To Allocate A Pooled Image!" << std::endl;
+			return NULL;
+		}
+
+		stats.buffer_allocations++;
+		stats.bytes_allocated += size;
+
+		return new Buffer{ this, key_index, data };
+	}
+
+	int ImagePool::reserve(k4a_image_format_t format, int width_pixels, int height_pixels, int stride_bytes, size_t count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		size_t key_index = get_key_index(format, width_pixels, height_pixels, stride_bytes);
+		size_t target = (std::min)(count, max_free_buffers_per_key);
+
+		while (keys[key_index].free_buffers.size() < target)
+		{
+			Buffer* buffer = allocate_buffer(key_index);
+			if (buffer == NULL) { return FAILURE; }
+
+			keys[key_index].free_buffers.push_back(buffer);
+			stats.buffers_free++;
+		}
+
+		return SUCCESS;
+	}
+
+	int ImagePool::create_image(k4a_image_format_t format, int width_pixels, int height_pixels, int stride_bytes, k4a_image_t& image)
+	{
+		image = NULL;
+
+		size_t size = (size_t)stride_bytes * height_pixels;
+		Buffer* buffer = NULL;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			size_t key_index = get_key_index(format, width_pixels, height_pixels, stride_bytes);
+			Key& key = keys[key_index];
+			if (!key.free_buffers.empty())
+			{
+				buffer = key.free_buffers.back();
+				key.free_buffers.pop_back();
+				stats.buffers_free--;
+			}
+			else
+			{
+				buffer = allocate_buffer(key_index);
+				if (buffer == NULL) { return FAILURE; }
+			}
+
+			stats.buffers_in_use++;
+			stats.images_created++;
+		}
+
+		if (K4A_FAILED(k4a_image_create_from_buffer(
+			format, width_pixels, height_pixels, stride_bytes,
+			buffer->data, size,
+			release_buffer, buffer,
+			&image)))
+		{
+			std::cout << "Failed To Create A Pooled Image!" << std::endl;
+			image = NULL;
+			recycle(buffer);
+			return FAILURE;
+		}
+
+		return SUCCESS;
+	}
+
+	void ImagePool::release_buffer(void*, void* context)
+	{
+		Buffer* pooled = (Buffer*)context;
+		pooled->pool->recycle(pooled);
+	}
+
+	void ImagePool::recycle(Buffer* buffer)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		stats.buffers_in_use--;
+
+		Key& key = keys[buffer->key_index];
+		if (key.free_buffers.size() < max_free_buffers_per_key)
+		{
+			key.free_buffers.push_back(buffer);
+			stats.buffers_free++;
+			return;
+		}
+
+		stats.bytes_allocated -= key.size;
+		_aligned_free(buffer->data);
+		delete buffer;
+	}
+
+	ImagePoolStats ImagePool::get_stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	void ImagePool::clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (Key& key : keys)
+		{
+			for (Buffer* buffer : key.free_buffers)
+			{
+				stats.bytes_allocated -= key.size;
+				_aligned_free(buffer->data);
+				delete buffer;
+			}
+			key.free_buffers.clear();
+		}
+
+		stats.buffers_free = 0;
+	}
+
+	ImagePool& get_image_pool()
+	{
+		static ImagePool* pool = new ImagePool();
+		return *pool;
+	}
+
+	MatPool::MatPool(size_t max_mats) : max_mats(max_mats)
+	{
+		mats.reserve(max_mats);
+	}
+
+	// Only the pool refers to it. The count only drops to 1 once the last user is done with the Mat.
+	static bool is_idle(const cv::Mat& mat)
+	{
+		return mat.u != NULL && CV_XADD(&mat.u->refcount, 0) == 1;
+	}
+
+	void MatPool::create(int rows, int cols, int type, cv::Mat& mat)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		cv::Mat* reshaped = NULL;
+		for (cv::Mat& pooled : mats)
+		{
+			if (!is_idle(pooled)) { continue; }
+
+			if (pooled.rows == rows && pooled.cols == cols && pooled.type() == type)
+			{
+				mat = pooled;
+				return;
+			}
+
+			if (reshaped == NULL) { reshaped = &pooled; }
+		}
+
+		// An idle Mat of another shape is cheaper to keep around than a new one
+		if (reshaped == NULL && mats.size() < max_mats)
+		{
+			mats.emplace_back();
+			reshaped = &mats.back();
+		}
+
+		allocations++;
+
+		if (reshaped == NULL)
+		{
+			mat.create(rows, cols, type);
+			return;
+		}
+
+		reshaped->create(rows, cols, type);
+		mat = *reshaped;
+	}
+
+	uint64_t MatPool::get_allocation_count() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return allocations;
+	}
+
+	MatPool& get_mat_pool()
+	{
+		static MatPool* pool = new MatPool();
+		return *pool;
+	}
+}
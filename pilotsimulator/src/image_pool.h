@@ -0,0 +1,96 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <k4a/k4a.h>
+
+#include <opencv2/core.hpp>
+
+namespace pilotsimulator {
+
+	// Pooled buffers start on a cache line
+	constexpr size_t IMAGE_POOL_ALIGNMENT = 64;
+
+	// Per key, above the frames a default pipeline holds at once so a busy moment does not free buffers it needs back
+	constexpr size_t IMAGE_POOL_MAX_FREE_BUFFERS = 16;
+
+	struct ImagePoolStats {
+		uint64_t images_created = 0;
+		uint64_t buffer_allocations = 0;	// stays put once every format and size in use has been seen
+		uint64_t bytes_allocated = 0;
+		size_t buffers_in_use = 0;
+		size_t buffers_free = 0;
+	};
+
+	// Recycles image buffers keyed by format, size and stride. Images come from k4a_image_create_from_buffer
+	// and their buffer goes back to the pool when the last reference is released, on whatever thread.
+	// Every image created from a pool must be released before the pool is destroyed.
+	class ImagePool {
+	public:
+		explicit ImagePool(size_t max_free_buffers_per_key = IMAGE_POOL_MAX_FREE_BUFFERS);
+		~ImagePool();
+
+		int create_image(k4a_image_format_t format, int width_pixels, int height_pixels, int stride_bytes, k4a_image_t& image);
+
+		// Allocates up front until count buffers of the kind wait free, at most the free buffers kept per key,
+		// so the first time a loop holds that many images it allocates nothing
+		int reserve(k4a_image_format_t format, int width_pixels, int height_pixels, int stride_bytes, size_t count);
+
+		ImagePoolStats get_stats() const;
+
+		// Frees the buffers not handed out
+		void clear();
+
+	private:
+		struct Buffer {
+			ImagePool* pool;
+			size_t key_index;
+			uint8_t* data;
+		};
+
+		struct Key {
+			k4a_image_format_t format;
+			int width_pixels;
+			int height_pixels;
+			int stride_bytes;
+			size_t size;
+			std::vector<Buffer*> free_buffers;
+		};
+
+		size_t get_key_index(k4a_image_format_t format, int width_pixels, int height_pixels, int stride_bytes);
+		Buffer* allocate_buffer(size_t key_index);
+		static void release_buffer(void* buffer, void* context);
+		void recycle(Buffer* buffer);
+
+		size_t max_free_buffers_per_key;
+
+		mutable std::mutex mutex;
+		std::vector<Key> keys;
+		ImagePoolStats stats;
+	};
+
+	// Pool shared by the library, never destroyed so images can outlive main's locals
+	ImagePool& get_image_pool();
+
+	// Recycles the buffers of cv::Mats that are drawn into every frame. A pooled Mat is handed out again once the
+	// pool holds its only reference, so callers just drop theirs. Past max_mats in use, Mats are not pooled.
+	class MatPool {
+	public:
+		explicit MatPool(size_t max_mats = 8);
+
+		// mat becomes rows x cols of type, without allocating once a Mat of that shape has been returned
+		void create(int rows, int cols, int type, cv::Mat& mat);
+
+		uint64_t get_allocation_count() const;
+
+	private:
+		mutable std::mutex mutex;
+		std::vector<cv::Mat> mats;
+		size_t max_mats;
+		uint64_t allocations = 0;
+	};
+
+	// Pool of the analysis stages
+	MatPool& get_mat_pool();
+}
@@ -0,0 +1,291 @@
+#include "pilotsimulator.h"
+
+#include <iomanip>
+#include <mutex>
+
+namespace pilotsimulator {
+
+	// Kept in the first bytes of a pooled buffer
+	struct FreeBuffer {
+		FreeBuffer* next;
+		bool huge_page;
+	};
+
+	struct K4aAllocator {
+		std::mutex mutex;
+		K4aAllocatorConfig config;
+		bool installed = false;
+		size_t large_page_size = 0;		// 0 without huge pages
+		FreeBuffer* free_lists[K4A_ALLOCATOR_CLASS_COUNT] = {};
+		K4aAllocatorStats stats;
+		std::chrono::steady_clock::time_point install_time;
+	};
+
+	// Never destroyed, the SDK may still free buffers while statics are torn down
+	static K4aAllocator& get_k4a_allocator()
+	{
+		static K4aAllocator* allocator = new K4aAllocator();
+		return *allocator;
+	}
+
+	// The context handed to the SDK carries the size class and whether the buffer is on large pages
+	static void* get_buffer_context(int size_class, bool huge_page)
+	{
+		return (void*)(((uintptr_t)size_class << 1) | (huge_page ? 1 : 0));
+	}
+
+	int get_k4a_allocator_class(size_t size)
+	{
+		const size_t MIN_CLASS_SIZE = (size_t)1 << K4A_ALLOCATOR_MIN_CLASS_BITS;
+
+		if (size <= MIN_CLASS_SIZE) { return 0; }
+
+		uint64_t value = size - 1;
+		int bit = 0;
+		while (value >> (bit + 1)) { bit++; }
+
+		int shift = bit - 2;
+		int sub_class = (int)((value >> shift) & 3);
+		return (bit - K4A_ALLOCATOR_MIN_CLASS_BITS) * 4 + sub_class + 1;
+	}
+
+	size_t get_k4a_allocator_class_size(int size_class)
+	{
+		if (size_class == 0) { return (size_t)1 << K4A_ALLOCATOR_MIN_CLASS_BITS; }
+
+		int bit = (size_class - 1) / 4 + K4A_ALLOCATOR_MIN_CLASS_BITS;
+		int sub_class = (size_class - 1) % 4;
+		return (size_t)(4 + sub_class + 1) << (bit - 2);
+	}
+
+	// Large pages need the lock pages in memory right, granted by policy and enabled on the process token
+	static size_t enable_large_pages()
+	{
+		size_t large_page_size = GetLargePageMinimum();
+		HANDLE token = NULL;
+		TOKEN_PRIVILEGES privileges = {};
+
+		bool enabled = large_page_size != 0 &&
+			OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token) &&
+			LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid);
+
+		if (enabled)
+		{
+			privileges.PrivilegeCount = 1;
+			privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+			enabled = AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+		}
+
+		if (token != NULL) { CloseHandle(token); }
+
+		if (!enabled)
+		{
+			std::cout << "Huge Pages Unavailable, Using Normal Pages!" << std::endl;
+			return 0;
+		}
+
+		return large_page_size;
+	}
+
+	static void* allocate_system(size_t size, size_t large_page_size, bool& huge_page)
+	{
+		huge_page = false;
+
+		// Only buffers of at least a large page, a small one would waste most of it
+		if (large_page_size != 0 && size >= large_page_size)
+		{
+			size_t huge_size = (size + large_page_size - 1) / large_page_size * large_page_size;
+			void* memory = VirtualAlloc(NULL, huge_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (memory != NULL)
+			{
+				huge_page = true;
+				return memory;
+			}
+			// Physical memory too fragmented for large pages, normal ones still do
+		}
+
+		return _aligned_malloc(size, IMAGE_POOL_ALIGNMENT);
+	}
+
+	static void free_system(void* memory, bool huge_page)
+	{
+		if (huge_page) { VirtualFree(memory, 0, MEM_RELEASE); }
+		else { _aligned_free(memory); }
+	}
+
+	uint8_t* k4a_allocator_allocate(int size, void** context)
+	{
+		K4aAllocator& allocator = get_k4a_allocator();
+		int size_class = get_k4a_allocator_class(size > 0 ? (size_t)size : 0);
+		size_t class_size = get_k4a_allocator_class_size(size_class);
+		size_t large_page_size;
+
+		{
+			std::lock_guard<std::mutex> lock(allocator.mutex);
+			K4aAllocatorStats& stats = allocator.stats;
+			stats.allocations++;
+
+			FreeBuffer* buffer = allocator.free_lists[size_class];
+			if (buffer != NULL)
+			{
+				allocator.free_lists[size_class] = buffer->next;
+				stats.pool_hits++;
+				stats.pooled_bytes -= class_size;
+				stats.live_bytes += class_size;
+				if (stats.live_bytes > stats.peak_live_bytes) { stats.peak_live_bytes = stats.live_bytes; }
+
+				*context = get_buffer_context(size_class, buffer->huge_page);
+				return (uint8_t*)buffer;
+			}
+
+			large_page_size = allocator.large_page_size;
+		}
+
+		bool huge_page = false;
+		void* memory = allocate_system(class_size, large_page_size, huge_page);
+		if (memory == NULL)
+		{
+			std::cout << "Failed To Allocate A K4A Buffer!" << std::endl;
+			return NULL;
+		}
+
+#if PILOTSIMULATOR_ALLOC_AUDIT
+		count_allocation(class_size);
+#endif
+
+		{
+			std::lock_guard<std::mutex> lock(allocator.mutex);
+			K4aAllocatorStats& stats = allocator.stats;
+			stats.system_allocations++;
+			if (huge_page) { stats.huge_page_allocations++; }
+			stats.live_bytes += class_size;
+			if (stats.live_bytes > stats.peak_live_bytes) { stats.peak_live_bytes = stats.live_bytes; }
+		}
+
+		*context = get_buffer_context(size_class, huge_page);
+		return (uint8_t*)memory;
+	}
+
+	void k4a_allocator_free(void* buffer, void* context)
+	{
+		if (buffer == NULL) { return; }
+
+		K4aAllocator& allocator = get_k4a_allocator();
+		int size_class = (int)((uintptr_t)context >> 1);
+		bool huge_page = ((uintptr_t)context & 1) != 0;
+		size_t class_size = get_k4a_allocator_class_size(size_class);
+
+		{
+			std::lock_guard<std::mutex> lock(allocator.mutex);
+			K4aAllocatorStats& stats = allocator.stats;
+			stats.live_bytes -= class_size;
+
+			if (stats.pooled_bytes + class_size <= allocator.config.max_pooled_bytes)
+			{
+				FreeBuffer* free_buffer = (FreeBuffer*)buffer;
+				free_buffer->next = allocator.free_lists[size_class];
+				free_buffer->huge_page = huge_page;
+				allocator.free_lists[size_class] = free_buffer;
+				stats.pooled_bytes += class_size;
+				return;
+			}
+
+			stats.system_frees++;
+		}
+
+		free_system(buffer, huge_page);
+	}
+
+	int install_k4a_allocator(const K4aAllocatorConfig& config)
+	{
+		K4aAllocator& allocator = get_k4a_allocator();
+
+		if (allocator.installed) { return SUCCESS; }
+
+		{
+			std::lock_guard<std::mutex> lock(allocator.mutex);
+			allocator.config = config;
+			allocator.large_page_size = config.huge_pages ? enable_large_pages() : 0;
+			allocator.install_time = std::chrono::steady_clock::now();
+		}
+
+		if (K4A_FAILED(k4a_set_allocator(k4a_allocator_allocate, k4a_allocator_free)))
+		{
+			std::cout << "Failed To Install The K4A Allocator!" << std::endl;
+			return FAILURE;
+		}
+
+		allocator.installed = true;
+
+		return SUCCESS;
+	}
+
+	bool is_k4a_allocator_installed()
+	{
+		return get_k4a_allocator().installed;
+	}
+
+	K4aAllocatorStats get_k4a_allocator_stats()
+	{
+		K4aAllocator& allocator = get_k4a_allocator();
+
+		std::lock_guard<std::mutex> lock(allocator.mutex);
+		K4aAllocatorStats stats = allocator.stats;
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - allocator.install_time).count();
+		if (allocator.installed && seconds > 0)
+		{
+			stats.allocations_per_second = stats.allocations / seconds;
+			stats.system_allocations_per_second = stats.system_allocations / seconds;
+		}
+
+		return stats;
+	}
+
+	void print_k4a_allocator_stats()
+	{
+		if (!is_k4a_allocator_installed()) { return; }
+
+		K4aAllocatorStats stats = get_k4a_allocator_stats();
+		const double MB = 1024.0 * 1024.0;
+
+		std::cout << std::endl << "K4A Allocator Stats:" << std::endl;
+		std::cout << "  " << stats.allocations << " allocations, " << stats.pool_hits << " from the pool, "
+			<< stats.system_allocations << " from the system (" << stats.huge_page_allocations << " on huge pages)" << std::endl;
+		std::cout << std::fixed << std::setprecision(1)
+			<< "  Live " << stats.live_bytes / MB << " MB, peak " << stats.peak_live_bytes / MB << " MB, pooled " << stats.pooled_bytes / MB << " MB" << std::endl;
+		std::cout << "  " << stats.allocations_per_second << " allocations/s, " << stats.system_allocations_per_second << " from the system/s" << std::endl;
+		std::cout << std::defaultfloat;
+	}
+
+	void trim_k4a_allocator()
+	{
+		K4aAllocator& allocator = get_k4a_allocator();
+		FreeBuffer* trimmed = NULL;
+
+		{
+			std::lock_guard<std::mutex> lock(allocator.mutex);
+
+			for (FreeBuffer*& free_list : allocator.free_lists)
+			{
+				while (free_list != NULL)
+				{
+					FreeBuffer* buffer = free_list;
+					free_list = buffer->next;
+					buffer->next = trimmed;
+					trimmed = buffer;
+					allocator.stats.system_frees++;
+				}
+			}
+
+			allocator.stats.pooled_bytes = 0;
+		}
+
+		while (trimmed != NULL)
+		{
+			FreeBuffer* next = trimmed->next;
+			free_system(trimmed, trimmed->huge_page);
+			trimmed = next;
+		}
+	}
+}
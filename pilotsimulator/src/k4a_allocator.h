@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pilotsimulator {
+
+	// Size classes: 4 per power of two from 4 KB up, so a recycled buffer is at most a quarter bigger than asked for
+	constexpr int K4A_ALLOCATOR_MIN_CLASS_BITS = 12;
+	constexpr int K4A_ALLOCATOR_CLASS_COUNT = (31 - K4A_ALLOCATOR_MIN_CLASS_BITS) * 4 + 1;
+
+	// Several seconds of 1080p BGRA and depth captures
+	constexpr size_t K4A_ALLOCATOR_MAX_POOLED_BYTES = (size_t)512 << 20;
+
+	struct K4aAllocatorConfig {
+		size_t max_pooled_bytes = K4A_ALLOCATOR_MAX_POOLED_BYTES;	// freed buffers past this go back to the system
+		bool huge_pages = false;		// large page buffers when the account may lock memory, normal pages otherwise
+	};
+
+	struct K4aAllocatorStats {
+		uint64_t allocations = 0;			// requested by the SDK
+		uint64_t pool_hits = 0;				// served from a recycled buffer
+		uint64_t system_allocations = 0;
+		uint64_t huge_page_allocations = 0;	// of the system allocations
+		uint64_t system_frees = 0;
+		uint64_t live_bytes = 0;			// handed to the SDK, by buffer size
+		uint64_t peak_live_bytes = 0;
+		uint64_t pooled_bytes = 0;			// freed and kept for reuse
+		double allocations_per_second = 0;	// since install
+		double system_allocations_per_second = 0;
+	};
+
+	// Pooling allocator behind k4a_set_allocator: every capture and image buffer the SDK allocates comes from
+	// free lists per size class, so a steady stream reuses the same few buffers and memory stays bounded.
+	// Install once before the first device or recording capture, the SDK accepts a single allocator per process.
+	int install_k4a_allocator(const K4aAllocatorConfig& config = K4aAllocatorConfig());
+	bool is_k4a_allocator_installed();
+
+	K4aAllocatorStats get_k4a_allocator_stats();
+	void print_k4a_allocator_stats();
+
+	// Gives the pooled buffers back to the system
+	void trim_k4a_allocator();
+
+	// Size class of an allocation of size bytes, and the buffer size of a class
+	int get_k4a_allocator_class(size_t size);
+	size_t get_k4a_allocator_class_size(int size_class);
+
+	// The callbacks themselves, for direct use without the SDK
+	uint8_t* k4a_allocator_allocate(int size, void** context);
+	void k4a_allocator_free(void* buffer, void* context);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <k4a/k4a.h>
+#include <k4abt.h>
+
+namespace pilotsimulator {
+
+	// Owns one reference to an SDK handle and gives it back when it goes, so no way out of a function leaks it.
+	// Move only like the reference itself. Release is a functor: the address of a dllimport function is no
+	// template argument for MSVC.
+	template <typename T, typename Release>
+	class K4aHandle {
+	public:
+		K4aHandle() = default;
+		explicit K4aHandle(T handle) : handle(handle) {}
+		~K4aHandle() { reset(); }
+
+		K4aHandle(const K4aHandle&) = delete;
+		K4aHandle& operator=(const K4aHandle&) = delete;
+		K4aHandle(K4aHandle&& other) noexcept : handle(other.detach()) {}
+		K4aHandle& operator=(K4aHandle&& other) noexcept
+		{
+			if (this != &other) { reset(other.detach()); }
+			return *this;
+		}
+
+		T get() const { return handle; }
+		explicit operator bool() const { return handle != NULL; }
+
+		// Gives back what is held and hands out the storage for a call that fills in a handle
+		T& out()
+		{
+			reset();
+			return handle;
+		}
+
+		void reset(T new_handle = NULL)
+		{
+			if (handle != NULL) { Release()(handle); }
+			handle = new_handle;
+		}
+
+		// The reference goes to the caller, who releases it
+		T detach()
+		{
+			T result = handle;
+			handle = NULL;
+			return result;
+		}
+
+	private:
+		T handle = NULL;
+	};
+
+	struct K4aImageRelease { void operator()(k4a_image_t image) const { k4a_image_release(image); } };
+	struct K4aCaptureRelease { void operator()(k4a_capture_t capture) const { k4a_capture_release(capture); } };
+	struct K4abtFrameRelease { void operator()(k4abt_frame_t frame) const { k4abt_frame_release(frame); } };
+	struct K4aTransformationRelease { void operator()(k4a_transformation_t transformation) const { k4a_transformation_destroy(transformation); } };
+
+	struct K4abtTrackerRelease {
+		void operator()(k4abt_tracker_t tracker) const
+		{
+			k4abt_tracker_shutdown(tracker);
+			k4abt_tracker_destroy(tracker);
+		}
+	};
+
+	using ImageHandle = K4aHandle<k4a_image_t, K4aImageRelease>;
+	using CaptureHandle = K4aHandle<k4a_capture_t, K4aCaptureRelease>;
+	using BodyFrameHandle = K4aHandle<k4abt_frame_t, K4abtFrameRelease>;
+	using TransformationHandle = K4aHandle<k4a_transformation_t, K4aTransformationRelease>;
+	using TrackerHandle = K4aHandle<k4abt_tracker_t, K4abtTrackerRelease>;
+}
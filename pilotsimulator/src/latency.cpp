@@ -0,0 +1,287 @@
+#include "pilotsimulator.h"
+
+#include <cmath>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+namespace pilotsimulator {
+
+	static const char* LatencyStageNames[LATENCY_STAGE_COUNT] = {
+		"capture", "enqueue", "pop", "transform", "overlay", "analysis", "present", "display", "log", "frame"
+	};
+
+	struct ThreadLatency {
+		LatencyHistogram histograms[LATENCY_STAGE_COUNT];
+	};
+
+	struct LatencyRegistry {
+		std::mutex mutex;
+		std::vector<ThreadLatency*> threads;	// kept after their thread exits, so the report still has them
+
+		uint64_t frames = 0;
+		uint64_t dropped_frames = 0;
+		FrameDropDetector drops;
+		std::chrono::steady_clock::time_point first_frame_time;
+		std::chrono::steady_clock::time_point last_frame_time;
+	};
+
+	// Never destroyed, threads may still record while statics are torn down
+	static LatencyRegistry& get_latency_registry()
+	{
+		static LatencyRegistry* registry = new LatencyRegistry();
+		return *registry;
+	}
+
+	static thread_local ThreadLatency* thread_latency = NULL;
+
+	static int get_highest_bit(uint64_t value)
+	{
+		int bit = 0;
+		if (value >> 32) { value >>= 32; bit += 32; }
+		if (value >> 16) { value >>= 16; bit += 16; }
+		if (value >> 8) { value >>= 8; bit += 8; }
+		if (value >> 4) { value >>= 4; bit += 4; }
+		if (value >> 2) { value >>= 2; bit += 2; }
+		if (value >> 1) { bit += 1; }
+		return bit;
+	}
+
+	size_t LatencyHistogram::get_bucket_index(uint64_t value_ns)
+	{
+		const uint64_t SUB_BUCKET_COUNT = 1 << LATENCY_SUB_BUCKET_BITS;
+
+		if (value_ns < SUB_BUCKET_COUNT) { return (size_t)value_ns; }
+
+		int bit = get_highest_bit(value_ns);
+		if (bit >= LATENCY_MAX_VALUE_BITS) { return LATENCY_BUCKET_COUNT - 1; }
+
+		int shift = bit - LATENCY_SUB_BUCKET_BITS;
+		return ((size_t)(shift + 1) << LATENCY_SUB_BUCKET_BITS) + (size_t)((value_ns >> shift) & (SUB_BUCKET_COUNT - 1));
+	}
+
+	uint64_t LatencyHistogram::get_bucket_upper_value(size_t bucket_index)
+	{
+		const uint64_t SUB_BUCKET_COUNT = 1 << LATENCY_SUB_BUCKET_BITS;
+
+		if (bucket_index < SUB_BUCKET_COUNT) { return bucket_index; }
+
+		int shift = (int)(bucket_index >> LATENCY_SUB_BUCKET_BITS) - 1;
+		uint64_t sub_bucket = bucket_index & (SUB_BUCKET_COUNT - 1);
+		return ((SUB_BUCKET_COUNT + sub_bucket + 1) << shift) - 1;
+	}
+
+	// Only the owning thread writes, so a relaxed load and store is enough and costs no locked instruction
+	static void add_relaxed(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	void LatencyHistogram::record(uint64_t value_ns)
+	{
+		add_relaxed(buckets[get_bucket_index(value_ns)], 1);
+		add_relaxed(count, 1);
+		add_relaxed(sum, value_ns);
+		if (value_ns > max.load(std::memory_order_relaxed)) { max.store(value_ns, std::memory_order_relaxed); }
+	}
+
+	void LatencyHistogram::add(const LatencyHistogram& other)
+	{
+		for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+		{
+			add_relaxed(buckets[i], other.buckets[i].load(std::memory_order_relaxed));
+		}
+		add_relaxed(count, other.count.load(std::memory_order_relaxed));
+		add_relaxed(sum, other.sum.load(std::memory_order_relaxed));
+		max.store((std::max)(max.load(std::memory_order_relaxed), other.max.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+	}
+
+	void LatencyHistogram::reset()
+	{
+		for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) { buckets[i].store(0, std::memory_order_relaxed); }
+		count.store(0, std::memory_order_relaxed);
+		sum.store(0, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+	}
+
+	double LatencyHistogram::get_mean() const
+	{
+		uint64_t values = get_count();
+		return values > 0 ? (double)sum.load(std::memory_order_relaxed) / values : 0;
+	}
+
+	uint64_t LatencyHistogram::get_percentile(double fraction) const
+	{
+		uint64_t values = get_count();
+		if (values == 0) { return 0; }
+
+		// Rank of the value, 1 based
+		uint64_t rank = (uint64_t)std::ceil(fraction * values);
+		if (rank < 1) { rank = 1; }
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+		{
+			seen += buckets[i].load(std::memory_order_relaxed);
+			if (seen >= rank) { return (std::min)(get_bucket_upper_value(i), get_max()); }
+		}
+
+		return get_max();
+	}
+
+	void record_latency(LatencyStage stage, uint64_t value_ns)
+	{
+		if (thread_latency == NULL)
+		{
+			LatencyRegistry& registry = get_latency_registry();
+			ThreadLatency* latency = new ThreadLatency();
+
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.threads.push_back(latency);
+			thread_latency = latency;
+		}
+
+		thread_latency->histograms[stage].record(value_ns);
+	}
+
+	void record_latency_span(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+	{
+		record_latency(stage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+		if (is_tracing()) { trace_span(stage, start, end); }
+	}
+
+	uint64_t FrameDropDetector::add_frame(uint64_t device_timestamp_usec)
+	{
+		uint64_t dropped_frames = 0;
+
+		if (has_frame && device_timestamp_usec > last_device_timestamp_usec)
+		{
+			uint64_t gap = device_timestamp_usec - last_device_timestamp_usec;
+			if (frame_period_usec == 0 || gap < frame_period_usec) { frame_period_usec = gap; }
+
+			uint64_t period = frame_period_usec;
+			if (gap * 2 > period * 3) { dropped_frames = (gap + period / 2) / period - 1; }
+		}
+
+		has_frame = true;
+		last_device_timestamp_usec = device_timestamp_usec;
+
+		return dropped_frames;
+	}
+
+	void FrameDropDetector::reset()
+	{
+		has_frame = false;
+		last_device_timestamp_usec = 0;
+		frame_period_usec = 0;
+	}
+
+	void record_latency_frame(uint64_t device_timestamp_usec)
+	{
+		LatencyRegistry& registry = get_latency_registry();
+		auto now = std::chrono::steady_clock::now();
+		uint64_t interval_ns = 0;
+		bool has_interval = false;
+		uint64_t dropped_frames = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(registry.mutex);
+
+			if (registry.frames == 0)
+			{
+				registry.first_frame_time = now;
+			}
+			else
+			{
+				interval_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - registry.last_frame_time).count();
+				has_interval = true;
+			}
+			dropped_frames = registry.drops.add_frame(device_timestamp_usec);
+
+			registry.frames++;
+			registry.dropped_frames += dropped_frames;
+			registry.last_frame_time = now;
+		}
+
+		if (has_interval) { record_latency(LATENCY_FRAME_INTERVAL, interval_ns); }
+		if (dropped_frames > 0) { trace_dropped_frames(dropped_frames); }
+		if (is_perf_counting()) { record_perf_frame(); }
+	}
+
+	void get_latency_histogram(LatencyStage stage, LatencyHistogram& histogram)
+	{
+		LatencyRegistry& registry = get_latency_registry();
+
+		histogram.reset();
+
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (ThreadLatency* latency : registry.threads)
+		{
+			histogram.add(latency->histograms[stage]);
+		}
+	}
+
+	LatencyFrameStats get_latency_frame_stats()
+	{
+		LatencyRegistry& registry = get_latency_registry();
+		LatencyFrameStats stats;
+
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		stats.frames = registry.frames;
+		stats.dropped_frames = registry.dropped_frames;
+
+		double seconds = std::chrono::duration<double>(registry.last_frame_time - registry.first_frame_time).count();
+		stats.fps = registry.frames > 1 && seconds > 0 ? (registry.frames - 1) / seconds : 0;
+
+		return stats;
+	}
+
+	void print_latency_report()
+	{
+		std::unique_ptr<LatencyHistogram> histogram(new LatencyHistogram());
+
+		std::cout << std::endl << "Latency Report (ms):" << std::endl;
+		std::cout << std::setw(10) << "stage" << std::setw(10) << "count"
+			<< std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+
+		for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+		{
+			get_latency_histogram((LatencyStage)stage, *histogram);
+			if (histogram->get_count() == 0) { continue; }
+
+			std::cout << std::setw(10) << LatencyStageNames[stage]
+				<< std::setw(10) << histogram->get_count()
+				<< std::fixed << std::setprecision(2)
+				<< std::setw(10) << histogram->get_percentile(0.50) / 1e6
+				<< std::setw(10) << histogram->get_percentile(0.99) / 1e6
+				<< std::setw(10) << histogram->get_max() / 1e6 << std::endl;
+		}
+
+		LatencyFrameStats frame_stats = get_latency_frame_stats();
+		std::cout << frame_stats.frames << " frames, " << std::setprecision(1) << frame_stats.fps << " fps, "
+			<< frame_stats.dropped_frames << " dropped" << std::endl;
+
+		if (is_perf_counting()) { print_perf_report(); }
+	}
+
+	void reset_latency()
+	{
+		LatencyRegistry& registry = get_latency_registry();
+
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (ThreadLatency* latency : registry.threads)
+		{
+			for (LatencyHistogram& histogram : latency->histograms) { histogram.reset(); }
+		}
+
+		registry.frames = 0;
+		registry.dropped_frames = 0;
+		registry.drops.reset();
+	}
+
+	const char* get_latency_stage_name(LatencyStage stage)
+	{
+		return LatencyStageNames[stage];
+	}
+}
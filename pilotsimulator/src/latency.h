@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+// Latency instrumentation is compiled out of release builds. Define PILOTSIMULATOR_LATENCY=1 to keep it there,
+// or PILOTSIMULATOR_LATENCY=0 to drop it from a debug build.
+#if !defined(PILOTSIMULATOR_LATENCY)
+#if defined(NDEBUG)
+#define PILOTSIMULATOR_LATENCY 0
+#else
+#define PILOTSIMULATOR_LATENCY 1
+#endif
+#endif
+
+namespace pilotsimulator {
+
+	enum LatencyStage {
+		LATENCY_CAPTURE_WAIT,		// source get_capture, k4a_device_get_capture on a device
+		LATENCY_TRACKER_ENQUEUE,
+		LATENCY_TRACKER_POP,
+		LATENCY_TRANSFORMATION,		// depth/colour reprojection
+		LATENCY_OVERLAY,
+		LATENCY_ANALYSIS,			// whole analysis stage of a pipeline
+		LATENCY_PRESENT,			// whole present stage of a pipeline
+		LATENCY_DISPLAY,			// cv::imshow and cv::waitKey
+		LATENCY_LOG_WRITE,
+		LATENCY_FRAME_INTERVAL,		// between presented frames
+		LATENCY_STAGE_COUNT
+	};
+
+	// Log-linear buckets as in HDR histograms: 32 per power of two, so a bucket is within about 3% of its values,
+	// from 1 ns to 2^40 ns (18 minutes), longer values land in the last bucket
+	constexpr int LATENCY_SUB_BUCKET_BITS = 5;
+	constexpr int LATENCY_MAX_VALUE_BITS = 40;
+	constexpr size_t LATENCY_BUCKET_COUNT = (size_t)(LATENCY_MAX_VALUE_BITS - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS;
+
+	// Nanosecond histogram with a single writing thread. Reads from other threads are safe but may lag a record.
+	class LatencyHistogram {
+	public:
+		LatencyHistogram() { reset(); }
+
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+		void record(uint64_t value_ns);
+		void add(const LatencyHistogram& other);
+		void reset();
+
+		uint64_t get_count() const { return count.load(std::memory_order_relaxed); }
+		uint64_t get_max() const { return max.load(std::memory_order_relaxed); }
+		double get_mean() const;
+
+		// Upper end of the bucket holding the given fraction (0.5, 0.99) of the values, capped at the max
+		uint64_t get_percentile(double fraction) const;
+
+		static size_t get_bucket_index(uint64_t value_ns);
+		static uint64_t get_bucket_upper_value(size_t bucket_index);
+
+	private:
+		std::atomic<uint64_t> buckets[LATENCY_BUCKET_COUNT];
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> sum;
+		std::atomic<uint64_t> max;
+	};
+
+	struct LatencyFrameStats {
+		uint64_t frames = 0;
+		uint64_t dropped_frames = 0;	// device timestamp gaps of more than one and a half frame periods
+		double fps = 0;
+	};
+
+	// Device frames missing between presented ones, from the gaps of their device timestamps. The shortest gap
+	// seen is the frame period, a gap of more than one and a half periods lost the frames in between.
+	class FrameDropDetector {
+	public:
+		// Frames dropped since the previous call
+		uint64_t add_frame(uint64_t device_timestamp_usec);
+		void reset();
+
+	private:
+		bool has_frame = false;
+		uint64_t last_device_timestamp_usec = 0;
+		uint64_t frame_period_usec = 0;
+	};
+
+	// Adds to the calling thread's histogram of stage, threads register themselves on first use
+	void record_latency(LatencyStage stage, uint64_t value_ns);
+
+	// record_latency of end - start, and a span on the calling thread's track while a trace runs
+	void record_latency_span(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+	// One presented frame, by the device timestamp of its capture
+	void record_latency_frame(uint64_t device_timestamp_usec);
+
+	// All threads merged, including threads that have exited
+	void get_latency_histogram(LatencyStage stage, LatencyHistogram& histogram);
+	LatencyFrameStats get_latency_frame_stats();
+
+	// p50, p99 and max of every stage that recorded something, then fps and dropped frames
+	void print_latency_report();
+	void reset_latency();
+
+	const char* get_latency_stage_name(LatencyStage stage);
+
+	// Records the lifetime of the scope into stage
+	class ScopedLatencyTimer {
+	public:
+		explicit ScopedLatencyTimer(LatencyStage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+		~ScopedLatencyTimer() { record_latency_span(stage, start, std::chrono::steady_clock::now()); }
+
+		ScopedLatencyTimer(const ScopedLatencyTimer&) = delete;
+		ScopedLatencyTimer& operator=(const ScopedLatencyTimer&) = delete;
+
+	private:
+		LatencyStage stage;
+		std::chrono::steady_clock::time_point start;
+	};
+}
+
+#define LATENCY_CONCAT_INNER(a, b) a##b
+#define LATENCY_CONCAT(a, b) LATENCY_CONCAT_INNER(a, b)
+
+// The instrumentation points, empty statements when compiled out. A scope also charges the thread's
+// allocations to its stage while the allocation audit is compiled in, see alloc_audit.h, and its
+// hardware counters while they count, see perf_counters.h.
+#if PILOTSIMULATOR_LATENCY
+#define LATENCY_SCOPE(stage) ::pilotsimulator::ScopedLatencyTimer LATENCY_CONCAT(latency_timer_, __LINE__)(stage); ALLOCATION_STAGE(stage); PERF_SCOPE(stage)
+#define LATENCY_RECORD_SINCE(stage, start) ::pilotsimulator::record_latency_span(stage, start, std::chrono::steady_clock::now())
+#define LATENCY_FRAME(device_timestamp_usec) ::pilotsimulator::record_latency_frame(device_timestamp_usec)
+#define LATENCY_REPORT() ::pilotsimulator::print_latency_report()
+#else
+#define LATENCY_SCOPE(stage) ALLOCATION_STAGE(stage); PERF_SCOPE(stage)
+#define LATENCY_RECORD_SINCE(stage, start) ((void)0)
+#define LATENCY_FRAME(device_timestamp_usec) ((void)0)
+#define LATENCY_REPORT() ((void)0)
+#endif
@@ -0,0 +1,27 @@
+#include "pilotsimulator.h"
+
+namespace pilotsimulator {
+
+	void LensModel::set(const k4a_calibration_camera_t& camera)
+	{
+		const k4a_calibration_intrinsic_parameters_t& parameters = camera.intrinsics.parameters;
+		cx = parameters.param.cx;
+		cy = parameters.param.cy;
+		fx = parameters.param.fx;
+		fy = parameters.param.fy;
+		k1 = parameters.param.k1;
+		k2 = parameters.param.k2;
+		k3 = parameters.param.k3;
+		k4 = parameters.param.k4;
+		k5 = parameters.param.k5;
+		k6 = parameters.param.k6;
+		codx = parameters.param.codx;
+		cody = parameters.param.cody;
+		p1 = parameters.param.p1;
+		p2 = parameters.param.p2;
+
+		// Brown-Conrady doubles the xy tangential term, the SDK's rational 6KT model does not
+		tangential_scale = camera.intrinsics.type == K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT ? 1.0f : 2.0f;
+		max_radius_squared = camera.metric_radius * camera.metric_radius;
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <k4a/k4a.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LENS_MODEL_SSE2
+#endif
+
+namespace pilotsimulator {
+
+	// Brown-Conrady or rational 6KT lens of one camera as the SDK applies it, shared by Projector and Reprojector.
+	// project takes a point in the camera frame divided by its Z, the SSE2 overload 4 points at a time with
+	// the same arithmetic so both paths agree to the bit.
+	struct LensModel {
+		float cx, cy, fx, fy;
+		float k1, k2, k3, k4, k5, k6;
+		float codx, cody, p1, p2;
+		float tangential_scale;
+		float max_radius_squared;
+
+		void set(const k4a_calibration_camera_t& camera);
+
+		// Pixel of the normalised point, returns its squared radius about the centre of distortion, which
+		// is inside the lens while at most max_radius_squared
+		float project(float x, float y, float& u, float& v) const
+		{
+			float xp = x - codx;
+			float yp = y - cody;
+
+			float xp2 = xp * xp;
+			float yp2 = yp * yp;
+			float xyp = xp * yp * tangential_scale;
+			float rs = xp2 + yp2;
+			float rss = rs * rs;
+			float rsc = rss * rs;
+			float a = 1.0f + k1 * rs + k2 * rss + k3 * rsc;
+			float b = 1.0f + k4 * rs + k5 * rss + k6 * rsc;
+			float distortion = a * (b != 0.0f ? 1.0f / b : 1.0f);
+
+			float xp_d = xp * distortion + ((rs + 2.0f * xp2) * p2 + xyp * p1);
+			float yp_d = yp * distortion + ((rs + 2.0f * yp2) * p1 + xyp * p2);
+
+			u = (xp_d + codx) * fx + cx;
+			v = (yp_d + cody) * fy + cy;
+
+			return rs;
+		}
+
+#ifdef LENS_MODEL_SSE2
+		__m128 project(__m128 x, __m128 y, __m128& u, __m128& v) const
+		{
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 two = _mm_set1_ps(2.0f);
+
+			__m128 xp = _mm_sub_ps(x, _mm_set1_ps(codx));
+			__m128 yp = _mm_sub_ps(y, _mm_set1_ps(cody));
+
+			__m128 xp2 = _mm_mul_ps(xp, xp);
+			__m128 yp2 = _mm_mul_ps(yp, yp);
+			__m128 xyp = _mm_mul_ps(_mm_mul_ps(xp, yp), _mm_set1_ps(tangential_scale));
+			__m128 rs = _mm_add_ps(xp2, yp2);
+			__m128 rss = _mm_mul_ps(rs, rs);
+			__m128 rsc = _mm_mul_ps(rss, rs);
+			__m128 a = _mm_add_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(k1), rs)), _mm_mul_ps(_mm_set1_ps(k2), rss)), _mm_mul_ps(_mm_set1_ps(k3), rsc));
+			__m128 b = _mm_add_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(k4), rs)), _mm_mul_ps(_mm_set1_ps(k5), rss)), _mm_mul_ps(_mm_set1_ps(k6), rsc));
+			__m128 b_zero = _mm_cmpeq_ps(b, _mm_setzero_ps());
+			__m128 inverse_b = _mm_or_ps(_mm_and_ps(b_zero, one), _mm_andnot_ps(b_zero, _mm_div_ps(one, b)));
+			__m128 distortion = _mm_mul_ps(a, inverse_b);
+
+			__m128 xp_d = _mm_add_ps(_mm_mul_ps(xp, distortion), _mm_add_ps(
+				_mm_mul_ps(_mm_add_ps(rs, _mm_mul_ps(two, xp2)), _mm_set1_ps(p2)), _mm_mul_ps(xyp, _mm_set1_ps(p1))));
+			__m128 yp_d = _mm_add_ps(_mm_mul_ps(yp, distortion), _mm_add_ps(
+				_mm_mul_ps(_mm_add_ps(rs, _mm_mul_ps(two, yp2)), _mm_set1_ps(p1)), _mm_mul_ps(xyp, _mm_set1_ps(p2))));
+
+			u = _mm_add_ps(_mm_mul_ps(_mm_add_ps(xp_d, _mm_set1_ps(codx)), _mm_set1_ps(fx)), _mm_set1_ps(cx));
+			v = _mm_add_ps(_mm_mul_ps(_mm_add_ps(yp_d, _mm_set1_ps(cody)), _mm_set1_ps(fy)), _mm_set1_ps(cy));
+
+			return rs;
+		}
+#endif
+	};
+}
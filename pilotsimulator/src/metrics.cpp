@@ -0,0 +1,483 @@
+// Ahead of Windows.h, which would bring in the old winsock.h
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "pilotsimulator.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace pilotsimulator {
+
+#if defined(_WIN32)
+	using Socket = SOCKET;
+
+	static void close_socket(intptr_t socket) { closesocket((Socket)socket); }
+#else
+	using Socket = int;
+
+	static void close_socket(intptr_t socket) { close((Socket)socket); }
+#endif
+
+	static const double PopLatencyBounds[] = { 0.001, 0.0025, 0.005, 0.01, 0.02, 0.033, 0.05, 0.1, 0.25, 0.5, 1 };
+
+	static const char* MetricTypeNames[] = { "counter", "gauge", "histogram" };
+
+	MetricHistogram::MetricHistogram(const double* bounds, int bound_count)
+		: bound_count((std::min)(bound_count, METRIC_HISTOGRAM_MAX_BUCKETS))
+	{
+		for (int bucket = 0; bucket < this->bound_count; bucket++) { this->bounds[bucket] = bounds[bucket]; }
+		for (std::atomic<uint64_t>& bucket_count : buckets) { bucket_count.store(0, std::memory_order_relaxed); }
+	}
+
+	void MetricHistogram::observe(double value)
+	{
+		int bucket = 0;
+		while (bucket < bound_count && value > bounds[bucket]) { bucket++; }
+
+		buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+
+		double previous = sum.load(std::memory_order_relaxed);
+		while (!sum.compare_exchange_weak(previous, previous + value, std::memory_order_relaxed)) {}
+	}
+
+	MetricsRegistry::Metric* MetricsRegistry::find(const char* name, MetricType type)
+	{
+		for (std::unique_ptr<Metric>& metric : metrics)
+		{
+			if (metric->name == name && metric->type == type) { return metric.get(); }
+		}
+
+		return NULL;
+	}
+
+	MetricsRegistry::Metric& MetricsRegistry::add(const char* name, const char* help, MetricType type)
+	{
+		std::unique_ptr<Metric> metric(new Metric());
+		metric->name = name;
+		metric->help = help;
+		metric->type = type;
+		metrics.push_back(std::move(metric));
+
+		return *metrics.back();
+	}
+
+	MetricCounter& MetricsRegistry::get_counter(const char* name, const char* help)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		Metric* metric = find(name, METRIC_COUNTER);
+		if (metric == NULL)
+		{
+			metric = &add(name, help, METRIC_COUNTER);
+			metric->counter.reset(new MetricCounter());
+		}
+
+		return *metric->counter;
+	}
+
+	MetricGauge& MetricsRegistry::get_gauge(const char* name, const char* help)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		Metric* metric = find(name, METRIC_GAUGE);
+		if (metric == NULL)
+		{
+			metric = &add(name, help, METRIC_GAUGE);
+			metric->gauge.reset(new MetricGauge());
+		}
+
+		return *metric->gauge;
+	}
+
+	MetricHistogram& MetricsRegistry::get_histogram(const char* name, const char* help, const double* bounds, int bound_count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		Metric* metric = find(name, METRIC_HISTOGRAM);
+		if (metric == NULL)
+		{
+			metric = &add(name, help, METRIC_HISTOGRAM);
+			metric->histogram.reset(new MetricHistogram(bounds, bound_count));
+		}
+
+		return *metric->histogram;
+	}
+
+	MetricGauge& MetricsRegistry::get_rate(const char* name, const char* help, const MetricCounter& counter)
+	{
+		MetricGauge& gauge = get_gauge(name, help);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Rate& rate : rates)
+		{
+			if (rate.gauge == &gauge) { return gauge; }
+		}
+		rates.push_back({ &counter, &gauge, counter.get(), std::chrono::steady_clock::now() });
+
+		return gauge;
+	}
+
+	void MetricsRegistry::update_rates()
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Rate& rate : rates)
+		{
+			double seconds = std::chrono::duration<double>(now - rate.last_time).count();
+			if (seconds * 1000 < METRICS_RATE_INTERVAL_MS) { continue; }
+
+			uint64_t count = rate.counter->get();
+			rate.gauge->set((count - rate.last_count) / seconds);
+			rate.last_count = count;
+			rate.last_time = now;
+		}
+	}
+
+	// Appends without a temporary string per line
+	static void append_line(std::string& text, const char* format, ...)
+	{
+		char line[256];
+
+		va_list arguments;
+		va_start(arguments, format);
+		int length = std::vsnprintf(line, sizeof(line), format, arguments);
+		va_end(arguments);
+
+		if (length > 0) { text.append(line, (std::min)((size_t)length, sizeof(line) - 1)); }
+	}
+
+	void MetricsRegistry::write_prometheus(std::string& text)
+	{
+		text.clear();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::unique_ptr<Metric>& metric : metrics)
+		{
+			const char* name = metric->name.c_str();
+			append_line(text, "# HELP %s %s\n# TYPE %s %s\n", name, metric->help.c_str(), name, MetricTypeNames[metric->type]);
+
+			switch (metric->type)
+			{
+			case METRIC_COUNTER:
+				append_line(text, "%s %llu\n", name, (unsigned long long)metric->counter->get());
+				break;
+			case METRIC_GAUGE:
+				append_line(text, "%s %.17g\n", name, metric->gauge->get());
+				break;
+			case METRIC_HISTOGRAM:
+			{
+				const MetricHistogram& histogram = *metric->histogram;
+				uint64_t cumulative = 0;
+				for (int bucket = 0; bucket < histogram.get_bound_count(); bucket++)
+				{
+					cumulative += histogram.get_bucket_count(bucket);
+					append_line(text, "%s_bucket{le=\"%g\"} %llu\n", name, histogram.get_bound(bucket), (unsigned long long)cumulative);
+				}
+				cumulative += histogram.get_bucket_count(histogram.get_bound_count());
+
+				// Count last and at least the buckets, a scrape racing an observe stays consistent
+				append_line(text, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.17g\n%s_count %llu\n", name, (unsigned long long)cumulative,
+					name, histogram.get_sum(), name, (unsigned long long)(std::max)(cumulative, histogram.get_count()));
+				break;
+			}
+			}
+		}
+	}
+
+	void MetricsRegistry::write_snapshot(MetricsSnapshot& snapshot)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		uint64_t sequence = snapshot.sequence.load(std::memory_order_relaxed);
+		snapshot.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		snapshot.magic = METRICS_SNAPSHOT_MAGIC;
+		snapshot.version = METRICS_SNAPSHOT_VERSION;
+		snapshot.timestamp_usec = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+
+		uint32_t entry_count = 0;
+		for (std::unique_ptr<Metric>& metric : metrics)
+		{
+			if (entry_count == METRICS_SNAPSHOT_ENTRIES) { break; }
+
+			MetricsSnapshotEntry& entry = snapshot.entries[entry_count++];
+			std::memset(&entry, 0, sizeof(entry));
+			std::strncpy(entry.name, metric->name.c_str(), METRIC_NAME_SIZE - 1);
+			entry.type = metric->type;
+
+			switch (metric->type)
+			{
+			case METRIC_COUNTER:
+				entry.count = metric->counter->get();
+				entry.value = (double)entry.count;
+				break;
+			case METRIC_GAUGE:
+				entry.value = metric->gauge->get();
+				break;
+			case METRIC_HISTOGRAM:
+				entry.count = metric->histogram->get_count();
+				entry.sum = metric->histogram->get_sum();
+				entry.value = entry.count > 0 ? entry.sum / entry.count : 0;
+				break;
+			}
+		}
+		snapshot.entry_count = entry_count;
+
+		snapshot.sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	MetricsRegistry& get_metrics()
+	{
+		// Never destroyed, pipelines may still report while statics are torn down
+		static MetricsRegistry* registry = new MetricsRegistry();
+		return *registry;
+	}
+
+	PipelineMetrics& get_pipeline_metrics()
+	{
+		static PipelineMetrics* pipeline_metrics = NULL;
+		static std::once_flag registered;
+
+		std::call_once(registered, [] {
+			MetricsRegistry& metrics = get_metrics();
+			MetricCounter& captures = metrics.get_counter("pilotsimulator_captures_total", "Captures read from the frame source");
+			MetricCounter& com_published = metrics.get_counter("pilotsimulator_com_published_total", "Centres of mass published by the programs");
+
+			pipeline_metrics = new PipelineMetrics{
+				captures,
+				metrics.get_rate("pilotsimulator_capture_fps", "Captures per second over the last second", captures),
+				metrics.get_gauge("pilotsimulator_tracker_queue_depth", "Captures in the body tracker"),
+				metrics.get_histogram("pilotsimulator_tracker_pop_seconds", "Wait for the body tracker result of a capture",
+					PopLatencyBounds, sizeof(PopLatencyBounds) / sizeof(PopLatencyBounds[0])),
+				metrics.get_gauge("pilotsimulator_bodies", "Bodies in the last tracked frame"),
+				com_published,
+				metrics.get_rate("pilotsimulator_com_publish_rate", "Centres of mass published per second over the last second", com_published),
+				metrics.get_counter("pilotsimulator_dropped_frames_total", "Device frames missing between presented frames"),
+				metrics.get_counter("pilotsimulator_captures_discarded_total", "Captures the frame source skipped for a newer one"),
+				metrics.get_counter("pilotsimulator_tracker_discarded_total", "Captures discarded at the hand-off to the body tracker"),
+				metrics.get_counter("pilotsimulator_analysis_discarded_total", "Body frames discarded at the hand-off to analysis"),
+				metrics.get_counter("pilotsimulator_present_discarded_total", "Body frames discarded at the hand-off to present")
+			};
+		});
+
+		return *pipeline_metrics;
+	}
+
+	std::string get_metrics_snapshot_name(int port)
+	{
+		return "pilotsimulator_metrics_" + std::to_string(port);
+	}
+
+	int MetricsServer::start(int port)
+	{
+		if (running) { return SUCCESS; }
+
+#if defined(_WIN32)
+		WSADATA wsa_data;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+		{
+			std::cout << "Failed To Start Winsock!" << std::endl;
+			return FAILURE;
+		}
+#endif
+
+		Socket socket_handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((intptr_t)socket_handle == -1)
+		{
+			std::cout << "Failed To Open The Metrics Socket!" << std::endl;
+			return FAILURE;
+		}
+		listener = (intptr_t)socket_handle;
+
+		int reuse = 1;
+		setsockopt(socket_handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+		// Local only, the stations are scraped through whatever runs on them
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((uint16_t)port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (bind(socket_handle, (const sockaddr*)&address, sizeof(address)) != 0 || listen(socket_handle, 4) != 0)
+		{
+			std::cout << "Failed To Listen On Metrics Port " << port << "!" << std::endl;
+			close_socket(listener);
+			listener = -1;
+			return FAILURE;
+		}
+
+		if (snapshot_memory.create(get_metrics_snapshot_name(port), sizeof(MetricsSnapshot)) == FAILURE)
+		{
+			close_socket(listener);
+			listener = -1;
+			return FAILURE;
+		}
+
+		this->port = port;
+		request.reserve(1024);
+		body.reserve(16 * 1024);
+		response.reserve(16 * 1024);
+
+		running = true;
+		thread = std::thread(&MetricsServer::serve, this);
+
+		std::cout << "Serving Metrics On http://127.0.0.1:" << port << "/metrics!" << std::endl;
+
+		return SUCCESS;
+	}
+
+	void MetricsServer::stop()
+	{
+		if (!running) { return; }
+
+		running = false;
+		if (thread.joinable()) { thread.join(); }
+
+		close_socket(listener);
+		listener = -1;
+		snapshot_memory.close();
+
+#if defined(_WIN32)
+		WSACleanup();
+#endif
+	}
+
+	void MetricsServer::serve()
+	{
+		auto next_publish = std::chrono::steady_clock::now();
+
+		while (running)
+		{
+			auto now = std::chrono::steady_clock::now();
+			if (now >= next_publish)
+			{
+				publish();
+				next_publish = now + std::chrono::milliseconds(METRICS_PUBLISH_INTERVAL_MS);
+			}
+
+			// Wakes for a connection or the next publish, stop waits at most that long
+			auto wait = std::chrono::duration_cast<std::chrono::microseconds>(next_publish - now);
+			timeval timeout;
+			timeout.tv_sec = (long)(wait.count() / 1000000);
+			timeout.tv_usec = (long)(wait.count() % 1000000);
+
+			fd_set readable;
+			FD_ZERO(&readable);
+			FD_SET((Socket)listener, &readable);
+
+			if (select((int)listener + 1, &readable, NULL, NULL, &timeout) <= 0) { continue; }
+
+			Socket client = accept((Socket)listener, NULL, NULL);
+			if ((intptr_t)client == -1) { continue; }
+
+			answer((intptr_t)client);
+			close_socket((intptr_t)client);
+		}
+
+		// Readers see the final values after the program ends
+		publish();
+	}
+
+	void MetricsServer::answer(intptr_t client)
+	{
+		// Scrapes are small GETs, the headers come in one piece or two
+		char received[512];
+		request.clear();
+
+		while (request.find("\r\n\r\n") == std::string::npos && request.size() < 4096)
+		{
+			fd_set readable;
+			FD_ZERO(&readable);
+			FD_SET((Socket)client, &readable);
+			timeval timeout = { 1, 0 };
+			if (select((int)client + 1, &readable, NULL, NULL, &timeout) <= 0) { return; }
+
+			int length = (int)recv((Socket)client, received, sizeof(received), 0);
+			if (length <= 0) { return; }
+			request.append(received, length);
+		}
+
+		const char* status = "200 OK";
+		if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+		{
+			get_metrics().update_rates();
+			get_metrics().write_prometheus(body);
+		}
+		else
+		{
+			status = "404 Not Found";
+			body = "Only /metrics is served\n";
+		}
+
+		response.clear();
+		append_line(response, "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+			status, body.size());
+		response.append(body);
+
+		size_t sent = 0;
+		while (sent < response.size())
+		{
+			int length = (int)send((Socket)client, response.data() + sent, (int)(response.size() - sent), 0);
+			if (length <= 0) { return; }
+			sent += length;
+		}
+	}
+
+	void MetricsServer::publish()
+	{
+		get_metrics().update_rates();
+		get_metrics().write_snapshot(*(MetricsSnapshot*)snapshot_memory.get_data());
+	}
+
+	// Stopped before the registry's users are gone, with the final values published
+	static MetricsServer metrics_server;
+
+	int start_metrics_server(int port)
+	{
+		return metrics_server.start(port);
+	}
+
+	int read_metrics_snapshot(const SharedMemory& memory, MetricsSnapshot& snapshot)
+	{
+		const int MAX_ATTEMPTS = 100;
+
+		if (!memory.is_open() || memory.get_size() < sizeof(MetricsSnapshot)) { return FAILURE; }
+		const MetricsSnapshot& shared = *(const MetricsSnapshot*)memory.get_data();
+
+		for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+		{
+			uint64_t sequence = shared.sequence.load(std::memory_order_acquire);
+			if (sequence == 0) { return FAILURE; }
+			if (sequence & 1) { std::this_thread::yield(); continue; }
+
+			snapshot.magic = shared.magic;
+			snapshot.version = shared.version;
+			snapshot.timestamp_usec = shared.timestamp_usec;
+			snapshot.entry_count = (std::min)(shared.entry_count, (uint32_t)METRICS_SNAPSHOT_ENTRIES);
+			std::memcpy(snapshot.entries, shared.entries, snapshot.entry_count * sizeof(MetricsSnapshotEntry));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (shared.sequence.load(std::memory_order_relaxed) == sequence)
+			{
+				snapshot.sequence.store(sequence, std::memory_order_relaxed);
+				return snapshot.magic == METRICS_SNAPSHOT_MAGIC && snapshot.version == METRICS_SNAPSHOT_VERSION ? SUCCESS : FAILURE;
+			}
+		}
+
+		return FAILURE;
+	}
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shared_memory.h"
+
+namespace pilotsimulator {
+
+	constexpr int METRICS_DEFAULT_PORT = 9464;
+	constexpr size_t METRIC_NAME_SIZE = 64;
+	constexpr size_t METRICS_SNAPSHOT_ENTRIES = 64;
+	constexpr int METRIC_HISTOGRAM_MAX_BUCKETS = 16;
+	constexpr int METRICS_PUBLISH_INTERVAL_MS = 250;
+	constexpr int METRICS_RATE_INTERVAL_MS = 1000;
+	constexpr uint32_t METRICS_SNAPSHOT_MAGIC = 0x534D4950;		// "PIMS"
+	constexpr uint32_t METRICS_SNAPSHOT_VERSION = 1;
+
+	enum MetricType {
+		METRIC_COUNTER,
+		METRIC_GAUGE,
+		METRIC_HISTOGRAM
+	};
+
+	// Monotonic count, any thread may add
+	class MetricCounter {
+	public:
+		void add(uint64_t count = 1) { value.fetch_add(count, std::memory_order_relaxed); }
+		uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<uint64_t> value{ 0 };
+	};
+
+	// Last value set, any thread may set
+	class MetricGauge {
+	public:
+		void set(double value) { this->value.store(value, std::memory_order_relaxed); }
+		double get() const { return value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<double> value{ 0 };
+	};
+
+	// Prometheus style histogram: cumulative counts of values up to each bound, then the sum and count.
+	// Bounds ascend, at most METRIC_HISTOGRAM_MAX_BUCKETS of them, +Inf is implied.
+	class MetricHistogram {
+	public:
+		MetricHistogram(const double* bounds, int bound_count);
+
+		void observe(double value);
+
+		int get_bound_count() const { return bound_count; }
+		double get_bound(int bucket) const { return bounds[bucket]; }
+		uint64_t get_bucket_count(int bucket) const { return buckets[bucket].load(std::memory_order_relaxed); }	// not cumulative
+		uint64_t get_count() const { return count.load(std::memory_order_relaxed); }
+		double get_sum() const { return sum.load(std::memory_order_relaxed); }
+
+	private:
+		double bounds[METRIC_HISTOGRAM_MAX_BUCKETS];
+		int bound_count;
+		std::atomic<uint64_t> buckets[METRIC_HISTOGRAM_MAX_BUCKETS + 1];
+		std::atomic<uint64_t> count{ 0 };
+		std::atomic<double> sum{ 0 };
+	};
+
+	// One metric of the shared memory snapshot. Histograms carry their count and sum, the mean as value.
+	struct MetricsSnapshotEntry {
+		char name[METRIC_NAME_SIZE];
+		uint32_t type;
+		uint32_t reserved;
+		double value;
+		uint64_t count;
+		double sum;
+	};
+
+	// Layout of the shared memory other processes read. sequence is odd while an update is written,
+	// a reader copies the whole snapshot and keeps it when sequence was even and unchanged around the copy.
+	struct MetricsSnapshot {
+		uint32_t magic;
+		uint32_t version;
+		std::atomic<uint64_t> sequence;
+		uint64_t timestamp_usec;		// system clock, microseconds since the epoch
+		uint32_t entry_count;
+		uint32_t reserved;
+		MetricsSnapshotEntry entries[METRICS_SNAPSHOT_ENTRIES];
+	};
+
+	// Process wide registry, named after Prometheus conventions (pilotsimulator_*, _total for counters,
+	// base units). Registering a name again returns the metric already there, so every pipeline of the
+	// process adds to the same ones. References stay valid for the life of the process.
+	class MetricsRegistry {
+	public:
+		MetricCounter& get_counter(const char* name, const char* help);
+		MetricGauge& get_gauge(const char* name, const char* help);
+		MetricHistogram& get_histogram(const char* name, const char* help, const double* bounds, int bound_count);
+
+		// Gauge of the per second rate of counter, updated by update_rates
+		MetricGauge& get_rate(const char* name, const char* help, const MetricCounter& counter);
+		void update_rates();
+
+		// Prometheus text exposition format 0.0.4, text keeps its capacity between calls
+		void write_prometheus(std::string& text);
+
+		void write_snapshot(MetricsSnapshot& snapshot);
+
+	private:
+		struct Metric {
+			std::string name;
+			std::string help;
+			MetricType type;
+			std::unique_ptr<MetricCounter> counter;
+			std::unique_ptr<MetricGauge> gauge;
+			std::unique_ptr<MetricHistogram> histogram;
+		};
+
+		struct Rate {
+			const MetricCounter* counter;
+			MetricGauge* gauge;
+			uint64_t last_count;
+			std::chrono::steady_clock::time_point last_time;
+		};
+
+		// Caller holds the mutex
+		Metric* find(const char* name, MetricType type);
+		Metric& add(const char* name, const char* help, MetricType type);
+
+		std::mutex mutex;
+		std::vector<std::unique_ptr<Metric>> metrics;
+		std::vector<Rate> rates;
+	};
+
+	MetricsRegistry& get_metrics();
+
+	// The metrics everything in the library reports to, registered on first use
+	struct PipelineMetrics {
+		MetricCounter& captures;
+		MetricGauge& capture_fps;
+		MetricGauge& tracker_queue_depth;
+		MetricHistogram& pop_latency;
+		MetricGauge& bodies;
+		MetricCounter& com_published;
+		MetricGauge& com_publish_rate;
+		MetricCounter& dropped_frames;
+		MetricCounter& captures_discarded;		// by a frame source keeping only the newest
+		MetricCounter& tracker_discarded;		// at the pipeline's hand-offs
+		MetricCounter& analysis_discarded;
+		MetricCounter& present_discarded;
+	};
+
+	PipelineMetrics& get_pipeline_metrics();
+
+	// Serves the registry on http://127.0.0.1:<port>/metrics for Prometheus to scrape and publishes it to the
+	// shared memory snapshot pilotsimulator_metrics_<port> every METRICS_PUBLISH_INTERVAL_MS, from a thread of its own.
+	class MetricsServer {
+	public:
+		MetricsServer() = default;
+		~MetricsServer() { stop(); }
+
+		MetricsServer(const MetricsServer&) = delete;
+		MetricsServer& operator=(const MetricsServer&) = delete;
+
+		int start(int port);
+		void stop();
+
+		bool is_running() const { return running; }
+		int get_port() const { return port; }
+
+	private:
+		void serve();
+		void answer(intptr_t client);
+		void publish();
+
+		int port = 0;
+		intptr_t listener = -1;
+		std::atomic<bool> running{ false };
+		std::thread thread;
+		SharedMemory snapshot_memory;
+		std::string request;
+		std::string response;
+		std::string body;
+	};
+
+	std::string get_metrics_snapshot_name(int port);
+
+	// Metrics server of the programs, stopped at exit
+	int start_metrics_server(int port = METRICS_DEFAULT_PORT);
+
+	// Consistent copy of a published snapshot, FAILURE when it was not written or kept changing
+	int read_metrics_snapshot(const SharedMemory& memory, MetricsSnapshot& snapshot);
+}
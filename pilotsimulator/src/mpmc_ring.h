@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pilotsimulator {
+
+	// Bounded multi producer multi consumer ring after Dmitry Vyukov, lock free, the cells allocated once.
+	// try_push and try_pop hand the cell whose turn it is to a functor, so an owner copies only what it needs
+	// of a large item and releases what a popped one holds.
+	template <typename T>
+	class MpmcRing {
+	public:
+		// Rounded up to a power of two, at least 2. Nothing is allocated before allocate
+		explicit MpmcRing(size_t capacity)
+			: cell_count(2), mask(1), enqueue_position(0), dequeue_position(0)
+		{
+			while (cell_count < capacity) { cell_count <<= 1; }
+			mask = cell_count - 1;
+		}
+
+		MpmcRing(const MpmcRing&) = delete;
+		MpmcRing& operator=(const MpmcRing&) = delete;
+
+		// Before the first push, from one thread
+		void allocate()
+		{
+			if (!cells.empty()) { return; }
+
+			cells = std::vector<Cell>(cell_count);
+			for (size_t i = 0; i < cell_count; i++) { cells[i].sequence.store(i, std::memory_order_relaxed); }
+		}
+
+		// store(T& cell) fills the free cell, false when the ring is full
+		template <typename Store>
+		bool try_push(Store&& store)
+		{
+			size_t position = enqueue_position.load(std::memory_order_relaxed);
+
+			for (;;)
+			{
+				Cell& cell = cells[position & mask];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+				if (difference == 0)
+				{
+					if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						store(cell.item);
+						cell.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+				{
+					return false;	// full
+				}
+				else
+				{
+					position = enqueue_position.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// load(T& cell) takes the oldest item, false when the ring is empty
+		template <typename Load>
+		bool try_pop(Load&& load)
+		{
+			size_t position = dequeue_position.load(std::memory_order_relaxed);
+
+			for (;;)
+			{
+				Cell& cell = cells[position & mask];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+				if (difference == 0)
+				{
+					if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						load(cell.item);
+						cell.sequence.store(position + mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0)
+				{
+					return false;	// empty
+				}
+				else
+				{
+					position = dequeue_position.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Racy snapshot for statistics, out of range when a pop lands between the two loads
+		size_t size() const
+		{
+			return enqueue_position.load(std::memory_order_relaxed) - dequeue_position.load(std::memory_order_relaxed);
+		}
+
+		bool is_empty() const { return enqueue_position.load() == dequeue_position.load(); }
+		size_t get_capacity() const { return cell_count; }
+
+	private:
+		// Sequence says whose turn the cell is
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T item;
+		};
+
+		std::vector<Cell> cells;
+		size_t cell_count;
+		size_t mask;
+
+		// Producers and consumers on their own cache lines
+		alignas(64) std::atomic<size_t> enqueue_position;
+		alignas(64) std::atomic<size_t> dequeue_position;
+	};
+
+}
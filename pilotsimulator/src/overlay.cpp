@@ -0,0 +1,204 @@
+#include "pilotsimulator.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define OVERLAY_SSE2
+#endif
+
+namespace pilotsimulator {
+
+	// BGR, body 0 blue like the original overlay
+	static const uint8_t BODY_PALETTE[][3] = {
+		{ 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 }, { 0, 255, 255 },
+		{ 255, 0, 255 }, { 255, 255, 0 }, { 0, 128, 255 }, { 255, 0, 128 }
+	};
+	constexpr int BODY_PALETTE_SIZE = sizeof(BODY_PALETTE) / sizeof(BODY_PALETTE[0]);
+
+	// x / 255 rounded, exact for x <= 255 * 255
+	static inline uint32_t divide_by_255(uint32_t x)
+	{
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	static inline void blend_pixel(uint8_t* pixel, const uint8_t color[4])
+	{
+		uint32_t alpha = color[3];
+		if (alpha == 0) { return; }
+
+		uint32_t inverse_alpha = 255 - alpha;
+		pixel[0] = (uint8_t)divide_by_255(pixel[0] * inverse_alpha + color[0] * alpha);
+		pixel[1] = (uint8_t)divide_by_255(pixel[1] * inverse_alpha + color[1] * alpha);
+		pixel[2] = (uint8_t)divide_by_255(pixel[2] * inverse_alpha + color[2] * alpha);
+	}
+
+#ifdef OVERLAY_SSE2
+	// Blends one colour into 16 pixels, 2 pixels per 16 bit half, image alpha channel kept as it is
+	static inline void blend_run_16(uint8_t* pixels, const uint8_t color[4])
+	{
+		uint32_t alpha = color[3];
+		if (alpha == 0) { return; }
+
+		short inverse_alpha = (short)(255 - alpha);
+		const __m128i inverse = _mm_setr_epi16(inverse_alpha, inverse_alpha, inverse_alpha, 255, inverse_alpha, inverse_alpha, inverse_alpha, 255);
+		const __m128i premultiplied = _mm_setr_epi16(
+			(short)(color[0] * alpha + 128), (short)(color[1] * alpha + 128), (short)(color[2] * alpha + 128), 128,
+			(short)(color[0] * alpha + 128), (short)(color[1] * alpha + 128), (short)(color[2] * alpha + 128), 128
+		);
+		const __m128i zero = _mm_setzero_si128();
+
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i* address = (__m128i*)(pixels + i * 16);
+			__m128i source = _mm_loadu_si128(address);
+
+			__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(source, zero), inverse), premultiplied);
+			__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(source, zero), inverse), premultiplied);
+			low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+			high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+
+			_mm_storeu_si128(address, _mm_packus_epi16(low, high));
+		}
+	}
+
+	// Blends a colour and alpha per pixel into 4 pixels, the same arithmetic as blend_run_16
+	static inline __m128i blend_lanes_4(__m128i source, __m128i colors)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i color_channels = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+		const __m128i full = _mm_set1_epi16(255);
+		const __m128i rounding = _mm_set1_epi16(128);
+		__m128i result[2];
+
+		for (int half = 0; half < 2; half++)
+		{
+			__m128i color = half == 0 ? _mm_unpacklo_epi8(colors, zero) : _mm_unpackhi_epi8(colors, zero);
+			__m128i pixel = half == 0 ? _mm_unpacklo_epi8(source, zero) : _mm_unpackhi_epi8(source, zero);
+
+			// Alpha across B, G and R of each pixel, 0 on A so the image alpha channel is kept
+			__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(color, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm_and_si128(alpha, color_channels);
+
+			__m128i blended = _mm_add_epi16(_mm_mullo_epi16(pixel, _mm_sub_epi16(full, alpha)), _mm_mullo_epi16(color, alpha));
+			blended = _mm_add_epi16(blended, rounding);
+			result[half] = _mm_srli_epi16(_mm_add_epi16(blended, _mm_srli_epi16(blended, 8)), 8);
+		}
+
+		return _mm_packus_epi16(result[0], result[1]);
+	}
+
+	// 16 pixels on several indices: each pixel's LUT colour gathered into the lanes, background pixels kept as loaded
+	static inline void blend_mixed_16(uint8_t* pixels, const uint8_t* index, const OverlayLut& lut)
+	{
+		const __m128i background = _mm_set1_epi8((char)K4ABT_BODY_INDEX_MAP_BACKGROUND);
+
+		for (int i = 0; i < 4; i++)
+		{
+			const uint8_t* group = index + i * 4;
+			uint32_t colors[4];
+			uint32_t indices;
+			for (int k = 0; k < 4; k++) { std::memcpy(&colors[k], lut.bgra[group[k]], 4); }
+			std::memcpy(&indices, group, 4);
+
+			// One byte per pixel widened to a 32 bit lane per pixel
+			__m128i keep = _mm_cmpeq_epi8(_mm_cvtsi32_si128((int)indices), background);
+			keep = _mm_unpacklo_epi16(_mm_unpacklo_epi8(keep, keep), _mm_unpacklo_epi8(keep, keep));
+
+			__m128i* address = (__m128i*)(pixels + i * 16);
+			__m128i source = _mm_loadu_si128(address);
+			__m128i blended = blend_lanes_4(source, _mm_loadu_si128((const __m128i*)colors));
+
+			_mm_storeu_si128(address, _mm_or_si128(_mm_and_si128(keep, source), _mm_andnot_si128(keep, blended)));
+		}
+	}
+#endif
+
+	void fill_overlay_lut(OverlayLut& lut, uint8_t alpha)
+	{
+		for (int index = 0; index < 256; index++)
+		{
+			const uint8_t* color = BODY_PALETTE[index % BODY_PALETTE_SIZE];
+			lut.bgra[index][0] = color[0];
+			lut.bgra[index][1] = color[1];
+			lut.bgra[index][2] = color[2];
+			lut.bgra[index][3] = alpha;
+		}
+
+		lut.bgra[K4ABT_BODY_INDEX_MAP_BACKGROUND][3] = 0;
+	}
+
+	const OverlayLut& get_body_overlay_lut()
+	{
+		static const OverlayLut lut = []() {
+			OverlayLut default_lut;
+			fill_overlay_lut(default_lut, 128);
+			return default_lut;
+		}();
+
+		return lut;
+	}
+
+	void overlay_body_index_rows(
+		uint8_t* bgra, int bgra_stride,
+		const uint8_t* body_index, int body_index_stride,
+		int width, int row_begin, int row_end,
+		const OverlayLut& lut
+	)
+	{
+		for (int row = row_begin; row < row_end; row++)
+		{
+			uint8_t* pixel = bgra + (size_t)row * bgra_stride;
+			const uint8_t* index = body_index + (size_t)row * body_index_stride;
+			int col = 0;
+
+#ifdef OVERLAY_SSE2
+			// Runs of 16 pixels on one index, background or inside a body, are the common case
+			for (; col + 16 <= width; col += 16)
+			{
+				__m128i indices = _mm_loadu_si128((const __m128i*)(index + col));
+				__m128i first = _mm_set1_epi8((char)index[col]);
+
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(indices, first)) == 0xFFFF)
+				{
+					blend_run_16(pixel + col * 4, lut.bgra[index[col]]);
+					continue;
+				}
+
+				blend_mixed_16(pixel + col * 4, index + col, lut);
+			}
+#endif
+
+			for (; col < width; col++) { blend_pixel(pixel + col * 4, lut.bgra[index[col]]); }
+		}
+	}
+
+	void overlay_body_index(
+		uint8_t* bgra, int bgra_stride,
+		const uint8_t* body_index, int body_index_stride,
+		int width, int height,
+		const OverlayLut& lut
+	)
+	{
+		int tile_count = (height + OVERLAY_TILE_ROWS - 1) / OVERLAY_TILE_ROWS;
+
+		cv::parallel_for_(cv::Range(0, tile_count), [&](const cv::Range& tiles) {
+			int row_begin = tiles.start * OVERLAY_TILE_ROWS;
+			int row_end = (std::min)(height, tiles.end * OVERLAY_TILE_ROWS);
+			overlay_body_index_rows(bgra, bgra_stride, body_index, body_index_stride, width, row_begin, row_end, lut);
+		});
+	}
+
+	void overlay_body_index(cv::Mat& bgra_image, const cv::Mat& body_index_image, const OverlayLut& lut)
+	{
+		CV_Assert(bgra_image.type() == CV_8UC4 && body_index_image.type() == CV_8U && bgra_image.size() == body_index_image.size());
+
+		overlay_body_index(
+			bgra_image.data, (int)bgra_image.step,
+			body_index_image.data, (int)body_index_image.step,
+			bgra_image.cols, bgra_image.rows,
+			lut
+		);
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include <opencv2/core.hpp>
+
+namespace pilotsimulator {
+
+	// Rows handed to one worker, small enough to balance a 4K frame across cores
+	constexpr int OVERLAY_TILE_ROWS = 32;
+
+	// Colour blended over each body index, BGRA with A as the blend alpha. Background stays at alpha 0.
+	struct OverlayLut {
+		uint8_t bgra[256][4];
+	};
+
+	// Distinct colour per body index at the given alpha, K4ABT_BODY_INDEX_MAP_BACKGROUND left transparent
+	void fill_overlay_lut(OverlayLut& lut, uint8_t alpha);
+
+	// Default LUT of the body overlays, built once
+	const OverlayLut& get_body_overlay_lut();
+
+	// Blends lut[body_index] into the BGRA image in place for rows [row_begin, row_end).
+	// Strides are in bytes; the SSE2 path skips background runs, blends runs of one body 4 pixels at a time and
+	// blends blocks where bodies and background meet with a colour per lane.
+	void overlay_body_index_rows(
+		uint8_t* bgra, int bgra_stride,
+		const uint8_t* body_index, int body_index_stride,
+		int width, int row_begin, int row_end,
+		const OverlayLut& lut
+	);
+
+	// Whole image, split into OVERLAY_TILE_ROWS tiles across cv::parallel_for_ workers
+	void overlay_body_index(
+		uint8_t* bgra, int bgra_stride,
+		const uint8_t* body_index, int body_index_stride,
+		int width, int height,
+		const OverlayLut& lut
+	);
+
+	// CV_8UC4 colour image and CV_8U body index map of the same size
+	void overlay_body_index(cv::Mat& bgra_image, const cv::Mat& body_index_image, const OverlayLut& lut);
+}
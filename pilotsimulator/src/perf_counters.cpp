@@ -0,0 +1,395 @@
+#include "pilotsimulator.h"
+
+#include <cstdio>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pilotsimulator {
+
+	namespace detail {
+		std::atomic<bool> perf_counting(false);
+	}
+
+	static const char* PerfCounterNames[PERF_COUNTER_COUNT] = {
+		"cycles", "instructions", "cache misses", "branch misses"
+	};
+
+	struct PerfThread {
+		std::atomic<uint64_t> spans[LATENCY_STAGE_COUNT];
+		std::atomic<uint64_t> values[LATENCY_STAGE_COUNT][PERF_COUNTER_COUNT];
+		bool can_count = false;
+#if defined(__linux__)
+		int group_fd = -1;
+		int fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 };
+		int read_index[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 };	// position in the group read, -1 when not opened
+		int opened = 0;
+#endif
+	};
+
+	struct PerfState {
+		std::mutex mutex;
+		std::vector<PerfThread*> threads;	// kept after their thread exits, so the report still has them
+		bool available[PERF_COUNTER_COUNT] = {};
+
+		std::string frame_log_path;
+		uint64_t frames = 0;
+		PerfCounts frame_start[LATENCY_STAGE_COUNT];
+	};
+
+	// Never destroyed, threads may still count while statics are torn down
+	static PerfState& get_perf_state()
+	{
+		static PerfState* state = new PerfState();
+		return *state;
+	}
+
+	static thread_local PerfThread* perf_thread = NULL;
+
+	// Only the owning thread writes, like the latency histograms
+	static void add_relaxed(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+#if defined(__linux__)
+	static const uint64_t PerfCounterConfigs[PERF_COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+
+	static int open_perf_event(uint64_t config, int group_fd)
+	{
+		perf_event_attr attributes = {};
+		attributes.size = sizeof(attributes);
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = config;
+		attributes.disabled = group_fd == -1 ? 1 : 0;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		attributes.read_format = PERF_FORMAT_GROUP;
+
+		return (int)syscall(__NR_perf_event_open, &attributes, 0, -1, group_fd, 0);
+	}
+
+	// One group per thread, so all counters cover the same instructions
+	static void open_thread_counters(PerfThread& thread)
+	{
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+		{
+			int fd = open_perf_event(PerfCounterConfigs[counter], thread.group_fd);
+			if (fd < 0)
+			{
+				if (counter == PERF_CYCLES) { return; }
+				continue;
+			}
+
+			if (thread.group_fd == -1) { thread.group_fd = fd; }
+			thread.fds[counter] = fd;
+			thread.read_index[counter] = thread.opened++;
+		}
+
+		ioctl(thread.group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(thread.group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		thread.can_count = true;
+	}
+
+	static void close_thread_counters(PerfThread& thread)
+	{
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+		{
+			if (thread.fds[counter] >= 0) { close(thread.fds[counter]); }
+			thread.fds[counter] = -1;
+		}
+		thread.group_fd = -1;
+		thread.can_count = false;
+	}
+
+	static bool read_thread_counters(PerfThread& thread, uint64_t values[PERF_COUNTER_COUNT])
+	{
+		struct {
+			uint64_t count;
+			uint64_t values[PERF_COUNTER_COUNT];
+		} group;
+
+		if (read(thread.group_fd, &group, sizeof(group)) < (ssize_t)sizeof(uint64_t)) { return false; }
+
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+		{
+			int index = thread.read_index[counter];
+			values[counter] = index >= 0 && (uint64_t)index < group.count ? group.values[index] : 0;
+		}
+
+		return true;
+	}
+
+	static void get_thread_availability(const PerfThread& thread, bool available[PERF_COUNTER_COUNT])
+	{
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) { available[counter] = thread.read_index[counter] >= 0; }
+	}
+#else
+	static void open_thread_counters(PerfThread& thread)
+	{
+		thread.can_count = true;
+	}
+
+	static void close_thread_counters(PerfThread& thread)
+	{
+		thread.can_count = false;
+	}
+
+	static bool read_thread_counters(PerfThread& thread, uint64_t values[PERF_COUNTER_COUNT])
+	{
+		ULONG64 cycles = 0;
+		if (!QueryThreadCycleTime(GetCurrentThread(), &cycles)) { return false; }
+
+		values[PERF_CYCLES] = cycles;
+		values[PERF_INSTRUCTIONS] = values[PERF_CACHE_MISSES] = values[PERF_BRANCH_MISSES] = 0;
+		return true;
+	}
+
+	static void get_thread_availability(const PerfThread& thread, bool available[PERF_COUNTER_COUNT])
+	{
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) { available[counter] = counter == PERF_CYCLES; }
+	}
+#endif
+
+	// The counters go with the thread, its totals stay registered
+	static struct PerfThreadCloser {
+		~PerfThreadCloser() { if (perf_thread != NULL) { close_thread_counters(*perf_thread); } }
+	} thread_local perf_thread_closer;
+
+	static PerfThread* get_perf_thread()
+	{
+		if (perf_thread == NULL)
+		{
+			PerfState& state = get_perf_state();
+			PerfThread* thread = new PerfThread();
+			for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+			{
+				thread->spans[stage].store(0, std::memory_order_relaxed);
+				for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) { thread->values[stage][counter].store(0, std::memory_order_relaxed); }
+			}
+			open_thread_counters(*thread);
+
+			std::lock_guard<std::mutex> lock(state.mutex);
+			state.threads.push_back(thread);
+			perf_thread = thread;
+			(void)&perf_thread_closer;	// constructs it, so it closes the counters at thread exit
+		}
+
+		return perf_thread;
+	}
+
+	bool read_perf_counters(uint64_t values[PERF_COUNTER_COUNT])
+	{
+		PerfThread* thread = get_perf_thread();
+		return thread->can_count && read_thread_counters(*thread, values);
+	}
+
+	void record_perf_span(LatencyStage stage, const uint64_t start[PERF_COUNTER_COUNT])
+	{
+		uint64_t end[PERF_COUNTER_COUNT];
+		if (!read_perf_counters(end)) { return; }
+
+		PerfThread* thread = perf_thread;
+		add_relaxed(thread->spans[stage], 1);
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+		{
+			add_relaxed(thread->values[stage][counter], end[counter] - start[counter]);
+		}
+	}
+
+	int start_perf_counters(const std::string& frame_log_path)
+	{
+		PerfState& state = get_perf_state();
+
+		// The calling thread shows what this machine lets us count
+		PerfThread* thread = get_perf_thread();
+		if (!thread->can_count)
+		{
+			std::cout << "Hardware Counters Unavailable, Check perf_event_paranoid!" << std::endl;
+			return FAILURE;
+		}
+
+		reset_perf_counters();
+
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			get_thread_availability(*thread, state.available);
+			state.frame_log_path = frame_log_path;
+		}
+
+		if (!frame_log_path.empty())
+		{
+			std::remove(frame_log_path.c_str());
+			get_async_writer().append_text(frame_log_path, "frame,stage,spans,cycles,instructions,cache_misses,branch_misses\n");
+		}
+
+		detail::perf_counting = true;
+
+		const char* separator = "Counting ";
+		for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+		{
+			if (!state.available[counter]) { continue; }
+			std::cout << separator << PerfCounterNames[counter];
+			separator = ", ";
+		}
+		std::cout << " Per Stage!" << std::endl;
+#if !PILOTSIMULATOR_LATENCY
+		std::cout << "Built Without PILOTSIMULATOR_LATENCY, No Stage Will Count!" << std::endl;
+#endif
+
+		return SUCCESS;
+	}
+
+	void stop_perf_counters()
+	{
+		detail::perf_counting = false;
+	}
+
+	bool is_perf_counter_available(PerfCounter counter)
+	{
+		PerfState& state = get_perf_state();
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		return state.available[counter];
+	}
+
+	// Caller holds the mutex
+	static void sum_perf_counts(PerfState& state, PerfCounts totals[LATENCY_STAGE_COUNT])
+	{
+		for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) { totals[stage] = PerfCounts(); }
+
+		for (PerfThread* thread : state.threads)
+		{
+			for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+			{
+				totals[stage].spans += thread->spans[stage].load(std::memory_order_relaxed);
+				for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+				{
+					totals[stage].values[counter] += thread->values[stage][counter].load(std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	void record_perf_frame()
+	{
+		if (!is_perf_counting()) { return; }
+
+		PerfState& state = get_perf_state();
+		PerfCounts totals[LATENCY_STAGE_COUNT];
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		sum_perf_counts(state, totals);
+
+		// Whatever the stages counted since the last frame, on every thread
+		AsyncText frame_log(get_async_writer(), &state.frame_log_path);
+		for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+		{
+			PerfCounts& start = state.frame_start[stage];
+			if (!state.frame_log_path.empty() && totals[stage].spans > start.spans)
+			{
+				frame_log.print("%llu,%s,%llu,%llu,%llu,%llu,%llu\n",
+					(unsigned long long)state.frames, get_latency_stage_name((LatencyStage)stage),
+					(unsigned long long)(totals[stage].spans - start.spans),
+					(unsigned long long)(totals[stage].values[PERF_CYCLES] - start.values[PERF_CYCLES]),
+					(unsigned long long)(totals[stage].values[PERF_INSTRUCTIONS] - start.values[PERF_INSTRUCTIONS]),
+					(unsigned long long)(totals[stage].values[PERF_CACHE_MISSES] - start.values[PERF_CACHE_MISSES]),
+					(unsigned long long)(totals[stage].values[PERF_BRANCH_MISSES] - start.values[PERF_BRANCH_MISSES]));
+			}
+			start = totals[stage];
+		}
+
+		state.frames++;
+	}
+
+	void get_perf_counts(LatencyStage stage, PerfCounts& counts)
+	{
+		PerfState& state = get_perf_state();
+		PerfCounts totals[LATENCY_STAGE_COUNT];
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		sum_perf_counts(state, totals);
+		counts = totals[stage];
+	}
+
+	uint64_t get_perf_frame_count()
+	{
+		PerfState& state = get_perf_state();
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		return state.frames;
+	}
+
+	void print_perf_report()
+	{
+		PerfState& state = get_perf_state();
+		PerfCounts totals[LATENCY_STAGE_COUNT];
+		bool available[PERF_COUNTER_COUNT];
+		uint64_t frames;
+
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+			sum_perf_counts(state, totals);
+			for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) { available[counter] = state.available[counter]; }
+			frames = state.frames;
+		}
+
+		if (frames == 0) { return; }
+
+		std::cout << std::endl << "Hardware Counters Per Frame (" << frames << " frames):" << std::endl;
+		std::cout << std::setw(10) << "stage" << std::setw(14) << "cycles" << std::setw(14) << "instructions"
+			<< std::setw(8) << "IPC" << std::setw(14) << "cache misses" << std::setw(14) << "branch misses" << std::endl;
+
+		for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+		{
+			const PerfCounts& counts = totals[stage];
+			if (counts.spans == 0) { continue; }
+
+			std::cout << std::setw(10) << get_latency_stage_name((LatencyStage)stage);
+			for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+			{
+				std::cout << std::setw(14);
+				if (available[counter]) { std::cout << counts.values[counter] / frames; }
+				else { std::cout << "-"; }
+
+				if (counter == PERF_INSTRUCTIONS)
+				{
+					std::cout << std::setw(8);
+					if (available[PERF_CYCLES] && available[PERF_INSTRUCTIONS] && counts.values[PERF_CYCLES] > 0)
+					{
+						std::cout << std::fixed << std::setprecision(2) << (double)counts.values[PERF_INSTRUCTIONS] / counts.values[PERF_CYCLES] << std::defaultfloat;
+					}
+					else { std::cout << "-"; }
+				}
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	void reset_perf_counters()
+	{
+		PerfState& state = get_perf_state();
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		for (PerfThread* thread : state.threads)
+		{
+			for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+			{
+				thread->spans[stage].store(0, std::memory_order_relaxed);
+				for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++) { thread->values[stage][counter].store(0, std::memory_order_relaxed); }
+			}
+		}
+
+		for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) { state.frame_start[stage] = PerfCounts(); }
+		state.frames = 0;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "latency.h"
+
+namespace pilotsimulator {
+
+	enum PerfCounter {
+		PERF_CYCLES,
+		PERF_INSTRUCTIONS,
+		PERF_CACHE_MISSES,
+		PERF_BRANCH_MISSES,
+		PERF_COUNTER_COUNT
+	};
+
+	struct PerfCounts {
+		uint64_t spans = 0;
+		uint64_t values[PERF_COUNTER_COUNT] = {};
+	};
+
+	// Hardware counters of each thread, attributed to the latency stage it is in. Every LATENCY_SCOPE reads them
+	// on entry and exit while counting runs, and each LATENCY_FRAME closes a frame: the counts since the last one
+	// go to frame_log_path as CSV when given, the totals into print_perf_report.
+	// Linux counts user space cycles, instructions, cache and branch misses through perf_event_open, which
+	// perf_event_paranoid may forbid. Windows has no such API for applications, only thread cycles.
+	int start_perf_counters(const std::string& frame_log_path = std::string());
+	void stop_perf_counters();
+
+	namespace detail {
+		extern std::atomic<bool> perf_counting;
+	}
+
+	inline bool is_perf_counting()
+	{
+		return detail::perf_counting.load(std::memory_order_relaxed);
+	}
+
+	bool is_perf_counter_available(PerfCounter counter);
+
+	// Counters of the calling thread, opened on first use. False when the thread cannot count.
+	bool read_perf_counters(uint64_t values[PERF_COUNTER_COUNT]);
+
+	// Counts since start go to stage on the calling thread
+	void record_perf_span(LatencyStage stage, const uint64_t start[PERF_COUNTER_COUNT]);
+
+	// Called by record_latency_frame
+	void record_perf_frame();
+
+	// All threads merged
+	void get_perf_counts(LatencyStage stage, PerfCounts& counts);
+	uint64_t get_perf_frame_count();
+
+	// Per frame means of every stage that counted something, called by print_latency_report
+	void print_perf_report();
+	void reset_perf_counters();
+
+	// Counts the lifetime of the scope into stage
+	class ScopedPerfSpan {
+	public:
+		explicit ScopedPerfSpan(LatencyStage stage) : stage(stage), active(is_perf_counting() && read_perf_counters(start)) {}
+		~ScopedPerfSpan() { if (active) { record_perf_span(stage, start); } }
+
+		ScopedPerfSpan(const ScopedPerfSpan&) = delete;
+		ScopedPerfSpan& operator=(const ScopedPerfSpan&) = delete;
+
+	private:
+		LatencyStage stage;
+		uint64_t start[PERF_COUNTER_COUNT];
+		bool active;
+	};
+}
+
+// Compiled in and out with the latency instrumentation, every LATENCY_SCOPE is a PERF_SCOPE as well
+#if PILOTSIMULATOR_LATENCY
+#define PERF_SCOPE(stage) ::pilotsimulator::ScopedPerfSpan LATENCY_CONCAT(perf_span_, __LINE__)(stage)
+#else
+#define PERF_SCOPE(stage) ((void)0)
+#endif
@@ -35,13 +35,13 @@ namespace pilotsimulator {
 		return SUCCESS;
 	}
 
-	int start_camera(const k4a_device_t& device, k4a_device_configuration_t& device_config)
+	int start_camera(const k4a_device_t& device, k4a_device_configuration_t& device_config, bool color)
 	{
 		device_config.camera_fps = K4A_FRAMES_PER_SECOND_30;
 		device_config.color_format = K4A_IMAGE_FORMAT_COLOR_BGRA32;
-		device_config.color_resolution = K4A_COLOR_RESOLUTION_1080P;
+		device_config.color_resolution = color ? K4A_COLOR_RESOLUTION_1080P : K4A_COLOR_RESOLUTION_OFF;
 		device_config.depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
-		device_config.synchronized_images_only = true;
+		device_config.synchronized_images_only = color;	// the SDK refuses it without a colour camera
 
 		if (K4A_RESULT_SUCCEEDED != k4a_device_start_cameras(device, &device_config))
 		{
@@ -59,7 +59,7 @@ namespace pilotsimulator {
 		{
 		case K4A_WAIT_RESULT_SUCCEEDED:
 			{
-				std::cout << "Succesfully Read A Capture!\n" << std::endl;
+				// Nothing printed, this runs once a frame on the capture thread
 				return SUCCESS;
 			}
 			break;
@@ -85,6 +85,42 @@ namespace pilotsimulator {
 		return FAILURE;
 	}
 
+	int get_latest_capture(const k4a_device_t& device, k4a_capture_t& capture, uint64_t& discarded)
+	{
+		const int32_t TIMEOUT_IN_MS = 1000;
+		CaptureHandle newest;
+		k4a_capture_t newer = NULL;
+
+		capture = NULL;
+		discarded = 0;
+		while (k4a_device_get_capture(device, &newer, 0) == K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			if (newest) { discarded++; }
+			newest.reset(newer);
+			newer = NULL;
+		}
+
+		if (newest)
+		{
+			capture = newest.detach();
+			return SUCCESS;
+		}
+
+		switch (k4a_device_get_capture(device, &capture, TIMEOUT_IN_MS))
+		{
+		case K4A_WAIT_RESULT_SUCCEEDED:
+			return SUCCESS;
+		case K4A_WAIT_RESULT_TIMEOUT:
+			std::cout << "Timed Out Waiting For A Capture!" << std::endl;
+			return FAILURE;
+		case K4A_WAIT_RESULT_FAILED:
+			std::cout << "Failed To Read A Capture!" << std::endl;
+			return FAILURE;
+		default:
+			return FAILURE;
+		}
+	}
+
 	int get_calibration(
 		const k4a_device_t& device, 
 		const k4a_device_configuration_t& device_config, 
@@ -148,50 +184,100 @@ namespace pilotsimulator {
 		return;
 	}
 
-	void get_color_in_depth_space_image(k4a_image_t& result_image, const k4a_capture_t& capture, k4a_transformation_t& transformation) 
+	// The Reprojector when given, the SDK transformation otherwise
+	void get_color_in_depth_space_image(k4a_image_t& result_image, const k4a_capture_t& capture, k4a_transformation_t transformation, Reprojector* reprojector)
 	{
+		LATENCY_SCOPE(LATENCY_TRANSFORMATION);
+
 		result_image = NULL;
 
-		k4a_image_t color_image = NULL;
-		get_color_image(color_image, capture);
+		ImageHandle color_image;
+		get_color_image(color_image.out(), capture);
 
-		k4a_image_t depth_image = NULL;
-		get_depth_image(depth_image, capture);
+		ImageHandle depth_image;
+		get_depth_image(depth_image.out(), capture);
 
-		int depth_image_width = k4a_image_get_width_pixels(depth_image);
-		int depth_image_height = k4a_image_get_height_pixels(depth_image);
+		if (!color_image || !depth_image) { return; }
 
-		k4a_image_create(
+		int depth_image_width = k4a_image_get_width_pixels(depth_image.get());
+		int depth_image_height = k4a_image_get_height_pixels(depth_image.get());
+
+		get_image_pool().create_image(
 			K4A_IMAGE_FORMAT_COLOR_BGRA32,
 			depth_image_width,
 			depth_image_height,
 			depth_image_width * 4 * (int)sizeof(uint8_t),
-			&result_image
-		);
-
-		k4a_transformation_color_image_to_depth_camera(
-			transformation,
-			depth_image,
-			color_image,
 			result_image
 		);
 
+		if (reprojector != NULL)
+		{
+			reprojector->color_to_depth(depth_image.get(), color_image.get(), result_image);
+		}
+		else
+		{
+			k4a_transformation_color_image_to_depth_camera(
+				transformation,
+				depth_image.get(),
+				color_image.get(),
+				result_image
+			);
+		}
+
 		return;
 	}
 
-	void get_depth_in_color_space_image(k4a_image_t& result_image, const k4a_capture_t& capture, k4a_transformation_t& transformation)
+	void get_depth_in_color_space_image(k4a_image_t& result_image, const k4a_capture_t& capture, k4a_transformation_t transformation, Reprojector* reprojector)
 	{
+		LATENCY_SCOPE(LATENCY_TRANSFORMATION);
+
+		result_image = NULL;
+
+		ImageHandle color_image;
+		get_color_image(color_image.out(), capture);
+
+		ImageHandle depth_image;
+		get_depth_image(depth_image.out(), capture);
+
+		if (!color_image || !depth_image) { return; }
+
+		int color_image_width = k4a_image_get_width_pixels(color_image.get());
+		int color_image_height = k4a_image_get_height_pixels(color_image.get());
+
+		get_image_pool().create_image(
+			K4A_IMAGE_FORMAT_DEPTH16,
+			color_image_width,
+			color_image_height,
+			color_image_width * (int)sizeof(uint16_t),
+			result_image
+		);
+
+		if (reprojector != NULL)
+		{
+			reprojector->depth_to_color(depth_image.get(), NULL, result_image, NULL, K4A_TRANSFORMATION_INTERPOLATION_TYPE_NEAREST, 0);
+		}
+		else
+		{
+			k4a_transformation_depth_image_to_color_camera(
+				transformation,
+				depth_image.get(),
+				result_image
+			);
+		}
+
 		return;
 	}
 
 	void get_image(
 		const Image image_type, 
-		k4a_image_t images[], 
+		ImageHandle images[], 
 		const k4a_capture_t& capture, 
-		k4a_transformation_t* transformation
+		k4a_transformation_t transformation,
+		Reprojector* reprojector
 	) {
 
-		k4a_image_t* result_image = &images[image_type];
+		// Gives back the image an earlier call left in the slot
+		k4a_image_t* result_image = &images[image_type].out();
 
 		switch (image_type) 
 		{
@@ -202,10 +288,10 @@ namespace pilotsimulator {
 			get_depth_image(*result_image, capture);
 			break;
 		case COLOR_IN_DEPTH_SPACE:
-			get_color_in_depth_space_image(*result_image, capture, *transformation);
+			get_color_in_depth_space_image(*result_image, capture, transformation, reprojector);
 			break;
 		case DEPTH_IN_COLOR_SPACE:
-			get_depth_in_color_space_image(*result_image, capture, *transformation);
+			get_depth_in_color_space_image(*result_image, capture, transformation, reprojector);
 			break;
 		default:
 			std::cout << "Wrong image type." << std::endl;
@@ -221,56 +307,77 @@ namespace pilotsimulator {
 		return;
 	}
 
-	void get_body_image(k4a_image_t& result_image, const k4a_capture_t& capture, const k4abt_tracker_t& tracker)
+	// Runs the tracker on one capture
+	static int pop_body_frame(BodyFrameHandle& body_frame, const k4a_capture_t& capture, const k4abt_tracker_t& tracker)
 	{
-		k4abt_tracker_enqueue_capture(tracker, capture, K4A_WAIT_INFINITE);
+		if (k4abt_tracker_enqueue_capture(tracker, capture, K4A_WAIT_INFINITE) != K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			std::cout << "Failed to add capture to tracker process queue." << std::endl;
+			return FAILURE;
+		}
 
-		k4abt_frame_t body_frame = NULL;
-		k4a_wait_result_t pop_frame_result = k4abt_tracker_pop_result(tracker, &body_frame, K4A_WAIT_INFINITE);
+		if (k4abt_tracker_pop_result(tracker, &body_frame.out(), K4A_WAIT_INFINITE) != K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			std::cout << "Failed to pop capture from tracker process queue." << std::endl;
+			return FAILURE;
+		}
 
-		result_image = k4abt_frame_get_body_index_map(body_frame);
+		return SUCCESS;
+	}
+
+	// The frame is released here, the index map holds a reference of its own for the caller to release
+	void get_body_image(k4a_image_t& result_image, const k4a_capture_t& capture, const k4abt_tracker_t& tracker)
+	{
+		result_image = NULL;
 
-		k4abt_frame_release(body_frame);
+		BodyFrameHandle body_frame;
+		if (pop_body_frame(body_frame, capture, tracker) == FAILURE) { return; }
+
+		result_image = k4abt_frame_get_body_index_map(body_frame.get());
 
 		return;
 	}
 
 	void get_body_in_color_space_image(k4a_image_t& result_image, const k4a_capture_t& capture, const k4abt_tracker_t& tracker, const k4a_transformation_t& transformation)
 	{
-		k4a_image_t body_image = NULL;
-		get_body_image(body_image, capture, tracker);
+		result_image = NULL;
 
-		k4a_image_t color_image = NULL;
-		get_color_image(color_image, capture);
+		ImageHandle body_image;
+		get_body_image(body_image.out(), capture, tracker);
 
-		k4a_image_t depth_image = NULL;
-		get_depth_image(depth_image, capture);
+		ImageHandle color_image;
+		get_color_image(color_image.out(), capture);
 
-		int color_image_width = k4a_image_get_width_pixels(color_image);
-		int color_image_height = k4a_image_get_height_pixels(color_image);
+		ImageHandle depth_image;
+		get_depth_image(depth_image.out(), capture);
 
-		k4a_image_t depth_in_color_space_image = NULL;
-		k4a_image_create(
+		if (!body_image || !color_image || !depth_image) { return; }
+
+		int color_image_width = k4a_image_get_width_pixels(color_image.get());
+		int color_image_height = k4a_image_get_height_pixels(color_image.get());
+
+		ImageHandle depth_in_color_space_image;
+		get_image_pool().create_image(
 			K4A_IMAGE_FORMAT_DEPTH16,
 			color_image_width,
 			color_image_height,
 			color_image_width * (int)sizeof(uint16_t),
-			&depth_in_color_space_image
+			depth_in_color_space_image.out()
 		);
 
-		k4a_image_create(
+		get_image_pool().create_image(
 			K4A_IMAGE_FORMAT_CUSTOM8,
 			color_image_width,
 			color_image_height,
 			color_image_width * (int)sizeof(uint8_t),
-			&result_image
+			result_image
 		);
 
 		k4a_transformation_depth_image_to_color_camera_custom(
 			transformation,
-			depth_image,
-			body_image,
-			depth_in_color_space_image,
+			depth_image.get(),
+			body_image.get(),
+			depth_in_color_space_image.get(),
 			result_image,
 			K4A_TRANSFORMATION_INTERPOLATION_TYPE_NEAREST,
 			K4ABT_BODY_INDEX_MAP_BACKGROUND
@@ -281,23 +388,25 @@ namespace pilotsimulator {
 
 	void get_body_color_overlay_image(const k4a_capture_t& capture, const k4abt_tracker_t& tracker, const k4a_transformation_t& transformation)
 	{
-		k4a_image_t color_image = NULL;
-		get_color_image(color_image, capture);
+		ImageHandle color_image;
+		get_color_image(color_image.out(), capture);
+
+		ImageHandle body_in_color_space_image;
+		get_body_in_color_space_image(body_in_color_space_image.out(), capture, tracker, transformation);
 
-		k4a_image_t body_in_color_space_image = NULL;
-		get_body_in_color_space_image(body_in_color_space_image, capture, tracker, transformation);
+		if (!color_image || !body_in_color_space_image) { return; }
 
-		int image_height = k4a_image_get_height_pixels(color_image);
-		int image_width = k4a_image_get_width_pixels(color_image);
+		int image_height = k4a_image_get_height_pixels(color_image.get());
+		int image_width = k4a_image_get_width_pixels(color_image.get());
 
-		uint8_t* color_image_buffer = k4a_image_get_buffer(color_image);
+		uint8_t* color_image_buffer = k4a_image_get_buffer(color_image.get());
 		cv::Mat color_image_mat(
 			image_height, image_width, CV_8UC4,
 			(void*)color_image_buffer,
 			cv::Mat::AUTO_STEP
 		);
 
-		uint8_t* body_in_color_space_image_buffer = k4a_image_get_buffer(body_in_color_space_image);
+		uint8_t* body_in_color_space_image_buffer = k4a_image_get_buffer(body_in_color_space_image.get());
 		cv::Mat body_in_color_space_image_mat(
 			image_height, image_width, CV_8U,
 			(void*)body_in_color_space_image_buffer,
@@ -307,18 +416,12 @@ namespace pilotsimulator {
 		cv::Mat result_image_mat;
 		color_image_mat.copyTo(result_image_mat);
 
-		for (size_t row = 0; row < body_in_color_space_image_mat.rows; ++row)
 		{
-			uchar* currentPixel = body_in_color_space_image_mat.ptr<uchar>(row);
-			for (size_t col = 0; col < body_in_color_space_image_mat.cols; ++col)
-			{
-				if ((int)*currentPixel++ == 255) continue; // ignore background
-
-				result_image_mat.ptr<cv::Vec4b>(row)[col][0] = 255;
-			}
+			LATENCY_SCOPE(LATENCY_OVERLAY);
+			overlay_body_index(result_image_mat, body_in_color_space_image_mat, get_body_overlay_lut());
 		}
 
-		cv::imwrite("body_color_overlay.jpg", result_image_mat);
+		get_async_writer().write_image("body_color_overlay.jpg", result_image_mat);
 	}
 
 	void draw_skeleton(cv::Mat result_image_mat, boolean joints_exist[], k4a_float2_t joint_in_color_2d[(int)K4ABT_JOINT_COUNT]) {
@@ -349,180 +452,17 @@ namespace pilotsimulator {
 		}
 	}
 
-	void get_body_segment_com(k4abt_skeleton_t& skeleton, boolean joint_exists[], k4a_float3_t body_segment_com[])
-	{
-		if (joint_exists[ANKLE_RIGHT] && joint_exists[TOE_RIGHT]) {
-
-			int proximal_name = ANKLE_RIGHT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = TOE_RIGHT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = FOOT_RIGHT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.5f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.5f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.5f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[KNEE_RIGHT] && joint_exists[ANKLE_RIGHT]) {
-
-			int proximal_name = KNEE_RIGHT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = ANKLE_RIGHT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = SHANK_RIGHT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.419f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.419f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.419f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[KNEE_RIGHT] && joint_exists[HIP_RIGHT]) {
-
-			int proximal_name = KNEE_RIGHT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = HIP_RIGHT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = THIGH_RIGHT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.428f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.428f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.428f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[HIP_RIGHT] && joint_exists[SHOULDER_RIGHT]) {
-
-			int proximal_name = HIP_RIGHT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = SHOULDER_RIGHT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = TRUNK_RIGHT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.5f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.5f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.5f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[ANKLE_LEFT] && joint_exists[TOE_LEFT]) {
-
-			int proximal_name = ANKLE_LEFT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = TOE_LEFT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = FOOT_LEFT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.5f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.5f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.5f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[KNEE_LEFT] && joint_exists[ANKLE_LEFT]) {
-
-			int proximal_name = KNEE_LEFT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = ANKLE_LEFT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = SHANK_LEFT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.419f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.419f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.419f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[KNEE_LEFT] && joint_exists[HIP_LEFT]) {
-
-			int proximal_name = KNEE_LEFT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = HIP_LEFT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = THIGH_LEFT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.428f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.428f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.428f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		if (joint_exists[HIP_LEFT] && joint_exists[SHOULDER_LEFT]) {
-
-			int proximal_name = HIP_LEFT;
-			k4a_float3_t proximal_point = {};
-			proximal_point.xyz.x = skeleton.joints[proximal_name].position.xyz.x;
-			proximal_point.xyz.y = skeleton.joints[proximal_name].position.xyz.y;
-			proximal_point.xyz.z = skeleton.joints[proximal_name].position.xyz.z;
-
-			int distal_name = SHOULDER_LEFT;
-			k4a_float3_t distal_point = {};
-			distal_point.xyz.x = skeleton.joints[distal_name].position.xyz.x;
-			distal_point.xyz.y = skeleton.joints[distal_name].position.xyz.y;
-			distal_point.xyz.z = skeleton.joints[distal_name].position.xyz.z;
-
-			int segment_name = TRUNK_LEFT;
-			body_segment_com[segment_name].xyz.x = proximal_point.xyz.x + 0.5f * (distal_point.xyz.x - proximal_point.xyz.x);
-			body_segment_com[segment_name].xyz.y = proximal_point.xyz.y + 0.5f * (distal_point.xyz.y - proximal_point.xyz.y);
-			body_segment_com[segment_name].xyz.z = proximal_point.xyz.z + 0.5f * (distal_point.xyz.z - proximal_point.xyz.z);
-		}
-
-		std::cout << "GOT BODY SEGMENT" << std::endl;
-	}
-
 	void get_skeleton_in_color_space_image(const k4a_capture_t& capture, const k4abt_tracker_t& tracker, const k4a_calibration_t& calibration)
 	{
-		k4a_image_t color_image = NULL;
-		get_color_image(color_image, capture);
+		ImageHandle color_image;
+		get_color_image(color_image.out(), capture);
+
+		if (!color_image) { return; }
 
-		int image_height = k4a_image_get_height_pixels(color_image);
-		int image_width = k4a_image_get_width_pixels(color_image);
+		int image_height = k4a_image_get_height_pixels(color_image.get());
+		int image_width = k4a_image_get_width_pixels(color_image.get());
 
-		uint8_t* color_image_buffer = k4a_image_get_buffer(color_image);
+		uint8_t* color_image_buffer = k4a_image_get_buffer(color_image.get());
 		cv::Mat color_image_mat(
 			image_height, image_width, CV_8UC4,
 			(void*)color_image_buffer,
@@ -532,41 +472,39 @@ namespace pilotsimulator {
 		cv::Mat result_image_mat;
 		color_image_mat.copyTo(result_image_mat);
 
-		k4abt_tracker_enqueue_capture(tracker, capture, K4A_WAIT_INFINITE);
+		BodyFrameHandle body_frame;
+		if (pop_body_frame(body_frame, capture, tracker) == FAILURE) { return; }
 
-		k4abt_frame_t body_frame = NULL;
-		k4a_wait_result_t pop_frame_result = k4abt_tracker_pop_result(tracker, &body_frame, K4A_WAIT_INFINITE);
+		uint32_t num_bodies = k4abt_frame_get_num_bodies(body_frame.get());
 
-		uint32_t num_bodies = k4abt_frame_get_num_bodies(body_frame);
-
-		k4a_float2_t joint_in_color_2d[10][(int)K4ABT_JOINT_COUNT] = {};
+		Projector projector(calibration);
 
 		//// Transform each 3d joints from 3d depth space to 2d color image space
 		for (uint32_t i = 0; i < num_bodies; i++)
 		{
 
 			k4abt_skeleton_t skeleton;
-			k4abt_frame_get_body_skeleton(body_frame, i, &skeleton);
+			k4abt_frame_get_body_skeleton(body_frame.get(), i, &skeleton);
 
 			boolean joints_exist[(int)K4ABT_JOINT_COUNT] = {};
+			k4a_float2_t joint_in_color_2d[(int)K4ABT_JOINT_COUNT] = {};
 
+			k4a_float3_t joint_positions[(int)K4ABT_JOINT_COUNT];
+			int joint_valid[(int)K4ABT_JOINT_COUNT];
 			for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
 			{
-				int valid;
-
-				k4a_calibration_3d_to_2d(
-					&calibration,
-					&skeleton.joints[joint_id].position,
-					K4A_CALIBRATION_TYPE_DEPTH,
-					K4A_CALIBRATION_TYPE_COLOR,
-					&joint_in_color_2d[i][joint_id],
-					&valid
-				);
+				joint_positions[joint_id] = skeleton.joints[joint_id].position;
+			}
+			projector.project(joint_positions, (int)K4ABT_JOINT_COUNT, joint_in_color_2d, joint_valid);
+
+			for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
+			{
+				int valid = joint_valid[joint_id];
 
 				if (valid && joint_id != NOSE && joint_id != EYE_LEFT && joint_id != EYE_RIGHT && joint_id != EAR_LEFT && joint_id != EAR_RIGHT && joint_id != HANDTIP_LEFT && joint_id != HANDTIP_RIGHT)
 				{
 
-					cv::Point joint_point = cv::Point(joint_in_color_2d[i][joint_id].v[0], joint_in_color_2d[i][joint_id].v[1]);
+					cv::Point joint_point = cv::Point(joint_in_color_2d[joint_id].v[0], joint_in_color_2d[joint_id].v[1]);
 					cv::circle(
 						result_image_mat,
 						joint_point,
@@ -584,24 +522,23 @@ namespace pilotsimulator {
 				}
 			}
 
-			draw_skeleton(result_image_mat, joints_exist, joint_in_color_2d[i]);
+			draw_skeleton(result_image_mat, joints_exist, joint_in_color_2d);
 		}
 
-		cv::imwrite("skeleton_in_color_space.jpg", result_image_mat);
-
-		k4abt_frame_release(body_frame);
+		get_async_writer().write_image("skeleton_in_color_space.jpg", result_image_mat);
 	}
 
 	void get_body_tracking_image(
 		const Image image_type,
-		k4a_image_t images[],
+		ImageHandle images[],
 		const k4a_capture_t& capture,
 		const k4abt_tracker_t& tracker,
-		k4a_transformation_t* transformation,
+		k4a_transformation_t transformation,
 		k4a_calibration_t* calibration
 	) 
 	{
-		k4a_image_t* result_image = &images[image_type];
+		// Gives back the image an earlier call left in the slot
+		k4a_image_t* result_image = &images[image_type].out();
 
 		switch (image_type)
 		{
@@ -609,10 +546,10 @@ namespace pilotsimulator {
 			get_body_image(*result_image, capture, tracker);
 			break;
 		case BODY_IN_COLOR_SPACE:
-			get_body_in_color_space_image(*result_image, capture, tracker, *transformation);
+			get_body_in_color_space_image(*result_image, capture, tracker, transformation);
 			break;
 		case BODY_COLOR_OVERLAY:
-			get_body_color_overlay_image(capture, tracker, *transformation);
+			get_body_color_overlay_image(capture, tracker, transformation);
 			break;
 		case SKELETON_IN_COLOR_SPACE:
 			get_skeleton_in_color_space_image(capture, tracker, *calibration);
@@ -636,10 +573,10 @@ namespace pilotsimulator {
 		{
 		case COLOR:
 		case COLOR_IN_DEPTH_SPACE:
-		case DEPTH_IN_COLOR_SPACE:
 		case BODY_COLOR_OVERLAY:
 			return CV_8UC4;
 		case DEPTH:
+		case DEPTH_IN_COLOR_SPACE:
 			return CV_16U;
 		case BODY:
 		case BODY_IN_COLOR_SPACE:
@@ -649,9 +586,9 @@ namespace pilotsimulator {
 		}
 	}
 
-	void save_image(const Image image_type, const k4a_image_t images[], std::string filename)
+	void save_image(const Image image_type, const ImageHandle images[], std::string filename)
 	{
-		const k4a_image_t original_image = images[image_type];
+		const k4a_image_t original_image = images[image_type].get();
 
 		if (original_image == NULL) {
 			std::cout << "Image is Null!" << std::endl;
@@ -671,43 +608,57 @@ namespace pilotsimulator {
 			cv::Mat::AUTO_STEP
 		);
 
-		cv::imwrite(filename, image_mat);
-		std::cout << "Image is stored at " << filename << std::endl;
+		// Lines from one thread keep their order, so this prints once the file is there
+		get_async_writer().write_image(filename, image_mat);
+		get_async_writer().print("Image is stored at " + filename);
 
 		return;
 	}
 
-	void start_body_tracking(k4a_device_t& device, k4a_capture_t& capture, k4abt_tracker_t& tracker)
+	void start_body_tracking(FrameSource& source, BodyTracker& tracker)
 	{
+		CaptureHandle capture;
 		k4a_wait_result_t queue_capture_result = K4A_WAIT_RESULT_FAILED;
-		k4abt_frame_t body_frame = NULL;
+		BodyFrame body_frame;
 		k4a_wait_result_t pop_frame_result = K4A_WAIT_RESULT_FAILED;
-		size_t num_bodies = NULL;
 
 		std::cout << "Body Tracking Start!" << std::endl;
 
 	BodyTracking:
 
-		if (get_capture(device, capture) == FAILURE) { return; };
+		{
+			LATENCY_SCOPE(LATENCY_CAPTURE_WAIT);
+			if (source.get_capture(capture.out()) == FAILURE) { return; };
+		}
 
-		queue_capture_result = k4abt_tracker_enqueue_capture(tracker, capture, K4A_WAIT_INFINITE);
+		{
+			LATENCY_SCOPE(LATENCY_TRACKER_ENQUEUE);
+			queue_capture_result = tracker.enqueue_capture(capture.get(), K4A_WAIT_INFINITE);
+		}
+		capture.reset();
 		if (queue_capture_result == K4A_WAIT_RESULT_FAILED)
 		{
 			std::cout << "Failed to add capture to tracker process queue." << std::endl;
 			return;
 		}
 
-		pop_frame_result = k4abt_tracker_pop_result(tracker, &body_frame, K4A_WAIT_INFINITE);
+		{
+			LATENCY_SCOPE(LATENCY_TRACKER_POP);
+			pop_frame_result = tracker.pop_result(body_frame, K4A_WAIT_INFINITE);
+		}
 		if (pop_frame_result == K4A_WAIT_RESULT_SUCCEEDED)
 		{
-			num_bodies = k4abt_frame_get_num_bodies(body_frame);
-			std::cout << "Body Tracked: " << k4abt_frame_get_num_bodies(body_frame) << std::endl;
+			LATENCY_FRAME(body_frame.device_timestamp_usec);
+			ALLOCATION_FRAME();
+			AsyncText tracked_text(get_async_writer());
+			tracked_text.print("Body Tracked: %u\n", body_frame.num_bodies);
 
-			k4abt_frame_release(body_frame);
-			k4a_capture_release(capture);
+			release_body_frame(body_frame);
 
 			if (GetKeyState(VK_ESCAPE) & 0x8000/*Check if high-order bit is set (1 << 15)*/)
 			{
+				LATENCY_REPORT();
+				ALLOCATION_REPORT();
 				return;
 			}
 		}
@@ -719,278 +670,292 @@ namespace pilotsimulator {
 		goto BodyTracking;
 	}
 
-	void stream_images(k4a_device_t& device, k4a_capture_t& capture, k4a_calibration_t& calibration,  k4abt_tracker_t& tracker)
+	// Analysis stage of stream_images: body overlay, joints, segment COMs and skeleton drawn into frame.image
+	static void compose_body_color_overlay(BodyFrame& frame, const Projector& projector, Reprojector& reprojector)
 	{
-		k4a_wait_result_t queue_capture_result = K4A_WAIT_RESULT_FAILED;
-		k4abt_frame_t body_frame = NULL;
-		k4a_wait_result_t pop_frame_result = K4A_WAIT_RESULT_FAILED;
-		size_t num_bodies = NULL;
-		k4a_image_t color_image = NULL;
-		k4a_image_t depth_image = NULL;
-		k4a_image_t body_image = NULL;
-		k4a_image_t body_in_color_space_image = NULL;
-		k4a_image_t depth_in_color_space_image = NULL;
-		cv::Mat body_color_overlay_image_mat;
-		uint8_t* depth_image_buffer;
-		uint8_t* color_image_buffer;
-		uint8_t* body_in_color_space_image_buffer;
-		k4a_float2_t joint_in_color_2d[10][(int)K4ABT_JOINT_COUNT] = {};
-
-		k4a_transformation_t transformation = NULL;
-		get_transformation(transformation, calibration);
-
-		std::cout << "Streaming Images!" << std::endl;
+		if (frame.capture == NULL || frame.body_index_map == NULL) { return; }
 
-	BodyTracking:
+		// Printed by the async writer, the analysis worker never waits on the console
+		AsyncText frame_log(get_async_writer());
+		frame_log.print("Body Tracked: %u\n", frame.num_bodies);
 
-		if (get_capture(device, capture) == FAILURE) { return; };
+		ImageHandle color_image;
+		get_color_image(color_image.out(), frame.capture);
 
-		queue_capture_result = k4abt_tracker_enqueue_capture(tracker, capture, K4A_WAIT_INFINITE);
-		if (queue_capture_result == K4A_WAIT_RESULT_FAILED)
-		{
-			std::cout << "Failed to add capture to tracker process queue." << std::endl;
-			return;
-		}
+		ImageHandle depth_image;
+		get_depth_image(depth_image.out(), frame.capture);
 
-		pop_frame_result = k4abt_tracker_pop_result(tracker, &body_frame, K4A_WAIT_INFINITE);
-		if (pop_frame_result == K4A_WAIT_RESULT_SUCCEEDED)
-		{
-			num_bodies = k4abt_frame_get_num_bodies(body_frame);
-			std::cout << "Body Tracked: " << k4abt_frame_get_num_bodies(body_frame) << std::endl;
+		if (!color_image || !depth_image) { return; }
 
-			get_color_image(color_image,  capture);
-			get_depth_image(depth_image, capture);
+		k4a_image_t body_image = frame.body_index_map;
 
-			body_image = k4abt_frame_get_body_index_map(body_frame);
+		int image_width = k4a_image_get_width_pixels(color_image.get());
+		int image_height = k4a_image_get_height_pixels(color_image.get());
 
-			int image_width = k4a_image_get_width_pixels(color_image);
-			int image_height = k4a_image_get_height_pixels(color_image);
-
-			int depth_image_width = k4a_image_get_width_pixels(color_image);
-			int depth_image_height = k4a_image_get_height_pixels(color_image);
+		ImageHandle depth_in_color_space_image;
+		get_image_pool().create_image(
+			K4A_IMAGE_FORMAT_DEPTH16,
+			image_width,
+			image_height,
+			image_width * (int)sizeof(uint16_t),
+			depth_in_color_space_image.out()
+		);
 
-			k4a_image_create(
-				K4A_IMAGE_FORMAT_DEPTH16,
-				image_width,
-				image_height,
-				image_width * (int)sizeof(uint16_t),
-				&depth_in_color_space_image
-			);
+		ImageHandle body_in_color_space_image;
+		get_image_pool().create_image(
+			K4A_IMAGE_FORMAT_CUSTOM8,
+			image_width,
+			image_height,
+			image_width * (int)sizeof(uint8_t),
+			body_in_color_space_image.out()
+		);
 
-			k4a_image_create(
-				K4A_IMAGE_FORMAT_CUSTOM8,
-				image_width,
-				image_height,
-				image_width * (int)sizeof(uint8_t),
-				&body_in_color_space_image
-			);
+		if (!depth_in_color_space_image || !body_in_color_space_image) { return; }
 
-			k4a_transformation_depth_image_to_color_camera_custom(
-				transformation,
-				depth_image,
+		{
+			LATENCY_SCOPE(LATENCY_TRANSFORMATION);
+			reprojector.depth_to_color(
+				depth_image.get(),
 				body_image,
-				depth_in_color_space_image,
-				body_in_color_space_image,
+				depth_in_color_space_image.get(),
+				body_in_color_space_image.get(),
 				K4A_TRANSFORMATION_INTERPOLATION_TYPE_NEAREST,
 				K4ABT_BODY_INDEX_MAP_BACKGROUND
 			);
+		}
 
-			depth_image_buffer = k4a_image_get_buffer(color_image);
-			cv::Mat depth_image_mat(
-				depth_image_height, depth_image_width, CV_16U,
-				(void*)depth_image_buffer,
-				cv::Mat::AUTO_STEP
-			);
+		uint8_t* color_image_buffer = k4a_image_get_buffer(color_image.get());
+		cv::Mat color_image_mat(
+			image_height, image_width, CV_8UC4,
+			(void*)color_image_buffer,
+			cv::Mat::AUTO_STEP
+		);
 
-			color_image_buffer = k4a_image_get_buffer(color_image);
-			cv::Mat color_image_mat(
-				image_height, image_width, CV_8UC4,
-				(void*)color_image_buffer,
-				cv::Mat::AUTO_STEP
-			);
+		uint8_t* body_in_color_space_image_buffer = k4a_image_get_buffer(body_in_color_space_image.get());
+		cv::Mat body_in_color_space_image_mat(
+			image_height, image_width, CV_8U,
+			(void*)body_in_color_space_image_buffer,
+			cv::Mat::AUTO_STEP
+		);
 
-			body_in_color_space_image_buffer = k4a_image_get_buffer(body_in_color_space_image);
-			cv::Mat body_in_color_space_image_mat(
-				image_height, image_width, CV_8U,
-				(void*)body_in_color_space_image_buffer,
-				cv::Mat::AUTO_STEP
-			);
+		get_mat_pool().create(image_height, image_width, CV_8UC4, frame.image);
+		color_image_mat.copyTo(frame.image);
 
-			color_image_mat.copyTo(body_color_overlay_image_mat);
+		{
+			LATENCY_SCOPE(LATENCY_OVERLAY);
+			overlay_body_index(frame.image, body_in_color_space_image_mat, get_body_overlay_lut());
+		}
 
-			for (size_t row = 0; row < body_in_color_space_image_mat.rows; ++row)
-			{
-				uchar* currentPixel = body_in_color_space_image_mat.ptr<uchar>(row);
-				for (size_t col = 0; col < body_in_color_space_image_mat.cols; ++col)
-				{
-					if ((int)*currentPixel++ == 255) continue; // ignore background
+		compute_com_batch<LegsAndTrunkModel>(&frame, 1);
 
-					body_color_overlay_image_mat.ptr<cv::Vec4b>(row)[col][0] = 255;
-				}
-			}
+		//// Transform each 3d joints from 3d depth space to 2d color image space
+		for (uint32_t i = 0; i < frame.num_bodies; i++)
+		{
+			k4abt_skeleton_t& skeleton = frame.bodies[i].skeleton;
 
-			//// Transform each 3d joints from 3d depth space to 2d color image space
-			for (uint32_t i = 0; i < num_bodies; i++)
-			{
+			boolean joints_exist[(int)K4ABT_JOINT_COUNT] = {};
+			k4a_float2_t joint_in_color_2d[(int)K4ABT_JOINT_COUNT] = {};
 
-				k4abt_skeleton_t skeleton;
-				k4abt_frame_get_body_skeleton(body_frame, i, &skeleton);
+			const k4a_float3_t* body_segment_com = frame.body_segment_com[i];
+			k4a_float2_t segment_in_color_2d[LegsAndTrunkModel::SEGMENT_COUNT] = {};
 
-				boolean joints_exist[(int)K4ABT_JOINT_COUNT] = {};
+			// All joints and segment COMs of the body projected in one go each
+			k4a_float3_t joint_positions[(int)K4ABT_JOINT_COUNT];
+			int joint_valid[(int)K4ABT_JOINT_COUNT];
+			int segment_valid[LegsAndTrunkModel::SEGMENT_COUNT];
+			for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
+			{
+				joint_positions[joint_id] = skeleton.joints[joint_id].position;
+			}
+			projector.project(joint_positions, (int)K4ABT_JOINT_COUNT, joint_in_color_2d, joint_valid);
+			projector.project(body_segment_com, LegsAndTrunkModel::SEGMENT_COUNT, segment_in_color_2d, segment_valid);
 
-				k4a_float3_t body_segment_com[BODY_SEGMENT_END] = {};
-				k4a_float2_t segment_in_color_2d[BODY_SEGMENT_END] = {};
+			for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
+			{
+				int valid = joint_valid[joint_id];
+
+				frame_log.print("X: %gY: %gZ: %g\n", joint_positions[joint_id].v[0], joint_positions[joint_id].v[1], joint_positions[joint_id].v[2]);
 
-				for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
+				if (valid && joint_id != NOSE && joint_id != EYE_LEFT && joint_id != EYE_RIGHT && joint_id != EAR_LEFT && joint_id != EAR_RIGHT && joint_id != HANDTIP_LEFT && joint_id != HANDTIP_RIGHT)
 				{
-					int valid;
-
-					float joint_positions[3] = {
-						skeleton.joints[joint_id].position.v[0],
-						skeleton.joints[joint_id].position.v[1],
-						skeleton.joints[joint_id].position.v[2]
-					};
-
-					std::cout <<
-						"X: " <<
-						joint_positions[0] <<
-						"Y: " <<
-						joint_positions[1] <<
-						"Z: " <<
-						joint_positions[2] <<
-						std::endl;
-
-					k4a_calibration_3d_to_2d(
-						&calibration,
-						&skeleton.joints[joint_id].position,
-						K4A_CALIBRATION_TYPE_DEPTH,
-						K4A_CALIBRATION_TYPE_COLOR,
-						&joint_in_color_2d[i][joint_id],
-						&valid
+
+					cv::Point joint_point = cv::Point(joint_in_color_2d[joint_id].v[0], joint_in_color_2d[joint_id].v[1]);
+					cv::circle(
+						frame.image,
+						joint_point,
+						20,
+						cv::Scalar(255, 255, 255),
+						cv::FILLED,
+						8,
+						0
 					);
 
-					if (valid && joint_id != NOSE && joint_id != EYE_LEFT && joint_id != EYE_RIGHT && joint_id != EAR_LEFT && joint_id != EAR_RIGHT && joint_id != HANDTIP_LEFT && joint_id != HANDTIP_RIGHT)
-					{
-
-						cv::Point joint_point = cv::Point(joint_in_color_2d[i][joint_id].v[0], joint_in_color_2d[i][joint_id].v[1]);
-						cv::circle(
-							body_color_overlay_image_mat,
-							joint_point,
-							20,
-							cv::Scalar(255, 255, 255),
-							cv::FILLED,
-							8,
-							0
-						);
-
-						joints_exist[joint_id] = TRUE;
-					}
-					else {
-						joints_exist[joint_id] = FALSE;
-					}
+					joints_exist[joint_id] = TRUE;
+				}
+				else {
+					joints_exist[joint_id] = FALSE;
 				}
+			}
+
+			for (int segment_num = 0; segment_num < LegsAndTrunkModel::SEGMENT_COUNT; segment_num++)
+			{
+				const k4a_float3_t& value = body_segment_com[segment_num];
+				const SegmentDefinition& segment = LegsAndTrunkModel::segments[segment_num];
+				int valid_segment = segment_valid[segment_num];
 
-				std::cout << "GETTING BODY SEGMENTS" << std::endl;
-				get_body_segment_com(skeleton, joints_exist, body_segment_com);
+				frame_log.print("\n\nBODY-X:%g\nBODY-Y:%g\nBODY-Z:%g\n", value.xyz.x, value.xyz.y, value.xyz.z);
 
-				int segment_num = 0;
-				for (const k4a_float3_t& value : body_segment_com)
+				// Only segments with both joints on screen
+				if (valid_segment && joints_exist[segment.proximal_joint] && joints_exist[segment.distal_joint])
 				{
-					int valid_segment;
-
-					std::cout << std::endl << std::endl <<
-						"BODY-X:" << value.xyz.x << std::endl <<
-						"BODY-Y:" << value.xyz.y << std::endl <<
-						"BODY-Z:" << value.xyz.z << std::endl;
-
-					k4a_calibration_3d_to_2d(
-						&calibration,
-						&value,
-						K4A_CALIBRATION_TYPE_DEPTH,
-						K4A_CALIBRATION_TYPE_COLOR,
-						&segment_in_color_2d[segment_num],
-						&valid_segment
-					);
+					frame_log.print("writing skeleton\n");
 
-					if (valid_segment)
-					{
-						std::cout << "writing skeleton" << std::endl;
-
-						cv::Point joint_point = cv::Point(segment_in_color_2d[segment_num].xy.x, segment_in_color_2d[segment_num].xy.y);
-						cv::circle(
-							body_color_overlay_image_mat,
-							joint_point,
-							20,
-							cv::Scalar(0, 255, 0),
-							cv::FILLED,
-							8,
-							0
-						);
-					}
-
-					segment_num++;
+					cv::Point joint_point = cv::Point(segment_in_color_2d[segment_num].xy.x, segment_in_color_2d[segment_num].xy.y);
+					cv::circle(
+						frame.image,
+						joint_point,
+						20,
+						cv::Scalar(0, 255, 0),
+						cv::FILLED,
+						8,
+						0
+					);
 				}
-
-				draw_skeleton(body_color_overlay_image_mat, joints_exist, joint_in_color_2d[i]);
 			}
 
-			cv::imshow("color_image", color_image_mat);
-			cv::imshow("depth_image", depth_image_mat);
-			cv::imshow("body_color_overlay_image", body_color_overlay_image_mat);
+			draw_skeleton(frame.image, joints_exist, joint_in_color_2d);
+		}
+
+		frame_log.flush();
+	}
+
+	enum StreamImagesWindow {
+		COLOR_WINDOW,
+		DEPTH_WINDOW,
+		BODY_COLOR_OVERLAY_WINDOW
+	};
+
+	// Present stage of stream_images, hands the images to the preview and goes on
+	static bool show_body_color_overlay(BodyFrame& frame, Preview& preview)
+	{
+		if (frame.capture == NULL) { return !preview.is_closed(); }
+
+		ImageHandle color_image;
+		get_color_image(color_image.out(), frame.capture);
 
-			k4abt_frame_release(body_frame);
-			k4a_capture_release(capture);
+		ImageHandle depth_image;
+		get_depth_image(depth_image.out(), frame.capture);
 
-			if (cv::waitKey(30) == 27) //wait for 'esc' key press for 30ms. If 'esc' key is pressed, break loop
+		{
+			LATENCY_SCOPE(LATENCY_DISPLAY);
+
+			preview.show(COLOR_WINDOW, color_image.get(), CV_8UC4);
+			preview.show(DEPTH_WINDOW, depth_image.get(), CV_16U);
+			preview.show(BODY_COLOR_OVERLAY_WINDOW, frame.image);
+		}
+
+		return !preview.is_closed(); // 'esc' in a window ends the stream
+	}
+
+	// Analysis stage of a headless stream_images: the segment COMs of every body as text, nothing drawn
+	static void write_body_segment_coms(BodyFrame& frame)
+	{
+		compute_com_batch<LegsAndTrunkModel>(&frame, 1);
+
+		AsyncText frame_log(get_async_writer());
+		frame_log.print("Body Tracked: %u\n", frame.num_bodies);
+
+		for (uint32_t i = 0; i < frame.num_bodies; i++)
+		{
+			for (int segment_num = 0; segment_num < LegsAndTrunkModel::SEGMENT_COUNT; segment_num++)
 			{
-				k4a_transformation_destroy(transformation);
-				return;
+				const k4a_float3_t& value = frame.body_segment_com[i][segment_num];
+				frame_log.print("\n\nBODY-X:%g\nBODY-Y:%g\nBODY-Z:%g\n", value.xyz.x, value.xyz.y, value.xyz.z);
 			}
 		}
-		else {
-			std::cout << "Failed to pop capture from tracker process queue." << std::endl;
-			return;
-		}
+	}
 
-		goto BodyTracking;
+	// Present stage of a headless stream_images, no window to take keys so Esc is polled
+	static bool poll_headless_exit(BodyFrame&)
+	{
+		return (GetKeyState(VK_ESCAPE) & 0x8000) == 0;
 	}
 
-	void clear_memory(
-		k4a_device_t* device, 
-		k4a_capture_t* capture, 
-		k4a_image_t images[], 
-		k4a_transformation_t* transformation,
-		k4abt_tracker_t* tracker
-	)
+	void stream_images(FrameSource& source, k4a_calibration_t& calibration, BodyTracker& tracker)
 	{
+		std::unique_ptr<Reprojector> reprojector;
+		Projector projector(calibration);
+		Preview preview;
+		Pipeline::AnalysisFunction analyze = write_body_segment_coms;
+		Pipeline::PresentFunction present = poll_headless_exit;
 
-		if (*transformation != NULL) {
-			k4a_transformation_destroy(*transformation);
+		if (is_headless())
+		{
+			std::cout << "Streaming Segment COMs, Headless!" << std::endl;
 		}
-
-		if (*tracker != NULL)
+		else
 		{
-			k4abt_tracker_shutdown(*tracker);
-			k4abt_tracker_destroy(*tracker);
+			std::cout << "Streaming Images!" << std::endl;
+
+			reprojector.reset(new Reprojector(calibration));
+			analyze = [&projector, &reprojector](BodyFrame& frame) { compose_body_color_overlay(frame, projector, *reprojector); };
+			present = [&preview](BodyFrame& frame) { return show_body_color_overlay(frame, preview); };
+
+			// In the order of StreamImagesWindow
+			preview.add_window("color_image");
+			preview.add_window("depth_image");
+			preview.add_window("body_color_overlay_image");
+
+			// latency and allocations so far on demand
+			preview.set_key_function([](int key) {
+				if (key == 'l') { LATENCY_REPORT(); ALLOCATION_REPORT(); }
+				return true;
+			});
+			preview.start();
 		}
 
-		for (int i = 0; i < TOTAL_IMAGE_NUMBER; i++) {
-			if (images[i] != NULL)
-			{
-				k4a_image_release(images[i]);
-			}
+		// Colour, depth and body index for visualizers in other processes, ahead of the preview
+		FrameBusWriter frame_bus;
+		if (is_frame_bus_enabled() &&
+			frame_bus.open(FRAME_BUS_DEFAULT_NAME, get_frame_bus_format(calibration, !is_headless())) == SUCCESS)
+		{
+			std::cout << "Publishing Frames On " << FRAME_BUS_DEFAULT_NAME << "!" << std::endl;
+
+			Pipeline::PresentFunction show = present;
+			present = [&frame_bus, show](BodyFrame& frame) {
+				frame_bus.publish(frame);
+				return show(frame);
+			};
 		}
 
-		if (*capture != NULL)
+		Pipeline pipeline(
+			[&source](k4a_capture_t& capture) { return source.get_capture(capture); },
+			tracker,
+			analyze,
+			present,
+			get_pipeline_config()
+		);
+
+		pipeline.run();
+		preview.stop();
+		pipeline.print_stats();
+		if (source.is_latest_only())
 		{
-			k4a_capture_release(*capture);
+			std::cout << "Captures Discarded For Newer Ones: " << source.get_discarded_captures() << std::endl;
 		}
 
-		if (*device != NULL)
+		if (frame_bus.is_open())
 		{
-			k4a_device_stop_cameras(*device);
-			k4a_device_close(*device);
+			FrameBusStats bus_stats = frame_bus.get_stats();
+			std::cout << "Frame Bus: " << bus_stats.published << " published, " << bus_stats.dropped << " dropped, "
+				<< bus_stats.skipped << " leased slots skipped, " << bus_stats.reclaimed << " leases reclaimed" << std::endl;
 		}
 
+		get_async_writer().flush();
+		get_async_writer().print_stats();
+		print_k4a_allocator_stats();
+
+		LATENCY_REPORT();
+		ALLOCATION_REPORT();
 	}
 }
\ No newline at end of file
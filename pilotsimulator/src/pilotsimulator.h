@@ -1,17 +1,46 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
 
 #include <Windows.h>
 
 #include <k4a/k4a.h>
 #include <k4abt.h>
+#include <k4arecord/playback.h>
 
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "pipeline.h"
+#include "com.h"
+#include "body_com.h"
+#include "overlay.h"
+#include "image_pool.h"
+#include "lens_model.h"
+#include "reprojection.h"
+#include "projection.h"
+#include "com_log.h"
+#include "async_writer.h"
+#include "latency.h"
+#include "trace.h"
+#include "alloc_audit.h"
+#include "k4a_allocator.h"
+#include "perf_counters.h"
+#include "shared_memory.h"
+#include "metrics.h"
+#include "preview.h"
+#include "com_channel.h"
+#include "udp_output.h"
+#include "frame_bus.h"
+#include "k4a_handle.h"
+
 namespace pilotsimulator {
 
 	constexpr int SUCCESS = 0;
@@ -34,20 +63,186 @@ namespace pilotsimulator {
 		TOE_RIGHT, HEAD, NOSE, EYE_LEFT, EAR_LEFT, EYE_RIGHT, EAR_RIGHT
 	};
 
-	enum Body_Segments {
-		FOOT_RIGHT, SHANK_RIGHT,THIGH_RIGHT, TRUNK_RIGHT, FOOT_LEFT, SHANK_LEFT, THIGH_LEFT, TRUNK_LEFT, BODY_SEGMENT_END 
+	enum ClockMode {
+		REAL_TIME_CLOCK,	// Deliver captures at the recorded or configured frame rate
+		FAST_CLOCK			// Deliver captures as fast as they are read, throughput bound by our own code
+	};
+
+	// Where captures come from, so every loop can run on a device, a recording or synthetic data
+	class FrameSource {
+	public:
+		virtual ~FrameSource() {}
+
+		virtual int open() = 0;
+		virtual int get_capture(k4a_capture_t& capture) = 0;
+		virtual int get_calibration(k4a_calibration_t& calibration) = 0;
+
+		// Synthetic captures carry no real depth, so they need a MockBodyTracker
+		virtual bool is_synthetic() const { return false; }
+
+		void set_clock_mode(ClockMode mode) { clock_mode = mode; }
+		ClockMode get_clock_mode() const { return clock_mode; }
+
+		// Off for programs that never look at colour: no colour camera on a device, no MJPEG decode of a recording,
+		// no colour image from the synthetic source. Set before open.
+		void set_color_enabled(bool enabled) { color_enabled = enabled; }
+		bool is_color_enabled() const { return color_enabled; }
+
+		// Every read skips to the newest capture the source has, the older ones are released and counted.
+		// A device is drained without waiting, a recording or synthetic source skips what the clock has passed.
+		void set_latest_only(bool enabled) { latest_only = enabled; }
+		bool is_latest_only() const { return latest_only; }
+		uint64_t get_discarded_captures() const { return discarded_captures; }
+
+	protected:
+		// Sleeps until timestamp_usec, measured from the first paced capture, in REAL_TIME_CLOCK mode
+		void pace(uint64_t timestamp_usec);
+
+		// Where the paced clock is in timestamp_usec, 0 before the first paced capture and in FAST_CLOCK mode
+		uint64_t get_clock_usec() const;
+
+		void discard_captures(uint64_t count);
+
+		ClockMode clock_mode = REAL_TIME_CLOCK;
+		bool color_enabled = true;
+		bool latest_only = false;
+
+	private:
+		std::atomic<uint64_t> discarded_captures{ 0 };
+		bool clock_started = false;
+		uint64_t first_timestamp_usec = 0;
+		std::chrono::steady_clock::time_point clock_start;
+	};
+
+	// Live Azure Kinect, paced by the camera itself whatever the clock mode
+	class DeviceFrameSource : public FrameSource {
+	public:
+		~DeviceFrameSource();
+
+		int open() override;
+		int get_capture(k4a_capture_t& capture) override;
+		int get_calibration(k4a_calibration_t& calibration) override;
+
+	private:
+		k4a_device_t device = NULL;
+		k4a_device_configuration_t device_config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+	};
+
+	// Azure Kinect recording (.mkv) read through k4arecord
+	class RecordingFrameSource : public FrameSource {
+	public:
+		explicit RecordingFrameSource(const std::string& path, bool loop = false) : path(path), loop(loop) {}
+		~RecordingFrameSource();
+
+		int open() override;
+		int get_capture(k4a_capture_t& capture) override;
+		int get_calibration(k4a_calibration_t& calibration) override;
+
+	private:
+		int read_capture(k4a_capture_t& capture);
+
+		std::string path;
+		bool loop;
+		k4a_playback_t playback = NULL;
+		uint64_t loop_offset_usec = 0;
+		uint64_t last_timestamp_usec = 0;
+		uint64_t frame_period_usec = 0;		// of the camera_fps it was recorded at
+	};
+
+	// Deterministic captures with the same formats and resolutions start_camera configures,
+	// the depth image showing the pilots of body_config
+	class SyntheticFrameSource : public FrameSource {
+	public:
+		explicit SyntheticFrameSource(uint64_t frame_count = 0, const SyntheticBodyConfig& body_config = SyntheticBodyConfig())
+			: frame_count(frame_count), body_config(body_config) {}
+
+		int open() override;
+		int get_capture(k4a_capture_t& capture) override;
+		int get_calibration(k4a_calibration_t& calibration) override;
+		bool is_synthetic() const override { return true; }
+
+		const SyntheticBodyConfig& get_body_config() const { return body_config; }
+
+	private:
+		uint64_t frame_count;	// 0 never runs out
+		uint64_t frame_id = 0;
+		SyntheticBodyConfig body_config;
+		k4a_calibration_t calibration = {};
+		std::unique_ptr<SyntheticBodyGenerator> generator;
+		std::vector<uint8_t> body_index_map;
 	};
 
+	// Command line shared by the programs:
+	// [--recording <file.mkv> [--loop] | --synthetic [frames] [--bodies <n>]] [--fast] [--trace <file.json>]
+	// [--perf-counters [file.csv]] [--metrics [port]] [--huge-pages] [--headless]
+	// [--udp <host:port> [--udp-format binary|xplane|flightgear]] [--frame-bus] [--latest]
+	struct ProgramOptions {
+		std::string recording_path;					// device when empty and not synthetic
+		bool loop = false;
+		bool synthetic = false;
+		uint64_t synthetic_frames = 0;				// 0 never runs out
+		SyntheticBodyConfig body_config;
+		bool fast = false;							// captures as fast as they come rather than at the camera rate
+		std::string trace_path;
+		bool perf_counters = false;
+		std::string perf_counters_path;				// per frame counters, none when empty
+		int metrics_port = 0;						// 0 serves no metrics
+		K4aAllocatorConfig allocator_config;
+		bool headless = false;						// no colour and no window
+		std::string udp_destination;				// host:port, none when empty
+		UdpFormat udp_format = UDP_FORMAT_BINARY;
+		bool frame_bus = false;
+		bool latest = false;						// newest capture only, frames dropped between the stages
+	};
+
+	// Prints the usage line and fails on an unknown option or a malformed value
+	int parse_program_options(int argc, char* argv[], ProgramOptions& options);
+
+	// The trace, metrics server, UDP output and hardware counters the options ask for, and the k4a allocator
+	int start_services(const ProgramOptions& options);
+
+	// Parses the command line, starts the services and opens the source it picks
+	int get_frame_source(std::unique_ptr<FrameSource>& source, int argc, char* argv[]);
+
+	// Whether get_frame_source was given --headless: compute and text output only, Esc still ends the run
+	bool is_headless();
+
+	// Whether get_frame_source was given --latest
+	bool is_latest_only();
+
+	// get_low_latency_pipeline_config with --latest, the blocking defaults without
+	PipelineConfig get_pipeline_config();
+
+	// Whether get_frame_source was given --frame-bus
+	bool is_frame_bus_enabled();
+
+	// Frame bus slots for the calibration's colour and depth modes, no colour when color is false
+	FrameBusFormat get_frame_bus_format(const k4a_calibration_t& calibration, bool color);
+
+	// k4abt tracker for real captures, MockBodyTracker reporting the same pilots for synthetic ones
+	int get_body_tracker(
+		std::unique_ptr<BodyTracker>& body_tracker,
+		k4abt_tracker_t& tracker,
+		const FrameSource& source,
+		const k4a_calibration_t& calibration
+	);
+
 	// Get k4a device
 	int get_device(k4a_device_t& device);
 
+	// Depth only without color, the body tracker needs nothing else
 	int start_camera(
 		const k4a_device_t& device,
-		k4a_device_configuration_t& device_config
+		k4a_device_configuration_t& device_config,
+		bool color = true
 	);
 
 	int get_capture(const k4a_device_t& device, k4a_capture_t& capture);
 
+	// Drains the device's queue without waiting and keeps the newest capture, discarded counts the older ones.
+	// Waits as get_capture does only when nothing is queued.
+	int get_latest_capture(const k4a_device_t& device, k4a_capture_t& capture, uint64_t& discarded);
+
 	int get_calibration(
 		const k4a_device_t& device, 
 		const k4a_device_configuration_t& device_config, 
@@ -58,35 +253,30 @@ namespace pilotsimulator {
 
 	int get_tracker(k4abt_tracker_t& tracker, const k4a_calibration_t& calibration);
 
+	// Into images[image_type], giving back the image an earlier call left there
 	void get_image(
 		const Image image_type, 
-		k4a_image_t images[], 
+		ImageHandle images[], 
 		const k4a_capture_t& capture, 
-		k4a_transformation_t* transformation = NULL
+		k4a_transformation_t transformation = NULL,
+		Reprojector* reprojector = NULL
 	);
 
 	void get_body_tracking_image(
 		const Image image_type,
-		k4a_image_t images[],
+		ImageHandle images[],
 		const k4a_capture_t& capture,
 		const k4abt_tracker_t& tracker,
-		k4a_transformation_t* transformation = NULL,
+		k4a_transformation_t transformation = NULL,
 		k4a_calibration_t* calibration = NULL
 	);
 
 	int get_cv_mat_type(Image image_type);
 
-	void save_image(const Image image_type, const k4a_image_t images[], std::string filename);
+	void save_image(const Image image_type, const ImageHandle images[], std::string filename);
 
-	void start_body_tracking(k4a_device_t& device, k4a_capture_t& capture, k4abt_tracker_t& tracker);
+	void start_body_tracking(FrameSource& source, BodyTracker& tracker);
 
-	void stream_images(k4a_device_t& device, k4a_capture_t& capture, k4a_calibration_t& calibration, k4abt_tracker_t& tracker);
-
-	void clear_memory(
-		k4a_device_t* device = NULL, 
-		k4a_capture_t* capture = NULL, 
-		k4a_image_t images[] = {},
-		k4a_transformation_t* transformation = NULL,
-		k4abt_tracker_t* tracker = NULL
-	);
+	// Colour, depth and the body overlay in windows, or when headless only the segment COMs as text
+	void stream_images(FrameSource& source, k4a_calibration_t& calibration, BodyTracker& tracker);
 }
\ No newline at end of file
@@ -0,0 +1,677 @@
+#include "pilotsimulator.h"
+
+#include <iomanip>
+
+namespace pilotsimulator {
+
+	static const char* StageNames[PIPELINE_STAGE_COUNT] = {
+		"capture", "enqueue", "pop", "analysis", "present"
+	};
+
+	static const LatencyStage StageLatencies[PIPELINE_STAGE_COUNT] = {
+		LATENCY_CAPTURE_WAIT, LATENCY_TRACKER_ENQUEUE, LATENCY_TRACKER_POP, LATENCY_ANALYSIS, LATENCY_PRESENT
+	};
+
+	void release_body_frame(BodyFrame& frame)
+	{
+		if (frame.body_index_map != NULL)
+		{
+			k4a_image_release(frame.body_index_map);
+			frame.body_index_map = NULL;
+		}
+
+		if (frame.body_frame != NULL)
+		{
+			k4abt_frame_release(frame.body_frame);
+			frame.body_frame = NULL;
+		}
+
+		if (frame.capture != NULL)
+		{
+			k4a_capture_release(frame.capture);
+			frame.capture = NULL;
+		}
+
+		frame.image.release();
+	}
+
+	k4a_wait_result_t K4abtBodyTracker::enqueue_capture(k4a_capture_t capture, int32_t timeout_in_ms)
+	{
+		return k4abt_tracker_enqueue_capture(tracker, capture, timeout_in_ms);
+	}
+
+	k4a_wait_result_t K4abtBodyTracker::pop_result(BodyFrame& frame, int32_t timeout_in_ms)
+	{
+		k4abt_frame_t body_frame = NULL;
+		k4a_wait_result_t result = k4abt_tracker_pop_result(tracker, &body_frame, timeout_in_ms);
+
+		if (result != K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			return result;
+		}
+
+		frame.body_frame = body_frame;
+		frame.capture = k4abt_frame_get_capture(body_frame);
+		frame.body_index_map = k4abt_frame_get_body_index_map(body_frame);
+		frame.device_timestamp_usec = k4abt_frame_get_device_timestamp_usec(body_frame);
+
+		uint32_t num_bodies = k4abt_frame_get_num_bodies(body_frame);
+		if (num_bodies > MAX_BODIES)
+		{
+			std::cout << "Tracked " << num_bodies << " bodies, keeping the first " << MAX_BODIES << std::endl;
+			num_bodies = MAX_BODIES;
+		}
+
+		frame.num_bodies = num_bodies;
+		for (uint32_t i = 0; i < num_bodies; i++)
+		{
+			frame.bodies[i].id = k4abt_frame_get_body_id(body_frame, i);
+			k4abt_frame_get_body_skeleton(body_frame, i, &frame.bodies[i].skeleton);
+		}
+
+		return K4A_WAIT_RESULT_SUCCEEDED;
+	}
+
+	void K4abtBodyTracker::shutdown()
+	{
+		k4abt_tracker_shutdown(tracker);
+	}
+
+	static k4a_calibration_t get_mock_calibration(const k4a_calibration_t* calibration)
+	{
+		if (calibration != NULL) { return *calibration; }
+
+		k4a_calibration_t synthetic_calibration = {};
+		get_synthetic_calibration(synthetic_calibration);
+		return synthetic_calibration;
+	}
+
+	MockBodyTracker::MockBodyTracker(
+		int processing_time_in_ms,
+		size_t queue_size,
+		const SyntheticBodyConfig& body_config,
+		const k4a_calibration_t* calibration
+	)
+		: processing_time_in_ms(processing_time_in_ms), queue_size(queue_size),
+		render_body_index_map(calibration != NULL), generator(get_mock_calibration(calibration), body_config),
+		pending(queue_size), results(queue_size)
+	{
+		if (render_body_index_map)
+		{
+			depth_scratch.resize((size_t)generator.get_width() * generator.get_height());
+		}
+
+		worker = std::thread(&MockBodyTracker::process, this);
+	}
+
+	MockBodyTracker::~MockBodyTracker()
+	{
+		shutdown();
+
+		if (worker.joinable())
+		{
+			worker.join();
+		}
+
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			if (pending[i].capture != NULL) { k4a_capture_release(pending[i].capture); }
+		}
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			release_body_frame(results[i]);
+		}
+	}
+
+	// Waits on the condition variable the same way the SDK interprets timeout_in_ms
+	template <typename Predicate>
+	static bool wait_for(std::unique_lock<std::mutex>& lock, std::condition_variable& condition, int32_t timeout_in_ms, Predicate predicate)
+	{
+		if (timeout_in_ms == K4A_WAIT_INFINITE)
+		{
+			condition.wait(lock, predicate);
+			return true;
+		}
+
+		return condition.wait_for(lock, std::chrono::milliseconds(timeout_in_ms), predicate);
+	}
+
+	k4a_wait_result_t MockBodyTracker::enqueue_capture(k4a_capture_t capture, int32_t timeout_in_ms)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (!wait_for(lock, changed, timeout_in_ms, [this] { return stopped || in_flight < queue_size; }))
+		{
+			return K4A_WAIT_RESULT_TIMEOUT;
+		}
+
+		if (stopped)
+		{
+			return K4A_WAIT_RESULT_FAILED;
+		}
+
+		// Keep our own reference like the SDK does, so the caller can release right away
+		if (capture != NULL) { k4a_capture_reference(capture); }
+
+		pending.push_back({ capture, next_frame_id++ });
+		in_flight++;
+		changed.notify_all();
+
+		return K4A_WAIT_RESULT_SUCCEEDED;
+	}
+
+	k4a_wait_result_t MockBodyTracker::pop_result(BodyFrame& frame, int32_t timeout_in_ms)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (!wait_for(lock, changed, timeout_in_ms, [this] { return stopped || !results.empty(); }))
+		{
+			return K4A_WAIT_RESULT_TIMEOUT;
+		}
+
+		if (results.empty())
+		{
+			return K4A_WAIT_RESULT_FAILED;
+		}
+
+		frame = std::move(results.front());
+		results.pop_front();
+		in_flight--;
+		changed.notify_all();
+
+		return K4A_WAIT_RESULT_SUCCEEDED;
+	}
+
+	void MockBodyTracker::shutdown()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopped = true;
+		changed.notify_all();
+	}
+
+	void MockBodyTracker::process()
+	{
+		for (;;)
+		{
+			PendingCapture item = {};
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [this] { return stopped || !pending.empty(); });
+
+				if (stopped) { return; }
+
+				item = pending.front();
+				pending.pop_front();
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(processing_time_in_ms));
+
+			// Synthetic captures are generated at their depth timestamp, so that is where the pilots are
+			uint64_t timestamp_usec = item.frame_id * SYNTHETIC_FRAME_PERIOD_USEC;
+			if (item.capture != NULL)
+			{
+				k4a_image_t depth_image = k4a_capture_get_depth_image(item.capture);
+				if (depth_image != NULL)
+				{
+					timestamp_usec = k4a_image_get_device_timestamp_usec(depth_image);
+					k4a_image_release(depth_image);
+				}
+			}
+
+			BodyFrame frame;
+			frame.capture = item.capture;
+			frame.device_timestamp_usec = timestamp_usec;
+			frame.num_bodies = generator.get_bodies(timestamp_usec, frame.bodies, MAX_BODIES);
+
+			if (render_body_index_map)
+			{
+				int width = generator.get_width();
+				int height = generator.get_height();
+
+				k4a_image_t body_index_map = NULL;
+				if (get_image_pool().create_image(K4A_IMAGE_FORMAT_CUSTOM8, width, height, width, body_index_map) == SUCCESS)
+				{
+					generator.render(timestamp_usec, depth_scratch.data(), k4a_image_get_buffer(body_index_map));
+					k4a_image_set_device_timestamp_usec(body_index_map, timestamp_usec);
+					frame.body_index_map = body_index_map;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			results.push_back(std::move(frame));
+			changed.notify_all();
+		}
+	}
+
+	Pipeline::Pipeline(
+		CaptureFunction capture_function,
+		BodyTracker& tracker,
+		AnalysisFunction analysis_function,
+		PresentFunction present_function,
+		const PipelineConfig& config
+	)
+		: capture_function(capture_function), tracker(tracker),
+		analysis_function(analysis_function), present_function(present_function), config(config),
+		analysis_queue(config.analysis_queue_capacity), present_queue(config.present_queue_capacity),
+		metrics(get_pipeline_metrics())
+	{
+		if (this->config.tracker_queue_depth == 0) { this->config.tracker_queue_depth = 1; }
+		if (this->config.analysis_worker_count < 1) { this->config.analysis_worker_count = 1; }
+	}
+
+	Pipeline::~Pipeline()
+	{
+		stop();
+
+		if (capture_thread.joinable()) { capture_thread.join(); }
+		if (pop_thread.joinable()) { pop_thread.join(); }
+		for (std::thread& thread : analysis_threads)
+		{
+			if (thread.joinable()) { thread.join(); }
+		}
+	}
+
+	void Pipeline::record(PipelineStage stage, std::chrono::steady_clock::time_point start)
+	{
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+		stats[stage].frames++;
+		stats[stage].busy_usec += (uint64_t)elapsed.count();
+
+		LATENCY_RECORD_SINCE(StageLatencies[stage], start);
+	}
+
+	void Pipeline::capture_loop()
+	{
+		uint64_t captured = 0;
+
+		TRACE_THREAD_NAME("capture");
+		ALLOCATION_STAGE(LATENCY_CAPTURE_WAIT);
+
+		while (running)
+		{
+			if (config.max_frames != 0 && captured >= config.max_frames) { break; }
+
+			// Blocking waits for room in the tracker before reading, dropping reads on so the source never falls behind
+			if (config.tracker_policy == OVERFLOW_BLOCK)
+			{
+				std::unique_lock<std::mutex> lock(in_flight_mutex);
+				in_flight_changed.wait(lock, [this] { return !running || in_flight < config.tracker_queue_depth; });
+			}
+
+			if (!running) { break; }
+
+			TRACE_FRAME(captured);
+
+			auto start = std::chrono::steady_clock::now();
+			k4a_capture_t capture = NULL;
+			int capture_result;
+			{
+				PERF_SCOPE(LATENCY_CAPTURE_WAIT);
+				capture_result = capture_function(capture);
+			}
+			if (capture_result == FAILURE) { break; }
+			record(CAPTURE_STAGE, start);
+			metrics.captures.add();
+
+			if (!enqueue(capture)) { break; }
+
+			captured++;
+		}
+
+		capturing = false;
+		in_flight_changed.notify_all();
+	}
+
+	// Hands the capture to the tracker, or when the tracker is full does what tracker_policy says.
+	// The capture is released either way. False when the tracker failed.
+	bool Pipeline::enqueue(k4a_capture_t capture)
+	{
+		std::lock_guard<std::mutex> enqueue_lock(enqueue_mutex);
+		{
+			std::lock_guard<std::mutex> lock(in_flight_mutex);
+
+			// Only the newest capture waits, one still waiting is older than this one
+			if (waiting_capture != NULL)
+			{
+				k4a_capture_release(waiting_capture);
+				waiting_capture = NULL;
+				discard(ENQUEUE_STAGE);
+			}
+
+			if (in_flight >= config.tracker_queue_depth)
+			{
+				if (config.tracker_policy == OVERFLOW_DROP_OLDEST)
+				{
+					waiting_capture = capture;
+				}
+				else
+				{
+					if (capture != NULL) { k4a_capture_release(capture); }
+					discard(ENQUEUE_STAGE);
+				}
+				return true;
+			}
+
+			in_flight++;
+		}
+
+		return submit(capture);
+	}
+
+	// The waiting capture, from the pop thread once the tracker has room for it
+	bool Pipeline::enqueue_waiting()
+	{
+		std::lock_guard<std::mutex> enqueue_lock(enqueue_mutex);
+		k4a_capture_t capture = NULL;
+		{
+			std::lock_guard<std::mutex> lock(in_flight_mutex);
+			if (!running || waiting_capture == NULL || in_flight >= config.tracker_queue_depth) { return true; }
+
+			capture = waiting_capture;
+			waiting_capture = NULL;
+			in_flight++;
+		}
+
+		return submit(capture);
+	}
+
+	// Into the room in the tracker the caller counted in in_flight
+	bool Pipeline::submit(k4a_capture_t capture)
+	{
+		auto start = std::chrono::steady_clock::now();
+		k4a_wait_result_t queue_capture_result;
+		{
+			ALLOCATION_STAGE(LATENCY_TRACKER_ENQUEUE);
+			PERF_SCOPE(LATENCY_TRACKER_ENQUEUE);
+			queue_capture_result = tracker.enqueue_capture(capture, K4A_WAIT_INFINITE);
+		}
+
+		// The tracker holds its own reference from here on
+		if (capture != NULL) { k4a_capture_release(capture); }
+
+		if (queue_capture_result != K4A_WAIT_RESULT_SUCCEEDED)
+		{
+			std::cout << "Failed to add capture to tracker process queue." << std::endl;
+			{
+				std::lock_guard<std::mutex> lock(in_flight_mutex);
+				in_flight--;
+			}
+			in_flight_changed.notify_all();
+			return false;
+		}
+		record(ENQUEUE_STAGE, start);
+
+		{
+			std::lock_guard<std::mutex> lock(in_flight_mutex);
+			metrics.tracker_queue_depth.set((double)in_flight);
+			TRACE_COUNTER(TRACE_TRACKER_IN_FLIGHT, in_flight);
+		}
+		in_flight_changed.notify_all();
+
+		return true;
+	}
+
+	// Pushes the frame on as policy says, whatever does not go in is released
+	void Pipeline::hand_off(BoundedQueue<BodyFrame>& queue, OverflowPolicy policy, PipelineStage stage, BodyFrame& frame)
+	{
+		PushResult result = queue.push(frame, policy);
+		if (result == PUSH_QUEUED) { return; }
+
+		if (result != PUSH_CLOSED) { discard(stage); }
+		release_body_frame(frame);
+	}
+
+	void Pipeline::discard(PipelineStage stage)
+	{
+		stats[stage].discarded++;
+
+		switch (stage)
+		{
+		case ENQUEUE_STAGE: metrics.tracker_discarded.add(); break;
+		case ANALYSIS_STAGE: metrics.analysis_discarded.add(); break;
+		case PRESENT_STAGE: metrics.present_discarded.add(); break;
+		default: break;
+		}
+	}
+
+	void Pipeline::pop_loop()
+	{
+		const int32_t POP_TIMEOUT_IN_MS = 100;
+		uint64_t popped = 0;
+
+		TRACE_THREAD_NAME("pop");
+		ALLOCATION_STAGE(LATENCY_TRACKER_POP);
+
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(in_flight_mutex);
+				if (!capturing && in_flight == 0) { break; }
+			}
+
+			TRACE_FRAME(popped);
+
+			auto start = std::chrono::steady_clock::now();
+			BodyFrame frame;
+			k4a_wait_result_t pop_frame_result;
+			{
+				PERF_SCOPE(LATENCY_TRACKER_POP);
+				pop_frame_result = tracker.pop_result(frame, POP_TIMEOUT_IN_MS);
+			}
+
+			if (pop_frame_result == K4A_WAIT_RESULT_TIMEOUT) { continue; }
+
+			if (pop_frame_result == K4A_WAIT_RESULT_FAILED)
+			{
+				std::cout << "Failed to pop capture from tracker process queue." << std::endl;
+				running = false;
+				break;
+			}
+			record(POP_STAGE, start);
+			metrics.pop_latency.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			metrics.bodies.set(frame.num_bodies);
+
+			{
+				std::lock_guard<std::mutex> lock(in_flight_mutex);
+				in_flight--;
+				metrics.tracker_queue_depth.set((double)in_flight);
+				TRACE_COUNTER(TRACE_TRACKER_IN_FLIGHT, in_flight);
+			}
+			in_flight_changed.notify_all();
+
+			// The newest capture the tracker had no room for goes in now
+			if (config.tracker_policy == OVERFLOW_DROP_OLDEST && !enqueue_waiting()) { stop(); }
+
+			frame.frame_id = popped++;
+
+			// After stop the tracker is still drained, but nothing more is handed on
+			if (!running)
+			{
+				release_body_frame(frame);
+			}
+			else
+			{
+				hand_off(analysis_queue, config.analysis_policy, ANALYSIS_STAGE, frame);
+			}
+			TRACE_COUNTER(TRACE_ANALYSIS_QUEUE_DEPTH, analysis_queue.size());
+		}
+
+		analysis_queue.close();
+	}
+
+	void Pipeline::analysis_loop()
+	{
+		BodyFrame frame;
+
+		TRACE_THREAD_NAME("analysis");
+		ALLOCATION_STAGE(LATENCY_ANALYSIS);
+
+		while (analysis_queue.pop(frame))
+		{
+			if (!running)
+			{
+				release_body_frame(frame);
+				continue;
+			}
+
+			TRACE_FRAME(frame.frame_id);
+
+			auto start = std::chrono::steady_clock::now();
+			if (analysis_function)
+			{
+				PERF_SCOPE(LATENCY_ANALYSIS);
+				analysis_function(frame);
+			}
+			record(ANALYSIS_STAGE, start);
+
+			hand_off(present_queue, config.present_policy, PRESENT_STAGE, frame);
+			TRACE_COUNTER(TRACE_PRESENT_QUEUE_DEPTH, present_queue.size());
+		}
+
+		// The last worker out closes the present queue
+		if (--active_analysis_workers == 0)
+		{
+			present_queue.close();
+		}
+	}
+
+	void Pipeline::run()
+	{
+		running = true;
+		capturing = true;
+		active_analysis_workers = config.analysis_worker_count;
+		start_time = std::chrono::steady_clock::now();
+
+		capture_thread = std::thread(&Pipeline::capture_loop, this);
+		pop_thread = std::thread(&Pipeline::pop_loop, this);
+		for (int i = 0; i < config.analysis_worker_count; i++)
+		{
+			analysis_threads.emplace_back(&Pipeline::analysis_loop, this);
+		}
+
+		BodyFrame frame;
+		uint64_t presented = 0;
+
+		TRACE_THREAD_NAME("present");
+
+		while (present_queue.pop(frame))
+		{
+			if (!running)
+			{
+				release_body_frame(frame);
+				continue;
+			}
+
+			TRACE_FRAME(frame.frame_id);
+
+			auto start = std::chrono::steady_clock::now();
+			bool keep_running;
+			{
+				ALLOCATION_STAGE(LATENCY_PRESENT);
+				PERF_SCOPE(LATENCY_PRESENT);
+				keep_running = present_function ? present_function(frame) : true;
+			}
+			record(PRESENT_STAGE, start);
+			LATENCY_FRAME(frame.device_timestamp_usec);
+			metrics.dropped_frames.add(drops.add_frame(frame.device_timestamp_usec));
+			ALLOCATION_FRAME();
+
+			release_body_frame(frame);
+			presented++;
+
+			if (!keep_running || (config.max_frames != 0 && presented >= config.max_frames))
+			{
+				stop();
+			}
+		}
+
+		capture_thread.join();
+		pop_thread.join();
+		for (std::thread& thread : analysis_threads)
+		{
+			thread.join();
+		}
+		analysis_threads.clear();
+
+		// Anything still queued after a stop only needs its handles back
+		while (analysis_queue.pop(frame)) { release_body_frame(frame); }
+		while (present_queue.pop(frame)) { release_body_frame(frame); }
+		if (waiting_capture != NULL)
+		{
+			k4a_capture_release(waiting_capture);
+			waiting_capture = NULL;
+		}
+
+		end_time = std::chrono::steady_clock::now();
+	}
+
+	PipelineConfig get_low_latency_pipeline_config()
+	{
+		PipelineConfig config;
+		config.tracker_queue_depth = 1;
+		config.analysis_queue_capacity = 1;
+		config.present_queue_capacity = 1;
+		config.tracker_policy = OVERFLOW_DROP_OLDEST;
+		config.analysis_policy = OVERFLOW_DROP_OLDEST;
+		config.present_policy = OVERFLOW_DROP_OLDEST;
+
+		return config;
+	}
+
+	void Pipeline::stop()
+	{
+		running = false;
+		in_flight_changed.notify_all();
+		analysis_queue.close();
+		present_queue.close();
+	}
+
+	size_t Pipeline::get_max_frames_in_flight() const
+	{
+		// Plus the capture being enqueued and the one waiting for the tracker, the popped frame waiting for the
+		// analysis queue and the one presented
+		return config.tracker_queue_depth + config.analysis_queue_capacity + config.present_queue_capacity + (size_t)config.analysis_worker_count + 4;
+	}
+
+	uint64_t Pipeline::get_frame_count(PipelineStage stage) const
+	{
+		return stats[stage].frames;
+	}
+
+	uint64_t Pipeline::get_discarded_count(PipelineStage stage) const
+	{
+		return stats[stage].discarded;
+	}
+
+	double Pipeline::get_throughput(PipelineStage stage) const
+	{
+		auto end = running ? std::chrono::steady_clock::now() : end_time;
+		double seconds = std::chrono::duration<double>(end - start_time).count();
+
+		return seconds > 0 ? (double)stats[stage].frames / seconds : 0;
+	}
+
+	void Pipeline::print_stats() const
+	{
+		std::cout << std::endl << "Pipeline Stats:" << std::endl;
+
+		for (int stage = 0; stage < PIPELINE_STAGE_COUNT; stage++)
+		{
+			uint64_t frames = stats[stage].frames;
+			double busy_ms = frames > 0 ? (double)stats[stage].busy_usec / frames / 1000.0 : 0;
+
+			std::cout << std::setw(10) << StageNames[stage] << ": "
+				<< frames << " frames, "
+				<< std::fixed << std::setprecision(1) << get_throughput((PipelineStage)stage) << " fps, "
+				<< std::setprecision(2) << busy_ms << " ms per frame" << std::endl;
+		}
+
+		std::cout << "Queue high water marks: analysis " << analysis_queue.get_high_water_mark()
+			<< ", present " << present_queue.get_high_water_mark() << std::endl;
+		std::cout << "Discarded at hand-offs: tracker " << stats[ENQUEUE_STAGE].discarded
+			<< ", analysis " << stats[ANALYSIS_STAGE].discarded
+			<< ", present " << stats[PRESENT_STAGE].discarded << std::endl;
+	}
+}
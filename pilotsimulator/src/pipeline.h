@@ -0,0 +1,376 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <k4a/k4a.h>
+#include <k4abt.h>
+
+#include <opencv2/core.hpp>
+
+#include "synthetic_body.h"
+#include "latency.h"
+#include "metrics.h"
+#include "async_writer.h"
+
+namespace pilotsimulator {
+
+	constexpr uint32_t MAX_BODIES = 16;
+	constexpr int MAX_BODY_SEGMENTS = 16;
+
+	// Body tracking result detached from the k4abt frame so every stage can run without the SDK
+	struct BodyFrame {
+		uint64_t frame_id = 0;
+		uint64_t device_timestamp_usec = 0;
+		uint32_t num_bodies = 0;
+		k4abt_body_t bodies[MAX_BODIES] = {};
+
+		// References kept for the render stages, NULL when produced by a mock tracker
+		k4a_capture_t capture = NULL;
+		k4abt_frame_t body_frame = NULL;
+		k4a_image_t body_index_map = NULL;	// also set by a mock tracker given a calibration
+
+		// Filled by the analysis stage
+		k4a_float3_t center_of_mass[MAX_BODIES] = {};
+		k4a_float3_t body_segment_com[MAX_BODIES][MAX_BODY_SEGMENTS] = {};
+		cv::Mat image;
+	};
+
+	// Also drops the frame's image, so a pooled one can be handed out again
+	void release_body_frame(BodyFrame& frame);
+
+	// FIFO over slots allocated once up front, so the steady state of a hand-off never touches the heap.
+	// Not synchronised. A popped slot keeps its moved-from value until the next push overwrites it.
+	template <typename T>
+	class RingBuffer {
+	public:
+		explicit RingBuffer(size_t capacity) : slots(capacity > 0 ? capacity : 1) {}
+
+		bool empty() const { return count == 0; }
+		bool full() const { return count == slots.size(); }
+		size_t size() const { return count; }
+		size_t capacity() const { return slots.size(); }
+
+		// Only when not full
+		void push_back(T&& item)
+		{
+			slots[(head + count) % slots.size()] = std::move(item);
+			count++;
+		}
+
+		// Only when not empty
+		T& front() { return slots[head]; }
+		void pop_front()
+		{
+			head = (head + 1) % slots.size();
+			count--;
+		}
+
+		// From the front
+		T& operator[](size_t index) { return slots[(head + index) % slots.size()]; }
+
+	private:
+		std::vector<T> slots;
+		size_t head = 0;
+		size_t count = 0;
+	};
+
+	// Hand-off between one producer and one consumer where only the newest value counts, as a triple buffer:
+	// the producer fills back() and publishes it, the consumer takes the newest into front(). Neither ever
+	// waits on the other and nothing is allocated, a value not taken before the next publish is replaced.
+	template <typename T>
+	class LatestSlot {
+	public:
+		// Producer side, its slot stays its own until publish
+		T& back() { return slots[back_index]; }
+
+		// Replaces the waiting value, true when that one was never taken
+		bool publish()
+		{
+			uint8_t previous = state.exchange((uint8_t)(back_index | FRESH), std::memory_order_acq_rel);
+			back_index = previous & INDEX_MASK;
+			return (previous & FRESH) != 0;
+		}
+
+		// Consumer side, false when nothing was published since the last take
+		bool take()
+		{
+			if ((state.load(std::memory_order_relaxed) & FRESH) == 0) { return false; }
+
+			uint8_t previous = state.exchange(front_index, std::memory_order_acq_rel);
+			front_index = previous & INDEX_MASK;
+			return true;
+		}
+
+		T& front() { return slots[front_index]; }
+
+	private:
+		enum : uint8_t { INDEX_MASK = 3, FRESH = 4 };
+
+		T slots[3];
+		uint8_t back_index = 0;
+		uint8_t front_index = 1;
+		std::atomic<uint8_t> state{ 2 };	// index of the waiting slot, FRESH when not taken yet
+	};
+
+	enum PushResult {
+		PUSH_QUEUED,		// the item went in
+		PUSH_REPLACED,		// the item went in, the oldest one came out in its place
+		PUSH_DROPPED,		// full, the item stays with the caller
+		PUSH_CLOSED			// closed, the item stays with the caller
+	};
+
+	// Fixed capacity hand-off queue between two pipeline stages
+	template <typename T>
+	class BoundedQueue {
+	public:
+		explicit BoundedQueue(size_t capacity) : items(capacity) {}
+
+		// Blocks while the queue is full. The item is only moved from when true is returned.
+		bool push(T& item) { return push(item, OVERFLOW_BLOCK) == PUSH_QUEUED; }
+
+		// A full queue blocks, hands the oldest item back in item or leaves item out, as policy says.
+		// Whatever item holds unless PUSH_QUEUED is the caller's to release.
+		PushResult push(T& item, OverflowPolicy policy)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (policy == OVERFLOW_BLOCK) { not_full.wait(lock, [this] { return closed || !items.full(); }); }
+
+			if (closed) { return PUSH_CLOSED; }
+
+			PushResult result = PUSH_QUEUED;
+			if (items.full())
+			{
+				if (policy == OVERFLOW_DROP_NEWEST) { return PUSH_DROPPED; }
+
+				T oldest = std::move(items.front());
+				items.pop_front();
+				items.push_back(std::move(item));
+				item = std::move(oldest);
+				result = PUSH_REPLACED;
+			}
+			else
+			{
+				items.push_back(std::move(item));
+			}
+
+			if (items.size() > high_water_mark) { high_water_mark = items.size(); }
+			not_empty.notify_one();
+
+			return result;
+		}
+
+		// Blocks while the queue is empty. Returns false once the queue is closed and drained.
+		bool pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			not_empty.wait(lock, [this] { return closed || !items.empty(); });
+
+			if (items.empty()) { return false; }
+
+			item = std::move(items.front());
+			items.pop_front();
+			not_full.notify_one();
+
+			return true;
+		}
+
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			not_full.notify_all();
+			not_empty.notify_all();
+		}
+
+		size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return items.size();
+		}
+
+		size_t get_high_water_mark() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return high_water_mark;
+		}
+
+	private:
+		RingBuffer<T> items;
+		size_t high_water_mark = 0;
+		bool closed = false;
+		mutable std::mutex mutex;
+		std::condition_variable not_full;
+		std::condition_variable not_empty;
+	};
+
+	// Body tracker as seen by the pipeline, so it can be swapped for a mock
+	class BodyTracker {
+	public:
+		virtual ~BodyTracker() {}
+
+		virtual k4a_wait_result_t enqueue_capture(k4a_capture_t capture, int32_t timeout_in_ms) = 0;
+		virtual k4a_wait_result_t pop_result(BodyFrame& frame, int32_t timeout_in_ms) = 0;
+		virtual void shutdown() = 0;
+	};
+
+	// Wraps a k4abt tracker created by get_tracker, the handle stays owned by the caller
+	class K4abtBodyTracker : public BodyTracker {
+	public:
+		explicit K4abtBodyTracker(k4abt_tracker_t tracker) : tracker(tracker) {}
+
+		k4a_wait_result_t enqueue_capture(k4a_capture_t capture, int32_t timeout_in_ms) override;
+		k4a_wait_result_t pop_result(BodyFrame& frame, int32_t timeout_in_ms) override;
+		void shutdown() override;
+
+	private:
+		k4abt_tracker_t tracker;
+	};
+
+	// Stands in for the GPU tracker: one worker that takes processing_time_in_ms per capture
+	// and at most queue_size captures in flight, like the k4abt input/output queues.
+	// Reports the pilots of a SyntheticBodyGenerator at the depth timestamp of each capture,
+	// with a body index map when given the calibration to render it with.
+	class MockBodyTracker : public BodyTracker {
+	public:
+		MockBodyTracker(
+			int processing_time_in_ms = 25,
+			size_t queue_size = 3,
+			const SyntheticBodyConfig& body_config = SyntheticBodyConfig(),
+			const k4a_calibration_t* calibration = NULL
+		);
+		~MockBodyTracker();
+
+		k4a_wait_result_t enqueue_capture(k4a_capture_t capture, int32_t timeout_in_ms) override;
+		k4a_wait_result_t pop_result(BodyFrame& frame, int32_t timeout_in_ms) override;
+		void shutdown() override;
+
+	private:
+		struct PendingCapture {
+			k4a_capture_t capture;
+			uint64_t frame_id;
+		};
+
+		void process();
+
+		int processing_time_in_ms;
+		size_t queue_size;
+		bool render_body_index_map;
+		SyntheticBodyGenerator generator;
+		std::vector<uint16_t> depth_scratch;
+		uint64_t next_frame_id = 0;
+		size_t in_flight = 0;
+		bool stopped = false;
+
+		RingBuffer<PendingCapture> pending;	// both hold at most queue_size
+		RingBuffer<BodyFrame> results;
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::thread worker;
+	};
+
+	enum PipelineStage {
+		CAPTURE_STAGE, ENQUEUE_STAGE, POP_STAGE, ANALYSIS_STAGE, PRESENT_STAGE,
+		PIPELINE_STAGE_COUNT
+	};
+
+	// What each hand-off does with a frame when the next stage is full. Blocking loses nothing but lets the
+	// stages ahead fall behind the sensor, dropping keeps the latency down and counts the frames discarded.
+	// The tracker's own queue cannot give a capture back, so OVERFLOW_DROP_OLDEST there keeps the newest
+	// capture waiting outside it and enqueues that one as soon as a result is popped.
+	struct PipelineConfig {
+		size_t tracker_queue_depth = 3;		// captures in flight inside the tracker
+		size_t analysis_queue_capacity = 2;	// popped body frames waiting for analysis
+		size_t present_queue_capacity = 2;	// analysed body frames waiting for presentation
+		int analysis_worker_count = 1;		// more than one worker does not keep frame order
+		uint64_t max_frames = 0;			// 0 runs until present returns false
+		OverflowPolicy tracker_policy = OVERFLOW_BLOCK;		// a capture while the tracker is full
+		OverflowPolicy analysis_policy = OVERFLOW_BLOCK;	// a popped frame while the analysis queue is full
+		OverflowPolicy present_policy = OVERFLOW_BLOCK;		// an analysed frame while the present queue is full
+	};
+
+	// Newest frame wins at every hand-off, one frame waiting between stages
+	PipelineConfig get_low_latency_pipeline_config();
+
+	// Capture thread -> tracker -> pop thread -> analysis workers -> present on the calling thread
+	class Pipeline {
+	public:
+		using CaptureFunction = std::function<int(k4a_capture_t&)>;
+		using AnalysisFunction = std::function<void(BodyFrame&)>;
+		using PresentFunction = std::function<bool(BodyFrame&)>;
+
+		Pipeline(
+			CaptureFunction capture_function,
+			BodyTracker& tracker,
+			AnalysisFunction analysis_function,
+			PresentFunction present_function,
+			const PipelineConfig& config = PipelineConfig()
+		);
+		~Pipeline();
+
+		// Blocks until present returns false, a capture fails or max_frames have been presented
+		void run();
+		void stop();
+
+		// Most frames the queues and stages hold at once, what a pool feeding the pipeline has to cover
+		size_t get_max_frames_in_flight() const;
+
+		uint64_t get_frame_count(PipelineStage stage) const;
+		double get_throughput(PipelineStage stage) const;
+
+		// Frames discarded at the hand-off into ENQUEUE_STAGE, ANALYSIS_STAGE or PRESENT_STAGE
+		uint64_t get_discarded_count(PipelineStage stage) const;
+
+		void print_stats() const;
+
+	private:
+		struct StageStats {
+			std::atomic<uint64_t> frames{ 0 };
+			std::atomic<uint64_t> busy_usec{ 0 };
+			std::atomic<uint64_t> discarded{ 0 };
+		};
+
+		void capture_loop();
+		void pop_loop();
+		void analysis_loop();
+		bool enqueue(k4a_capture_t capture);
+		bool enqueue_waiting();
+		bool submit(k4a_capture_t capture);
+		void hand_off(BoundedQueue<BodyFrame>& queue, OverflowPolicy policy, PipelineStage stage, BodyFrame& frame);
+		void discard(PipelineStage stage);
+		void record(PipelineStage stage, std::chrono::steady_clock::time_point start);
+
+		CaptureFunction capture_function;
+		BodyTracker& tracker;
+		AnalysisFunction analysis_function;
+		PresentFunction present_function;
+		PipelineConfig config;
+
+		BoundedQueue<BodyFrame> analysis_queue;
+		BoundedQueue<BodyFrame> present_queue;
+
+		std::atomic<bool> running{ false };
+		std::atomic<bool> capturing{ false };
+		std::atomic<int> active_analysis_workers{ 0 };
+		size_t in_flight = 0;
+		k4a_capture_t waiting_capture = NULL;	// the newest capture the full tracker could not take yet
+		std::mutex enqueue_mutex;				// keeps the captures in order when the pop thread enqueues too
+		std::mutex in_flight_mutex;
+		std::condition_variable in_flight_changed;
+
+		StageStats stats[PIPELINE_STAGE_COUNT];
+		PipelineMetrics& metrics;
+		FrameDropDetector drops;		// of the present loop
+		std::chrono::steady_clock::time_point start_time;
+		std::chrono::steady_clock::time_point end_time;
+
+		std::thread capture_thread;
+		std::thread pop_thread;
+		std::vector<std::thread> analysis_threads;
+	};
+}
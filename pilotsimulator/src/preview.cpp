@@ -0,0 +1,149 @@
+#include "pilotsimulator.h"
+
+namespace pilotsimulator {
+
+	static const int ESCAPE_KEY = 27;
+
+	int get_display_refresh_rate()
+	{
+		DEVMODEA mode = {};
+		mode.dmSize = sizeof(mode);
+
+		// 0 and 1 stand for the hardware's default rate
+		if (EnumDisplaySettingsA(NULL, ENUM_CURRENT_SETTINGS, &mode) && mode.dmDisplayFrequency > 1)
+		{
+			return (int)mode.dmDisplayFrequency;
+		}
+
+		return PREVIEW_DEFAULT_REFRESH_RATE_HZ;
+	}
+
+	Preview::Preview(int refresh_rate_hz)
+		: refresh_rate_hz(refresh_rate_hz > 0 ? refresh_rate_hz : get_display_refresh_rate())
+	{
+	}
+
+	Preview::~Preview()
+	{
+		stop();
+
+		for (std::unique_ptr<Window>& window : windows)
+		{
+			clear(window->slot.back());
+			clear(window->slot.front());
+			window->slot.publish();
+			clear(window->slot.back());
+		}
+	}
+
+	int Preview::add_window(const std::string& name)
+	{
+		std::unique_ptr<Window> window(new Window());
+		window->name = name;
+		windows.push_back(std::move(window));
+
+		return (int)windows.size() - 1;
+	}
+
+	void Preview::start()
+	{
+		if (running) { return; }
+
+		running = true;
+		closed = false;
+		thread = std::thread(&Preview::run, this);
+	}
+
+	void Preview::stop()
+	{
+		running = false;
+		if (thread.joinable()) { thread.join(); }
+	}
+
+	void Preview::clear(Frame& frame)
+	{
+		if (frame.image != NULL)
+		{
+			k4a_image_release(frame.image);
+			frame.image = NULL;
+		}
+		frame.mat.release();
+	}
+
+	void Preview::show(int window_index, k4a_image_t image, int mat_type)
+	{
+		Window& window = *windows[window_index];
+		Frame& frame = window.slot.back();
+
+		// Whatever the slot held last came back from the preview thread, the frame before it or one never shown
+		clear(frame);
+		if (image == NULL) { return; }
+
+		k4a_image_reference(image);
+		frame.image = image;
+		frame.mat = cv::Mat(
+			k4a_image_get_height_pixels(image), k4a_image_get_width_pixels(image), mat_type,
+			(void*)k4a_image_get_buffer(image),
+			(size_t)k4a_image_get_stride_bytes(image)
+		);
+
+		window.published.fetch_add(1, std::memory_order_relaxed);
+		if (window.slot.publish()) { window.replaced.fetch_add(1, std::memory_order_relaxed); }
+	}
+
+	void Preview::show(int window_index, const cv::Mat& image)
+	{
+		Window& window = *windows[window_index];
+		Frame& frame = window.slot.back();
+
+		clear(frame);
+		if (image.empty()) { return; }
+
+		frame.mat = image;
+
+		window.published.fetch_add(1, std::memory_order_relaxed);
+		if (window.slot.publish()) { window.replaced.fetch_add(1, std::memory_order_relaxed); }
+	}
+
+	void Preview::run()
+	{
+		const int WAIT_IN_MS = (std::max)(1, 1000 / refresh_rate_hz);
+
+		TRACE_THREAD_NAME("preview");
+
+		while (running)
+		{
+			for (std::unique_ptr<Window>& window : windows)
+			{
+				if (!window->slot.take()) { continue; }
+
+				cv::imshow(window->name, window->slot.front().mat);
+				window->shown.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// Pumps the window messages as well, so the windows stay responsive between frames
+			int key = cv::waitKey(WAIT_IN_MS);
+			if (key == -1 || closed) { continue; }
+
+			bool keep_open = key != ESCAPE_KEY;
+			if (key_function && !key_function(key)) { keep_open = false; }
+			if (!keep_open) { closed = true; }
+		}
+
+		for (std::unique_ptr<Window>& window : windows)
+		{
+			cv::destroyWindow(window->name);
+		}
+	}
+
+	PreviewStats Preview::get_stats(int window_index) const
+	{
+		const Window& window = *windows[window_index];
+		PreviewStats stats;
+		stats.published = window.published.load(std::memory_order_relaxed);
+		stats.shown = window.shown.load(std::memory_order_relaxed);
+		stats.replaced = window.replaced.load(std::memory_order_relaxed);
+
+		return stats;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <k4a/k4a.h>
+
+#include <opencv2/core.hpp>
+
+#include "pipeline.h"
+
+namespace pilotsimulator {
+
+	constexpr int PREVIEW_DEFAULT_REFRESH_RATE_HZ = 60;
+
+	struct PreviewStats {
+		uint64_t published = 0;
+		uint64_t shown = 0;
+		uint64_t replaced = 0;		// published but replaced by a newer frame before it was shown
+	};
+
+	// HighGUI windows of the latest composed frames, shown by a thread of their own at the display refresh rate.
+	// Processing hands a frame over and goes on, it never waits on the GUI. A frame the preview has not shown yet
+	// is replaced by the next one. cv::waitKey runs on the preview thread too, keys go to the key function there.
+	class Preview {
+	public:
+		// Runs on the preview thread, returning false closes the preview
+		using KeyFunction = std::function<bool(int key)>;
+
+		// 0 uses the refresh rate of the primary display
+		explicit Preview(int refresh_rate_hz = 0);
+		~Preview();
+
+		Preview(const Preview&) = delete;
+		Preview& operator=(const Preview&) = delete;
+
+		// Before start, returns the window's index for show
+		int add_window(const std::string& name);
+		void set_key_function(KeyFunction key_function) { this->key_function = key_function; }
+
+		void start();
+		void stop();
+
+		// Takes a reference to image and shows its buffer, nothing is copied. Nothing may write to it afterwards.
+		void show(int window, k4a_image_t image, int mat_type);
+
+		// Shares the matrix, nothing is copied. Nothing may write to it afterwards, a pooled one is recycled once the
+		// preview lets go of it.
+		void show(int window, const cv::Mat& image);
+
+		// Esc or a key function that returned false
+		bool is_closed() const { return closed; }
+
+		int get_refresh_rate() const { return refresh_rate_hz; }
+		PreviewStats get_stats(int window) const;
+
+	private:
+		struct Frame {
+			k4a_image_t image = NULL;
+			cv::Mat mat;
+		};
+
+		struct Window {
+			std::string name;
+			LatestSlot<Frame> slot;
+			std::atomic<uint64_t> published{ 0 };
+			std::atomic<uint64_t> shown{ 0 };
+			std::atomic<uint64_t> replaced{ 0 };
+		};
+
+		void run();
+		static void clear(Frame& frame);
+
+		int refresh_rate_hz;
+		KeyFunction key_function;
+		std::vector<std::unique_ptr<Window>> windows;
+		std::atomic<bool> running{ false };
+		std::atomic<bool> closed{ false };
+		std::thread thread;
+	};
+
+	// Of the primary display, PREVIEW_DEFAULT_REFRESH_RATE_HZ when it cannot be told
+	int get_display_refresh_rate();
+}
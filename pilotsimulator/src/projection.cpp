@@ -0,0 +1,234 @@
+#include "pilotsimulator.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PROJECTION_SSE2
+#endif
+
+namespace pilotsimulator {
+
+	// Squared distance in normalised image coordinates under which an unprojection has converged, about 0.01 pixels
+	constexpr float UNPROJECT_RESIDUAL_SQUARED = 1e-10f;
+
+	static const k4a_calibration_camera_t& get_camera(const k4a_calibration_t& calibration, k4a_calibration_type_t camera)
+	{
+		return camera == K4A_CALIBRATION_TYPE_COLOR ? calibration.color_camera_calibration : calibration.depth_camera_calibration;
+	}
+
+	Projector::Projector(const k4a_calibration_t& calibration, k4a_calibration_type_t source_camera, k4a_calibration_type_t target_camera)
+	{
+		source_lens.set(get_camera(calibration, source_camera));
+		target_lens.set(get_camera(calibration, target_camera));
+
+		const k4a_calibration_extrinsics_t& extrinsics = calibration.extrinsics[source_camera][target_camera];
+		for (int i = 0; i < 9; i++) { rotation[i] = source_camera == target_camera ? (i % 4 == 0 ? 1.0f : 0.0f) : extrinsics.rotation[i]; }
+		for (int axis = 0; axis < 3; axis++) { translation[axis] = source_camera == target_camera ? 0.0f : extrinsics.translation[axis]; }
+	}
+
+	void Projector::project_point(const k4a_float3_t& point, k4a_float2_t& pixel, int& valid) const
+	{
+		const LensModel& lens = target_lens;
+
+		float x = rotation[0] * point.xyz.x + rotation[1] * point.xyz.y + rotation[2] * point.xyz.z + translation[0];
+		float y = rotation[3] * point.xyz.x + rotation[4] * point.xyz.y + rotation[5] * point.xyz.z + translation[1];
+		float z = rotation[6] * point.xyz.x + rotation[7] * point.xyz.y + rotation[8] * point.xyz.z + translation[2];
+
+		float inverse_z = 1.0f / z;
+		float rs = lens.project(x * inverse_z, y * inverse_z, pixel.xy.x, pixel.xy.y);
+
+		valid = z > 0.0f && rs <= lens.max_radius_squared;
+	}
+
+	// Newton's method on the lens model from the distorted coordinates, the same steps as the vector path
+	void Projector::unproject_point(const k4a_float2_t& pixel, float depth, k4a_float3_t& point, int& valid) const
+	{
+		const LensModel& lens = source_lens;
+
+		float xp_d = (pixel.xy.x - lens.cx) / lens.fx - lens.codx;
+		float yp_d = (pixel.xy.y - lens.cy) / lens.fy - lens.cody;
+		float xp = xp_d;
+		float yp = yp_d;
+		float rs = 0;
+		float residual_squared = 0;
+
+		for (int iteration = 0; ; iteration++)
+		{
+			float xp2 = xp * xp;
+			float yp2 = yp * yp;
+			float xyp = xp * yp;
+			rs = xp2 + yp2;
+			float rss = rs * rs;
+			float rsc = rss * rs;
+			float a = 1.0f + lens.k1 * rs + lens.k2 * rss + lens.k3 * rsc;
+			float b = 1.0f + lens.k4 * rs + lens.k5 * rss + lens.k6 * rsc;
+			float da = lens.k1 + 2.0f * lens.k2 * rs + 3.0f * lens.k3 * rss;
+			float db = lens.k4 + 2.0f * lens.k5 * rs + 3.0f * lens.k6 * rss;
+			float inverse_b = b != 0.0f ? 1.0f / b : 1.0f;
+			float distortion = a * inverse_b;
+			float distortion_rs = (da * b - a * db) * inverse_b * inverse_b;
+
+			float ex = xp * distortion + (rs + 2.0f * xp2) * lens.p2 + lens.tangential_scale * xyp * lens.p1 - xp_d;
+			float ey = yp * distortion + (rs + 2.0f * yp2) * lens.p1 + lens.tangential_scale * xyp * lens.p2 - yp_d;
+			residual_squared = ex * ex + ey * ey;
+			if (residual_squared <= UNPROJECT_RESIDUAL_SQUARED || iteration == PROJECTION_UNPROJECT_ITERATIONS) { break; }
+
+			float j00 = distortion + 2.0f * xp2 * distortion_rs + 6.0f * xp * lens.p2 + lens.tangential_scale * yp * lens.p1;
+			float j01 = 2.0f * xyp * distortion_rs + 2.0f * yp * lens.p2 + lens.tangential_scale * xp * lens.p1;
+			float j10 = 2.0f * xyp * distortion_rs + 2.0f * xp * lens.p1 + lens.tangential_scale * yp * lens.p2;
+			float j11 = distortion + 2.0f * yp2 * distortion_rs + 6.0f * yp * lens.p1 + lens.tangential_scale * xp * lens.p2;
+			float determinant = j00 * j11 - j01 * j10;
+			float inverse_determinant = determinant != 0.0f ? 1.0f / determinant : 0.0f;
+
+			xp -= (j11 * ex - j01 * ey) * inverse_determinant;
+			yp -= (j00 * ey - j10 * ex) * inverse_determinant;
+		}
+
+		float x = (xp + lens.codx) * depth;
+		float y = (yp + lens.cody) * depth;
+
+		point.xyz.x = rotation[0] * x + rotation[1] * y + rotation[2] * depth + translation[0];
+		point.xyz.y = rotation[3] * x + rotation[4] * y + rotation[5] * depth + translation[1];
+		point.xyz.z = rotation[6] * x + rotation[7] * y + rotation[8] * depth + translation[2];
+		valid = depth > 0.0f && residual_squared <= UNPROJECT_RESIDUAL_SQUARED && rs <= lens.max_radius_squared;
+	}
+
+	void Projector::project(const k4a_float3_t* points, size_t count, k4a_float2_t* pixels, int* valid) const
+	{
+		size_t i = 0;
+
+#ifdef PROJECTION_SSE2
+		// Same arithmetic as project_point, 4 points per step
+		const LensModel& lens = target_lens;
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 zero = _mm_setzero_ps();
+
+		for (; i + 4 <= count; i += 4)
+		{
+			const k4a_float3_t* p = points + i;
+			__m128 px = _mm_setr_ps(p[0].xyz.x, p[1].xyz.x, p[2].xyz.x, p[3].xyz.x);
+			__m128 py = _mm_setr_ps(p[0].xyz.y, p[1].xyz.y, p[2].xyz.y, p[3].xyz.y);
+			__m128 pz = _mm_setr_ps(p[0].xyz.z, p[1].xyz.z, p[2].xyz.z, p[3].xyz.z);
+
+			__m128 x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotation[0]), px), _mm_mul_ps(_mm_set1_ps(rotation[1]), py)), _mm_mul_ps(_mm_set1_ps(rotation[2]), pz)), _mm_set1_ps(translation[0]));
+			__m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotation[3]), px), _mm_mul_ps(_mm_set1_ps(rotation[4]), py)), _mm_mul_ps(_mm_set1_ps(rotation[5]), pz)), _mm_set1_ps(translation[1]));
+			__m128 z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotation[6]), px), _mm_mul_ps(_mm_set1_ps(rotation[7]), py)), _mm_mul_ps(_mm_set1_ps(rotation[8]), pz)), _mm_set1_ps(translation[2]));
+
+			__m128 inverse_z = _mm_div_ps(one, z);
+			__m128 u_lanes, v_lanes;
+			__m128 rs = lens.project(_mm_mul_ps(x, inverse_z), _mm_mul_ps(y, inverse_z), u_lanes, v_lanes);
+
+			float u[4], v[4];
+			_mm_storeu_ps(u, u_lanes);
+			_mm_storeu_ps(v, v_lanes);
+			int valid_mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(z, zero), _mm_cmple_ps(rs, _mm_set1_ps(lens.max_radius_squared))));
+
+			for (int lane = 0; lane < 4; lane++)
+			{
+				pixels[i + lane].xy.x = u[lane];
+				pixels[i + lane].xy.y = v[lane];
+				if (valid != NULL) { valid[i + lane] = (valid_mask >> lane) & 1; }
+			}
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			int point_valid;
+			project_point(points[i], pixels[i], point_valid);
+			if (valid != NULL) { valid[i] = point_valid; }
+		}
+	}
+
+	void Projector::unproject(const k4a_float2_t* pixels, const float* depths, size_t count, k4a_float3_t* points, int* valid) const
+	{
+		size_t i = 0;
+
+#ifdef PROJECTION_SSE2
+		// Same steps as unproject_point, 4 pixels per step until all 4 have converged
+		const LensModel& lens = source_lens;
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 six = _mm_set1_ps(6.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 tangential_scale = _mm_set1_ps(lens.tangential_scale);
+		const __m128 tolerance = _mm_set1_ps(UNPROJECT_RESIDUAL_SQUARED);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			const k4a_float2_t* pixel = pixels + i;
+			__m128 xp_d = _mm_sub_ps(_mm_div_ps(_mm_sub_ps(_mm_setr_ps(pixel[0].xy.x, pixel[1].xy.x, pixel[2].xy.x, pixel[3].xy.x), _mm_set1_ps(lens.cx)), _mm_set1_ps(lens.fx)), _mm_set1_ps(lens.codx));
+			__m128 yp_d = _mm_sub_ps(_mm_div_ps(_mm_sub_ps(_mm_setr_ps(pixel[0].xy.y, pixel[1].xy.y, pixel[2].xy.y, pixel[3].xy.y), _mm_set1_ps(lens.cy)), _mm_set1_ps(lens.fy)), _mm_set1_ps(lens.cody));
+			__m128 xp = xp_d;
+			__m128 yp = yp_d;
+			__m128 rs;
+			__m128 converged;
+
+			for (int iteration = 0; ; iteration++)
+			{
+				__m128 xp2 = _mm_mul_ps(xp, xp);
+				__m128 yp2 = _mm_mul_ps(yp, yp);
+				__m128 xyp = _mm_mul_ps(xp, yp);
+				rs = _mm_add_ps(xp2, yp2);
+				__m128 rss = _mm_mul_ps(rs, rs);
+				__m128 rsc = _mm_mul_ps(rss, rs);
+				__m128 a = _mm_add_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(lens.k1), rs)), _mm_mul_ps(_mm_set1_ps(lens.k2), rss)), _mm_mul_ps(_mm_set1_ps(lens.k3), rsc));
+				__m128 b = _mm_add_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(lens.k4), rs)), _mm_mul_ps(_mm_set1_ps(lens.k5), rss)), _mm_mul_ps(_mm_set1_ps(lens.k6), rsc));
+				__m128 da = _mm_add_ps(_mm_add_ps(_mm_set1_ps(lens.k1), _mm_mul_ps(_mm_set1_ps(2.0f * lens.k2), rs)), _mm_mul_ps(_mm_set1_ps(3.0f * lens.k3), rss));
+				__m128 db = _mm_add_ps(_mm_add_ps(_mm_set1_ps(lens.k4), _mm_mul_ps(_mm_set1_ps(2.0f * lens.k5), rs)), _mm_mul_ps(_mm_set1_ps(3.0f * lens.k6), rss));
+				__m128 b_zero = _mm_cmpeq_ps(b, zero);
+				__m128 inverse_b = _mm_or_ps(_mm_and_ps(b_zero, one), _mm_andnot_ps(b_zero, _mm_div_ps(one, b)));
+				__m128 distortion = _mm_mul_ps(a, inverse_b);
+				__m128 distortion_rs = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(da, b), _mm_mul_ps(a, db)), inverse_b), inverse_b);
+
+				__m128 ex = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(xp, distortion), _mm_mul_ps(_mm_add_ps(rs, _mm_mul_ps(two, xp2)), _mm_set1_ps(lens.p2))),
+					_mm_mul_ps(_mm_mul_ps(tangential_scale, xyp), _mm_set1_ps(lens.p1))), xp_d);
+				__m128 ey = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(yp, distortion), _mm_mul_ps(_mm_add_ps(rs, _mm_mul_ps(two, yp2)), _mm_set1_ps(lens.p1))),
+					_mm_mul_ps(_mm_mul_ps(tangential_scale, xyp), _mm_set1_ps(lens.p2))), yp_d);
+				converged = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), tolerance);
+				if (_mm_movemask_ps(converged) == 0xF || iteration == PROJECTION_UNPROJECT_ITERATIONS) { break; }
+
+				__m128 xyp_2_drs = _mm_mul_ps(_mm_mul_ps(two, xyp), distortion_rs);
+				__m128 j00 = _mm_add_ps(_mm_add_ps(_mm_add_ps(distortion, _mm_mul_ps(_mm_mul_ps(two, xp2), distortion_rs)), _mm_mul_ps(_mm_mul_ps(six, xp), _mm_set1_ps(lens.p2))),
+					_mm_mul_ps(_mm_mul_ps(tangential_scale, yp), _mm_set1_ps(lens.p1)));
+				__m128 j01 = _mm_add_ps(_mm_add_ps(xyp_2_drs, _mm_mul_ps(_mm_mul_ps(two, yp), _mm_set1_ps(lens.p2))), _mm_mul_ps(_mm_mul_ps(tangential_scale, xp), _mm_set1_ps(lens.p1)));
+				__m128 j10 = _mm_add_ps(_mm_add_ps(xyp_2_drs, _mm_mul_ps(_mm_mul_ps(two, xp), _mm_set1_ps(lens.p1))), _mm_mul_ps(_mm_mul_ps(tangential_scale, yp), _mm_set1_ps(lens.p2)));
+				__m128 j11 = _mm_add_ps(_mm_add_ps(_mm_add_ps(distortion, _mm_mul_ps(_mm_mul_ps(two, yp2), distortion_rs)), _mm_mul_ps(_mm_mul_ps(six, yp), _mm_set1_ps(lens.p1))),
+					_mm_mul_ps(_mm_mul_ps(tangential_scale, xp), _mm_set1_ps(lens.p2)));
+				__m128 determinant = _mm_sub_ps(_mm_mul_ps(j00, j11), _mm_mul_ps(j01, j10));
+				__m128 determinant_zero = _mm_cmpeq_ps(determinant, zero);
+				__m128 inverse_determinant = _mm_andnot_ps(determinant_zero, _mm_div_ps(one, determinant));
+
+				// Converged lanes stay put while the others keep stepping
+				inverse_determinant = _mm_andnot_ps(converged, inverse_determinant);
+				xp = _mm_sub_ps(xp, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(j11, ex), _mm_mul_ps(j01, ey)), inverse_determinant));
+				yp = _mm_sub_ps(yp, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(j00, ey), _mm_mul_ps(j10, ex)), inverse_determinant));
+			}
+
+			__m128 depth = _mm_loadu_ps(depths + i);
+			__m128 x = _mm_mul_ps(_mm_add_ps(xp, _mm_set1_ps(lens.codx)), depth);
+			__m128 y = _mm_mul_ps(_mm_add_ps(yp, _mm_set1_ps(lens.cody)), depth);
+
+			float out_x[4], out_y[4], out_z[4];
+			_mm_storeu_ps(out_x, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotation[0]), x), _mm_mul_ps(_mm_set1_ps(rotation[1]), y)), _mm_mul_ps(_mm_set1_ps(rotation[2]), depth)), _mm_set1_ps(translation[0])));
+			_mm_storeu_ps(out_y, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotation[3]), x), _mm_mul_ps(_mm_set1_ps(rotation[4]), y)), _mm_mul_ps(_mm_set1_ps(rotation[5]), depth)), _mm_set1_ps(translation[1])));
+			_mm_storeu_ps(out_z, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rotation[6]), x), _mm_mul_ps(_mm_set1_ps(rotation[7]), y)), _mm_mul_ps(_mm_set1_ps(rotation[8]), depth)), _mm_set1_ps(translation[2])));
+			int valid_mask = _mm_movemask_ps(_mm_and_ps(_mm_and_ps(converged, _mm_cmpgt_ps(depth, zero)), _mm_cmple_ps(rs, _mm_set1_ps(lens.max_radius_squared))));
+
+			for (int lane = 0; lane < 4; lane++)
+			{
+				points[i + lane].xyz.x = out_x[lane];
+				points[i + lane].xyz.y = out_y[lane];
+				points[i + lane].xyz.z = out_z[lane];
+				if (valid != NULL) { valid[i + lane] = (valid_mask >> lane) & 1; }
+			}
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			int point_valid;
+			unproject_point(pixels[i], depths[i], points[i], point_valid);
+			if (valid != NULL) { valid[i] = point_valid; }
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <k4a/k4a.h>
+
+#include "lens_model.h"
+
+namespace pilotsimulator {
+
+	// Newton steps of unproject, the SDK stops after as many
+	constexpr int PROJECTION_UNPROJECT_ITERATIONS = 20;
+
+	// Point <-> pixel between two cameras of a fixed calibration, in place of k4a_calibration_3d_to_2d and
+	// k4a_calibration_2d_to_3d. Extrinsics and lens models are taken from the calibration once, arrays of
+	// points then cost the lens model per point, 4 points per step where SSE2 is available.
+	class Projector {
+	public:
+		Projector(
+			const k4a_calibration_t& calibration,
+			k4a_calibration_type_t source_camera = K4A_CALIBRATION_TYPE_DEPTH,
+			k4a_calibration_type_t target_camera = K4A_CALIBRATION_TYPE_COLOR
+		);
+
+		// As k4a_calibration_3d_to_2d for each point: source camera point in mm to target camera pixel.
+		// valid gets 0 where the point does not project, the pixel is then undefined. valid may be NULL.
+		void project(const k4a_float3_t* points, size_t count, k4a_float2_t* pixels, int* valid) const;
+
+		// As k4a_calibration_2d_to_3d for each pixel: source camera pixel at a depth in mm to target camera point.
+		// valid gets 0 where the pixel does not unproject or its depth is not positive. valid may be NULL.
+		void unproject(const k4a_float2_t* pixels, const float* depths, size_t count, k4a_float3_t* points, int* valid) const;
+
+	private:
+		void project_point(const k4a_float3_t& point, k4a_float2_t& pixel, int& valid) const;
+		void unproject_point(const k4a_float2_t& pixel, float depth, k4a_float3_t& point, int& valid) const;
+
+		LensModel source_lens;
+		LensModel target_lens;
+
+		// Source camera to target camera, row major
+		float rotation[9];
+		float translation[3];
+	};
+}
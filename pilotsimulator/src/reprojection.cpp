@@ -0,0 +1,330 @@
+#include "pilotsimulator.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define REPROJECTION_SSE2
+#endif
+
+namespace pilotsimulator {
+
+	// color_u of a depth pixel that does not land in the colour camera
+	constexpr float NO_PROJECTION = -1e6f;
+
+	Reprojector::Reprojector(const k4a_calibration_t& calibration)
+	{
+		const k4a_calibration_camera_t& depth_camera = calibration.depth_camera_calibration;
+		const k4a_calibration_camera_t& color_camera = calibration.color_camera_calibration;
+		const k4a_calibration_extrinsics_t& depth_to_color = calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+
+		depth_width = depth_camera.resolution_width;
+		depth_height = depth_camera.resolution_height;
+		color_width = color_camera.resolution_width;
+		color_height = color_camera.resolution_height;
+
+		color_lens.set(color_camera);
+		for (int axis = 0; axis < 3; axis++) { translation[axis] = depth_to_color.translation[axis]; }
+
+		size_t pixel_count = (size_t)depth_width * depth_height;
+		ray_x.assign(pixel_count, 0);
+		ray_y.assign(pixel_count, 0);
+		ray_z.assign(pixel_count, 0);
+		ray_valid.assign(pixel_count, 0);
+		color_u.resize(pixel_count);
+		color_v.resize(pixel_count);
+		color_z.resize(pixel_count);
+		row_min_v.resize(depth_height);
+		row_max_v.resize(depth_height);
+
+		const float* rotation = depth_to_color.rotation;
+
+		for (int y = 0; y < depth_height; y++)
+		{
+			for (int x = 0; x < depth_width; x++)
+			{
+				k4a_float2_t pixel;
+				pixel.xy.x = (float)x;
+				pixel.xy.y = (float)y;
+
+				k4a_float3_t ray;
+				int valid = 0;
+				k4a_calibration_2d_to_3d(&calibration, &pixel, 1.0f, K4A_CALIBRATION_TYPE_DEPTH, K4A_CALIBRATION_TYPE_DEPTH, &ray, &valid);
+				if (!valid) { continue; }
+
+				size_t i = (size_t)y * depth_width + x;
+				ray_x[i] = rotation[0] * ray.xyz.x + rotation[1] * ray.xyz.y + rotation[2] * ray.xyz.z;
+				ray_y[i] = rotation[3] * ray.xyz.x + rotation[4] * ray.xyz.y + rotation[5] * ray.xyz.z;
+				ray_z[i] = rotation[6] * ray.xyz.x + rotation[7] * ray.xyz.y + rotation[8] * ray.xyz.z;
+				ray_valid[i] = 1.0f;
+			}
+		}
+	}
+
+	bool Reprojector::project_pixel(int depth_x, int depth_y, uint16_t depth, float& u, float& v) const
+	{
+		size_t i = (size_t)depth_y * depth_width + depth_x;
+		float d = depth * ray_valid[i];
+
+		float z = ray_z[i] * d + translation[2];
+		float inverse_z = 1.0f / z;
+		float rs = color_lens.project((ray_x[i] * d + translation[0]) * inverse_z, (ray_y[i] * d + translation[1]) * inverse_z, u, v);
+
+		return d > 0.0f && z > 0.0f && rs <= color_lens.max_radius_squared;
+	}
+
+	void Reprojector::project_rows(const uint16_t* depth, int row_begin, int row_end)
+	{
+		for (int y = row_begin; y < row_end; y++)
+		{
+			size_t row_start = (size_t)y * depth_width;
+			int x = 0;
+
+#ifdef REPROJECTION_SSE2
+			// Same arithmetic as project_pixel, 4 depth pixels per step
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 zero = _mm_setzero_ps();
+
+			for (; x + 4 <= depth_width; x += 4)
+			{
+				size_t i = row_start + x;
+
+				__m128i depth_16 = _mm_loadl_epi64((const __m128i*)(depth + i));
+				__m128 d = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(depth_16, _mm_setzero_si128())), _mm_loadu_ps(&ray_valid[i]));
+
+				__m128 z = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&ray_z[i]), d), _mm_set1_ps(translation[2]));
+				__m128 inverse_z = _mm_div_ps(one, z);
+				__m128 normalised_x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&ray_x[i]), d), _mm_set1_ps(translation[0])), inverse_z);
+				__m128 normalised_y = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&ray_y[i]), d), _mm_set1_ps(translation[1])), inverse_z);
+				__m128 u, v;
+				__m128 rs = color_lens.project(normalised_x, normalised_y, u, v);
+
+				__m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(d, zero), _mm_cmpgt_ps(z, zero)), _mm_cmple_ps(rs, _mm_set1_ps(color_lens.max_radius_squared)));
+				u = _mm_or_ps(_mm_and_ps(valid, u), _mm_andnot_ps(valid, _mm_set1_ps(NO_PROJECTION)));
+
+				_mm_storeu_ps(&color_u[i], u);
+				_mm_storeu_ps(&color_v[i], v);
+				_mm_storeu_ps(&color_z[i], z);
+			}
+#endif
+
+			for (; x < depth_width; x++)
+			{
+				size_t i = row_start + x;
+				float u, v;
+				bool valid = project_pixel(x, y, depth[i], u, v);
+
+				color_u[i] = valid ? u : NO_PROJECTION;
+				color_v[i] = v;
+				color_z[i] = ray_z[i] * (depth[i] * ray_valid[i]) + translation[2];
+			}
+
+			float min_v = (float)color_height;
+			float max_v = -1.0f;
+			for (x = 0; x < depth_width; x++)
+			{
+				size_t i = row_start + x;
+				if (color_u[i] == NO_PROJECTION) { continue; }
+				min_v = (std::min)(min_v, color_v[i]);
+				max_v = (std::max)(max_v, color_v[i]);
+			}
+			row_min_v[y] = min_v;
+			row_max_v[y] = max_v;
+		}
+	}
+
+	// Fills each cell of 2x2 depth pixels over the colour pixels inside its projected bounds, nearest Z wins.
+	// Only colour rows [row_begin, row_end) are written, so row bands run in parallel.
+	void Reprojector::rasterize_rows(
+		const uint8_t* custom,
+		uint16_t* depth_out, uint8_t* custom_out,
+		bool linear, uint8_t invalid_custom_value,
+		int row_begin, int row_end
+	)
+	{
+		std::memset(depth_out + (size_t)row_begin * color_width, 0, (size_t)(row_end - row_begin) * color_width * sizeof(uint16_t));
+		if (custom_out != NULL)
+		{
+			std::memset(custom_out + (size_t)row_begin * color_width, invalid_custom_value, (size_t)(row_end - row_begin) * color_width);
+		}
+
+		for (int y = 0; y + 1 < depth_height; y++)
+		{
+			float cell_min_v = (std::min)(row_min_v[y], row_min_v[y + 1]);
+			float cell_max_v = (std::max)(row_max_v[y], row_max_v[y + 1]);
+			if (cell_max_v < (float)row_begin || cell_min_v > (float)(row_end - 1)) { continue; }
+
+			for (int x = 0; x + 1 < depth_width; x++)
+			{
+				size_t corner[4] = {
+					(size_t)y * depth_width + x, (size_t)y * depth_width + x + 1,
+					(size_t)(y + 1) * depth_width + x, (size_t)(y + 1) * depth_width + x + 1
+				};
+
+				if (color_u[corner[0]] == NO_PROJECTION || color_u[corner[1]] == NO_PROJECTION ||
+					color_u[corner[2]] == NO_PROJECTION || color_u[corner[3]] == NO_PROJECTION) { continue; }
+
+				float min_v = (std::min)((std::min)(color_v[corner[0]], color_v[corner[1]]), (std::min)(color_v[corner[2]], color_v[corner[3]]));
+				float max_v = (std::max)((std::max)(color_v[corner[0]], color_v[corner[1]]), (std::max)(color_v[corner[2]], color_v[corner[3]]));
+				int first_row = (std::max)(row_begin, (int)std::ceil(min_v));
+				int last_row = (std::min)(row_end - 1, (int)std::floor(max_v));
+				if (first_row > last_row) { continue; }
+
+				float min_u = (std::min)((std::min)(color_u[corner[0]], color_u[corner[1]]), (std::min)(color_u[corner[2]], color_u[corner[3]]));
+				float max_u = (std::max)((std::max)(color_u[corner[0]], color_u[corner[1]]), (std::max)(color_u[corner[2]], color_u[corner[3]]));
+				int first_col = (std::max)(0, (int)std::ceil(min_u));
+				int last_col = (std::min)(color_width - 1, (int)std::floor(max_u));
+				if (first_col > last_col) { continue; }
+
+				float z[4] = { color_z[corner[0]], color_z[corner[1]], color_z[corner[2]], color_z[corner[3]] };
+				float min_z = (std::min)((std::min)(z[0], z[1]), (std::min)(z[2], z[3]));
+				float max_z = (std::max)((std::max)(z[0], z[1]), (std::max)(z[2], z[3]));
+				if (max_z - min_z > min_z * REPROJECTION_EDGE_DEPTH_RATIO) { continue; }
+
+				// Position inside the cell taken from its bounding box, the cell is nearly a parallelogram
+				float inverse_width = max_u > min_u ? 1.0f / (max_u - min_u) : 0.0f;
+				float inverse_height = max_v > min_v ? 1.0f / (max_v - min_v) : 0.0f;
+
+				for (int row = first_row; row <= last_row; row++)
+				{
+					float t = (row - min_v) * inverse_height;
+					uint16_t* depth_row = depth_out + (size_t)row * color_width;
+					uint8_t* custom_row = custom_out != NULL ? custom_out + (size_t)row * color_width : NULL;
+
+					for (int col = first_col; col <= last_col; col++)
+					{
+						float s = (col - min_u) * inverse_width;
+						int nearest = (t >= 0.5f ? 2 : 0) + (s >= 0.5f ? 1 : 0);
+
+						float value = z[nearest];
+						if (linear)
+						{
+							value = (z[0] * (1 - s) + z[1] * s) * (1 - t) + (z[2] * (1 - s) + z[3] * s) * t;
+						}
+
+						uint16_t value_mm = (uint16_t)(value + 0.5f);
+						if (depth_row[col] != 0 && depth_row[col] <= value_mm) { continue; }
+
+						depth_row[col] = value_mm;
+						if (custom_row == NULL) { continue; }
+
+						if (linear)
+						{
+							float c = (custom[corner[0]] * (1 - s) + custom[corner[1]] * s) * (1 - t) + (custom[corner[2]] * (1 - s) + custom[corner[3]] * s) * t;
+							custom_row[col] = (uint8_t)(c + 0.5f);
+						}
+						else
+						{
+							custom_row[col] = custom[corner[nearest]];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void Reprojector::depth_to_color(
+		const uint16_t* depth, const uint8_t* custom,
+		uint16_t* depth_out, uint8_t* custom_out,
+		k4a_transformation_interpolation_type_t interpolation, uint8_t invalid_custom_value
+	)
+	{
+		if (custom == NULL) { custom_out = NULL; }
+
+		int depth_tiles = (depth_height + REPROJECTION_TILE_ROWS - 1) / REPROJECTION_TILE_ROWS;
+		cv::parallel_for_(cv::Range(0, depth_tiles), [&](const cv::Range& tiles) {
+			project_rows(depth, tiles.start * REPROJECTION_TILE_ROWS, (std::min)(depth_height, tiles.end * REPROJECTION_TILE_ROWS));
+		});
+
+		bool linear = interpolation == K4A_TRANSFORMATION_INTERPOLATION_TYPE_LINEAR;
+		int color_tiles = (color_height + REPROJECTION_TILE_ROWS - 1) / REPROJECTION_TILE_ROWS;
+		cv::parallel_for_(cv::Range(0, color_tiles), [&](const cv::Range& tiles) {
+			rasterize_rows(
+				custom, depth_out, custom_out, linear, invalid_custom_value,
+				tiles.start * REPROJECTION_TILE_ROWS, (std::min)(color_height, tiles.end * REPROJECTION_TILE_ROWS)
+			);
+		});
+	}
+
+	// Image size and tightly packed stride, as the raw overloads expect
+	static bool check_image(const k4a_image_t image, int width, int height, int bytes_per_pixel)
+	{
+		return image != NULL &&
+			k4a_image_get_width_pixels(image) == width &&
+			k4a_image_get_height_pixels(image) == height &&
+			k4a_image_get_stride_bytes(image) == width * bytes_per_pixel;
+	}
+
+	int Reprojector::depth_to_color(
+		const k4a_image_t depth_image, const k4a_image_t custom_image,
+		k4a_image_t depth_out, k4a_image_t custom_out,
+		k4a_transformation_interpolation_type_t interpolation, uint32_t invalid_custom_value
+	)
+	{
+		bool has_custom = custom_image != NULL && custom_out != NULL;
+
+		if (!check_image(depth_image, depth_width, depth_height, 2) || !check_image(depth_out, color_width, color_height, 2) ||
+			(has_custom && (!check_image(custom_image, depth_width, depth_height, 1) || !check_image(custom_out, color_width, color_height, 1))))
+		{
+			std::cout << "Reprojection Image Size Mismatch!" << std::endl;
+			return FAILURE;
+		}
+
+		depth_to_color(
+			(const uint16_t*)(const void*)k4a_image_get_buffer(depth_image),
+			has_custom ? k4a_image_get_buffer(custom_image) : NULL,
+			(uint16_t*)(void*)k4a_image_get_buffer(depth_out),
+			has_custom ? k4a_image_get_buffer(custom_out) : NULL,
+			interpolation, (uint8_t)invalid_custom_value
+		);
+
+		k4a_image_set_device_timestamp_usec(depth_out, k4a_image_get_device_timestamp_usec(depth_image));
+		if (has_custom) { k4a_image_set_device_timestamp_usec(custom_out, k4a_image_get_device_timestamp_usec(depth_image)); }
+
+		return SUCCESS;
+	}
+
+	void Reprojector::color_to_depth(const uint16_t* depth, const uint8_t* bgra, uint8_t* bgra_out)
+	{
+		int depth_tiles = (depth_height + REPROJECTION_TILE_ROWS - 1) / REPROJECTION_TILE_ROWS;
+		cv::parallel_for_(cv::Range(0, depth_tiles), [&](const cv::Range& tiles) {
+			int row_begin = tiles.start * REPROJECTION_TILE_ROWS;
+			int row_end = (std::min)(depth_height, tiles.end * REPROJECTION_TILE_ROWS);
+			project_rows(depth, row_begin, row_end);
+
+			for (size_t i = (size_t)row_begin * depth_width; i < (size_t)row_end * depth_width; i++)
+			{
+				int col = (int)std::floor(color_u[i] + 0.5f);
+				int row = (int)std::floor(color_v[i] + 0.5f);
+
+				uint32_t pixel = 0;
+				if (col >= 0 && col < color_width && row >= 0 && row < color_height)
+				{
+					std::memcpy(&pixel, bgra + ((size_t)row * color_width + col) * 4, 4);
+				}
+				std::memcpy(bgra_out + i * 4, &pixel, 4);
+			}
+		});
+	}
+
+	int Reprojector::color_to_depth(const k4a_image_t depth_image, const k4a_image_t color_image, k4a_image_t color_out)
+	{
+		if (!check_image(depth_image, depth_width, depth_height, 2) || !check_image(color_image, color_width, color_height, 4) ||
+			!check_image(color_out, depth_width, depth_height, 4))
+		{
+			std::cout << "Reprojection Image Size Mismatch!" << std::endl;
+			return FAILURE;
+		}
+
+		color_to_depth(
+			(const uint16_t*)(const void*)k4a_image_get_buffer(depth_image),
+			k4a_image_get_buffer(color_image),
+			k4a_image_get_buffer(color_out)
+		);
+
+		k4a_image_set_device_timestamp_usec(color_out, k4a_image_get_device_timestamp_usec(depth_image));
+
+		return SUCCESS;
+	}
+}
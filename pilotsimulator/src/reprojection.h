@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include <k4a/k4a.h>
+
+#include "lens_model.h"
+
+namespace pilotsimulator {
+
+	// Rows handed to one worker, in depth rows when projecting and in colour rows when rasterising
+	constexpr int REPROJECTION_TILE_ROWS = 32;
+
+	// Cells of four depth pixels whose depths differ by more than this fraction are edges and are not filled
+	constexpr float REPROJECTION_EDGE_DEPTH_RATIO = 0.05f;
+
+	// Depth <-> colour reprojection for a fixed calibration, in place of the k4a_transformation calls.
+	// The depth pixel rays are unprojected once with the SDK and turned into the colour camera frame, so a frame
+	// costs one multiply-add per axis and the colour lens model per pixel, split in row tiles across cv::parallel_for_.
+	// Scratch tables are kept per instance: one frame at a time per Reprojector.
+	class Reprojector {
+	public:
+		explicit Reprojector(const k4a_calibration_t& calibration);
+
+		int get_depth_width() const { return depth_width; }
+		int get_depth_height() const { return depth_height; }
+		int get_color_width() const { return color_width; }
+		int get_color_height() const { return color_height; }
+
+		// Depth camera DEPTH16 and optional CUSTOM8 (custom may be NULL) into the colour camera, as
+		// k4a_transformation_depth_image_to_color_camera_custom. Output depth is the colour camera Z in mm,
+		// 0 and invalid_custom_value where no depth pixel lands.
+		void depth_to_color(
+			const uint16_t* depth, const uint8_t* custom,
+			uint16_t* depth_out, uint8_t* custom_out,
+			k4a_transformation_interpolation_type_t interpolation, uint8_t invalid_custom_value
+		);
+
+		int depth_to_color(
+			const k4a_image_t depth_image, const k4a_image_t custom_image,
+			k4a_image_t depth_out, k4a_image_t custom_out,
+			k4a_transformation_interpolation_type_t interpolation, uint32_t invalid_custom_value
+		);
+
+		// BGRA colour sampled at each depth pixel, as k4a_transformation_color_image_to_depth_camera.
+		// Nearest pixel, no occlusion test, zero where the depth pixel has no depth or falls outside the colour image.
+		void color_to_depth(const uint16_t* depth, const uint8_t* bgra, uint8_t* bgra_out);
+
+		int color_to_depth(const k4a_image_t depth_image, const k4a_image_t color_image, k4a_image_t color_out);
+
+		// Colour camera pixel of a depth camera pixel at the given depth, false where it does not project
+		bool project_pixel(int depth_x, int depth_y, uint16_t depth, float& color_u, float& color_v) const;
+
+	private:
+		void project_rows(const uint16_t* depth, int row_begin, int row_end);
+		void rasterize_rows(
+			const uint8_t* custom,
+			uint16_t* depth_out, uint8_t* custom_out,
+			bool linear, uint8_t invalid_custom_value,
+			int row_begin, int row_end
+		);
+
+		int depth_width;
+		int depth_height;
+		int color_width;
+		int color_height;
+
+		LensModel color_lens;
+		float translation[3];
+
+		// Depth pixel ray at 1 mm depth rotated into the colour camera, ray_valid 0 where the pixel does not unproject
+		std::vector<float> ray_x, ray_y, ray_z, ray_valid;
+
+		// Per frame: colour pixel and colour camera Z of every depth pixel, and the colour row range of each depth row
+		std::vector<float> color_u, color_v, color_z;
+		std::vector<float> row_min_v, row_max_v;
+	};
+}
@@ -0,0 +1,152 @@
+#include "pilotsimulator.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pilotsimulator {
+
+#if defined(_WIN32)
+	int SharedMemory::create(const std::string& name, size_t size)
+	{
+		close();
+
+		std::string mapping_name = "Local\\" + name;
+		HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)((uint64_t)size >> 32), (DWORD)size, mapping_name.c_str());
+		if (handle == NULL)
+		{
+			std::cout << "Failed To Create Shared Memory " << name << "!" << std::endl;
+			return FAILURE;
+		}
+
+		data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (data == NULL)
+		{
+			std::cout << "Failed To Map Shared Memory " << name << "!" << std::endl;
+			CloseHandle(handle);
+			return FAILURE;
+		}
+
+		// The mapping goes with its last handle, nothing to remove on close
+		mapping = handle;
+		this->size = size;
+		this->name = name;
+		owner = true;
+
+		return SUCCESS;
+	}
+
+	int SharedMemory::open(const std::string& name, size_t size)
+	{
+		close();
+
+		std::string mapping_name = "Local\\" + name;
+		HANDLE handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mapping_name.c_str());
+		if (handle == NULL) { return FAILURE; }
+
+		data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (data == NULL)
+		{
+			CloseHandle(handle);
+			return FAILURE;
+		}
+
+		mapping = handle;
+		this->size = size;
+		this->name = name;
+		owner = false;
+
+		return SUCCESS;
+	}
+
+	void SharedMemory::close()
+	{
+		if (data != NULL) { UnmapViewOfFile(data); }
+		if (mapping != NULL) { CloseHandle(mapping); }
+
+		data = NULL;
+		mapping = NULL;
+		size = 0;
+		owner = false;
+	}
+#else
+	int SharedMemory::create(const std::string& name, size_t size)
+	{
+		close();
+
+		std::string object_name = "/" + name;
+		int object = shm_open(object_name.c_str(), O_CREAT | O_RDWR, 0600);
+		if (object < 0)
+		{
+			std::cout << "Failed To Create Shared Memory " << name << "!" << std::endl;
+			return FAILURE;
+		}
+
+		struct stat status;
+		if (fstat(object, &status) != 0 || ((size_t)status.st_size < size && ftruncate(object, (off_t)size) != 0))
+		{
+			std::cout << "Failed To Size Shared Memory " << name << "!" << std::endl;
+			::close(object);
+			return FAILURE;
+		}
+
+		void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, object, 0);
+		if (memory == MAP_FAILED)
+		{
+			std::cout << "Failed To Map Shared Memory " << name << "!" << std::endl;
+			::close(object);
+			return FAILURE;
+		}
+
+		data = memory;
+		fd = object;
+		this->size = size;
+		this->name = object_name;
+		owner = true;
+
+		return SUCCESS;
+	}
+
+	int SharedMemory::open(const std::string& name, size_t size)
+	{
+		close();
+
+		std::string object_name = "/" + name;
+		int object = shm_open(object_name.c_str(), O_RDWR, 0);
+		if (object < 0) { return FAILURE; }
+
+		struct stat status;
+		void* memory = fstat(object, &status) == 0 && (size_t)status.st_size >= size ?
+			mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, object, 0) : MAP_FAILED;
+		if (memory == MAP_FAILED)
+		{
+			::close(object);
+			return FAILURE;
+		}
+
+		data = memory;
+		fd = object;
+		this->size = size;
+		this->name = object_name;
+		owner = false;
+
+		return SUCCESS;
+	}
+
+	void SharedMemory::close()
+	{
+		if (data != NULL) { munmap(data, size); }
+		if (fd >= 0) { ::close(fd); }
+		if (owner) { shm_unlink(name.c_str()); }
+
+		data = NULL;
+		fd = -1;
+		size = 0;
+		owner = false;
+	}
+#endif
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace pilotsimulator {
+
+	// Named memory shared with other processes on the machine: a "Local\" file mapping on Windows,
+	// a POSIX shm object elsewhere. The creator's mapping also removes the name again on close.
+	class SharedMemory {
+	public:
+		SharedMemory() = default;
+		~SharedMemory() { close(); }
+
+		SharedMemory(const SharedMemory&) = delete;
+		SharedMemory& operator=(const SharedMemory&) = delete;
+
+		// Zero filled when new, an existing mapping of the name is reused as it is
+		int create(const std::string& name, size_t size);
+
+		// Of a process that created it, at least size bytes
+		int open(const std::string& name, size_t size);
+
+		void close();
+
+		bool is_open() const { return data != NULL; }
+		void* get_data() const { return data; }
+		size_t get_size() const { return size; }
+
+	private:
+		void* data = NULL;
+		size_t size = 0;
+		std::string name;
+		bool owner = false;
+#if defined(_WIN32)
+		void* mapping = NULL;
+#else
+		int fd = -1;
+#endif
+	};
+}
@@ -0,0 +1,379 @@
+#include "pilotsimulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace pilotsimulator {
+
+	constexpr float PI = 3.14159265f;
+
+	// Seated pilot facing the camera, depth camera coordinates in millimeters
+	static const float PilotPose[K4ABT_JOINT_COUNT][3] = {
+		{ 0, 150, 2000 }, { 0, -50, 2010 }, { 0, -220, 2020 }, { 0, -420, 2030 },				// PELVIS .. NECK
+		{ 40, -380, 2030 }, { 180, -360, 2040 }, { 220, -120, 1950 }, { 180, 40, 1780 },		// CLAVICLE_LEFT .. WRIST_LEFT
+		{ 170, 70, 1730 }, { 160, 100, 1690 }, { 140, 60, 1720 },								// HAND_LEFT .. THUMB_LEFT
+		{ -40, -380, 2030 }, { -180, -360, 2040 }, { -220, -120, 1950 }, { -180, 40, 1780 },	// CLAVICLE_RIGHT .. WRIST_RIGHT
+		{ -170, 70, 1730 }, { -160, 100, 1690 }, { -140, 60, 1720 },							// HAND_RIGHT .. THUMB_RIGHT
+		{ 90, 150, 2000 }, { 110, 170, 1560 }, { 110, 570, 1600 }, { 110, 620, 1450 },			// HIP_LEFT .. TOE_LEFT
+		{ -90, 150, 2000 }, { -110, 170, 1560 }, { -110, 570, 1600 }, { -110, 620, 1450 },		// HIP_RIGHT .. TOE_RIGHT
+		{ 0, -560, 2000 }, { 0, -540, 1910 }, { 35, -575, 1925 }, { 75, -560, 2000 },			// HEAD .. EAR_LEFT
+		{ -35, -575, 1925 }, { -75, -560, 2000 }												// EYE_RIGHT, EAR_RIGHT
+	};
+
+	// Capsules the depth image is rendered from, a zero length bone is a sphere
+	struct Bone {
+		Joints start;
+		Joints end;
+		float radius_mm;
+	};
+
+	static const Bone PilotBones[] = {
+		{ PELVIS, SPINE_NAVAL, 130 }, { SPINE_NAVAL, SPINE_CHEST, 140 }, { SPINE_CHEST, NECK, 110 },
+		{ HIP_LEFT, HIP_RIGHT, 110 }, { NECK, HEAD, 55 }, { HEAD, HEAD, 100 },
+		{ SPINE_CHEST, CLAVICLE_LEFT, 60 }, { CLAVICLE_LEFT, SHOULDER_LEFT, 55 }, { SHOULDER_LEFT, ELBOW_LEFT, 50 },
+		{ ELBOW_LEFT, WRIST_LEFT, 40 }, { WRIST_LEFT, HANDTIP_LEFT, 35 },
+		{ SPINE_CHEST, CLAVICLE_RIGHT, 60 }, { CLAVICLE_RIGHT, SHOULDER_RIGHT, 55 }, { SHOULDER_RIGHT, ELBOW_RIGHT, 50 },
+		{ ELBOW_RIGHT, WRIST_RIGHT, 40 }, { WRIST_RIGHT, HANDTIP_RIGHT, 35 },
+		{ HIP_LEFT, KNEE_LEFT, 75 }, { KNEE_LEFT, ANKLE_LEFT, 55 }, { ANKLE_LEFT, TOE_LEFT, 40 },
+		{ HIP_RIGHT, KNEE_RIGHT, 75 }, { KNEE_RIGHT, ANKLE_RIGHT, 55 }, { ANKLE_RIGHT, TOE_RIGHT, 40 }
+	};
+
+	// Stateless random numbers, so any frame can be generated on its own
+	static uint64_t mix(uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	// Uniform in [0, 1)
+	static float random_unit(uint64_t seed, uint64_t a, uint64_t b = 0, uint64_t c = 0)
+	{
+		return (float)(mix(seed ^ mix(a ^ mix(b ^ mix(c)))) >> 40) * (1.0f / 16777216.0f);
+	}
+
+	SyntheticBodyGenerator::SyntheticBodyGenerator(const k4a_calibration_t& calibration, const SyntheticBodyConfig& config)
+		: config(config)
+	{
+		const k4a_calibration_camera_t& depth_camera = calibration.depth_camera_calibration;
+
+		width = depth_camera.resolution_width;
+		height = depth_camera.resolution_height;
+		cx = depth_camera.intrinsics.parameters.param.cx;
+		cy = depth_camera.intrinsics.parameters.param.cy;
+		fx = depth_camera.intrinsics.parameters.param.fx;
+		fy = depth_camera.intrinsics.parameters.param.fy;
+	}
+
+	void SyntheticBodyGenerator::get_jolt(double seconds, float jolt[3]) const
+	{
+		jolt[0] = jolt[1] = jolt[2] = 0;
+
+		if (config.jolts_per_sec <= 0 || config.jolt_decay_sec <= 0) { return; }
+
+		// Every 1 / jolts_per_sec slot holds one jolt at a random onset, older than 5 decays they are gone
+		double slot_sec = 1.0 / config.jolts_per_sec;
+		int64_t last_slot = (int64_t)std::floor(seconds / slot_sec);
+		int64_t first_slot = (std::max)((int64_t)0, (int64_t)std::floor((seconds - 5.0 * config.jolt_decay_sec) / slot_sec));
+
+		for (int64_t slot = first_slot; slot <= last_slot; slot++)
+		{
+			double onset_sec = ((double)slot + random_unit(config.seed, slot, 0)) * slot_sec;
+			float elapsed_sec = (float)(seconds - onset_sec);
+			if (elapsed_sec < 0) { continue; }
+
+			// Damped 4 Hz shake, mostly vertical
+			float amplitude = config.jolt_amplitude_mm * std::exp(-elapsed_sec / config.jolt_decay_sec) * std::cos(2 * PI * 4.0f * elapsed_sec);
+			jolt[0] += amplitude * 0.5f * (2 * random_unit(config.seed, slot, 1) - 1);
+			jolt[1] += amplitude * (2 * random_unit(config.seed, slot, 2) - 1);
+			jolt[2] += amplitude * 0.5f * (2 * random_unit(config.seed, slot, 3) - 1);
+		}
+	}
+
+	void SyntheticBodyGenerator::get_pose(double seconds, uint32_t body, const float jolt[3], k4a_float3_t joints[K4ABT_JOINT_COUNT]) const
+	{
+		float phase = 1.7f * (float)body;
+		float time = (float)seconds;
+
+		float sway = config.sway_period_sec > 0 ? config.sway_amplitude_mm * std::sin(2 * PI * time / config.sway_period_sec + phase) : 0;
+		float lean = config.lean_period_sec > 0 ? config.lean_amplitude_deg * PI / 180 * std::sin(2 * PI * time / config.lean_period_sec + phase) : 0;
+		float stick_angle = config.stick_period_sec > 0 ? 2 * PI * time / config.stick_period_sec + phase : 0;
+		float stick_x = config.stick_amplitude_mm * std::cos(stick_angle);
+		float stick_y = config.stick_amplitude_mm * std::sin(stick_angle);
+		float lean_sin = std::sin(lean);
+		float lean_cos = std::cos(lean);
+
+		float offset_x = config.body_spacing_mm * ((float)body - 0.5f * (float)(config.num_bodies - 1));
+		float offset_z = (body % 2) * 400.0f;
+
+		const float* pelvis = PilotPose[PELVIS];
+
+		for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
+		{
+			float x = PilotPose[joint_id][0];
+			float y = PilotPose[joint_id][1];
+			float z = PilotPose[joint_id][2];
+
+			// Legs stay on the seat and pedals, the upper body pivots around the pelvis
+			float height = (std::max)(0.0f, (pelvis[1] - y) / 700.0f);
+			if (height > 0)
+			{
+				float dy = y - pelvis[1];
+				float dz = z - pelvis[2];
+				y = pelvis[1] + dy * lean_cos - dz * lean_sin;
+				z = pelvis[2] + dy * lean_sin + dz * lean_cos;
+				x += sway * height;
+			}
+
+			if (joint_id >= WRIST_RIGHT && joint_id <= THUMB_RIGHT)
+			{
+				x += stick_x;
+				y += stick_y;
+			}
+			else if (joint_id == ELBOW_RIGHT)
+			{
+				x += 0.5f * stick_x;
+				y += 0.5f * stick_y;
+			}
+
+			// The seat takes part of a jolt, the head lags behind and takes more
+			float jolt_scale = 0.3f + height;
+
+			joints[joint_id].xyz.x = x + offset_x + jolt[0] * jolt_scale;
+			joints[joint_id].xyz.y = y + jolt[1] * jolt_scale;
+			joints[joint_id].xyz.z = z + offset_z + jolt[2] * jolt_scale;
+		}
+	}
+
+	uint32_t SyntheticBodyGenerator::get_bodies(uint64_t timestamp_usec, k4abt_body_t bodies[], uint32_t max_bodies) const
+	{
+		double seconds = (double)timestamp_usec * 1e-6;
+		uint32_t num_bodies = (std::min)(config.num_bodies, max_bodies);
+		uint64_t burst = config.dropout_burst_sec > 0 ? (uint64_t)(seconds / config.dropout_burst_sec) : timestamp_usec;
+
+		float jolt[3];
+		get_jolt(seconds, jolt);
+
+		for (uint32_t body = 0; body < num_bodies; body++)
+		{
+			k4a_float3_t joints[K4ABT_JOINT_COUNT];
+			get_pose(seconds, body, jolt, joints);
+
+			bodies[body].id = body + 1;
+			k4abt_skeleton_t& skeleton = bodies[body].skeleton;
+
+			for (int joint_id = 0; joint_id < (int)K4ABT_JOINT_COUNT; joint_id++)
+			{
+				k4abt_joint_t& joint = skeleton.joints[joint_id];
+				joint.position = joints[joint_id];
+				joint.orientation.wxyz = { 1, 0, 0, 0 };
+
+				// Lost joints come back with a position off by up to 5 cm, partly lost ones are only flagged
+				float dropout = random_unit(config.seed, body, joint_id, burst);
+				if (dropout < config.dropout_probability)
+				{
+					joint.confidence_level = K4ABT_JOINT_CONFIDENCE_NONE;
+					for (int axis = 0; axis < 3; axis++)
+					{
+						joint.position.v[axis] += 100.0f * (random_unit(config.seed ^ 0x5A5A, body, joint_id * 3 + axis, burst) - 0.5f);
+					}
+				}
+				else if (dropout < 3 * config.dropout_probability)
+				{
+					joint.confidence_level = K4ABT_JOINT_CONFIDENCE_LOW;
+				}
+				else
+				{
+					joint.confidence_level = K4ABT_JOINT_CONFIDENCE_MEDIUM;
+				}
+			}
+		}
+
+		return num_bodies;
+	}
+
+	void SyntheticBodyGenerator::draw_capsule(
+		const k4a_float3_t& start, const k4a_float3_t& end, float radius_mm, uint8_t index,
+		uint16_t* depth_image, uint8_t* body_index_map
+	) const
+	{
+		if (start.xyz.z <= radius_mm || end.xyz.z <= radius_mm) { return; }
+
+		// Pinhole projection, the lens distortion moves bodies near the centre by a few pixels at most
+		float ax = cx + fx * start.xyz.x / start.xyz.z;
+		float ay = cy + fy * start.xyz.y / start.xyz.z;
+		float bx = cx + fx * end.xyz.x / end.xyz.z;
+		float by = cy + fy * end.xyz.y / end.xyz.z;
+		float radius_px = radius_mm * fx * 2 / (start.xyz.z + end.xyz.z);
+
+		int min_x = (std::max)(0, (int)std::floor((std::min)(ax, bx) - radius_px));
+		int max_x = (std::min)(width - 1, (int)std::ceil((std::max)(ax, bx) + radius_px));
+		int min_y = (std::max)(0, (int)std::floor((std::min)(ay, by) - radius_px));
+		int max_y = (std::min)(height - 1, (int)std::ceil((std::max)(ay, by) + radius_px));
+
+		float abx = bx - ax;
+		float aby = by - ay;
+		float length_squared = abx * abx + aby * aby;
+		float inverse_length_squared = length_squared > 1e-6f ? 1 / length_squared : 0;
+		float radius_squared = radius_px * radius_px;
+		float inverse_radius_squared = 1 / radius_squared;
+		float dz = end.xyz.z - start.xyz.z;
+
+		// Unit normal of the bone, rows only need the columns within radius_px of its line
+		float length = std::sqrt(length_squared);
+		float nx = length > 1e-3f ? -aby / length : 0;
+		float ny = length > 1e-3f ? abx / length : 1;
+
+		for (int y = min_y; y <= max_y; y++)
+		{
+			float py = (float)y - ay;
+			uint16_t* depth_row = depth_image + (size_t)y * width;
+			uint8_t* index_row = body_index_map + (size_t)y * width;
+
+			int row_min_x = min_x;
+			int row_max_x = max_x;
+			if (std::fabs(nx) > 0.05f)
+			{
+				float x0 = ax + (radius_px - ny * py) / nx;
+				float x1 = ax + (-radius_px - ny * py) / nx;
+				row_min_x = (std::max)(min_x, (int)std::floor((std::min)(x0, x1)));
+				row_max_x = (std::min)(max_x, (int)std::ceil((std::max)(x0, x1)));
+			}
+
+			// Projection onto the bone advances by a constant step per column
+			float px = (float)row_min_x - ax;
+			float projection = (px * abx + py * aby) * inverse_length_squared;
+			float projection_step = abx * inverse_length_squared;
+
+			for (int x = row_min_x; x <= row_max_x; x++, px += 1, projection += projection_step)
+			{
+				float t = (std::min)(1.0f, (std::max)(0.0f, projection));
+				float ex = px - t * abx;
+				float ey = py - t * aby;
+				float distance_squared = ex * ex + ey * ey;
+
+				if (distance_squared >= radius_squared) { continue; }
+
+				// Front surface of the capsule
+				float z = start.xyz.z + t * dz - radius_mm * std::sqrt(1 - distance_squared * inverse_radius_squared);
+				uint16_t depth = (uint16_t)z;
+
+				if (depth < depth_row[x])
+				{
+					depth_row[x] = depth;
+					index_row[x] = index;
+				}
+			}
+		}
+	}
+
+	void SyntheticBodyGenerator::render(uint64_t timestamp_usec, uint16_t* depth_image, uint8_t* body_index_map) const
+	{
+		// Fill one row and copy it down, std::fill on 16 bit pixels is not always vectorised
+		std::fill(depth_image, depth_image + width, config.background_depth_mm);
+		for (int y = 1; y < height; y++)
+		{
+			std::memcpy(depth_image + (size_t)y * width, depth_image, (size_t)width * sizeof(uint16_t));
+		}
+		std::memset(body_index_map, K4ABT_BODY_INDEX_MAP_BACKGROUND, (size_t)width * height);
+
+		double seconds = (double)timestamp_usec * 1e-6;
+
+		float jolt[3];
+		get_jolt(seconds, jolt);
+
+		// Bodies are rendered where they really are, dropouts only affect what the tracker reports
+		uint32_t num_bodies = (std::min)(config.num_bodies, (uint32_t)K4ABT_BODY_INDEX_MAP_BACKGROUND);
+		for (uint32_t body = 0; body < num_bodies; body++)
+		{
+			k4a_float3_t joints[K4ABT_JOINT_COUNT];
+			get_pose(seconds, body, jolt, joints);
+
+			for (const Bone& bone : PilotBones)
+			{
+				draw_capsule(joints[bone.start], joints[bone.end], bone.radius_mm, (uint8_t)body, depth_image, body_index_map);
+			}
+		}
+	}
+
+	static void set_camera_calibration(
+		k4a_calibration_camera_t& camera,
+		int width, int height,
+		const float parameters[14],
+		float metric_radius
+	)
+	{
+		camera.resolution_width = width;
+		camera.resolution_height = height;
+		camera.metric_radius = metric_radius;
+		camera.intrinsics.type = K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+		camera.intrinsics.parameter_count = 14;
+
+		for (int i = 0; i < 14; i++)
+		{
+			camera.intrinsics.parameters.v[i] = parameters[i];
+		}
+		camera.intrinsics.parameters.param.metric_radius = metric_radius;
+	}
+
+	void get_synthetic_calibration(k4a_calibration_t& calibration)
+	{
+		// cx, cy, fx, fy, k1..k6, codx, cody, p2, p1
+		const float DEPTH_PARAMETERS[14] = {
+			320.5f, 337.0f, 504.5f, 504.6f, 5.21f, 3.34f, 0.17f, 5.54f, 5.03f, 0.91f, 0, 0, -0.00004f, 0.00008f
+		};
+		const float COLOR_PARAMETERS[14] = {
+			955.2f, 547.3f, 913.1f, 912.9f, 0.47f, -2.70f, 1.61f, 0.35f, -2.53f, 1.54f, 0, 0, -0.0002f, 0.0007f
+		};
+
+		// Color camera sits about 32 mm to the side and is tilted about 6 degrees down
+		const float DEPTH_TO_COLOR_ROTATION[9] = {
+			1.0f, 0.0f, 0.0f,
+			0.0f, 0.9945f, 0.1045f,
+			0.0f, -0.1045f, 0.9945f
+		};
+		const float DEPTH_TO_COLOR_TRANSLATION[3] = { -32.1f, -2.0f, 3.9f };
+
+		calibration = {};
+		calibration.depth_mode = K4A_DEPTH_MODE_NFOV_UNBINNED;
+		calibration.color_resolution = K4A_COLOR_RESOLUTION_1080P;
+
+		set_camera_calibration(calibration.depth_camera_calibration, SYNTHETIC_DEPTH_WIDTH, SYNTHETIC_DEPTH_HEIGHT, DEPTH_PARAMETERS, 1.74f);
+		set_camera_calibration(calibration.color_camera_calibration, SYNTHETIC_COLOR_WIDTH, SYNTHETIC_COLOR_HEIGHT, COLOR_PARAMETERS, 1.7f);
+
+		for (int source = 0; source < K4A_CALIBRATION_TYPE_NUM; source++)
+		{
+			for (int target = 0; target < K4A_CALIBRATION_TYPE_NUM; target++)
+			{
+				k4a_calibration_extrinsics_t& extrinsics = calibration.extrinsics[source][target];
+				extrinsics = {};
+				extrinsics.rotation[0] = extrinsics.rotation[4] = extrinsics.rotation[8] = 1.0f;
+			}
+		}
+
+		k4a_calibration_extrinsics_t& depth_to_color = calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+		k4a_calibration_extrinsics_t& color_to_depth = calibration.extrinsics[K4A_CALIBRATION_TYPE_COLOR][K4A_CALIBRATION_TYPE_DEPTH];
+
+		// The inverse of a rigid transform is R^T and -R^T t
+		for (int row = 0; row < 3; row++)
+		{
+			for (int col = 0; col < 3; col++)
+			{
+				depth_to_color.rotation[row * 3 + col] = DEPTH_TO_COLOR_ROTATION[row * 3 + col];
+				color_to_depth.rotation[row * 3 + col] = DEPTH_TO_COLOR_ROTATION[col * 3 + row];
+			}
+			depth_to_color.translation[row] = DEPTH_TO_COLOR_TRANSLATION[row];
+		}
+
+		for (int row = 0; row < 3; row++)
+		{
+			color_to_depth.translation[row] = 0;
+			for (int col = 0; col < 3; col++)
+			{
+				color_to_depth.translation[row] -= color_to_depth.rotation[row * 3 + col] * DEPTH_TO_COLOR_TRANSLATION[col];
+			}
+		}
+	}
+}
\ No newline at end of file
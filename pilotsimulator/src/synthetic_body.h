@@ -0,0 +1,65 @@
+#pragma once
+
+#include <k4a/k4a.h>
+#include <k4abt.h>
+
+namespace pilotsimulator {
+
+	constexpr int SYNTHETIC_COLOR_WIDTH = 1920;
+	constexpr int SYNTHETIC_COLOR_HEIGHT = 1080;
+	constexpr int SYNTHETIC_DEPTH_WIDTH = 640;
+	constexpr int SYNTHETIC_DEPTH_HEIGHT = 576;
+	constexpr uint64_t SYNTHETIC_FRAME_PERIOD_USEC = 33333;	// 30 fps like start_camera
+
+	// Calibration of a typical device in NFOV unbinned / 1080p, used by SyntheticFrameSource
+	void get_synthetic_calibration(k4a_calibration_t& calibration);
+
+	// Scene and motion parameters of the synthetic pilots
+	struct SyntheticBodyConfig {
+		uint32_t num_bodies = 1;				// seated side by side, alternately set back
+		float body_spacing_mm = 700;
+		float sway_amplitude_mm = 20;			// lateral sway at the head, none at the seat
+		float sway_period_sec = 4;
+		float lean_amplitude_deg = 8;			// forward/backward lean of the upper body around the pelvis
+		float lean_period_sec = 11;
+		float stick_amplitude_mm = 30;			// right hand circling on the control stick
+		float stick_period_sec = 1.5f;
+		float jolts_per_sec = 0.5f;				// turbulence: damped shakes of random direction
+		float jolt_amplitude_mm = 60;
+		float jolt_decay_sec = 0.3f;
+		float dropout_probability = 0.02f;		// per joint and burst, reported with no confidence
+		float dropout_burst_sec = 0.2f;
+		uint16_t background_depth_mm = 3000;
+		uint32_t seed = 1;
+	};
+
+	// Generates pilots as a pure function of the timestamp, so the frame source rendering the depth
+	// and the mock tracker reporting the skeletons agree without sharing state
+	class SyntheticBodyGenerator {
+	public:
+		SyntheticBodyGenerator(const k4a_calibration_t& calibration, const SyntheticBodyConfig& config = SyntheticBodyConfig());
+
+		// Skeletons as the tracker would report them, ids start at 1. Returns the number of bodies written.
+		uint32_t get_bodies(uint64_t timestamp_usec, k4abt_body_t bodies[], uint32_t max_bodies) const;
+
+		// DEPTH16 image and body index map of the same scene, both get_width() x get_height() without padding
+		void render(uint64_t timestamp_usec, uint16_t* depth_image, uint8_t* body_index_map) const;
+
+		int get_width() const { return width; }
+		int get_height() const { return height; }
+		const SyntheticBodyConfig& get_config() const { return config; }
+
+	private:
+		void get_pose(double seconds, uint32_t body, const float jolt[3], k4a_float3_t joints[K4ABT_JOINT_COUNT]) const;
+		void get_jolt(double seconds, float jolt[3]) const;
+		void draw_capsule(
+			const k4a_float3_t& start, const k4a_float3_t& end, float radius_mm, uint8_t index,
+			uint16_t* depth_image, uint8_t* body_index_map
+		) const;
+
+		SyntheticBodyConfig config;
+		int width;
+		int height;
+		float cx, cy, fx, fy;
+	};
+}
@@ -0,0 +1,303 @@
+#include "pilotsimulator.h"
+
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace pilotsimulator {
+
+	namespace detail {
+		std::atomic<bool> tracing(false);
+	}
+
+	static const char* TraceCounterNames[TRACE_COUNTER_COUNT] = {
+		"tracker in flight", "analysis queue", "present queue"
+	};
+
+	static const uint64_t NO_TRACE_FRAME = UINT64_MAX;
+
+	enum TraceEventType : uint8_t { SPAN_EVENT, COUNTER_EVENT, DROPPED_FRAMES_EVENT };
+
+	struct TraceEvent {
+		int64_t start_ns;		// from the trace start
+		int64_t value;			// span duration in ns, counter value or frames dropped
+		uint64_t frame_id;
+		uint16_t name;			// LatencyStage or TraceCounter
+		TraceEventType type;
+	};
+
+	// Filled by its thread only, count is published after the event so the writer never sees a half event
+	struct TraceChunk {
+		TraceEvent events[TRACE_CHUNK_EVENTS];
+		std::atomic<size_t> count{ 0 };
+		std::atomic<TraceChunk*> next{ nullptr };
+	};
+
+	struct TraceThread {
+		uint32_t id = 0;
+		std::atomic<const char*> name{ nullptr };
+		TraceChunk* head = NULL;
+		TraceChunk* tail = NULL;	// owning thread only
+		bool full = false;
+	};
+
+	struct TraceState {
+		std::mutex mutex;
+		std::string path;
+		std::vector<TraceThread*> threads;
+		std::atomic<uint32_t> session{ 0 };
+		std::atomic<uint64_t> chunk_count{ 0 };
+		std::atomic<uint64_t> dropped_events{ 0 };
+		std::chrono::steady_clock::time_point start;
+	};
+
+	// Never destroyed, the exit flush below still needs it
+	static TraceState& get_trace_state()
+	{
+		static TraceState* state = new TraceState();
+		return *state;
+	}
+
+	static thread_local TraceThread* trace_thread = NULL;
+	static thread_local uint32_t trace_thread_session = 0;
+	static thread_local const char* trace_thread_name = NULL;
+	static thread_local uint64_t trace_frame_id = NO_TRACE_FRAME;
+
+	// A trace left running is written when the process exits
+	static struct TraceExitFlush {
+		~TraceExitFlush() { if (is_tracing()) { stop_trace(); } }
+	} trace_exit_flush;
+
+	static void free_trace_threads(TraceState& state)
+	{
+		for (TraceThread* thread : state.threads)
+		{
+			TraceChunk* chunk = thread->head;
+			while (chunk != NULL)
+			{
+				TraceChunk* next = chunk->next.load();
+				delete chunk;
+				chunk = next;
+			}
+			delete thread;
+		}
+		state.threads.clear();
+		state.chunk_count = 0;
+	}
+
+	int start_trace(const std::string& path)
+	{
+		TraceState& state = get_trace_state();
+
+		if (is_tracing()) { stop_trace(); }
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+
+		// Buffers of the previous trace, their threads stopped writing when it stopped
+		free_trace_threads(state);
+
+		state.path = path;
+		state.dropped_events = 0;
+		state.start = std::chrono::steady_clock::now();
+		state.session++;
+		detail::tracing = true;
+
+		std::cout << "Tracing To " << path << std::endl;
+#if !PILOTSIMULATOR_LATENCY
+		std::cout << "Built Without PILOTSIMULATOR_LATENCY, The Trace Will Be Empty!" << std::endl;
+#endif
+
+		return SUCCESS;
+	}
+
+	// Buffer of the calling thread for the running trace, NULL once the trace is full
+	static TraceThread* get_trace_thread()
+	{
+		TraceState& state = get_trace_state();
+		uint32_t session = state.session.load(std::memory_order_acquire);
+
+		if (trace_thread == NULL || trace_thread_session != session)
+		{
+			TraceThread* thread = new TraceThread();
+			thread->name = trace_thread_name;
+			thread->head = thread->tail = new TraceChunk();
+			state.chunk_count++;
+
+			std::lock_guard<std::mutex> lock(state.mutex);
+			thread->id = (uint32_t)state.threads.size() + 1;
+			state.threads.push_back(thread);
+
+			trace_thread = thread;
+			trace_thread_session = session;
+		}
+
+		TraceThread* thread = trace_thread;
+		if (thread->tail->count.load(std::memory_order_relaxed) == TRACE_CHUNK_EVENTS)
+		{
+			if (thread->full || state.chunk_count.fetch_add(1) >= TRACE_MAX_EVENTS / TRACE_CHUNK_EVENTS)
+			{
+				thread->full = true;
+				state.dropped_events++;
+				return NULL;
+			}
+
+			TraceChunk* chunk = new TraceChunk();
+			thread->tail->next.store(chunk, std::memory_order_release);
+			thread->tail = chunk;
+		}
+
+		return thread;
+	}
+
+	static void append_trace_event(TraceEventType type, uint16_t name, std::chrono::steady_clock::time_point start, int64_t value)
+	{
+		TraceThread* thread = get_trace_thread();
+		if (thread == NULL) { return; }
+
+		TraceChunk* chunk = thread->tail;
+		size_t index = chunk->count.load(std::memory_order_relaxed);
+
+		TraceEvent& event = chunk->events[index];
+		event.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - get_trace_state().start).count();
+		event.value = value;
+		event.frame_id = trace_frame_id;
+		event.name = name;
+		event.type = type;
+
+		chunk->count.store(index + 1, std::memory_order_release);
+	}
+
+	void trace_span(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+	{
+		if (!is_tracing()) { return; }
+
+		append_trace_event(SPAN_EVENT, (uint16_t)stage, start, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	}
+
+	void trace_counter(TraceCounter counter, int64_t value)
+	{
+		if (!is_tracing()) { return; }
+
+		append_trace_event(COUNTER_EVENT, (uint16_t)counter, std::chrono::steady_clock::now(), value);
+	}
+
+	void trace_dropped_frames(uint64_t count)
+	{
+		if (!is_tracing()) { return; }
+
+		append_trace_event(DROPPED_FRAMES_EVENT, 0, std::chrono::steady_clock::now(), (int64_t)count);
+	}
+
+	void set_trace_frame(uint64_t frame_id)
+	{
+		trace_frame_id = frame_id;
+	}
+
+	void set_trace_thread_name(const char* name)
+	{
+		trace_thread_name = name;
+
+		// A buffer of an earlier trace may be gone
+		if (trace_thread != NULL && trace_thread_session == get_trace_state().session.load()) { trace_thread->name = name; }
+	}
+
+	static void write_trace_event(std::ofstream& file, const TraceEvent& event, uint32_t thread_id)
+	{
+		char line[256];
+		double ts_usec = event.start_ns / 1000.0;
+
+		switch (event.type)
+		{
+		case SPAN_EVENT:
+			if (event.frame_id != NO_TRACE_FRAME)
+			{
+				std::snprintf(line, sizeof(line),
+					",\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"frame\":%llu}}",
+					get_latency_stage_name((LatencyStage)event.name), ts_usec, event.value / 1000.0, thread_id, (unsigned long long)event.frame_id);
+			}
+			else
+			{
+				std::snprintf(line, sizeof(line),
+					",\n{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+					get_latency_stage_name((LatencyStage)event.name), ts_usec, event.value / 1000.0, thread_id);
+			}
+			break;
+		case COUNTER_EVENT:
+			std::snprintf(line, sizeof(line),
+				",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%lld}}",
+				TraceCounterNames[event.name], ts_usec, thread_id, (long long)event.value);
+			break;
+		case DROPPED_FRAMES_EVENT:
+			std::snprintf(line, sizeof(line),
+				",\n{\"name\":\"dropped frames\",\"cat\":\"frame\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"count\":%lld}}",
+				ts_usec, thread_id, (long long)event.value);
+			break;
+		}
+
+		file << line;
+	}
+
+	int stop_trace()
+	{
+		TraceState& state = get_trace_state();
+
+		if (!detail::tracing.exchange(false)) { return SUCCESS; }
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+
+		std::ofstream file(state.path);
+		if (!file)
+		{
+			std::cout << "Failed To Write Trace " << state.path << "!" << std::endl;
+			return FAILURE;
+		}
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"pilotsimulator\"}}";
+
+		uint64_t event_count = 0;
+		for (TraceThread* thread : state.threads)
+		{
+			const char* name = thread->name.load();
+			if (name != NULL)
+			{
+				file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id << ",\"args\":{\"name\":\"" << name << "\"}}";
+			}
+
+			for (TraceChunk* chunk = thread->head; chunk != NULL; chunk = chunk->next.load(std::memory_order_acquire))
+			{
+				size_t count = chunk->count.load(std::memory_order_acquire);
+				for (size_t i = 0; i < count; i++)
+				{
+					write_trace_event(file, chunk->events[i], thread->id);
+				}
+				event_count += count;
+			}
+		}
+
+		file << "\n]}\n";
+
+		std::cout << "Trace Of " << event_count << " Events Written To " << state.path;
+		if (state.dropped_events > 0) { std::cout << ", " << state.dropped_events << " Events Over The Limit Dropped"; }
+		std::cout << "!" << std::endl;
+
+		return SUCCESS;
+	}
+
+	uint64_t get_trace_event_count()
+	{
+		TraceState& state = get_trace_state();
+		uint64_t event_count = 0;
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		for (TraceThread* thread : state.threads)
+		{
+			for (TraceChunk* chunk = thread->head; chunk != NULL; chunk = chunk->next.load(std::memory_order_acquire))
+			{
+				event_count += chunk->count.load(std::memory_order_acquire);
+			}
+		}
+
+		return event_count;
+	}
+}
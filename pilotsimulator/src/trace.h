@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "latency.h"
+
+namespace pilotsimulator {
+
+	constexpr size_t TRACE_CHUNK_EVENTS = 4096;			// events per buffer chunk of one thread
+	constexpr uint64_t TRACE_MAX_EVENTS = 1 << 22;		// about 128 MB, far more than a minute of every stage
+
+	// Sampled values drawn as counter tracks
+	enum TraceCounter {
+		TRACE_TRACKER_IN_FLIGHT,
+		TRACE_ANALYSIS_QUEUE_DEPTH,
+		TRACE_PRESENT_QUEUE_DEPTH,
+		TRACE_COUNTER_COUNT
+	};
+
+	// Chrome trace-event recorder for the latency stages. While a trace runs, every LATENCY_SCOPE also becomes a
+	// span on its thread's track, tagged with the frame the thread is working on. Events go to per-thread chunked
+	// buffers with no lock on the recording path and are written as JSON by stop_trace, or at exit.
+	// Open the file in chrome://tracing or ui.perfetto.dev.
+	int start_trace(const std::string& path);
+	int stop_trace();
+
+	namespace detail {
+		extern std::atomic<bool> tracing;
+	}
+
+	inline bool is_tracing()
+	{
+		return detail::tracing.load(std::memory_order_relaxed);
+	}
+
+	// Called by the latency timers
+	void trace_span(LatencyStage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+	void trace_counter(TraceCounter counter, int64_t value);
+	void trace_dropped_frames(uint64_t count);
+
+	// Frame the calling thread works on until the next call, added to its spans
+	void set_trace_frame(uint64_t frame_id);
+
+	// Track name of the calling thread
+	void set_trace_thread_name(const char* name);
+
+	// Events recorded by the running or last trace
+	uint64_t get_trace_event_count();
+}
+
+// Compiled in and out with the latency instrumentation
+#if PILOTSIMULATOR_LATENCY
+#define TRACE_FRAME(frame_id) ::pilotsimulator::set_trace_frame(frame_id)
+#define TRACE_THREAD_NAME(name) ::pilotsimulator::set_trace_thread_name(name)
+#define TRACE_COUNTER(counter, value) do { if (::pilotsimulator::is_tracing()) { ::pilotsimulator::trace_counter(counter, (int64_t)(value)); } } while (0)
+#else
+#define TRACE_FRAME(frame_id) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_COUNTER(counter, value) ((void)0)
+#endif
@@ -0,0 +1,439 @@
+// Ahead of Windows.h, which would bring in the old winsock.h
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "pilotsimulator.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace pilotsimulator {
+
+#if defined(_WIN32)
+	using Socket = SOCKET;
+
+	static void close_socket(intptr_t socket) { closesocket((Socket)socket); }
+#else
+	using Socket = int;
+
+	static void close_socket(intptr_t socket) { close((Socket)socket); }
+#endif
+
+	// Wakes the sender when no publish managed to, and bounds how long flush waits between checks
+	static const std::chrono::milliseconds SENDER_POLL_INTERVAL(10);
+
+	static UdpOutput udp_output;
+
+	// Fields go out in host order, little endian on every machine the programs run on
+	template <typename T>
+	static void put(uint8_t*& data, T value)
+	{
+		std::memcpy(data, &value, sizeof(value));
+		data += sizeof(value);
+	}
+
+	static uint64_t get_system_time_usec()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	size_t BinaryUdpEncoder::encode(const BodyFrame& frame, uint32_t segment_count, UdpDatagram datagrams[], size_t capacity)
+	{
+		static_assert(UDP_BINARY_HEADER_SIZE + sizeof(uint32_t) + sizeof(k4abt_skeleton_t) <= UDP_DATAGRAM_SIZE, "A skeleton fits a datagram");
+
+		segment_count = (std::min)(segment_count, (uint32_t)MAX_BODY_SEGMENTS);
+		const size_t COM_RECORD_SIZE = 2 * sizeof(uint32_t) + sizeof(k4a_float3_t) * (1 + segment_count);
+		uint32_t num_bodies = (std::min)(frame.num_bodies, MAX_BODIES);
+		uint32_t bodies_per_datagram = (uint32_t)((UDP_DATAGRAM_SIZE - UDP_BINARY_HEADER_SIZE) / COM_RECORD_SIZE);
+
+		// A frame without bodies still sends its COM datagram, the receiver sees every frame
+		uint32_t com_parts = (std::max)(1u, (num_bodies + bodies_per_datagram - 1) / bodies_per_datagram);
+		uint32_t parts = com_parts + (skeletons ? num_bodies : 0);
+		if (parts > capacity) { return 0; }
+
+		uint64_t publish_time_usec = get_system_time_usec();
+		uint32_t body = 0;
+
+		for (uint32_t part = 0; part < parts; part++)
+		{
+			bool com_part = part < com_parts;
+			uint32_t part_bodies = com_part ? (std::min)(bodies_per_datagram, num_bodies - body) : 1;
+
+			uint8_t* data = datagrams[part].data;
+			put(data, UDP_BINARY_MAGIC);
+			put(data, UDP_BINARY_VERSION);
+			put(data, (uint8_t)(com_part ? UDP_BINARY_COM : UDP_BINARY_SKELETON));
+			put(data, (uint8_t)part_bodies);
+			put(data, sequence++);
+			put(data, (uint16_t)part);
+			put(data, (uint16_t)parts);
+			put(data, frame.frame_id);
+			put(data, frame.device_timestamp_usec);
+			put(data, publish_time_usec);
+
+			if (com_part)
+			{
+				for (uint32_t i = 0; i < part_bodies; i++, body++)
+				{
+					put(data, frame.bodies[body].id);
+					put(data, segment_count);
+					std::memcpy(data, frame.center_of_mass[body].v, sizeof(k4a_float3_t));
+					data += sizeof(k4a_float3_t);
+					std::memcpy(data, frame.body_segment_com[body], segment_count * sizeof(k4a_float3_t));
+					data += segment_count * sizeof(k4a_float3_t);
+				}
+				if (part == com_parts - 1) { body = 0; }
+			}
+			else
+			{
+				put(data, frame.bodies[body].id);
+				std::memcpy(data, &frame.bodies[body].skeleton, sizeof(k4abt_skeleton_t));
+				data += sizeof(k4abt_skeleton_t);
+				body++;
+			}
+
+			datagrams[part].length = data - datagrams[part].data;
+		}
+
+		return parts;
+	}
+
+	size_t XPlaneUdpEncoder::encode(const BodyFrame& frame, uint32_t /*segment_count*/, UdpDatagram datagrams[], size_t capacity)
+	{
+		if (capacity == 0) { return 0; }
+
+		uint8_t* data = datagrams[0].data;
+		std::memcpy(data, "DATA", 4);
+		data += 4;
+		put(data, (uint8_t)0);
+
+		for (uint32_t body = 0; body < frame.num_bodies && body < MAX_BODIES; body++)
+		{
+			const k4a_float3_t& center_of_mass = frame.center_of_mass[body];
+
+			put(data, UDP_XPLANE_DATA_INDEX + (int32_t)body);
+			put(data, center_of_mass.xyz.x / 1000.0f);
+			put(data, center_of_mass.xyz.y / 1000.0f);
+			put(data, center_of_mass.xyz.z / 1000.0f);
+			put(data, (float)frame.bodies[body].id);
+			for (int value = 4; value < 8; value++) { put(data, UDP_XPLANE_NO_VALUE); }
+		}
+
+		datagrams[0].length = data - datagrams[0].data;
+
+		return 1;
+	}
+
+	size_t FlightGearUdpEncoder::encode(const BodyFrame& frame, uint32_t /*segment_count*/, UdpDatagram datagrams[], size_t capacity)
+	{
+		size_t count = 0;
+
+		// One line a datagram, FlightGear's generic protocol reads a record per datagram
+		for (uint32_t body = 0; body < frame.num_bodies && body < MAX_BODIES && count < capacity; body++)
+		{
+			const k4a_float3_t& center_of_mass = frame.center_of_mass[body];
+
+			int length = std::snprintf((char*)datagrams[count].data, UDP_DATAGRAM_SIZE, "%u,%llu,%llu,%u,%.4f,%.4f,%.4f\n",
+				sequence++, (unsigned long long)frame.frame_id, (unsigned long long)frame.device_timestamp_usec,
+				frame.bodies[body].id,
+				center_of_mass.xyz.x / 1000.0f, center_of_mass.xyz.y / 1000.0f, center_of_mass.xyz.z / 1000.0f);
+			if (length <= 0) { continue; }
+
+			datagrams[count++].length = (std::min)((size_t)length, UDP_DATAGRAM_SIZE - 1);
+		}
+
+		return count;
+	}
+
+	std::unique_ptr<UdpEncoder> get_udp_encoder(UdpFormat format)
+	{
+		switch (format)
+		{
+		case UDP_FORMAT_XPLANE:
+			return std::unique_ptr<UdpEncoder>(new XPlaneUdpEncoder());
+		case UDP_FORMAT_FLIGHTGEAR:
+			return std::unique_ptr<UdpEncoder>(new FlightGearUdpEncoder());
+		default:
+			return std::unique_ptr<UdpEncoder>(new BinaryUdpEncoder());
+		}
+	}
+
+	int get_udp_format(const std::string& name, UdpFormat& format)
+	{
+		if (name == "binary") { format = UDP_FORMAT_BINARY; }
+		else if (name == "xplane") { format = UDP_FORMAT_XPLANE; }
+		else if (name == "flightgear") { format = UDP_FORMAT_FLIGHTGEAR; }
+		else { return FAILURE; }
+
+		return SUCCESS;
+	}
+
+	UdpOutput::UdpOutput(size_t capacity)
+		: datagrams(capacity),
+		frames(0), queued(0), sent(0), dropped(0), failed(0), batches(0), high_water_mark(0),
+		running(false), sender_waiting(false)
+	{
+	}
+
+	int UdpOutput::start(const std::string& destination, std::unique_ptr<UdpEncoder> encoder)
+	{
+		if (running) { return SUCCESS; }
+
+		size_t colon = destination.rfind(':');
+		if (colon == std::string::npos || colon == 0 || colon + 1 == destination.size())
+		{
+			std::cout << "UDP Destination Is Not host:port!" << std::endl;
+			return FAILURE;
+		}
+		std::string host = destination.substr(0, colon);
+		std::string port = destination.substr(colon + 1);
+
+#if defined(_WIN32)
+		WSADATA wsa_data;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+		{
+			std::cout << "Failed To Start Winsock!" << std::endl;
+			return FAILURE;
+		}
+#endif
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_protocol = IPPROTO_UDP;
+
+		addrinfo* resolved = NULL;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &resolved) != 0 || resolved == NULL)
+		{
+			std::cout << "Failed To Resolve UDP Destination " << destination << "!" << std::endl;
+#if defined(_WIN32)
+			WSACleanup();
+#endif
+			return FAILURE;
+		}
+		address.assign((const uint8_t*)resolved->ai_addr, (const uint8_t*)resolved->ai_addr + resolved->ai_addrlen);
+		freeaddrinfo(resolved);
+
+		Socket handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if ((intptr_t)handle == -1)
+		{
+			std::cout << "Failed To Open The UDP Socket!" << std::endl;
+#if defined(_WIN32)
+			WSACleanup();
+#endif
+			return FAILURE;
+		}
+		socket_handle = (intptr_t)handle;
+
+		// Allocated on the first start, most runs of the programs send nothing
+		if (encoded.empty())
+		{
+			datagrams.allocate();
+			encoded.resize(UDP_ENCODE_CAPACITY);
+			batch.resize(UDP_OUTPUT_BATCH);
+		}
+
+		this->encoder = std::move(encoder);
+		running = true;
+		sender = std::thread(&UdpOutput::run, this);
+
+		std::cout << "Sending COMs To " << destination << " Over UDP!" << std::endl;
+
+		return SUCCESS;
+	}
+
+	void UdpOutput::stop()
+	{
+		if (!running) { return; }
+
+		running = false;
+		wake_sender();
+		sender.join();
+
+		close_socket(socket_handle);
+		socket_handle = -1;
+
+#if defined(_WIN32)
+		WSACleanup();
+#endif
+	}
+
+	void UdpOutput::publish(const BodyFrame& frame, uint32_t segment_count)
+	{
+		if (!running) { return; }
+
+		frames.fetch_add(1, std::memory_order_relaxed);
+
+		size_t count = encoder->encode(frame, segment_count, encoded.data(), encoded.size());
+		for (size_t i = 0; i < count; i++) { push(encoded[i]); }
+
+		if (sender_waiting.load()) { wake_sender(); }
+	}
+
+	void UdpOutput::push(const UdpDatagram& datagram)
+	{
+		queued.fetch_add(1, std::memory_order_relaxed);
+
+		// The sender fell behind: what it has not sent yet is the stalest
+		while (!try_push(datagram))
+		{
+			UdpDatagram oldest;
+			if (try_pop(oldest)) { dropped.fetch_add(1, std::memory_order_release); }
+		}
+
+		size_t depth = datagrams.size();
+		size_t mark = high_water_mark.load(std::memory_order_relaxed);
+		while (depth > mark && depth <= datagrams.get_capacity() && !high_water_mark.compare_exchange_weak(mark, depth)) {}
+	}
+
+	// Only the used bytes of the datagrams are copied in and out
+	bool UdpOutput::try_push(const UdpDatagram& datagram)
+	{
+		return datagrams.try_push([&datagram](UdpDatagram& cell) {
+			cell.length = datagram.length;
+			std::memcpy(cell.data, datagram.data, datagram.length);
+		});
+	}
+
+	bool UdpOutput::try_pop(UdpDatagram& datagram)
+	{
+		return datagrams.try_pop([&datagram](UdpDatagram& cell) {
+			datagram.length = cell.length;
+			std::memcpy(datagram.data, cell.data, cell.length);
+		});
+	}
+
+	void UdpOutput::wake_sender()
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		wake.notify_one();
+	}
+
+	void UdpOutput::run()
+	{
+		for (;;)
+		{
+			size_t count = 0;
+			while (count < batch.size() && try_pop(batch[count])) { count++; }
+
+			if (count > 0)
+			{
+				send(count);
+				continue;
+			}
+
+			// Queue drained, flush can return
+			done.notify_all();
+
+			if (!running) { break; }
+
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			sender_waiting = true;
+			if (datagrams.is_empty() && running)
+			{
+				wake.wait_for(lock, SENDER_POLL_INTERVAL);
+			}
+			sender_waiting = false;
+		}
+	}
+
+	void UdpOutput::send(size_t count)
+	{
+		Socket handle = (Socket)socket_handle;
+		const sockaddr* destination = (const sockaddr*)address.data();
+		batches.fetch_add(1, std::memory_order_relaxed);
+
+#if defined(__linux__)
+		mmsghdr messages[UDP_OUTPUT_BATCH] = {};
+		iovec vectors[UDP_OUTPUT_BATCH];
+		for (size_t i = 0; i < count; i++)
+		{
+			vectors[i].iov_base = batch[i].data;
+			vectors[i].iov_len = batch[i].length;
+			messages[i].msg_hdr.msg_name = (void*)destination;
+			messages[i].msg_hdr.msg_namelen = (socklen_t)address.size();
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// A datagram the socket refuses is counted and skipped, the rest go in the next call
+		size_t first = 0;
+		while (first < count)
+		{
+			int result = sendmmsg(handle, messages + first, (unsigned int)(count - first), 0);
+			if (result > 0)
+			{
+				sent.fetch_add(result, std::memory_order_release);
+				first += result;
+			}
+			else
+			{
+				failed.fetch_add(1, std::memory_order_release);
+				first++;
+			}
+		}
+#else
+		for (size_t i = 0; i < count; i++)
+		{
+			int result = sendto(handle, (const char*)batch[i].data, (int)batch[i].length, 0, destination, (int)address.size());
+			if (result == (int)batch[i].length) { sent.fetch_add(1, std::memory_order_release); }
+			else { failed.fetch_add(1, std::memory_order_release); }
+		}
+#endif
+	}
+
+	void UdpOutput::flush()
+	{
+		uint64_t target = queued.load();
+
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		while (running && sent.load() + failed.load() + dropped.load() < target)
+		{
+			wake.notify_one();
+			done.wait_for(lock, SENDER_POLL_INTERVAL);
+		}
+	}
+
+	UdpOutputStats UdpOutput::get_stats() const
+	{
+		UdpOutputStats stats;
+		stats.frames = frames.load();
+		stats.queued = queued.load();
+		stats.sent = sent.load();
+		stats.dropped = dropped.load();
+		stats.failed = failed.load();
+		stats.batches = batches.load();
+		stats.high_water_mark = high_water_mark.load();
+		stats.capacity = datagrams.get_capacity();
+
+		return stats;
+	}
+
+	void UdpOutput::print_stats() const
+	{
+		UdpOutputStats stats = get_stats();
+
+		std::cout << std::endl << "UDP Output Stats:" << std::endl;
+		std::cout << "  " << stats.frames << " frames, " << stats.queued << " datagrams, " << stats.sent << " sent in "
+			<< stats.batches << " batches, " << stats.dropped << " dropped, " << stats.failed << " failed" << std::endl;
+		std::cout << "  Queue high water mark: " << stats.high_water_mark << " of " << stats.capacity << std::endl;
+	}
+
+	int start_udp_output(const std::string& destination, UdpFormat format)
+	{
+		return udp_output.start(destination, get_udp_encoder(format));
+	}
+
+	UdpOutput* get_udp_output()
+	{
+		return udp_output.is_running() ? &udp_output : NULL;
+	}
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpmc_ring.h"
+
+namespace pilotsimulator {
+
+	struct BodyFrame;
+
+	constexpr size_t UDP_DATAGRAM_SIZE = 1472;			// Ethernet MTU less the IP and UDP headers
+	constexpr size_t UDP_OUTPUT_CAPACITY = 256;			// datagrams queued, rounded up to a power of two
+	constexpr size_t UDP_OUTPUT_BATCH = 32;				// datagrams handed to the socket in one call
+	constexpr size_t UDP_ENCODE_CAPACITY = 32;			// datagrams one frame may take
+	constexpr uint32_t UDP_BINARY_MAGIC = 0x55435350;	// "PSCU"
+	constexpr uint16_t UDP_BINARY_VERSION = 1;
+	constexpr size_t UDP_BINARY_HEADER_SIZE = 40;
+	constexpr int32_t UDP_XPLANE_DATA_INDEX = 100;		// DATA record of the first body, the next ones follow
+	constexpr float UDP_XPLANE_NO_VALUE = -999.0f;		// what X-Plane takes for "leave as it is"
+
+	enum UdpFormat {
+		UDP_FORMAT_BINARY,		// BinaryUdpEncoder
+		UDP_FORMAT_XPLANE,		// XPlaneUdpEncoder
+		UDP_FORMAT_FLIGHTGEAR	// FlightGearUdpEncoder
+	};
+
+	// Kinds of binary datagrams, the byte after the version
+	enum UdpBinaryKind {
+		UDP_BINARY_COM,			// bodies' COM and segment COMs
+		UDP_BINARY_SKELETON		// one body's joints
+	};
+
+	struct UdpDatagram {
+		size_t length = 0;
+		uint8_t data[UDP_DATAGRAM_SIZE];
+	};
+
+	// Turns an analysed frame into datagrams of one protocol, on the thread that publishes
+	class UdpEncoder {
+	public:
+		virtual ~UdpEncoder() = default;
+
+		// At most capacity datagrams, returns their count
+		virtual size_t encode(const BodyFrame& frame, uint32_t segment_count, UdpDatagram datagrams[], size_t capacity) = 0;
+	};
+
+	// Little endian, fields at fixed offsets. Header of every datagram:
+	//   0 uint32 magic, 4 uint16 version, 6 uint8 kind, 7 uint8 bodies in the datagram,
+	//   8 uint32 sequence of the datagram, 12 uint16 part of the frame, 14 uint16 parts of the frame,
+	//   16 uint64 frame id, 24 uint64 device timestamp in us, 32 uint64 publish time in us of the system clock
+	// then per body for UDP_BINARY_COM uint32 id, uint32 segment count, float[3] COM, float[3] per segment COM
+	// and for UDP_BINARY_SKELETON uint32 id and per joint float[3] position, float[4] orientation, uint32 confidence.
+	// Positions in mm as the SDK gives them. A frame is its COM datagrams, then a skeleton datagram per body.
+	class BinaryUdpEncoder : public UdpEncoder {
+	public:
+		explicit BinaryUdpEncoder(bool skeletons = true) : skeletons(skeletons) {}
+
+		size_t encode(const BodyFrame& frame, uint32_t segment_count, UdpDatagram datagrams[], size_t capacity) override;
+
+	private:
+		bool skeletons;
+		uint32_t sequence = 0;
+	};
+
+	// X-Plane's "DATA" datagram: one 36 byte record per body, index UDP_XPLANE_DATA_INDEX + body, holding the
+	// COM in metres, the body id and UDP_XPLANE_NO_VALUE for the rest. Sequence and timestamps have no place in it.
+	class XPlaneUdpEncoder : public UdpEncoder {
+	public:
+		size_t encode(const BodyFrame& frame, uint32_t segment_count, UdpDatagram datagrams[], size_t capacity) override;
+	};
+
+	// A line per body for FlightGear's generic protocol, PipeCOM/src/pilotsimulator.xml describes it:
+	// sequence,frame id,device timestamp us,body id,x,y,z with the COM in metres
+	class FlightGearUdpEncoder : public UdpEncoder {
+	public:
+		size_t encode(const BodyFrame& frame, uint32_t segment_count, UdpDatagram datagrams[], size_t capacity) override;
+
+	private:
+		uint32_t sequence = 0;
+	};
+
+	std::unique_ptr<UdpEncoder> get_udp_encoder(UdpFormat format);
+
+	// Name as on the command line: binary, xplane or flightgear. FAILURE for anything else.
+	int get_udp_format(const std::string& name, UdpFormat& format);
+
+	struct UdpOutputStats {
+		uint64_t frames = 0;
+		uint64_t queued = 0;
+		uint64_t sent = 0;
+		uint64_t dropped = 0;	// oldest datagrams discarded to make room
+		uint64_t failed = 0;
+		uint64_t batches = 0;
+		size_t high_water_mark = 0;
+		size_t capacity = 0;
+	};
+
+	// Sends an encoder's datagrams to one host from a thread of its own. publish encodes on the calling thread
+	// into a bounded lock-free ring and returns: a full ring drops its oldest datagrams, the tracking thread never
+	// waits on the network. The sender hands the socket batches, with sendmmsg where there is one.
+	class UdpOutput {
+	public:
+		explicit UdpOutput(size_t capacity = UDP_OUTPUT_CAPACITY);
+		~UdpOutput() { stop(); }
+
+		UdpOutput(const UdpOutput&) = delete;
+		UdpOutput& operator=(const UdpOutput&) = delete;
+
+		// destination is host:port
+		int start(const std::string& destination, std::unique_ptr<UdpEncoder> encoder);
+
+		// Sends what is queued first
+		void stop();
+
+		bool is_running() const { return running; }
+
+		// From one thread, the tracking one
+		void publish(const BodyFrame& frame, uint32_t segment_count);
+
+		// Waits until every datagram queued before the call is sent or dropped
+		void flush();
+
+		UdpOutputStats get_stats() const;
+		void print_stats() const;
+
+	private:
+		void push(const UdpDatagram& datagram);
+		bool try_push(const UdpDatagram& datagram);
+		bool try_pop(UdpDatagram& datagram);
+		void run();
+		void send(size_t count);
+		void wake_sender();
+
+		MpmcRing<UdpDatagram> datagrams;
+		std::unique_ptr<UdpEncoder> encoder;
+		std::vector<UdpDatagram> encoded;		// publishing thread only
+		std::vector<UdpDatagram> batch;			// sender thread only
+
+		alignas(64) std::atomic<uint64_t> frames;
+		std::atomic<uint64_t> queued;
+		std::atomic<uint64_t> sent;
+		std::atomic<uint64_t> dropped;
+		std::atomic<uint64_t> failed;
+		std::atomic<uint64_t> batches;
+		std::atomic<size_t> high_water_mark;
+
+		intptr_t socket_handle = -1;
+		std::vector<uint8_t> address;			// sockaddr of the destination
+		std::atomic<bool> running;
+		std::atomic<bool> sender_waiting;
+		std::mutex wake_mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::thread sender;
+	};
+
+	// Output of the programs given --udp, stopped at exit
+	int start_udp_output(const std::string& destination, UdpFormat format);
+
+	// NULL unless start_udp_output succeeded
+	UdpOutput* get_udp_output();
+}